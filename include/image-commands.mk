@@ -390,16 +390,16 @@ define Build/sysupgrade-tar
 		$@
 endef
 
+# Goes through a one line batch manifest, which runs exactly like a direct
+# call. Images of several devices can be listed in one manifest the same way.
 define Build/tplink-safeloader
-	-$(STAGING_DIR_HOST)/bin/tplink-safeloader \
-		-B $(TPLINK_BOARD_ID) \
-		-V $(REVISION) \
-		-k $(IMAGE_KERNEL) \
-		-r $@ \
-		-o $@.new \
-		-j \
-		$(wordlist 2,$(words $(1)),$(1)) \
-		$(if $(findstring sysupgrade,$(word 1,$(1))),-S) && mv $@.new $@ || rm -f $@
+	echo "-B '$(TPLINK_BOARD_ID)' -V '$(REVISION)'" \
+		"-k '$(IMAGE_KERNEL)' -r '$@' -o '$@.new' -j" \
+		"$(wordlist 2,$(words $(1)),$(1))" \
+		"$(if $(findstring sysupgrade,$(word 1,$(1))),-S)" > $@.manifest
+	-$(STAGING_DIR_HOST)/bin/tplink-safeloader -b $@.manifest 1 && \
+		mv $@.new $@ || rm -f $@
+	rm -f $@.manifest
 endef
 
 define Build/tplink-v1-header
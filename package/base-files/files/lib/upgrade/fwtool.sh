@@ -1,3 +1,38 @@
+# Check the CRCs and extract metadata and signature in a single pass over
+# the image, once per image. Falls back to fwtool if fwcheck is missing.
+fwcheck_image() {
+	[ -x /sbin/fwcheck ] || return 1
+	[ "$fwcheck_image" = "$1" ] && return 0
+
+	rm -f /tmp/sysupgrade.meta /tmp/sysupgrade.ucert
+	eval "$(fwcheck -q -i /tmp/sysupgrade.meta -s /tmp/sysupgrade.ucert "$1")"
+	fwcheck_image="$1"
+}
+
+fwtool_get_signature() {
+	if fwcheck_image "$1"; then
+		[ "$fwcheck_signature" = 1 ]
+	else
+		fwtool -q -s /tmp/sysupgrade.ucert "$1"
+	fi
+}
+
+fwtool_get_metadata() {
+	if fwcheck_image "$1"; then
+		[ "$fwcheck_metadata" = 1 ]
+	else
+		fwtool -q -i /tmp/sysupgrade.meta "$1"
+	fi
+}
+
+fwtool_signed_data() {
+	if [ -x /sbin/fwcheck ]; then
+		fwcheck -q -T "$1"
+	else
+		fwtool -q -T -s /dev/null "$1"
+	fi
+}
+
 fwtool_check_signature() {
 	[ $# -gt 1 ] && return 1
 
@@ -9,7 +44,7 @@ fwtool_check_signature() {
 		fi
 	}
 
-	if ! fwtool -q -s /tmp/sysupgrade.ucert "$1"; then
+	if ! fwtool_get_signature "$1"; then
 		v "Image signature not present"
 		[ "$REQUIRE_IMAGE_SIGNATURE" = 1 -a "$FORCE" != 1 ] && {
 			v "Use sysupgrade -F to override this check when downgrading or flashing to vendor firmware"
@@ -18,7 +53,7 @@ fwtool_check_signature() {
 		return 0
 	fi
 
-	fwtool -q -T -s /dev/null "$1" | \
+	fwtool_signed_data "$1" | \
 		ucert -V -m - -c "/tmp/sysupgrade.ucert" -P /etc/opkg/keys
 
 	return $?
@@ -29,7 +64,11 @@ fwtool_check_image() {
 
 	. /usr/share/libubox/jshn.sh
 
-	if ! fwtool -q -i /tmp/sysupgrade.meta "$1"; then
+	if ! fwtool_get_metadata "$1"; then
+		[ "$fwcheck_crc" = "bad" ] && {
+			v "Image checksum mismatch"
+			return 1
+		}
 		v "Image metadata not present"
 		[ "$REQUIRE_IMAGE_METADATA" = 1 -a "$FORCE" != 1 ] && {
 			v "Use sysupgrade -F to override this check when downgrading or flashing to vendor firmware"
@@ -220,19 +220,24 @@ nand_upgrade_tar() {
 	local tar_file="$1"
 	local kernel_mtd="$(find_mtd_index $CI_KERNPART)"
 
-	local board_dir=$(tar tf $tar_file | grep -m 1 '^sysupgrade-.*/$')
-	board_dir=${board_dir%/}
-
-	local kernel_length=$( (tar xf $tar_file ${board_dir}/kernel -O | wc -c) 2> /dev/null)
-	local rootfs_length=$( (tar xf $tar_file ${board_dir}/root -O | wc -c) 2> /dev/null)
+	# a single pass over the tar headers instead of extracting every member
+	local board_dir kernel_length rootfs_length rootfs_magic
+	local tar_info
+	tar_info="$(tarflash info "$tar_file")" || {
+		echo "cannot parse $tar_file"
+		return 1
+	}
+	eval "$tar_info"
+	kernel_length=${kernel_length:-0}
+	rootfs_length=${rootfs_length:-0}
 
-	local rootfs_type="$(identify_tar "$tar_file" ${board_dir}/root)"
+	local rootfs_type="$(identify_magic_long "$rootfs_magic")"
 
 	local has_kernel=1
 	local has_env=0
 
 	[ "$kernel_length" != 0 -a -n "$kernel_mtd" ] && {
-		tar xf $tar_file ${board_dir}/kernel -O | mtd write - $CI_KERNPART
+		tarflash cat $tar_file ${board_dir}/kernel | mtd write - $CI_KERNPART
 	}
 	[ "$kernel_length" = 0 -o ! -z "$kernel_mtd" ] && has_kernel=0
 
@@ -241,13 +246,11 @@ nand_upgrade_tar() {
 	local ubidev="$( nand_find_ubi "$CI_UBIPART" )"
 	[ "$has_kernel" = "1" ] && {
 		local kern_ubivol="$(nand_find_volume $ubidev $CI_KERNPART)"
-		tar xf $tar_file ${board_dir}/kernel -O | \
-			ubiupdatevol /dev/$kern_ubivol -s $kernel_length -
+		tarflash write $tar_file ${board_dir}/kernel /dev/$kern_ubivol >/dev/null
 	}
 
 	local root_ubivol="$(nand_find_volume $ubidev $CI_ROOTPART)"
-	tar xf $tar_file ${board_dir}/root -O | \
-		ubiupdatevol /dev/$root_ubivol -s $rootfs_length -
+	tarflash write $tar_file ${board_dir}/root /dev/$root_ubivol >/dev/null
 
 	nand_do_upgrade_success
 }
@@ -0,0 +1,743 @@
+/*
+ * backup.c - back up several mtd partitions into one stream and restore them
+ *
+ * The bad blocks of all partitions are collected before anything is read,
+ * then every partition is read by its own thread. The main thread writes
+ * the blocks to stdout as they arrive, so the stream can be piped straight
+ * into a compressor (xz, zstd, gzip).
+ *
+ * Stream format, all fields big endian:
+ *
+ *   header      "MTDBAK\0\0", version, number of partitions
+ *   partition   name[32], size, erase size, write size, type,
+ *               number of bad blocks, followed by their block numbers
+ *   crc32       of everything above
+ *   record      partition, flags, offset, length, crc32 of the data,
+ *               followed by the data unless the block was erased
+ *   ...
+ *   end record  partition 0xffffffff, offset = number of records
+ *
+ * Records never cross an erase block and come in increasing offset order
+ * for each partition, but the partitions are interleaved. Bad blocks and
+ * fully erased blocks carry no data.
+ *
+ * Restoring writes the good blocks of each partition in order to the good
+ * blocks of the target, like mtd write does with an image, and erases the
+ * blocks that are left over. Pages that are still erased are not written,
+ * so UBI and UBIFS find them free.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License v2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define _GNU_SOURCE
+#include <endian.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/param.h>
+#include <mtd/mtd-user.h>
+
+#include "crc32.h"
+#include "mtd.h"
+
+#define BACKUP_MAGIC		"MTDBAK\0\0"
+#define BACKUP_VERSION		1
+#define BACKUP_NAME_LEN		32
+#define BACKUP_MAX_PARTS	32
+#define BACKUP_END		0xffffffff
+
+/* record flags */
+#define BACKUP_ERASED		(1 << 0)
+
+/* Partitions are read in chunks of this size, rounded up to erase blocks */
+#define BACKUP_CHUNK		(256 * 1024)
+
+/* Chunks read ahead of the output, shared by all reader threads */
+#define BACKUP_QUEUE		8
+
+struct backup_part {
+	char name[BACKUP_NAME_LEN];
+	const char *dev;
+	int fd;
+	uint64_t size;
+	uint32_t erasesize;
+	uint32_t writesize;
+	uint32_t type;
+	uint32_t n_bad;
+	uint8_t *bad;		/* one byte per erase block */
+	pthread_t thread;
+
+	/* restore state */
+	uint64_t src_block;	/* last source block seen, +1 */
+	uint64_t dst;		/* next target block */
+	uint64_t dst_cur;	/* target block of the current source block */
+};
+
+struct backup_chunk {
+	int part;
+	uint64_t offset;
+	size_t len;
+	uint8_t *data;
+	int error;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct backup_chunk *slot[BACKUP_QUEUE];
+	int head, count;
+	int running;
+	int stop;
+} queue = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static struct backup_part parts[BACKUP_MAX_PARTS];
+static int n_parts;
+
+static uint8_t *
+put_be32(uint8_t *p, uint32_t v)
+{
+	v = htobe32(v);
+	memcpy(p, &v, 4);
+	return p + 4;
+}
+
+static uint8_t *
+put_be64(uint8_t *p, uint64_t v)
+{
+	v = htobe64(v);
+	memcpy(p, &v, 8);
+	return p + 8;
+}
+
+static uint32_t
+get_be32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return be32toh(v);
+}
+
+static uint64_t
+get_be64(const uint8_t *p)
+{
+	uint64_t v;
+
+	memcpy(&v, p, 8);
+	return be64toh(v);
+}
+
+static int
+write_all(int fd, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+	ssize_t r;
+
+	while (len) {
+		r = write(fd, p, len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/* Returns 1 on success, 0 at the end of the input and -1 on errors */
+static int
+read_all(int fd, void *data, size_t len)
+{
+	uint8_t *p = data;
+	size_t done = 0;
+	ssize_t r;
+
+	while (done < len) {
+		r = read(fd, p + done, len - done);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!r)
+			return done ? -1 : 0;
+		done += r;
+	}
+
+	return 1;
+}
+
+static bool
+is_erased(const uint8_t *data, size_t len)
+{
+	return data[0] == 0xff && !memcmp(data, data + 1, len - 1);
+}
+
+static bool
+is_nand(const struct backup_part *p)
+{
+	return p->type == MTD_NANDFLASH || p->type == MTD_MLCNANDFLASH;
+}
+
+static int
+part_open(struct backup_part *p, const char *dev)
+{
+	struct mtd_info_user info;
+	uint64_t i, blocks;
+	loff_t o;
+	int r;
+
+	p->dev = dev;
+	p->fd = mtd_open(dev, false);
+	if (p->fd < 0 || ioctl(p->fd, MEMGETINFO, &info)) {
+		fprintf(stderr, "Could not open mtd device: %s\n", dev);
+		return -1;
+	}
+
+	snprintf(p->name, sizeof(p->name), "%s", dev);
+	p->size = info.size;
+	p->erasesize = info.erasesize;
+	p->writesize = info.writesize ? info.writesize : 1;
+	p->type = info.type;
+
+	blocks = p->size / p->erasesize;
+	p->bad = calloc(blocks, 1);
+	if (!p->bad)
+		return -1;
+
+	if (!is_nand(p))
+		return 0;
+
+	for (i = 0; i < blocks; i++) {
+		o = i * p->erasesize;
+		r = ioctl(p->fd, MEMGETBADBLOCK, &o);
+		if (r < 0) {
+			fprintf(stderr, "Failed to get erase block status of %s\n", dev);
+			return -1;
+		}
+		if (r) {
+			p->bad[i] = 1;
+			p->n_bad++;
+		}
+	}
+
+	return 0;
+}
+
+static void
+queue_push(struct backup_chunk *c)
+{
+	pthread_mutex_lock(&queue.lock);
+	while (queue.count == BACKUP_QUEUE && !queue.stop)
+		pthread_cond_wait(&queue.cond, &queue.lock);
+	if (queue.stop) {
+		pthread_mutex_unlock(&queue.lock);
+		free(c->data);
+		free(c);
+		return;
+	}
+	queue.slot[(queue.head + queue.count++) % BACKUP_QUEUE] = c;
+	pthread_cond_broadcast(&queue.cond);
+	pthread_mutex_unlock(&queue.lock);
+}
+
+/* Returns NULL once all readers are done */
+static struct backup_chunk *
+queue_pop(void)
+{
+	struct backup_chunk *c = NULL;
+
+	pthread_mutex_lock(&queue.lock);
+	while (!queue.count && queue.running)
+		pthread_cond_wait(&queue.cond, &queue.lock);
+	if (queue.count) {
+		c = queue.slot[queue.head];
+		queue.head = (queue.head + 1) % BACKUP_QUEUE;
+		queue.count--;
+		pthread_cond_broadcast(&queue.cond);
+	}
+	pthread_mutex_unlock(&queue.lock);
+
+	return c;
+}
+
+static void *
+backup_reader(void *arg)
+{
+	struct backup_part *p = &parts[(intptr_t) arg];
+	uint64_t block, blocks = p->size / p->erasesize;
+	uint64_t chunk_blocks = (MAX(BACKUP_CHUNK, p->erasesize) + p->erasesize - 1) / p->erasesize;
+	struct backup_chunk *c;
+	uint64_t n;
+	ssize_t r;
+	int error;
+
+	for (block = 0; block < blocks && !queue.stop; block += n) {
+		if (p->bad[block]) {
+			n = 1;
+			continue;
+		}
+
+		/* a run of good blocks */
+		for (n = 1; n < chunk_blocks && block + n < blocks && !p->bad[block + n]; n++)
+			;
+
+		c = calloc(1, sizeof(*c));
+		if (c)
+			c->data = malloc(n * p->erasesize);
+		if (!c || !c->data) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+
+		c->part = (intptr_t) arg;
+		c->offset = block * p->erasesize;
+		c->len = n * p->erasesize;
+
+		do {
+			r = pread(p->fd, c->data, c->len, c->offset);
+		} while (r < 0 && errno == EINTR);
+		error = c->error = r != (ssize_t) c->len;
+
+		queue_push(c);
+		if (error)
+			break;
+	}
+
+	pthread_mutex_lock(&queue.lock);
+	queue.running--;
+	pthread_cond_broadcast(&queue.cond);
+	pthread_mutex_unlock(&queue.lock);
+
+	return NULL;
+}
+
+static int
+backup_write_header(void)
+{
+	size_t len = 16 + 4;
+	uint8_t *hdr, *p;
+	uint64_t i, blocks;
+	int j, ret;
+
+	for (j = 0; j < n_parts; j++)
+		len += BACKUP_NAME_LEN + 24 + 4 * parts[j].n_bad;
+
+	hdr = p = calloc(1, len);
+	if (!hdr)
+		return -1;
+
+	memcpy(p, BACKUP_MAGIC, 8);
+	p = put_be32(p + 8, BACKUP_VERSION);
+	p = put_be32(p, n_parts);
+
+	for (j = 0; j < n_parts; j++) {
+		memcpy(p, parts[j].name, BACKUP_NAME_LEN);
+		p = put_be64(p + BACKUP_NAME_LEN, parts[j].size);
+		p = put_be32(p, parts[j].erasesize);
+		p = put_be32(p, parts[j].writesize);
+		p = put_be32(p, parts[j].type);
+		p = put_be32(p, parts[j].n_bad);
+
+		blocks = parts[j].size / parts[j].erasesize;
+		for (i = 0; i < blocks; i++)
+			if (parts[j].bad[i])
+				p = put_be32(p, i);
+	}
+
+	put_be32(p, crc32_buf(hdr, p - hdr));
+
+	ret = write_all(1, hdr, len);
+	free(hdr);
+
+	return ret;
+}
+
+static int
+backup_write_record(uint32_t part, uint32_t flags, uint64_t offset,
+		    const uint8_t *data, uint32_t len)
+{
+	uint8_t rec[24], *p;
+
+	p = put_be32(rec, part);
+	p = put_be32(p, flags);
+	p = put_be64(p, offset);
+	p = put_be32(p, len);
+	put_be32(p, data ? crc32_buf(data, len) : 0);
+
+	if (write_all(1, rec, sizeof(rec)))
+		return -1;
+
+	return data ? write_all(1, data, len) : 0;
+}
+
+int
+mtd_backup(char *devices)
+{
+	struct backup_chunk *c;
+	uint64_t records = 0, bad = 0;
+	char *dev, *brkt;
+	size_t off;
+	int i, ret = 0;
+
+	for (dev = strtok_r(devices, ":", &brkt); dev;
+	     dev = strtok_r(NULL, ":", &brkt)) {
+		if (n_parts == BACKUP_MAX_PARTS) {
+			fprintf(stderr, "Too many partitions\n");
+			return -1;
+		}
+		if (part_open(&parts[n_parts], dev))
+			return -1;
+		bad += parts[n_parts++].n_bad;
+	}
+
+	if (quiet < 2)
+		fprintf(stderr, "Backing up %d partitions, %llu bad blocks ...\n",
+			n_parts, (unsigned long long) bad);
+
+	if (backup_write_header()) {
+		fprintf(stderr, "Failed to write the backup: %s\n", strerror(errno));
+		return -1;
+	}
+
+	queue.running = n_parts;
+	for (i = 0; i < n_parts; i++) {
+		if (pthread_create(&parts[i].thread, NULL, backup_reader, (void *) (intptr_t) i)) {
+			fprintf(stderr, "Failed to start reader thread\n");
+			exit(1);
+		}
+	}
+
+	while ((c = queue_pop())) {
+		struct backup_part *p = &parts[c->part];
+
+		if (c->error) {
+			fprintf(stderr, "Failed to read %s at 0x%08llx\n",
+				p->dev, (unsigned long long) c->offset);
+			ret = -1;
+		}
+
+		for (off = 0; !ret && off < c->len; off += p->erasesize) {
+			const uint8_t *data = c->data + off;
+
+			if (is_erased(data, p->erasesize))
+				ret = backup_write_record(c->part, BACKUP_ERASED,
+							  c->offset + off, NULL, p->erasesize);
+			else
+				ret = backup_write_record(c->part, 0, c->offset + off,
+							  data, p->erasesize);
+			if (ret)
+				fprintf(stderr, "Failed to write the backup: %s\n", strerror(errno));
+			records++;
+		}
+
+		free(c->data);
+		free(c);
+
+		if (ret) {
+			pthread_mutex_lock(&queue.lock);
+			queue.stop = 1;
+			pthread_cond_broadcast(&queue.cond);
+			pthread_mutex_unlock(&queue.lock);
+		}
+	}
+
+	for (i = 0; i < n_parts; i++) {
+		pthread_join(parts[i].thread, NULL);
+		close(parts[i].fd);
+	}
+
+	if (!ret && backup_write_record(BACKUP_END, 0, records, NULL, 0)) {
+		fprintf(stderr, "Failed to write the backup: %s\n", strerror(errno));
+		ret = -1;
+	}
+
+	return ret;
+}
+
+static int
+restore_read_header(int fd, char *devices)
+{
+	uint8_t hdr[16], desc[BACKUP_NAME_LEN + 24], raw[4];
+	char *dev = NULL, *brkt = NULL;
+	uint32_t crc, n_bad, i;
+	struct backup_part *p;
+	int j;
+
+	if (read_all(fd, hdr, sizeof(hdr)) != 1 || memcmp(hdr, BACKUP_MAGIC, 8) ||
+	    get_be32(hdr + 8) != BACKUP_VERSION) {
+		fprintf(stderr, "Not an mtd backup\n");
+		return -1;
+	}
+
+	n_parts = get_be32(hdr + 12);
+	if (n_parts < 1 || n_parts > BACKUP_MAX_PARTS) {
+		fprintf(stderr, "Invalid number of partitions in the backup\n");
+		return -1;
+	}
+
+	crc = crc32_update(crc32_init(), hdr, sizeof(hdr));
+
+	for (j = 0; j < n_parts; j++) {
+		p = &parts[j];
+
+		if (read_all(fd, desc, sizeof(desc)) != 1)
+			goto truncated;
+		crc = crc32_update(crc, desc, sizeof(desc));
+
+		memcpy(p->name, desc, BACKUP_NAME_LEN);
+		p->name[BACKUP_NAME_LEN - 1] = 0;
+		p->size = get_be64(desc + BACKUP_NAME_LEN);
+		p->erasesize = get_be32(desc + BACKUP_NAME_LEN + 8);
+		p->writesize = get_be32(desc + BACKUP_NAME_LEN + 12);
+		p->type = get_be32(desc + BACKUP_NAME_LEN + 16);
+		n_bad = get_be32(desc + BACKUP_NAME_LEN + 20);
+
+		if (!p->erasesize || p->size % p->erasesize || !p->writesize ||
+		    n_bad > p->size / p->erasesize) {
+			fprintf(stderr, "Invalid partition %s in the backup\n", p->name);
+			return -1;
+		}
+
+		for (i = 0; i < n_bad; i++) {
+			if (read_all(fd, raw, 4) != 1)
+				goto truncated;
+			crc = crc32_update(crc, raw, 4);
+		}
+
+		if (quiet < 2 && n_bad)
+			fprintf(stderr, "%s had %u bad blocks\n", p->name, n_bad);
+	}
+
+	if (read_all(fd, raw, 4) != 1)
+		goto truncated;
+	if (get_be32(raw) != crc32_final(crc)) {
+		fprintf(stderr, "Backup header checksum mismatch\n");
+		return -1;
+	}
+
+	/* open the targets, by name unless given */
+	if (devices)
+		dev = strtok_r(devices, ":", &brkt);
+
+	for (j = 0; j < n_parts; j++) {
+		struct mtd_info_user info;
+
+		p = &parts[j];
+		p->dev = devices ? dev : p->name;
+		if (!p->dev) {
+			fprintf(stderr, "Not enough devices for the backup\n");
+			return -1;
+		}
+		if (devices)
+			dev = strtok_r(NULL, ":", &brkt);
+
+		p->fd = mtd_open(p->dev, false);
+		if (p->fd < 0 || ioctl(p->fd, MEMGETINFO, &info)) {
+			fprintf(stderr, "Could not open mtd device: %s\n", p->dev);
+			return -1;
+		}
+
+		if (info.erasesize != p->erasesize || info.size < p->size) {
+			fprintf(stderr, "%s does not match %s in the backup\n", p->dev, p->name);
+			return -1;
+		}
+		p->size = info.size;
+		p->type = info.type;
+		p->writesize = info.writesize ? info.writesize : 1;
+	}
+
+	return 0;
+
+truncated:
+	fprintf(stderr, "Truncated backup\n");
+	return -1;
+}
+
+static int
+restore_erase(struct backup_part *p, uint64_t block)
+{
+	struct erase_info_user erase = {
+		.start = block * p->erasesize,
+		.length = p->erasesize,
+	};
+
+	ioctl(p->fd, MEMUNLOCK, &erase);
+	return ioctl(p->fd, MEMERASE, &erase);
+}
+
+/* Finds and erases the next good target block */
+static int
+restore_next_block(struct backup_part *p)
+{
+	loff_t o;
+
+	for (; p->dst < p->size / p->erasesize; p->dst++) {
+		o = p->dst * p->erasesize;
+		if (is_nand(p) && ioctl(p->fd, MEMGETBADBLOCK, &o) > 0) {
+			if (quiet < 2)
+				fprintf(stderr, "skipping bad block at 0x%08llx on %s\n",
+					(unsigned long long) o, p->dev);
+			continue;
+		}
+
+		if (restore_erase(p, p->dst)) {
+			fprintf(stderr, "Failed to erase block 0x%08llx on %s\n",
+				(unsigned long long) o, p->dev);
+			return -1;
+		}
+
+		p->dst_cur = p->dst++;
+		return 0;
+	}
+
+	fprintf(stderr, "Not enough good blocks on %s\n", p->dev);
+	return -1;
+}
+
+static int
+restore_record(struct backup_part *p, uint32_t flags, uint64_t offset,
+	       const uint8_t *data, uint32_t len)
+{
+	uint64_t block = offset / p->erasesize;
+	uint64_t pos;
+	ssize_t r;
+
+	if (block + 1 != p->src_block) {
+		if (block + 1 < p->src_block) {
+			fprintf(stderr, "Backup records for %s out of order\n", p->name);
+			return -1;
+		}
+		if (restore_next_block(p))
+			return -1;
+		p->src_block = block + 1;
+	}
+
+	if (flags & BACKUP_ERASED)
+		return 0;
+
+	/* pages that are still erased are left unwritten */
+	while (len >= p->writesize && is_erased(data + len - p->writesize, p->writesize))
+		len -= p->writesize;
+	if (!len)
+		return 0;
+
+	pos = p->dst_cur * p->erasesize + offset % p->erasesize;
+	do {
+		r = pwrite(p->fd, data, len, pos);
+	} while (r < 0 && errno == EINTR);
+
+	if (r != (ssize_t) len) {
+		fprintf(stderr, "Failed to write %s at 0x%08llx\n",
+			p->dev, (unsigned long long) pos);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+mtd_restore(int fd, char *devices)
+{
+	uint8_t rec[24], *data = NULL;
+	uint64_t records = 0, offset;
+	uint32_t part, flags, len, max = 0;
+	struct backup_part *p;
+	int i, ret = -1;
+
+	if (restore_read_header(fd, devices))
+		goto out;
+
+	for (i = 0; i < n_parts; i++)
+		max = MAX(max, parts[i].erasesize);
+
+	data = malloc(max);
+	if (!data)
+		goto out;
+
+	if (quiet < 2)
+		fprintf(stderr, "Restoring %d partitions ...\n", n_parts);
+
+	for (;;) {
+		if (read_all(fd, rec, sizeof(rec)) != 1)
+			goto truncated;
+
+		part = get_be32(rec);
+		flags = get_be32(rec + 4);
+		offset = get_be64(rec + 8);
+		len = get_be32(rec + 16);
+
+		if (part == BACKUP_END) {
+			if (offset != records)
+				goto truncated;
+			break;
+		}
+
+		if (part >= (uint32_t) n_parts)
+			goto invalid;
+
+		p = &parts[part];
+		if (!len || len > p->erasesize || offset >= p->size ||
+		    offset % p->erasesize + len > p->erasesize)
+			goto invalid;
+
+		if (!(flags & BACKUP_ERASED)) {
+			if (read_all(fd, data, len) != 1)
+				goto truncated;
+			if (crc32_buf(data, len) != get_be32(rec + 20)) {
+				fprintf(stderr, "Checksum mismatch in %s at 0x%08llx\n",
+					p->name, (unsigned long long) offset);
+				goto out;
+			}
+		}
+
+		if (restore_record(p, flags, offset, data, len))
+			goto out;
+		records++;
+	}
+
+	/* erase what is left over, e.g. when the target has fewer bad blocks */
+	for (i = 0; i < n_parts; i++) {
+		p = &parts[i];
+		for (; p->dst < p->size / p->erasesize; p->dst++) {
+			loff_t o = p->dst * p->erasesize;
+
+			if (is_nand(p) && ioctl(p->fd, MEMGETBADBLOCK, &o) > 0)
+				continue;
+			restore_erase(p, p->dst);
+		}
+	}
+
+	ret = 0;
+	goto out;
+
+invalid:
+	fprintf(stderr, "Invalid record in the backup\n");
+	goto out;
+truncated:
+	fprintf(stderr, "Truncated backup\n");
+out:
+	for (i = 0; i < n_parts; i++)
+		if (parts[i].fd > 0)
+			close(parts[i].fd);
+	free(data);
+	return ret;
+}
@@ -1,26 +1,50 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * CRC32 (IEEE 802.3, reflected polynomial 0xedb88320)
+ *
+ * crc32_update() works on the raw register value, without the initial and
+ * final inversion, so it can be used both for the Ethernet/zlib CRC and for
+ * the many image formats that store the register as is:
+ *
+ *	crc = crc32_init();
+ *	crc = crc32_update(crc, buf, len);
+ *	...
+ *	crc = crc32_final(crc);
+ */
+
 #ifndef CRC32_H
 #define CRC32_H
 
+#include <stddef.h>
 #include <stdint.h>
 
-extern const uint32_t crc32_table[256];
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
 
-/* Return a 32-bit CRC of the contents of the buffer. */
+static inline uint32_t crc32_init(void)
+{
+	return 0xffffffff;
+}
 
-static inline uint32_t
-crc32(uint32_t val, const void *ss, int len)
+static inline uint32_t crc32_final(uint32_t crc)
 {
-	const unsigned char *s = ss;
-	while (--len >= 0)
-		val = crc32_table[(val ^ *s++) & 0xff] ^ (val >> 8);
-	return val;
+	return crc ^ 0xffffffff;
 }
 
-static inline unsigned int crc32buf(char *buf, size_t len)
+/* Ethernet/zlib CRC32 of a single buffer */
+static inline uint32_t crc32_buf(const void *buf, size_t len)
 {
-	return crc32(0xFFFFFFFF, buf, len);
+	return crc32_final(crc32_update(crc32_init(), buf, len));
 }
 
+/* Raw register update, as used by jffs2, trx and imagetag */
+static inline uint32_t crc32(uint32_t val, const void *ss, int len)
+{
+	return crc32_update(val, ss, len);
+}
 
+static inline unsigned int crc32buf(char *buf, size_t len)
+{
+	return crc32_update(0xFFFFFFFF, buf, len);
+}
 
-#endif
+#endif /* CRC32_H */
@@ -0,0 +1,283 @@
+/*
+ * fwcheck - validate the fwtool metadata and signature of an image in one pass
+ *
+ * fwtool appends blocks to an image, each followed by a trailer:
+ *
+ *   magic "FWx0", crc32, type, pad[3], size       (big endian)
+ *
+ * where size covers the block data and the trailer, and the CRC (raw
+ * register, starting at ~0) covers everything in front of the trailer. The
+ * metadata block starts with an 8 byte header (version, flags) followed by
+ * the JSON, the signature block is the ucert data as is.
+ *
+ * The image is mapped once and all trailer CRCs are checked in a single
+ * forward pass, instead of one full read per fwtool call. The metadata and
+ * the signature are extracted in the same run, and the result is printed as
+ * shell variables for the upgrade scripts.
+ *
+ * As with fwtool, only an outermost signature block is used, and the
+ * metadata is taken from below it, i.e. from the signed part of the image.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License v2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "crc32.h"
+
+#define FWIMAGE_MAGIC		0x46577830	/* "FWx0" */
+#define FWIMAGE_HEADER_SIZE	8
+#define FWIMAGE_TRAILER_SIZE	16
+#define FWIMAGE_MAX_BLOCKS	8
+
+#define WRITE_CHUNK		(1024 * 1024)
+
+enum fwimage_type {
+	FWIMAGE_SIGNATURE,
+	FWIMAGE_INFO,
+};
+
+struct fwimage_block {
+	int type;
+	uint32_t crc;
+	uint64_t start;		/* block data */
+	uint64_t len;
+	uint64_t end;		/* start of the trailer */
+};
+
+static int quiet;
+
+static uint32_t
+get_be32(const uint8_t *p)
+{
+	return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static int
+write_all(int fd, const uint8_t *data, uint64_t len)
+{
+	ssize_t r;
+
+	while (len) {
+		r = write(fd, data, MIN(len, WRITE_CHUNK));
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		data += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+static int
+write_file(const char *file, const uint8_t *data, uint64_t len)
+{
+	int fd, ret;
+
+	fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	ret = write_all(fd, data, len);
+	if (ret)
+		fprintf(stderr, "Failed to write %s: %s\n", file, strerror(errno));
+
+	close(fd);
+	return ret;
+}
+
+/* Collects the blocks from the end of the image, outermost first */
+static int
+find_blocks(const uint8_t *map, uint64_t size, struct fwimage_block *blocks)
+{
+	const uint8_t *tr;
+	uint64_t end = size;
+	uint32_t len;
+	int n = 0;
+
+	while (end >= FWIMAGE_TRAILER_SIZE && n < FWIMAGE_MAX_BLOCKS) {
+		tr = map + end - FWIMAGE_TRAILER_SIZE;
+		if (get_be32(tr) != FWIMAGE_MAGIC)
+			break;
+
+		len = get_be32(tr + 12);
+		if (len < FWIMAGE_TRAILER_SIZE || len > end) {
+			if (!quiet)
+				fprintf(stderr, "Invalid block size\n");
+			return -1;
+		}
+
+		blocks[n].type = tr[8];
+		blocks[n].crc = get_be32(tr + 4);
+		blocks[n].end = end - FWIMAGE_TRAILER_SIZE;
+		blocks[n].start = end - len;
+		blocks[n].len = len - FWIMAGE_TRAILER_SIZE;
+		n++;
+
+		end -= len;
+	}
+
+	return n;
+}
+
+/* One pass from the start, checking each trailer CRC on the way */
+static bool
+check_crcs(const uint8_t *map, const struct fwimage_block *blocks, int n)
+{
+	uint32_t crc = crc32_init();
+	uint64_t pos = 0;
+	int i;
+
+	for (i = n - 1; i >= 0; i--) {
+		crc = crc32_update(crc, map + pos, blocks[i].end - pos);
+		pos = blocks[i].end;
+
+		if (crc != blocks[i].crc) {
+			if (!quiet)
+				fprintf(stderr, "CRC error\n");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static int
+usage(void)
+{
+	fprintf(stderr, "Usage: fwcheck [<options>] <image>\n\n"
+		"Checks the CRCs of the fwtool blocks and prints the result as shell\n"
+		"variables: fwcheck_crc (ok, bad, none), fwcheck_metadata, fwcheck_signature.\n\n"
+		"Options:\n"
+		"        -i <file>       extract the metadata to <file>\n"
+		"        -s <file>       extract the signature to <file>\n"
+		"        -T              write the signed part of the image to stdout for\n"
+		"                        ucert, without checking the CRCs again\n"
+		"        -q              quiet\n");
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct fwimage_block blocks[FWIMAGE_MAX_BLOCKS];
+	const struct fwimage_block *info = NULL, *sig = NULL;
+	const char *meta_file = NULL, *sig_file = NULL;
+	bool signed_part = false, crc_ok = true;
+	uint64_t size;
+	const uint8_t *map;
+	struct stat s;
+	int ch, fd, i, n, ret = 0;
+
+	while ((ch = getopt(argc, argv, "i:s:Tq")) != -1) {
+		switch (ch) {
+		case 'i':
+			meta_file = optarg;
+			break;
+		case 's':
+			sig_file = optarg;
+			break;
+		case 'T':
+			signed_part = true;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			return usage();
+		}
+	}
+
+	if (optind + 1 != argc)
+		return usage();
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &s)) {
+		fprintf(stderr, "Failed to open %s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+
+	size = s.st_size;
+	map = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	close(fd);
+
+	if (!map || map == MAP_FAILED) {
+		fprintf(stderr, "Failed to map %s\n", argv[optind]);
+		return 1;
+	}
+
+	madvise((void *) map, size, MADV_SEQUENTIAL);
+
+	n = find_blocks(map, size, blocks);
+	if (n < 0)
+		return 1;
+
+	/*
+	 * As for fwtool, a signature only counts as the outermost block, and
+	 * the metadata is the outermost info block below it, so an info block
+	 * appended to a signed image is never used.
+	 */
+	i = 0;
+	if (n && blocks[0].type == FWIMAGE_SIGNATURE)
+		sig = &blocks[i++];
+
+	for (; i < n; i++) {
+		if (blocks[i].type != FWIMAGE_INFO)
+			continue;
+
+		if (blocks[i].len >= FWIMAGE_HEADER_SIZE)
+			info = &blocks[i];
+		break;
+	}
+
+	if (signed_part) {
+		/* the signature covers everything in front of it */
+		if (write_all(1, map, sig ? sig->start : size)) {
+			fprintf(stderr, "Write failed: %s\n", strerror(errno));
+			return 1;
+		}
+		return 0;
+	}
+
+	crc_ok = check_crcs(map, blocks, n);
+	if (!crc_ok) {
+		info = sig = NULL;
+		ret = 1;
+	}
+
+	if (meta_file && info &&
+	    write_file(meta_file, map + info->start + FWIMAGE_HEADER_SIZE,
+		       info->len - FWIMAGE_HEADER_SIZE))
+		ret = 1;
+
+	if (sig_file && sig && write_file(sig_file, map + sig->start, sig->len))
+		ret = 1;
+
+	printf("fwcheck_crc=%s\n", !n ? "none" : crc_ok ? "ok" : "bad");
+	printf("fwcheck_metadata=%d\n", !!info);
+	printf("fwcheck_signature=%d\n", !!sig);
+
+	return ret;
+}
@@ -18,6 +18,7 @@
  */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/param.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <fcntl.h>
@@ -26,12 +27,17 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <endian.h>
+#include <time.h>
 #include "jffs2.h"
 #include "crc32.h"
 #include "mtd.h"
 
 #define PAD(x) (((x)+3)&~3)
 
+/* data nodes never cross a page of the file, as written by the kernel */
+#define JFFS2_PAGE_SIZE	4096
+#define JFFS2_READ_BUF	(64 * 1024)
+
 #if BYTE_ORDER == BIG_ENDIAN
 # define CLEANMARKER "\x19\x85\x20\x03\x00\x00\x00\x0c\xf0\x60\xdc\x98"
 #else
@@ -45,6 +51,8 @@ static int ofs = 0;
 static int outfd = -1;
 static int mtdofs = 0;
 static int target_ino = 0;
+static int write_error = 0;
+static int bad_blocks = 0;
 
 static void prep_eraseblock(void);
 
@@ -64,12 +72,17 @@ static void pad(int size)
 				fprintf(stderr, "\nSkipping bad block at 0x%08x   ", mtdofs);
 
 			mtdofs += erasesize;
+			bad_blocks++;
 
 			/* Move the file pointer along over the bad block. */
 			lseek(outfd, erasesize, SEEK_CUR);
 		}
-		mtd_erase_block(outfd, mtdofs);
-		write(outfd, buf, erasesize);
+		if (mtd_erase_block(outfd, mtdofs) < 0 ||
+		    write(outfd, buf, erasesize) != erasesize) {
+			if (!write_error)
+				fprintf(stderr, "\nFailed to write jffs2 data at 0x%08x\n", mtdofs);
+			write_error = 1;
+		}
 		mtdofs += erasesize;
 	}
 }
@@ -160,13 +173,89 @@ static int add_dir(const char *name, int parent)
 	return inode;
 }
 
+/*
+ * Same algorithm as the kernel's rtime compressor, so the nodes can be read
+ * by any kernel with CONFIG_JFFS2_RTIME. May consume less than *sourcelen
+ * if the output does not fit into *dstlen.
+ */
+static int rtime_compress(const unsigned char *data_in, unsigned char *cpage_out,
+			  int *sourcelen, int *dstlen)
+{
+	unsigned short positions[256];
+	int outpos = 0;
+	int pos = 0;
+
+	if (*dstlen <= 3)
+		return -1;
+
+	memset(positions, 0, sizeof(positions));
+
+	while (pos < *sourcelen && outpos <= *dstlen - 2) {
+		int backpos, runlen = 0;
+		unsigned char value;
+
+		value = data_in[pos];
+		cpage_out[outpos++] = data_in[pos++];
+
+		backpos = positions[value];
+		positions[value] = pos;
+
+		while (backpos < pos && pos < *sourcelen &&
+		       data_in[pos] == data_in[backpos++] && runlen < 255) {
+			pos++;
+			runlen++;
+		}
+		cpage_out[outpos++] = runlen;
+	}
+
+	if (outpos >= pos)
+		return -1;
+
+	*sourcelen = pos;
+	*dstlen = outpos;
+	return 0;
+}
+
+/*
+ * Picks the node encoding for the data: zero pages take no space, rtime is
+ * used if it saves anything, otherwise the data is stored as is. On return
+ * *len is the amount of data covered by the node and *clen its size on flash.
+ */
+static int compress_data(const char *data, int *len, char *cbuf, int *clen, int avail)
+{
+	int i, raw = MIN(*len, avail), slen = *len, dlen = raw;
+
+	for (i = 0; i < *len; i++)
+		if (data[i])
+			break;
+
+	if (i == *len) {
+		*clen = 0;
+		return JFFS2_COMPR_ZERO;
+	}
+
+	/* rtime only returns success if the output is smaller than the input */
+	if (!rtime_compress((const unsigned char *) data, (unsigned char *) cbuf,
+			    &slen, &dlen) && slen >= raw) {
+		*len = slen;
+		*clen = dlen;
+		return JFFS2_COMPR_RTIME;
+	}
+
+	memcpy(cbuf, data, raw);
+	*len = *clen = raw;
+	return JFFS2_COMPR_NONE;
+}
+
 static void add_file(const char *name, int parent)
 {
-	int inode, f_offset = 0, fd;
+	int inode, f_offset = 0, page_len = 0, page_pos = 0;
 	struct jffs2_raw_inode ri;
 	struct stat st;
-	char wbuf[4096];
+	char page[JFFS2_PAGE_SIZE];
+	char cbuf[JFFS2_PAGE_SIZE];
 	const char *fname;
+	FILE *f;
 
 	if (stat(name, &st)) {
 		fprintf(stderr, "File %s does not exist\n", name);
@@ -191,55 +280,80 @@ static void add_file(const char *name, int parent)
 	ri.ctime = st.st_ctime;
 	ri.mtime = st.st_mtime;
 	ri.isize = st.st_size;
-	ri.compr = 0;
 	ri.usercompr = 0;
 
-	fd = open(name, 0);
-	if (fd < 0) {
+	f = fopen(name, "r");
+	if (!f) {
 		fprintf(stderr, "File %s does not exist\n", name);
 		return;
 	}
+	setvbuf(f, NULL, _IOFBF, JFFS2_READ_BUF);
 
 	for (;;) {
-		int len = 0;
+		int len, clen, avail;
 
 		for (;;) {
-			len = rbytes() - sizeof(ri);
-			if (len > 128)
+			avail = rbytes() - sizeof(ri);
+			if (avail > 128)
 				break;
 
 			pad(erasesize);
 			prep_eraseblock();
 		}
 
-		if (len > sizeof(wbuf))
-			len = sizeof(wbuf);
+		if (page_pos == page_len) {
+			page_len = fread(page, 1, sizeof(page), f);
+			page_pos = 0;
+			if (page_len <= 0)
+				break;
+		}
 
-		len = read(fd, wbuf, len);
-		if (len <= 0)
-			break;
+		/* the rest of the page, or as much of it as fits here */
+		len = page_len - page_pos;
+		ri.compr = compress_data(page + page_pos, &len, cbuf, &clen, avail);
 
-		ri.totlen = sizeof(ri) + len;
+		ri.totlen = sizeof(ri) + clen;
 		ri.hdr_crc = crc32(0, &ri, sizeof(struct jffs2_unknown_node) - 4);
 		ri.version = ++last_version;
 		ri.offset = f_offset;
-		ri.csize = ri.dsize = len;
+		ri.csize = clen;
+		ri.dsize = len;
 		ri.node_crc = crc32(0, &ri, sizeof(ri) - 8);
-		ri.data_crc = crc32(0, wbuf, len);
+		ri.data_crc = crc32(0, cbuf, clen);
 		f_offset += len;
+		page_pos += len;
 		add_data((char *) &ri, sizeof(ri));
-		add_data(wbuf, len);
+		add_data(cbuf, clen);
 		pad(4);
 		prep_eraseblock();
 	}
 
-	close(fd);
+	if (ferror(f)) {
+		fprintf(stderr, "Failed to read %s\n", name);
+		write_error = 1;
+	}
+
+	fclose(f);
+}
+
+static void jffs2_timing_report(const char *mtd, int start_ofs,
+				const struct timespec *start)
+{
+	if (!timing)
+		return;
+
+	timing_report("jffs2", mtd, start_ofs, mtdofs - start_ofs, bad_blocks,
+		      elapsed(start));
+	fprintf(stderr, " result=%s\n", write_error ? "error" : "ok");
 }
 
 int mtd_replace_jffs2(const char *mtd, int fd, int ofs, const char *filename)
 {
+	struct timespec start;
+
 	outfd = fd;
 	mtdofs = ofs;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	buf = malloc(erasesize);
 	target_ino = 1;
@@ -253,6 +367,13 @@ int mtd_replace_jffs2(const char *mtd, int fd, int ofs, const char *filename)
 	pad(erasesize);
 	free(buf);
 
+	/* the progress output leaves the cursor behind a '.' */
+	if (timing && quiet < 2)
+		fprintf(stderr, "\n");
+	jffs2_timing_report(mtd, ofs, &start);
+	if (write_error)
+		return -1;
+
 	return (mtdofs - ofs);
 }
 
@@ -285,7 +406,8 @@ void mtd_parse_jffs2data(const char *buf, const char *dir)
 
 int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir)
 {
-	int err = -1, fdeof = 0;
+	int err = -1, fdeof = 0, start_ofs;
+	struct timespec start;
 
 	outfd = mtd_check_open(mtd);
 	if (outfd < 0)
@@ -337,6 +459,8 @@ int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir)
 	lseek(outfd, mtdofs, SEEK_SET);
 
 	ofs = 0;
+	start_ofs = mtdofs;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	if (!last_ino)
 		last_ino = 1;
@@ -351,6 +475,10 @@ int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir)
 	add_data(JFFS2_EOF, sizeof(JFFS2_EOF) - 1);
 	pad(erasesize);
 
+	jffs2_timing_report(mtd, start_ofs, &start);
+	if (write_error)
+		goto done;
+
 	err = 0;
 
 	if (trx_fixup) {
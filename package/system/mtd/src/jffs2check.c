@@ -0,0 +1,305 @@
+/*
+ * jffs2check - decode files from a jffs2 image written by mtd
+ *
+ * Copyright (C) 2026 OpenWrt.org
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License v2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Checks the CRCs of every node in the image, then rebuilds each named
+ * file from its data nodes and compares it with the original. Only the
+ * encodings written by jffs2.c (none, zero and rtime) are decoded.
+ * Runs on the build host against a dump of the partition.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include "jffs2.h"
+#include "crc32.h"
+
+#define PAD(x) (((x)+3)&~3)
+
+static unsigned char *image;
+static size_t image_len;
+
+static int read_file(const char *name, unsigned char **data, size_t *len)
+{
+	struct stat st;
+	FILE *f;
+
+	f = fopen(name, "r");
+	if (!f || fstat(fileno(f), &st)) {
+		fprintf(stderr, "Failed to open %s\n", name);
+		return -1;
+	}
+
+	*len = st.st_size;
+	*data = malloc(*len + 1);
+	if (!*data || fread(*data, 1, *len, f) != *len) {
+		fprintf(stderr, "Failed to read %s\n", name);
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+/* Checks the CRCs of a node whose header CRC and length are valid */
+static int node_ok(struct jffs2_unknown_node *node)
+{
+	struct jffs2_raw_dirent *de = (struct jffs2_raw_dirent *) node;
+	struct jffs2_raw_inode *ri = (struct jffs2_raw_inode *) node;
+
+	switch (node->nodetype) {
+	case JFFS2_NODETYPE_DIRENT:
+		return node->totlen >= sizeof(*de) &&
+		       de->node_crc == crc32(0, de, sizeof(*de) - 8) &&
+		       de->nsize <= node->totlen - sizeof(*de) &&
+		       de->name_crc == crc32(0, de->name, de->nsize);
+	case JFFS2_NODETYPE_INODE:
+		return node->totlen >= sizeof(*ri) &&
+		       ri->node_crc == crc32(0, ri, sizeof(*ri) - 8) &&
+		       ri->csize <= node->totlen - sizeof(*ri) &&
+		       ri->data_crc == crc32(0, ri->data, ri->csize);
+	default:
+		return 1;
+	}
+}
+
+/*
+ * Calls fn for every valid node. Without fn, reports the nodes with a valid
+ * header but bad contents and returns their number instead.
+ */
+static int for_each_node(void (*fn)(struct jffs2_unknown_node *, void *), void *ctx)
+{
+	struct jffs2_unknown_node *node;
+	size_t ofs = 0;
+	int bad = 0;
+
+	while (ofs + sizeof(*node) <= image_len) {
+		node = (struct jffs2_unknown_node *) (image + ofs);
+		if (node->magic != JFFS2_MAGIC_BITMASK) {
+			ofs += 4;
+			continue;
+		}
+
+		/* like the kernel, treat a bad header as dirty space */
+		if (node->hdr_crc != crc32(0, node, sizeof(*node) - 4) ||
+		    node->totlen < sizeof(*node) || node->totlen > image_len - ofs) {
+			ofs += 4;
+			continue;
+		}
+
+		if (!node_ok(node)) {
+			if (!fn)
+				fprintf(stderr, "Bad node CRC at 0x%zx\n", ofs);
+			bad++;
+		} else if (fn) {
+			fn(node, ctx);
+		}
+
+		ofs += PAD(node->totlen);
+	}
+
+	return bad;
+}
+
+/* Kernel rtime decompressor, bounded by the input length */
+static int rtime_decompress(const unsigned char *data_in, unsigned char *cpage_out,
+			    uint32_t srclen, uint32_t destlen)
+{
+	unsigned short positions[256];
+	uint32_t outpos = 0, pos = 0;
+
+	memset(positions, 0, sizeof(positions));
+
+	while (outpos < destlen) {
+		unsigned char value;
+		int backoffs, repeat;
+
+		if (pos + 2 > srclen)
+			return -1;
+
+		value = data_in[pos++];
+		cpage_out[outpos++] = value;
+		repeat = data_in[pos++];
+		backoffs = positions[value];
+		positions[value] = outpos;
+
+		if (outpos + repeat > destlen)
+			return -1;
+
+		while (repeat--)
+			cpage_out[outpos++] = cpage_out[backoffs++];
+	}
+
+	return pos == srclen ? 0 : -1;
+}
+
+struct dirent_ctx {
+	const char *name;
+	uint32_t ino;
+	uint32_t version;
+};
+
+static void find_dirent(struct jffs2_unknown_node *node, void *ctx)
+{
+	struct jffs2_raw_dirent *de = (struct jffs2_raw_dirent *) node;
+	struct dirent_ctx *d = ctx;
+
+	if (node->nodetype != JFFS2_NODETYPE_DIRENT ||
+	    de->nsize != strlen(d->name) ||
+	    memcmp(de->name, d->name, de->nsize) ||
+	    (d->ino && de->version < d->version))
+		return;
+
+	d->ino = de->ino;
+	d->version = de->version;
+}
+
+struct inode_ctx {
+	uint32_t ino;
+	uint32_t version;
+	uint32_t isize;
+	unsigned char *data;
+	size_t len;
+	int nodes[256];
+	int errors;
+};
+
+static void add_inode(struct jffs2_unknown_node *node, void *ctx)
+{
+	struct jffs2_raw_inode *ri = (struct jffs2_raw_inode *) node;
+	struct inode_ctx *c = ctx;
+	unsigned char *dst;
+	size_t end;
+
+	if (node->nodetype != JFFS2_NODETYPE_INODE || ri->ino != c->ino)
+		return;
+
+	/* mtd writes every range once, so nodes are applied in scan order */
+	if (ri->version >= c->version) {
+		c->version = ri->version;
+		c->isize = ri->isize;
+	}
+
+	if (!ri->dsize)
+		return;
+
+	end = (size_t) ri->offset + ri->dsize;
+	if (end > c->len) {
+		c->data = realloc(c->data, end);
+		if (!c->data) {
+			perror("realloc");
+			exit(1);
+		}
+		memset(c->data + c->len, 0, end - c->len);
+		c->len = end;
+	}
+
+	dst = c->data + ri->offset;
+	c->nodes[ri->compr]++;
+
+	switch (ri->compr) {
+	case JFFS2_COMPR_NONE:
+		if (ri->csize != ri->dsize)
+			goto error;
+		memcpy(dst, ri->data, ri->dsize);
+		break;
+	case JFFS2_COMPR_ZERO:
+		memset(dst, 0, ri->dsize);
+		break;
+	case JFFS2_COMPR_RTIME:
+		if (rtime_decompress(ri->data, dst, ri->csize, ri->dsize))
+			goto error;
+		break;
+	default:
+		fprintf(stderr, "Unsupported compression %d at offset %u\n",
+			ri->compr, ri->offset);
+		c->errors++;
+		break;
+	}
+	return;
+
+error:
+	fprintf(stderr, "Corrupt data node at offset %u\n", ri->offset);
+	c->errors++;
+}
+
+static int check_file(const char *file)
+{
+	struct dirent_ctx d = {};
+	struct inode_ctx c = {};
+	unsigned char *data;
+	char *name;
+	size_t len;
+	int ret = 1;
+
+	if (read_file(file, &data, &len))
+		return 1;
+
+	name = strdup(file);
+	d.name = basename(name);
+	for_each_node(find_dirent, &d);
+	if (!d.ino) {
+		fprintf(stderr, "%s: not found\n", d.name);
+		goto out;
+	}
+
+	c.ino = d.ino;
+	for_each_node(add_inode, &c);
+
+	if (c.errors)
+		fprintf(stderr, "%s: %d bad data nodes\n", d.name, c.errors);
+	else if (c.isize != len || c.len > c.isize)
+		fprintf(stderr, "%s: size %u, expected %zu\n", d.name, c.isize, len);
+	else if (c.len < len || memcmp(c.data, data, len))
+		fprintf(stderr, "%s: content differs\n", d.name);
+	else
+		ret = 0;
+
+	fprintf(stderr, "%s: %s, %zu bytes in %d none, %d zero, %d rtime nodes\n",
+		d.name, ret ? "FAILED" : "ok", len, c.nodes[JFFS2_COMPR_NONE],
+		c.nodes[JFFS2_COMPR_ZERO], c.nodes[JFFS2_COMPR_RTIME]);
+
+out:
+	free(c.data);
+	free(name);
+	free(data);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int i, bad, ret = 0;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <image> <file>...\n", argv[0]);
+		return 1;
+	}
+
+	if (read_file(argv[1], &image, &image_len))
+		return 1;
+
+	bad = for_each_node(NULL, NULL);
+	if (bad) {
+		fprintf(stderr, "%s: %d bad nodes\n", argv[1], bad);
+		ret = 1;
+	}
+
+	for (i = 2; i < argc; i++)
+		ret |= check_file(argv[i]);
+
+	return ret;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+# Time "mtd write" end to end on a simulated flash device.
+#
+# usage: mtd-bench.sh [-v] <mtdram|nandsim> <image> [<source command>]
+#
+# The image is written twice: once after the source has been drained to
+# /tmp, as a serial download-then-flash upgrade would, and once streamed
+# from the source into mtd, where the image read-ahead overlaps the source
+# with erasing and programming. The source command defaults to reading the
+# image file, pass e.g. "wget -qO- http://host/image.bin" to include the
+# network. -v adds the verify pass to both runs.
+#
+# Runs on the target, needs the mtdram or nandsim kernel module and
+# busybox. nandsim is loaded as a 256 MiB, 128 KiB block device with its
+# erase and program delays enabled.
+
+VERIFY=
+[ "$1" = "-v" ] && { VERIFY=-v; shift; }
+
+SIM="$1"
+IMAGE="$2"
+SOURCE="${3:-cat $IMAGE}"
+
+[ -f "$IMAGE" ] || {
+	echo "usage: $0 [-v] <mtdram|nandsim> <image> [<source command>]" >&2
+	exit 1
+}
+
+now() {
+	local up rest
+	read up rest < /proc/uptime
+	echo "${up%.*}${up#*.}0"
+}
+
+case "$SIM" in
+	mtdram)
+		size=$(( ($(wc -c < "$IMAGE") + 1048575) / 1048576 * 1024 ))
+		insmod mtdram total_size=$size erase_size=128 || exit 1
+		name="mtdram test device"
+	;;
+	nandsim)
+		insmod nandsim first_id_byte=0x20 second_id_byte=0xaa \
+			third_id_byte=0x00 fourth_id_byte=0x15 do_delays=1 \
+			programm_delay=200 erase_delay=2 || exit 1
+		name="NAND simulator partition 0"
+	;;
+	*)
+		echo "unknown simulator: $SIM" >&2
+		exit 1
+	;;
+esac
+
+dev=$(grep "\"$name\"" /proc/mtd | cut -d: -f1)
+[ -n "$dev" ] || { echo "$SIM did not register an mtd device" >&2; rmmod "$SIM"; exit 1; }
+
+t0=$(now)
+$SOURCE > /tmp/mtd-bench.img
+t1=$(now)
+mtd -q $VERIFY write /tmp/mtd-bench.img "$dev" || err=1
+t2=$(now)
+rm -f /tmp/mtd-bench.img
+
+mtd -q erase "$dev"
+
+t3=$(now)
+$SOURCE | mtd -q $VERIFY write - "$dev" || err=1
+t4=$(now)
+
+rmmod "$SIM"
+
+echo "$SIM $dev: $(wc -c < "$IMAGE") bytes${VERIFY:+, verified}"
+echo "serial:    source $((t1 - t0)) ms + write $((t2 - t1)) ms = $((t2 - t0)) ms"
+echo "streamed:  $((t4 - t3)) ms"
+
+exit ${err:-0}
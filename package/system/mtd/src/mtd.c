@@ -25,6 +25,7 @@
 #include <byteswap.h>
 #include <endian.h>
 #include <limits.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -39,6 +40,7 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/param.h>
+#include <sys/mman.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
 #include <sys/reboot.h>
@@ -47,6 +49,7 @@
 #include "crc32.h"
 #include "fis.h"
 #include "mtd.h"
+#include "sha256.h"
 
 #include <libubox/md5.h>
 
@@ -90,6 +93,9 @@ static char *tpl_uboot_args_part;
 static int buflen = 0;
 int quiet;
 int no_erase;
+int diff_write;
+int verify_write;
+int timing;
 int mtdsize = 0;
 int erasesize = 0;
 int jffs2_skip_bytes=0;
@@ -183,6 +189,254 @@ int mtd_write_buffer(int fd, const char *buf, int offset, int length)
 	return 0;
 }
 
+static char *diffbuf = NULL;
+
+/*
+ * Compare the block at the current position with the data about to be
+ * written. NAND blocks that needed ECC correction while reading are
+ * reported as changed, so that they get refreshed by the rewrite.
+ */
+static int
+mtd_block_unchanged(int fd, const char *data, int len)
+{
+	struct mtd_ecc_stats before, after;
+	int stats;
+	off_t pos;
+
+	if (!diffbuf && !(diffbuf = malloc(erasesize)))
+		return 0;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	stats = !ioctl(fd, ECCGETSTATS, &before);
+
+	if (pread(fd, diffbuf, len, pos) != len)
+		return 0;
+
+	if (stats && !ioctl(fd, ECCGETSTATS, &after) &&
+	    (after.corrected != before.corrected ||
+	     after.failed != before.failed))
+		return 0;
+
+	return !memcmp(diffbuf, data, len);
+}
+
+double
+elapsed(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+	       (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * The image is read by a separate thread into a ring buffer, so that the
+ * next block arrives from stdin or the network while the current one is
+ * being erased and written. image_read() has the semantics of read().
+ */
+#define IMAGE_RING_BLOCKS	2
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *ring;
+	size_t size;
+	size_t head;
+	size_t tail;
+	int fd;
+	int eof;
+	int err;
+	bool started;
+} reader = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void *
+image_reader_thread(void *arg)
+{
+	size_t pos, len;
+	ssize_t r;
+
+	for (;;) {
+		pthread_mutex_lock(&reader.lock);
+		while (reader.head - reader.tail == reader.size)
+			pthread_cond_wait(&reader.cond, &reader.lock);
+
+		pos = reader.head % reader.size;
+		len = MIN(reader.size - (reader.head - reader.tail),
+			  reader.size - pos);
+		pthread_mutex_unlock(&reader.lock);
+
+		/* only this thread touches the free part of the ring */
+		r = read(reader.fd, reader.ring + pos, len);
+		if (r < 0 && ((errno == EINTR) || (errno == EAGAIN)))
+			continue;
+
+		pthread_mutex_lock(&reader.lock);
+		if (r > 0)
+			reader.head += r;
+		else if (r == 0)
+			reader.eof = 1;
+		else
+			reader.err = errno;
+		pthread_cond_broadcast(&reader.cond);
+		pthread_mutex_unlock(&reader.lock);
+
+		if (r <= 0)
+			return NULL;
+	}
+}
+
+static ssize_t
+image_read(int imagefd, char *data, size_t len)
+{
+	size_t pos, avail;
+	int err;
+
+	if (!reader.started) {
+		reader.size = IMAGE_RING_BLOCKS * erasesize;
+		reader.ring = malloc(reader.size);
+		reader.fd = imagefd;
+		if (!reader.ring ||
+		    pthread_create(&reader.thread, NULL, image_reader_thread, NULL)) {
+			free(reader.ring);
+			reader.ring = NULL;
+			return read(imagefd, data, len);
+		}
+		pthread_detach(reader.thread);
+		reader.started = true;
+	}
+
+	if (!reader.ring)
+		return read(imagefd, data, len);
+
+	pthread_mutex_lock(&reader.lock);
+	while (reader.head == reader.tail && !reader.eof && !reader.err)
+		pthread_cond_wait(&reader.cond, &reader.lock);
+
+	avail = reader.head - reader.tail;
+	if (!avail) {
+		err = reader.err;
+		pthread_mutex_unlock(&reader.lock);
+		if (err) {
+			errno = err;
+			return -1;
+		}
+		return 0;
+	}
+
+	pos = reader.tail % reader.size;
+	len = MIN(len, MIN(avail, reader.size - pos));
+	pthread_mutex_unlock(&reader.lock);
+
+	memcpy(data, reader.ring + pos, len);
+
+	pthread_mutex_lock(&reader.lock);
+	reader.tail += len;
+	pthread_cond_broadcast(&reader.cond);
+	pthread_mutex_unlock(&reader.lock);
+
+	return len;
+}
+
+/*
+ * With -v every written block is read back and compared by a separate
+ * thread, while the next block is being erased and written.
+ */
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	char *data;
+	char *readback;
+	int fd;
+	int len;
+	off_t pos;
+	int pending;
+	int failed;
+	off_t failed_pos;
+	bool started;
+} verifier = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void *
+verify_thread(void *arg)
+{
+	int ok;
+
+	pthread_mutex_lock(&verifier.lock);
+	for (;;) {
+		while (!verifier.pending)
+			pthread_cond_wait(&verifier.cond, &verifier.lock);
+		pthread_mutex_unlock(&verifier.lock);
+
+		ok = pread(verifier.fd, verifier.readback, verifier.len,
+			   verifier.pos) == verifier.len &&
+		     !memcmp(verifier.readback, verifier.data, verifier.len);
+
+		pthread_mutex_lock(&verifier.lock);
+		if (!ok && !verifier.failed) {
+			verifier.failed = 1;
+			verifier.failed_pos = verifier.pos;
+		}
+		verifier.pending = 0;
+		pthread_cond_broadcast(&verifier.cond);
+	}
+
+	return NULL;
+}
+
+/* Wait for the last queued block and bail out if any block did not verify */
+static void
+verify_wait(void)
+{
+	if (!verifier.started)
+		return;
+
+	pthread_mutex_lock(&verifier.lock);
+	while (verifier.pending)
+		pthread_cond_wait(&verifier.cond, &verifier.lock);
+	pthread_mutex_unlock(&verifier.lock);
+
+	if (verifier.failed) {
+		fprintf(stderr, "\nVerification failed at 0x%08llx\n",
+			(unsigned long long) verifier.failed_pos);
+		exit(1);
+	}
+}
+
+static void
+verify_queue(int fd, off_t pos, const char *data, int len)
+{
+	if (!verifier.started) {
+		verifier.data = malloc(erasesize);
+		verifier.readback = malloc(erasesize);
+		if (!verifier.data || !verifier.readback ||
+		    pthread_create(&verifier.thread, NULL, verify_thread, NULL)) {
+			fprintf(stderr, "Failed to start the verify thread\n");
+			exit(1);
+		}
+		verifier.started = true;
+	}
+
+	verify_wait();
+
+	memcpy(verifier.data, data, len);
+
+	pthread_mutex_lock(&verifier.lock);
+	verifier.fd = fd;
+	verifier.pos = pos;
+	verifier.len = len;
+	verifier.pending = 1;
+	pthread_cond_broadcast(&verifier.cond);
+	pthread_mutex_unlock(&verifier.lock);
+}
+
 static int
 image_check(int imagefd, const char *mtd)
 {
@@ -346,10 +600,76 @@ mtd_erase(const char *mtd)
 
 }
 
+/*
+ * Read up to len bytes starting at *pos, skipping over bad NAND blocks
+ * without reading them. Returns the number of bytes read, which is short
+ * only at the end of the device.
+ */
+static ssize_t
+mtd_read_good(int fd, char *data, size_t len, off_t *pos, int *bad)
+{
+	size_t done = 0, n;
+	ssize_t r;
+
+	while (done < len && *pos < mtdsize) {
+		n = MIN(len - done, mtdsize - *pos);
+
+		if (mtdtype == MTD_NANDFLASH) {
+			if (!(*pos % erasesize) && mtd_block_is_bad(fd, *pos)) {
+				fprintf(stderr, "skipping bad block at 0x%08llx\n",
+					(unsigned long long) *pos);
+				(*bad)++;
+				*pos += erasesize;
+				continue;
+			}
+
+			n = MIN(n, erasesize - *pos % erasesize);
+		}
+
+		r = pread(fd, data + done, n, *pos);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!r)
+			break;
+
+		done += r;
+		*pos += r;
+	}
+
+	return done;
+}
+
+/* Reads are done in chunks of at least this size, rounded up to erase blocks */
+#define MTD_READ_CHUNK		(256 * 1024)
+
+static size_t
+mtd_read_chunk(void)
+{
+	return (MAX(MTD_READ_CHUNK, erasesize) + erasesize - 1) / erasesize * erasesize;
+}
+
+void
+timing_report(const char *cmd, const char *mtd, off_t offset, uint64_t len,
+	      int bad, double secs)
+{
+	fprintf(stderr, "%s mtd=%s offset=%llu bytes=%llu bad_blocks=%d time_ms=%llu kib_s=%llu",
+		cmd, mtd, (unsigned long long) offset, (unsigned long long) len,
+		bad, (unsigned long long) (secs * 1000),
+		(unsigned long long) (secs > 0 ? len / 1024.0 / secs : 0));
+}
+
 static int
 mtd_dump(const char *mtd, int part_offset, int size)
 {
-	int ret = 0, offset = 0;
+	struct timespec start;
+	int ret = 0, bad = 0;
+	off_t pos = part_offset;
+	uint64_t total = 0;
+	size_t chunk;
+	ssize_t rlen, w;
 	int fd;
 	char *buf;
 
@@ -365,92 +685,303 @@ mtd_dump(const char *mtd, int part_offset, int size)
 	if (!size)
 		size = mtdsize;
 
-	if (part_offset)
-		lseek(fd, part_offset, SEEK_SET);
-
-	buf = malloc(erasesize);
-	if (!buf)
+	chunk = mtd_read_chunk();
+	buf = malloc(chunk);
+	if (!buf) {
+		close(fd);
 		return -1;
+	}
 
-	do {
-		int len = (size > erasesize) ? (erasesize) : (size);
-		int rlen = read(fd, buf, len);
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
+	while (size > 0) {
+		rlen = mtd_read_good(fd, buf, MIN(chunk, size), &pos, &bad);
 		if (rlen < 0) {
-			if (errno == EINTR)
-				continue;
 			ret = -1;
-			goto out;
+			break;
 		}
-		if (!rlen || rlen != len)
+		if (!rlen)
 			break;
-		if (mtd_block_is_bad(fd, offset)) {
-			fprintf(stderr, "skipping bad block at 0x%08x\n", offset);
-		} else {
-			size -= rlen;
-			write(1, buf, rlen);
+
+		for (w = 0; w < rlen; ) {
+			ssize_t r = write(1, buf + w, rlen - w);
+
+			if (r < 0) {
+				if (errno == EINTR)
+					continue;
+				ret = -1;
+				goto out;
+			}
+			w += r;
 		}
-		offset += rlen;
-	} while (size > 0);
+
+		size -= rlen;
+		total += rlen;
+	}
 
 out:
+	if (timing) {
+		timing_report("dump", mtd, part_offset, total, bad, elapsed(&start));
+		fprintf(stderr, " result=%s\n", ret ? "error" : "ok");
+	}
+
+	free(buf);
 	close(fd);
 	return ret;
 }
 
+/*
+ * Verification reads the flash and the image in large chunks in the main
+ * thread, while a second thread compares and hashes the previous chunk.
+ * Only the flash data is hashed as long as both sides match, as the image
+ * hash is the same up to the first difference.
+ */
+enum {
+	VERIFY_MD5	= (1 << 0),
+	VERIFY_SHA256	= (1 << 1),
+};
+
+struct verify_hash {
+	md5_ctx_t md5;
+	sha256_ctx_t sha256;
+};
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct {
+		char *mtd;
+		char *img;
+		const char *data;
+		size_t len;
+		int full;
+	} slot[2];
+	int done;
+	bool differ;
+	uint64_t pos;
+	uint64_t first_diff;
+	struct verify_hash mtd_hash;
+	struct verify_hash img_hash;
+} hasher = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static int verify_hashes = VERIFY_MD5;
+
+static void
+verify_hash_update(struct verify_hash *h, const void *data, size_t len)
+{
+	if (verify_hashes & VERIFY_MD5)
+		md5_hash(data, len, &h->md5);
+	if (verify_hashes & VERIFY_SHA256)
+		sha256_hash(data, len, &h->sha256);
+}
+
+static void *
+hasher_thread(void *arg)
+{
+	const char *mtd, *img;
+	size_t i, len;
+	int n = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&hasher.lock);
+		while (!hasher.slot[n].full && !hasher.done)
+			pthread_cond_wait(&hasher.cond, &hasher.lock);
+		if (!hasher.slot[n].full) {
+			pthread_mutex_unlock(&hasher.lock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&hasher.lock);
+
+		mtd = hasher.slot[n].mtd;
+		img = hasher.slot[n].data;
+		len = hasher.slot[n].len;
+
+		if (!hasher.differ && memcmp(mtd, img, len) != 0) {
+			for (i = 0; mtd[i] == img[i]; i++)
+				;
+
+			hasher.differ = true;
+			hasher.first_diff = hasher.pos + i;
+			hasher.img_hash = hasher.mtd_hash;
+		}
+
+		verify_hash_update(&hasher.mtd_hash, mtd, len);
+		if (hasher.differ)
+			verify_hash_update(&hasher.img_hash, img, len);
+		hasher.pos += len;
+
+		pthread_mutex_lock(&hasher.lock);
+		hasher.slot[n].full = 0;
+		pthread_cond_broadcast(&hasher.cond);
+		pthread_mutex_unlock(&hasher.lock);
+
+		n ^= 1;
+	}
+}
+
+static void
+verify_print(const char *name, const struct verify_hash *h)
+{
+	uint8_t md5[16], sha256[SHA256_DIGEST_LENGTH];
+	md5_ctx_t md5_ctx = h->md5;
+	sha256_ctx_t sha256_ctx = h->sha256;
+	int i;
+
+	if (verify_hashes & VERIFY_MD5) {
+		md5_end(md5, &md5_ctx);
+		for (i = 0; i < sizeof(md5); i++)
+			fprintf(stderr, "%02x", md5[i]);
+		fprintf(stderr, " - %s\n", name);
+	}
+
+	if (verify_hashes & VERIFY_SHA256) {
+		sha256_end(sha256, &sha256_ctx);
+		for (i = 0; i < sizeof(sha256); i++)
+			fprintf(stderr, "%02x", sha256[i]);
+		fprintf(stderr, " - %s\n", name);
+	}
+}
+
 static int
-mtd_verify(const char *mtd, char *file)
+mtd_verify(const char *mtd, char *file, size_t part_offset, size_t length)
 {
-	uint32_t f_md5[4], m_md5[4];
+	struct timespec start;
 	struct stat s;
-	md5_ctx_t ctx;
-	int ret = 0;
-	int fd;
+	const char *map = NULL;
+	uint64_t size = UINT64_MAX, done = 0;
+	off_t pos = part_offset;
+	size_t chunk, len;
+	ssize_t r;
+	int ret = 0, bad = 0, n = 0;
+	int fd, imgfd;
 
 	if (quiet < 2)
 		fprintf(stderr, "Verifying %s against %s ...\n", mtd, file);
 
-	if (stat(file, &s) || md5sum(file, f_md5) < 0) {
-		fprintf(stderr, "Failed to hash %s\n", file);
-		return -1;
+	if (!strcmp(file, "-")) {
+		imgfd = 0;
+	} else {
+		imgfd = open(file, O_RDONLY);
+		if (imgfd < 0 || fstat(imgfd, &s)) {
+			fprintf(stderr, "Failed to open %s\n", file);
+			return -1;
+		}
+
+		size = s.st_size;
+		if (size)
+			map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, imgfd, 0);
+		if (map == MAP_FAILED)
+			map = NULL;
+		if (map)
+			madvise((void *) map, size, MADV_SEQUENTIAL);
 	}
 
+	if (length)
+		size = MIN(size, length);
+
 	fd = mtd_check_open(mtd);
 	if(fd < 0) {
 		fprintf(stderr, "Could not open mtd device: %s\n", mtd);
 		return -1;
 	}
 
-	md5_begin(&ctx);
-	do {
-		char buf[256];
-		int len = (s.st_size > sizeof(buf)) ? (sizeof(buf)) : (s.st_size);
-		int rlen = read(fd, buf, len);
+	chunk = mtd_read_chunk();
+	for (n = 0; n < 2; n++) {
+		hasher.slot[n].mtd = malloc(chunk);
+		hasher.slot[n].img = map ? NULL : malloc(chunk);
+		if (!hasher.slot[n].mtd || (!map && !hasher.slot[n].img)) {
+			fprintf(stderr, "Out of memory\n");
+			exit(1);
+		}
+	}
 
-		if (rlen < 0) {
-			if (errno == EINTR)
-				continue;
-			ret = -1;
-			goto out;
+	md5_begin(&hasher.mtd_hash.md5);
+	sha256_begin(&hasher.mtd_hash.sha256);
+
+	if (pthread_create(&hasher.thread, NULL, hasher_thread, NULL)) {
+		fprintf(stderr, "Failed to start the hash thread\n");
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (n = 0; done < size; n ^= 1) {
+		pthread_mutex_lock(&hasher.lock);
+		while (hasher.slot[n].full)
+			pthread_cond_wait(&hasher.cond, &hasher.lock);
+		pthread_mutex_unlock(&hasher.lock);
+
+		len = MIN(chunk, size - done);
+		if (map) {
+			hasher.slot[n].data = map + done;
+		} else {
+			for (r = 0; (size_t)r < len; ) {
+				ssize_t rlen = read(imgfd, hasher.slot[n].img + r, len - r);
+
+				if (rlen < 0 && errno == EINTR)
+					continue;
+				if (rlen <= 0)
+					break;
+				r += rlen;
+			}
+			len = r;
+			hasher.slot[n].data = hasher.slot[n].img;
 		}
-		if (!rlen)
+		if (!len)
 			break;
-		md5_hash(buf, rlen, &ctx);
-		s.st_size -= rlen;
-	} while (s.st_size > 0);
 
-	md5_end(m_md5, &ctx);
+		r = mtd_read_good(fd, hasher.slot[n].mtd, len, &pos, &bad);
+		if (r < 0 || (size_t)r < len) {
+			fprintf(stderr, "Failed to read %s at 0x%08llx\n", mtd,
+				(unsigned long long) pos);
+			ret = -1;
+			break;
+		}
 
-	fprintf(stderr, "%08x%08x%08x%08x - %s\n", m_md5[0], m_md5[1], m_md5[2], m_md5[3], mtd);
-	fprintf(stderr, "%08x%08x%08x%08x - %s\n", f_md5[0], f_md5[1], f_md5[2], f_md5[3], file);
+		pthread_mutex_lock(&hasher.lock);
+		hasher.slot[n].len = len;
+		hasher.slot[n].full = 1;
+		pthread_cond_broadcast(&hasher.cond);
+		pthread_mutex_unlock(&hasher.lock);
 
-	ret = memcmp(f_md5, m_md5, sizeof(m_md5));
-	if (!ret)
-		fprintf(stderr, "Success\n");
-	else
-		fprintf(stderr, "Failed\n");
+		done += len;
+	}
 
-out:
+	pthread_mutex_lock(&hasher.lock);
+	hasher.done = 1;
+	pthread_cond_broadcast(&hasher.cond);
+	pthread_mutex_unlock(&hasher.lock);
+	pthread_join(hasher.thread, NULL);
+
+	if (!ret) {
+		verify_print(mtd, &hasher.mtd_hash);
+		verify_print(file, hasher.differ ? &hasher.img_hash : &hasher.mtd_hash);
+
+		if (hasher.differ) {
+			fprintf(stderr, "Failed, first difference at image offset 0x%08llx\n",
+				(unsigned long long) hasher.first_diff);
+			ret = 1;
+		} else {
+			fprintf(stderr, "Success\n");
+		}
+	}
+
+	if (timing) {
+		timing_report("verify", mtd, part_offset, done, bad, elapsed(&start));
+		if (hasher.differ)
+			fprintf(stderr, " first_diff=%llu",
+				(unsigned long long) hasher.first_diff);
+		fprintf(stderr, " result=%s\n", ret < 0 ? "error" : ret ? "fail" : "ok");
+	}
+
+	if (map)
+		munmap((void *) map, s.st_size);
+	if (imgfd > 0)
+		close(imgfd);
 	close(fd);
 	return ret;
 }
@@ -477,6 +1008,9 @@ mtd_write(int imagefd, const char *mtd, char *fis_layout, size_t part_offset)
 	int buflen_raw = 0;
 	int jffs2_replaced = 0;
 	int skip_bad_blocks = 0;
+	int unchanged, diff_skipped = 0, diff_written = 0;
+	double diff_time = 0;
+	struct timespec start;
 
 #ifdef FIS_SUPPORT
 	static struct fis_part new_parts[MAX_ARGS];
@@ -577,7 +1111,7 @@ resume:
 	for (;;) {
 		/* buffer may contain data already (from trx check or last mtd partition write attempt) */
 		while (buflen < erasesize) {
-			r = read(imagefd, buf + buflen, erasesize - buflen);
+			r = image_read(imagefd, buf + buflen, erasesize - buflen);
 			if (r < 0) {
 				if ((errno == EINTR) || (errno == EAGAIN))
 					continue;
@@ -623,6 +1157,8 @@ resume:
 					fprintf(stderr, "\nAppending jffs2 data from %s to %s..\n.", jffs2file, mtd);
 				/* got an EOF marker - this is the place to add some jffs2 data */
 				skip = mtd_replace_jffs2(mtd, fd, e, jffs2file);
+				if (skip < 0)
+					exit(1);
 				jffs2_replaced = 1;
 
 				/* don't add it again */
@@ -641,6 +1177,10 @@ resume:
 			mtd_parse_jffs2data(buf, jffs2dir);
 		}
 
+		unchanged = 0;
+		if (diff_write)
+			clock_gettime(CLOCK_MONOTONIC, &start);
+
 		/* need to erase the next block before writing data to it */
 		if(!no_erase)
 		{
@@ -660,6 +1200,14 @@ resume:
 					continue;
 				}
 
+				/* leave the block alone if it already holds this data */
+				if (diff_write && !offset && w == e - skip_bad_blocks &&
+				    mtd_block_unchanged(fd, buf, buflen)) {
+					unchanged = 1;
+					e += erasesize;
+					break;
+				}
+
 				if (mtd_erase_block(fd, e + part_offset) < 0) {
 					if (next) {
 						if (w < e) {
@@ -668,6 +1216,7 @@ resume:
 						}
 						w = 0;
 						e = 0;
+						verify_wait();
 						close(fd);
 						mtd = next;
 						fprintf(stderr, "\b\b\b   \n");
@@ -683,16 +1232,37 @@ resume:
 			}
 		}
 
-		if (!quiet)
-			fprintf(stderr, "\b\b\b[w]");
+		else if (diff_write && !offset)
+			unchanged = mtd_block_unchanged(fd, buf, buflen);
 
-		if ((result = write(fd, buf + offset, buflen)) < buflen) {
-			if (result < 0) {
-				fprintf(stderr, "Error writing image.\n");
-				exit(1);
-			} else {
-				fprintf(stderr, "Insufficient space.\n");
-				exit(1);
+		if (unchanged) {
+			if (!quiet)
+				fprintf(stderr, "\b\b\b[s]");
+
+			lseek(fd, buflen, SEEK_CUR);
+			diff_skipped++;
+		} else {
+			off_t pos = lseek(fd, 0, SEEK_CUR);
+
+			if (!quiet)
+				fprintf(stderr, "\b\b\b[w]");
+
+			if ((result = write(fd, buf + offset, buflen)) < buflen) {
+				if (result < 0) {
+					fprintf(stderr, "Error writing image.\n");
+					exit(1);
+				} else {
+					fprintf(stderr, "Insufficient space.\n");
+					exit(1);
+				}
+			}
+
+			if (verify_write)
+				verify_queue(fd, pos, buf + offset, buflen);
+
+			if (diff_write) {
+				diff_time += elapsed(&start);
+				diff_written++;
 			}
 		}
 		w += buflen;
@@ -712,6 +1282,8 @@ resume:
 		offset = 0;
 	}
 
+	verify_wait();
+
 	if (jffs2_replaced) {
 		switch (imageformat) {
 		case MTD_IMAGE_FORMAT_TRX:
@@ -741,6 +1313,16 @@ resume:
 	if (quiet < 2)
 		fprintf(stderr, "\n");
 
+	if (diff_write && quiet < 2) {
+		fprintf(stderr, "Skipped %d of %d unchanged blocks",
+			diff_skipped, diff_skipped + diff_written);
+		/* estimated from the blocks that had to be rewritten */
+		if (diff_written)
+			fprintf(stderr, ", saved about %.1fs",
+				diff_skipped * diff_time / diff_written);
+		fprintf(stderr, "\n");
+	}
+
 #ifdef FIS_SUPPORT
 	if (fis_layout) {
 		if (fis_remap(old_parts, n_old, new_parts, n_new) < 0)
@@ -774,7 +1356,13 @@ static void usage(void)
 	"        erase                   erase all data on device\n"
 	"        verify <imagefile>|-    verify <imagefile> (use - for stdin) to device\n"
 	"        write <imagefile>|-     write <imagefile> (use - for stdin) to device\n"
-	"        jffs2write <file>       append <file> to the jffs2 partition on the device\n");
+	"        jffs2write <file>       append <file> to the jffs2 partition on the device\n"
+	"        dump                    write the device to stdout\n"
+	"        backup                  write the devices to stdout, read in parallel,\n"
+	"                                skipping bad and erased blocks (pipe into xz/zstd)\n"
+	"        restore <file>|- [<device>]\n"
+	"                                write a backup back to the devices it was taken\n"
+	"                                from, or to the given ones\n");
 	if (mtd_resetbc) {
 	    fprintf(stderr,
 	"        resetbc <device>        reset the uboot boot counter\n");
@@ -800,14 +1388,20 @@ static void usage(void)
 	"        -q                      quiet mode (once: no [w] on writing,\n"
 	"                                           twice: no status messages)\n"
 	"        -n                      write without first erasing the blocks\n"
+	"        -D                      differential write: skip blocks that\n"
+	"                                already hold the data being written\n"
+	"        -v                      read back and compare each block after writing it\n"
+	"        -H <hash>[,<hash>]      hashes for verify: md5 (default), sha256\n"
+	"        -T                      print a machine readable timing report for verify, dump\n"
+	"                                and the jffs2 data of -j and jffs2write\n"
 	"        -r                      reboot after successful command\n"
 	"        -f                      force write without trx checks\n"
 	"        -e <device>             erase <device> before executing the command\n"
 	"        -d <name>               directory for jffs2write, defaults to \"tmp\"\n"
 	"        -j <name>               integrate <file> into jffs2 data when writing an image\n"
 	"        -s <number>             skip the first n bytes when appending data to the jffs2 partiton, defaults to \"0\"\n"
-	"        -p <number>             write beginning at partition offset\n"
-	"        -l <length>             the length of data that we want to dump\n");
+	"        -p <number>             write or verify beginning at partition offset\n"
+	"        -l <length>             the length of data that we want to dump or verify\n");
 	if (mtd_fixtrx) {
 	    fprintf(stderr,
 	"        -o offset               offset of the image header in the partition(for fixtrx)\n");
@@ -848,7 +1442,7 @@ static void do_reboot(void)
 
 int main (int argc, char **argv)
 {
-	int ch, i, boot, imagefd = 0, force, unlocked;
+	int ch, i, boot, imagefd = 0, force, unlocked, ret = 0;
 	char *erase[MAX_ARGS], *device = NULL;
 	char *fis_layout = NULL;
 	size_t offset = 0, data_size = 0, part_offset = 0, dump_len = 0;
@@ -863,6 +1457,8 @@ int main (int argc, char **argv)
 		CMD_FIXWRGG,
 		CMD_VERIFY,
 		CMD_DUMP,
+		CMD_BACKUP,
+		CMD_RESTORE,
 		CMD_RESETBC,
 	} cmd = -1;
 
@@ -872,12 +1468,15 @@ int main (int argc, char **argv)
 	buflen = 0;
 	quiet = 0;
 	no_erase = 0;
+	diff_write = 0;
+	verify_write = 0;
+	timing = 0;
 
 	while ((ch = getopt(argc, argv,
 #ifdef FIS_SUPPORT
 			"F:"
 #endif
-			"frnqe:d:s:j:p:o:c:t:l:")) != -1)
+			"frnDvTH:qe:d:s:j:p:o:c:t:l:")) != -1)
 		switch (ch) {
 			case 'f':
 				force = 1;
@@ -888,6 +1487,32 @@ int main (int argc, char **argv)
 			case 'n':
 				no_erase = 1;
 				break;
+			case 'D':
+				diff_write = 1;
+				break;
+			case 'v':
+				verify_write = 1;
+				break;
+			case 'T':
+				timing = 1;
+				break;
+			case 'H': {
+				char *word, *brkt;
+
+				verify_hashes = 0;
+				for (word = strtok_r(optarg, ",", &brkt); word;
+				     word = strtok_r(NULL, ",", &brkt)) {
+					if (!strcmp(word, "md5"))
+						verify_hashes |= VERIFY_MD5;
+					else if (!strcmp(word, "sha256"))
+						verify_hashes |= VERIFY_SHA256;
+					else
+						usage();
+				}
+				if (!verify_hashes)
+					usage();
+				break;
+			}
 			case 'j':
 				jffs2file = optarg;
 				break;
@@ -991,6 +1616,19 @@ int main (int argc, char **argv)
 	} else if ((strcmp(argv[0], "dump") == 0) && (argc == 2)) {
 		cmd = CMD_DUMP;
 		device = argv[1];
+	} else if ((strcmp(argv[0], "backup") == 0) && (argc == 2)) {
+		cmd = CMD_BACKUP;
+		device = argv[1];
+	} else if ((strcmp(argv[0], "restore") == 0) && (argc == 2 || argc == 3)) {
+		cmd = CMD_RESTORE;
+		device = argc == 3 ? argv[2] : NULL;
+
+		if (strcmp(argv[1], "-") == 0) {
+			imagefd = 0;
+		} else if ((imagefd = open(argv[1], O_RDONLY)) < 0) {
+			fprintf(stderr, "Couldn't open backup file: %s!\n", argv[1]);
+			exit(1);
+		}
 	} else if ((strcmp(argv[0], "write") == 0) && (argc == 3)) {
 		cmd = CMD_WRITE;
 		device = argv[2];
@@ -1035,7 +1673,7 @@ int main (int argc, char **argv)
 	while (erase[i] != NULL) {
 		mtd_unlock(erase[i]);
 		mtd_erase(erase[i]);
-		if (strcmp(erase[i], device) == 0)
+		if (device && strcmp(erase[i], device) == 0)
 			unlocked = 1;
 		i++;
 	}
@@ -1046,10 +1684,20 @@ int main (int argc, char **argv)
 				mtd_unlock(device);
 			break;
 		case CMD_VERIFY:
-			mtd_verify(device, imagefile);
+			if (mtd_verify(device, imagefile, part_offset, dump_len))
+				ret = 1;
 			break;
 		case CMD_DUMP:
-			mtd_dump(device, offset, dump_len);
+			if (mtd_dump(device, offset, dump_len))
+				ret = 1;
+			break;
+		case CMD_BACKUP:
+			if (mtd_backup(device))
+				ret = 1;
+			break;
+		case CMD_RESTORE:
+			if (mtd_restore(imagefd, device))
+				ret = 1;
 			break;
 		case CMD_ERASE:
 			if (!unlocked)
@@ -1095,5 +1743,5 @@ int main (int argc, char **argv)
 	if (boot)
 		do_reboot();
 
-	return 0;
+	return ret;
 }
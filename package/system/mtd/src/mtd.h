@@ -2,6 +2,9 @@
 #define __mtd_h
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
 
 #if defined(target_bcm47xx) || defined(target_bcm53xx)
 #define target_brcm 1
@@ -12,15 +15,21 @@
 extern int quiet;
 extern int mtdsize;
 extern int erasesize;
+extern int timing;
 
 extern int mtd_open(const char *mtd, bool block);
 extern int mtd_check_open(const char *mtd);
 extern int mtd_block_is_bad(int fd, int offset);
 extern int mtd_erase_block(int fd, int offset);
+extern double elapsed(const struct timespec *start);
+extern void timing_report(const char *cmd, const char *mtd, off_t offset, uint64_t len,
+			  int bad, double secs);
 extern int mtd_write_buffer(int fd, const char *buf, int offset, int length);
 extern int mtd_write_jffs2(const char *mtd, const char *filename, const char *dir);
 extern int mtd_replace_jffs2(const char *mtd, int fd, int ofs, const char *filename);
 extern void mtd_parse_jffs2data(const char *buf, const char *dir);
+extern int mtd_backup(char *devices);
+extern int mtd_restore(int fd, char *devices);
 
 /* target specific functions */
 extern int trx_fixup(int fd, const char *name)  __attribute__ ((weak));
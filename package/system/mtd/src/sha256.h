@@ -0,0 +1,20 @@
+#ifndef __SHA256_H
+#define __SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BLOCK_LENGTH		64
+#define SHA256_DIGEST_LENGTH		32
+
+typedef struct {
+	uint32_t state[8];
+	uint64_t count;
+	uint8_t buf[SHA256_BLOCK_LENGTH];
+} sha256_ctx_t;
+
+void sha256_begin(sha256_ctx_t *ctx);
+void sha256_hash(const void *data, size_t len, sha256_ctx_t *ctx);
+void sha256_end(void *resbuf, sha256_ctx_t *ctx);
+
+#endif /* __SHA256_H */
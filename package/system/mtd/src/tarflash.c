@@ -0,0 +1,432 @@
+/*
+ * tarflash - write members of a sysupgrade tar to flash in a single pass
+ *
+ * The tar is mapped and its headers are parsed once. Members are then
+ * streamed straight from the mapping to a UBI volume, a block device or
+ * stdout, without running tar, ubiupdatevol or dd.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License v2
+ * as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <mtd/ubi-user.h>
+
+#define TAR_BLOCK	512
+
+/* Writes are issued in chunks of this size, at aligned device offsets */
+#define WRITE_CHUNK	(1024 * 1024)
+
+struct tar_header {
+	char name[100];
+	char mode[8];
+	char uid[8];
+	char gid[8];
+	char size[12];
+	char mtime[12];
+	char chksum[8];
+	char typeflag;
+	char linkname[100];
+	char magic[6];
+	char version[2];
+	char uname[32];
+	char gname[32];
+	char devmajor[8];
+	char devminor[8];
+	char prefix[155];
+	char pad[12];
+};
+
+struct tar_member {
+	char name[PATH_MAX];
+	char type;
+	const uint8_t *data;
+	uint64_t size;
+};
+
+struct tar {
+	const uint8_t *map;
+	uint64_t size;
+	uint64_t pos;
+};
+
+static uint64_t
+tar_number(const char *field, int len)
+{
+	uint64_t val = 0;
+	int i;
+
+	/* GNU base-256 encoding for large values */
+	if (*field & 0x80) {
+		val = *field & 0x3f;
+		for (i = 1; i < len; i++)
+			val = (val << 8) | (uint8_t) field[i];
+		return val;
+	}
+
+	for (i = 0; i < len && field[i] == ' '; i++)
+		;
+	for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+		val = (val << 3) | (field[i] - '0');
+
+	return val;
+}
+
+static bool
+tar_header_valid(const struct tar_header *hdr)
+{
+	const uint8_t *p = (const uint8_t *) hdr;
+	uint64_t sum = 0;
+	int i;
+
+	for (i = 0; i < TAR_BLOCK; i++) {
+		if (i >= offsetof(struct tar_header, chksum) &&
+		    i < offsetof(struct tar_header, typeflag))
+			sum += ' ';
+		else
+			sum += p[i];
+	}
+
+	return sum == tar_number(hdr->chksum, sizeof(hdr->chksum));
+}
+
+static bool
+tar_block_empty(const uint8_t *p)
+{
+	int i;
+
+	for (i = 0; i < TAR_BLOCK; i++)
+		if (p[i])
+			return false;
+
+	return true;
+}
+
+/* Returns 1 and fills m for the next member, 0 at the end, -1 on errors */
+static int
+tar_next(struct tar *tar, struct tar_member *m)
+{
+	const struct tar_header *hdr;
+	bool longname = false;
+	uint64_t size;
+
+	for (;;) {
+		if (tar->pos + TAR_BLOCK > tar->size)
+			return 0;
+
+		hdr = (const struct tar_header *) (tar->map + tar->pos);
+		if (tar_block_empty((const uint8_t *) hdr))
+			return 0;
+
+		if (!tar_header_valid(hdr)) {
+			fprintf(stderr, "Bad tar header at offset %llu\n",
+				(unsigned long long) tar->pos);
+			return -1;
+		}
+
+		size = tar_number(hdr->size, sizeof(hdr->size));
+		tar->pos += TAR_BLOCK;
+		if (size > tar->size - tar->pos) {
+			fprintf(stderr, "Truncated tar file\n");
+			return -1;
+		}
+
+		m->type = hdr->typeflag;
+		m->data = tar->map + tar->pos;
+		m->size = size;
+		tar->pos += (size + TAR_BLOCK - 1) & ~(uint64_t) (TAR_BLOCK - 1);
+
+		switch (m->type) {
+		case 'L':
+			/* GNU long name, applies to the next header */
+			if (size >= sizeof(m->name))
+				return -1;
+			memcpy(m->name, m->data, size);
+			m->name[size] = 0;
+			longname = true;
+			continue;
+		case 'x':
+		case 'g':
+			/* pax extended headers are not needed here */
+			continue;
+		}
+
+		if (!longname) {
+			if (hdr->prefix[0] && !memcmp(hdr->magic, "ustar", 5))
+				snprintf(m->name, sizeof(m->name), "%.*s/%.*s",
+					 (int) sizeof(hdr->prefix), hdr->prefix,
+					 (int) sizeof(hdr->name), hdr->name);
+			else
+				snprintf(m->name, sizeof(m->name), "%.*s",
+					 (int) sizeof(hdr->name), hdr->name);
+		}
+
+		return 1;
+	}
+}
+
+static int
+tar_open(struct tar *tar, const char *file)
+{
+	struct stat s;
+	int fd;
+
+	fd = open(file, O_RDONLY);
+	if (fd < 0 || fstat(fd, &s)) {
+		fprintf(stderr, "Failed to open %s: %s\n", file, strerror(errno));
+		return -1;
+	}
+
+	tar->size = s.st_size;
+	tar->pos = 0;
+	tar->map = tar->size ? mmap(NULL, tar->size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+	close(fd);
+
+	if (!tar->map || tar->map == MAP_FAILED) {
+		fprintf(stderr, "Failed to map %s\n", file);
+		return -1;
+	}
+
+	madvise((void *) tar->map, tar->size, MADV_SEQUENTIAL);
+
+	return 0;
+}
+
+static bool
+tar_regular(const struct tar_member *m)
+{
+	return m->type == '0' || m->type == '\0';
+}
+
+static int
+tar_find(struct tar *tar, const char *name, struct tar_member *m)
+{
+	int ret;
+
+	tar->pos = 0;
+	while ((ret = tar_next(tar, m)) > 0) {
+		if (tar_regular(m) && !strcmp(m->name, name))
+			return 0;
+	}
+
+	if (!ret)
+		fprintf(stderr, "%s not found in the tar file\n", name);
+
+	return -1;
+}
+
+/* The output of info is eval'ed by the upgrade scripts */
+static bool
+safe_name(const char *name)
+{
+	for (; *name; name++) {
+		if (!strchr("abcdefghijklmnopqrstuvwxyz"
+			    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+			    "0123456789._,+-", *name))
+			return false;
+	}
+
+	return true;
+}
+
+static int
+cmd_info(struct tar *tar)
+{
+	char board_dir[PATH_MAX] = "";
+	struct tar_member m;
+	const char *sub;
+	size_t len;
+	int i, ret;
+
+	while ((ret = tar_next(tar, &m)) > 0) {
+		if (!board_dir[0]) {
+			if (strncmp(m.name, "sysupgrade-", 11) != 0)
+				continue;
+
+			len = strcspn(m.name, "/");
+			if (!m.name[len])
+				continue;
+
+			memcpy(board_dir, m.name, len);
+			board_dir[len] = 0;
+			if (!safe_name(board_dir)) {
+				fprintf(stderr, "Invalid board directory in the tar file\n");
+				return 1;
+			}
+
+			printf("board_dir=%s\n", board_dir);
+		}
+
+		len = strlen(board_dir);
+		if (strncmp(m.name, board_dir, len) != 0 || m.name[len] != '/' ||
+		    !tar_regular(&m))
+			continue;
+
+		sub = m.name + len + 1;
+		if (!strcmp(sub, "kernel")) {
+			printf("kernel_length=%llu\n", (unsigned long long) m.size);
+		} else if (!strcmp(sub, "root")) {
+			printf("rootfs_length=%llu\n", (unsigned long long) m.size);
+			printf("rootfs_magic=");
+			for (i = 0; i < MIN(m.size, 4); i++)
+				printf("%02x", m.data[i]);
+			printf("\n");
+		}
+	}
+
+	if (ret < 0)
+		return 1;
+
+	if (!board_dir[0]) {
+		fprintf(stderr, "No sysupgrade directory in the tar file\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+write_all(int fd, const uint8_t *data, size_t len)
+{
+	ssize_t r;
+
+	while (len) {
+		r = write(fd, data, len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		data += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+static int
+write_member(int fd, const struct tar_member *m)
+{
+	uint64_t done;
+	size_t len;
+
+	for (done = 0; done < m->size; done += len) {
+		len = MIN(WRITE_CHUNK, m->size - done);
+		if (write_all(fd, m->data + done, len))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+cmd_cat(struct tar *tar, const char *name)
+{
+	struct tar_member m;
+
+	if (tar_find(tar, name, &m))
+		return 1;
+
+	if (write_member(1, &m)) {
+		fprintf(stderr, "Write failed: %s\n", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+cmd_write(struct tar *tar, const char *name, const char *dev)
+{
+	struct tar_member m;
+	struct stat s;
+	int64_t bytes;
+	int fd, ret = 1;
+
+	if (tar_find(tar, name, &m))
+		return 1;
+
+	fd = open(dev, O_WRONLY);
+	if (fd < 0 || fstat(fd, &s)) {
+		fprintf(stderr, "Failed to open %s: %s\n", dev, strerror(errno));
+		return 1;
+	}
+
+	if (S_ISCHR(s.st_mode)) {
+		/* the volume takes exactly this many bytes, as ubiupdatevol -s */
+		bytes = m.size;
+		if (ioctl(fd, UBI_IOCVOLUP, &bytes)) {
+			fprintf(stderr, "%s is not a UBI volume: %s\n", dev, strerror(errno));
+			goto out;
+		}
+	} else if (!S_ISBLK(s.st_mode) && !S_ISREG(s.st_mode)) {
+		fprintf(stderr, "Cannot write to %s\n", dev);
+		goto out;
+	}
+
+	if (write_member(fd, &m) || fsync(fd)) {
+		fprintf(stderr, "Failed to write %s: %s\n", dev, strerror(errno));
+		goto out;
+	}
+
+	/* 512 byte blocks written, counting a partial one as dd does */
+	printf("%llu\n", (unsigned long long) (m.size + 511) / 512);
+	ret = 0;
+
+out:
+	close(fd);
+	return ret;
+}
+
+static int
+usage(void)
+{
+	fprintf(stderr, "Usage: tarflash <command> <tarfile> [<arguments>]\n\n"
+		"Commands:\n"
+		"        info <tarfile>                  print board_dir and the kernel/root\n"
+		"                                        member sizes as shell variables\n"
+		"        cat <tarfile> <member>          write <member> to stdout\n"
+		"        write <tarfile> <member> <dev>  write <member> to a UBI volume or a block\n"
+		"                                        device, print the 512 byte blocks written\n");
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	struct tar tar;
+
+	if (argc < 3)
+		return usage();
+
+	if (tar_open(&tar, argv[2]))
+		return 1;
+
+	if (!strcmp(argv[1], "info") && argc == 3)
+		return cmd_info(&tar);
+	if (!strcmp(argv[1], "cat") && argc == 4)
+		return cmd_cat(&tar, argv[3]);
+	if (!strcmp(argv[1], "write") && argc == 5)
+		return cmd_write(&tar, argv[3], argv[4]);
+
+	return usage();
+}
@@ -19,6 +19,7 @@ endif
 
 export TMP_DIR:=$(TOPDIR)/tmp
 export TMPDIR:=$(TMP_DIR)
+export MKHASH_CACHE:=$(TMP_DIR)/.mkhash-cache
 
 qstrip=$(strip $(subst ",,$(1)))
 #"))
@@ -18,23 +18,21 @@ rm -f "$OUTPUT"
 head=16
 sect=63
 
-# create partition table
-set $(ptgen -o "$OUTPUT" -h $head -s $sect ${GUID:+-g} -p "${KERNELSIZE}m" -p "${ROOTFSSIZE}m" ${ALIGN:+-l $ALIGN} ${SIGNATURE:+-S 0x$SIGNATURE} ${GUID:+-G $GUID})
+ptgen_opts="-h $head -s $sect ${GUID:+-g} ${ALIGN:+-l $ALIGN} ${SIGNATURE:+-S 0x$SIGNATURE} ${GUID:+-G $GUID}"
 
-KERNELOFFSET="$(($1 / 512))"
-KERNELSIZE="$2"
-ROOTFSOFFSET="$(($3 / 512))"
-ROOTFSSIZE="$(($4 / 512))"
+# get the partition layout
+set $(ptgen -o "$OUTPUT" $ptgen_opts -p "${KERNELSIZE}m" -p "${ROOTFSSIZE}m")
 
-[ -n "$PADDING" ] && dd if=/dev/zero of="$OUTPUT" bs=512 seek="$ROOTFSOFFSET" conv=notrunc count="$ROOTFSSIZE"
-dd if="$ROOTFSIMAGE" of="$OUTPUT" bs=512 seek="$ROOTFSOFFSET" conv=notrunc
+KERNELPARTSIZE="$2"
 
 if [ -n "$GUID" ]; then
-    [ -n "$PADDING" ] && dd if=/dev/zero of="$OUTPUT" bs=512 seek="$((ROOTFSOFFSET + ROOTFSSIZE))" conv=notrunc count="$sect"
-    mkfs.fat -n kernel -C "$OUTPUT.kernel" -S 512 "$((KERNELSIZE / 1024))"
+    mkfs.fat -n kernel -C "$OUTPUT.kernel" -S 512 "$((KERNELPARTSIZE / 1024))"
     mcopy -s -i "$OUTPUT.kernel" "$KERNELDIR"/* ::/
 else
-    make_ext4fs -J -L kernel -l "$KERNELSIZE" "$OUTPUT.kernel" "$KERNELDIR"
+    make_ext4fs -J -L kernel -l "$KERNELPARTSIZE" "$OUTPUT.kernel" "$KERNELDIR"
 fi
-dd if="$OUTPUT.kernel" of="$OUTPUT" bs=512 seek="$KERNELOFFSET" conv=notrunc
+
+# write the partition table and the partition images in a single pass,
+# with PADDING the output covers the whole disk, the unused space stays sparse
+ptgen -o "$OUTPUT" $ptgen_opts ${PADDING:+-P} -i "$OUTPUT.kernel" -p "${KERNELSIZE}m" -i "$ROOTFSIMAGE" -p "${ROOTFSSIZE}m" > /dev/null
 rm -f "$OUTPUT.kernel"
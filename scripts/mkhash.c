@@ -85,13 +85,31 @@
 #include <sys/endian.h>
 #endif
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 5)
+#define SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#ifdef __APPLE__
+#define st_mtim st_mtimespec
+#define st_ctim st_ctimespec
+#endif
+
 #define ARRAY_SIZE(_n) (sizeof(_n) / sizeof((_n)[0]))
 
 #ifndef __FreeBSD__
@@ -562,6 +580,119 @@ SHA256_Transform(uint32_t * state, const unsigned char block[64])
 		state[i] += S[i];
 }
 
+#ifdef SHA256_X86
+/*
+ * SHA256 block function using the x86 SHA extensions.  The state is kept
+ * as ABEF/CDGH, which is the layout sha256rnds2 works on.
+ */
+__attribute__((target("sha,sse4.1")))
+static void
+SHA256_Transform_x86(uint32_t *state, const unsigned char *data, size_t blocks)
+{
+	static const uint32_t K[64] __attribute__((aligned(16))) = {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+		0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+		0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+		0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+		0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+		0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+		0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+		0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+		0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+	};
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+					    0x0405060700010203ULL);
+	__m128i state0, state1, abef, cdgh, msg, tmp, w[4];
+	int i;
+
+	tmp = _mm_loadu_si128((const __m128i *) &state[0]);
+	state1 = _mm_loadu_si128((const __m128i *) &state[4]);
+
+	tmp = _mm_shuffle_epi32(tmp, 0xb1);		/* CDAB */
+	state1 = _mm_shuffle_epi32(state1, 0x1b);	/* EFGH */
+	state0 = _mm_alignr_epi8(tmp, state1, 8);	/* ABEF */
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);	/* CDGH */
+
+	while (blocks--) {
+		abef = state0;
+		cdgh = state1;
+
+		for (i = 0; i < 16; i++) {
+			if (i < 4) {
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128(
+					(const __m128i *) (data + i * 16)), mask);
+			} else {
+				/* W[t-16] + s0(W[t-15]) + W[t-7], then s1(W[t-2]) */
+				tmp = _mm_sha256msg1_epu32(w[i % 4], w[(i + 1) % 4]);
+				tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(w[(i + 3) % 4],
+									 w[(i + 2) % 4], 4));
+				w[i % 4] = _mm_sha256msg2_epu32(tmp, w[(i + 3) % 4]);
+			}
+
+			msg = _mm_add_epi32(w[i % 4],
+					    _mm_load_si128((const __m128i *) &K[i * 4]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			msg = _mm_shuffle_epi32(msg, 0x0e);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+		}
+
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+		data += 64;
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);		/* FEBA */
+	state1 = _mm_shuffle_epi32(state1, 0xb1);	/* DCHG */
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);	/* DCBA */
+	state1 = _mm_alignr_epi8(state1, tmp, 8);	/* HGFE */
+
+	_mm_storeu_si128((__m128i *) &state[0], state0);
+	_mm_storeu_si128((__m128i *) &state[4], state1);
+}
+
+static bool
+sha256_x86_supported(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+
+	__cpuid(1, eax, ebx, ecx, edx);
+	if (!(ecx & bit_SSE4_1))
+		return false;
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	return ebx & (1 << 29);
+}
+#endif
+
+static bool sha256_use_x86;
+
+/* Process a number of complete 64 byte blocks */
+static void
+SHA256_Blocks(uint32_t *state, const unsigned char *data, size_t blocks)
+{
+#ifdef SHA256_X86
+	if (sha256_use_x86) {
+		SHA256_Transform_x86(state, data, blocks);
+		return;
+	}
+#endif
+
+	while (blocks--) {
+		SHA256_Transform(state, data);
+		data += 64;
+	}
+}
+
 static unsigned char PAD[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -647,11 +778,9 @@ SHA256_Update(SHA256_CTX * ctx, const void *in, size_t len)
 	len -= 64 - r;
 
 	/* Perform complete blocks */
-	while (len >= 64) {
-		SHA256_Transform(ctx->state, src);
-		src += 64;
-		len -= 64;
-	}
+	SHA256_Blocks(ctx->state, src, len / 64);
+	src += len & ~(size_t) 63;
+	len &= 63;
 
 	/* Copy left over data into buffer */
 	memcpy(ctx->buf, src, len);
@@ -674,90 +803,60 @@ SHA256_Final(unsigned char digest[static SHA256_DIGEST_LENGTH], SHA256_CTX *ctx)
 	memset(ctx, 0, sizeof(*ctx));
 }
 
-static void *hash_buf(FILE *f, int *len)
-{
-	static char buf[1024];
+/* Read size for files that cannot be mapped */
+#define HASH_READ_SIZE	(64 * 1024)
 
-	*len = fread(buf, 1, sizeof(buf), f);
+#define HASH_STR_LEN	(SHA256_DIGEST_LENGTH * 2 + 1)
 
-	return *len > 0 ? buf : NULL;
-}
+union hash_ctx {
+	MD5_CTX md5;
+	SHA256_CTX sha256;
+};
 
-static char *hash_string(unsigned char *buf, int len)
+static void md5_init(union hash_ctx *ctx)
 {
-	static char str[SHA256_DIGEST_LENGTH * 2 + 1];
-	int i;
-
-	if (len * 2 + 1 > sizeof(str))
-		return NULL;
-
-	for (i = 0; i < len; i++)
-		sprintf(&str[i * 2], "%02x", buf[i]);
-
-	return str;
+	MD5_begin(&ctx->md5);
 }
 
-static const char *md5_hash(FILE *f)
+static void md5_update(union hash_ctx *ctx, const void *data, size_t len)
 {
-	MD5_CTX ctx;
-	unsigned char val[MD5_DIGEST_LENGTH];
-	void *buf;
-	int len;
-
-	MD5_begin(&ctx);
-	while ((buf = hash_buf(f, &len)) != NULL)
-		MD5_hash(buf, len, &ctx);
-	MD5_end(val, &ctx);
+	MD5_hash(data, len, &ctx->md5);
+}
 
-	return hash_string(val, MD5_DIGEST_LENGTH);
+static void md5_final(unsigned char *val, union hash_ctx *ctx)
+{
+	MD5_end(val, &ctx->md5);
 }
 
-static const char *sha256_hash(FILE *f)
+static void sha256_init(union hash_ctx *ctx)
 {
-	SHA256_CTX ctx;
-	unsigned char val[SHA256_DIGEST_LENGTH];
-	void *buf;
-	int len;
+	SHA256_Init(&ctx->sha256);
+}
 
-	SHA256_Init(&ctx);
-	while ((buf = hash_buf(f, &len)) != NULL)
-		SHA256_Update(&ctx, buf, len);
-	SHA256_Final(val, &ctx);
+static void sha256_update(union hash_ctx *ctx, const void *data, size_t len)
+{
+	SHA256_Update(&ctx->sha256, data, len);
+}
 
-	return hash_string(val, SHA256_DIGEST_LENGTH);
+static void sha256_final(unsigned char *val, union hash_ctx *ctx)
+{
+	SHA256_Final(val, &ctx->sha256);
 }
 
 
 struct hash_type {
 	const char *name;
-	const char *(*func)(FILE *f);
+	void (*init)(union hash_ctx *ctx);
+	void (*update)(union hash_ctx *ctx, const void *data, size_t len);
+	void (*final)(unsigned char *val, union hash_ctx *ctx);
 	int len;
 };
 
 struct hash_type types[] = {
-	{ "md5", md5_hash, MD5_DIGEST_LENGTH },
-	{ "sha256", sha256_hash, SHA256_DIGEST_LENGTH },
+	{ "md5", md5_init, md5_update, md5_final, MD5_DIGEST_LENGTH },
+	{ "sha256", sha256_init, sha256_update, sha256_final, SHA256_DIGEST_LENGTH },
 };
 
-
-static int usage(const char *progname)
-{
-	int i;
-
-	fprintf(stderr, "Usage: %s <hash type> [options] [<file>...]\n"
-		"Options:\n"
-		"	-n		Print filename(s)\n"
-		"	-N		Suppress trailing newline\n"
-		"\n"
-		"Supported hash types:", progname);
-
-	for (i = 0; i < ARRAY_SIZE(types); i++)
-		fprintf(stderr, "%s %s", i ? "," : "", types[i].name);
-
-	fprintf(stderr, "\n");
-	return 1;
-}
-
 static struct hash_type *get_hash_type(const char *name)
 {
 	int i;
@@ -771,54 +870,420 @@ static struct hash_type *get_hash_type(const char *name)
 	return NULL;
 }
 
+static void hash_string(char *str, const unsigned char *buf, int len)
+{
+	static const char hex[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < len; i++) {
+		str[i * 2] = hex[buf[i] >> 4];
+		str[i * 2 + 1] = hex[buf[i] & 0xf];
+	}
+	str[len * 2] = 0;
+}
 
-static int hash_file(struct hash_type *t, const char *filename, bool add_filename,
-	bool no_newline)
+/* Regular files are mapped, anything else is read in large chunks */
+static int hash_fd(struct hash_type *t, int fd, const struct stat *st, char *str)
 {
-	const char *str;
+	unsigned char val[SHA256_DIGEST_LENGTH];
+	union hash_ctx ctx;
+	void *map = MAP_FAILED;
+	char *buf;
+	ssize_t len;
 
-	if (!filename || !strcmp(filename, "-")) {
-		str = t->func(stdin);
+	t->init(&ctx);
+
+	if (S_ISREG(st->st_mode) && st->st_size > 0)
+		map = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (map != MAP_FAILED) {
+		madvise(map, st->st_size, MADV_SEQUENTIAL);
+		t->update(&ctx, map, st->st_size);
+		munmap(map, st->st_size);
 	} else {
-		struct stat path_stat;
-		stat(filename, &path_stat);
-		if (S_ISDIR(path_stat.st_mode)) {
-			fprintf(stderr, "Failed to open '%s': Is a directory\n", filename);
-			return 1;
+		buf = malloc(HASH_READ_SIZE);
+		if (!buf)
+			return -1;
+
+		while ((len = read(fd, buf, HASH_READ_SIZE)) != 0) {
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+				free(buf);
+				return -1;
+			}
+			t->update(&ctx, buf, len);
 		}
+		free(buf);
+	}
+
+	t->final(val, &ctx);
+	hash_string(str, val, t->len);
+
+	return 0;
+}
+
 
-		FILE *f = fopen(filename, "r");
+/*
+ * Digest cache, one entry per line:
+ *
+ *   <type> <dev> <ino> <size> <mtime> <ctime> <digest> <path>
+ *
+ * An entry is only used if the file still has the same inode, size and
+ * timestamps. New entries are appended, so the last matching line wins.
+ */
+struct cache_entry {
+	struct cache_entry *next;
+	const struct hash_type *type;
+	unsigned long long dev, ino, size;
+	long long mtime_s, ctime_s;
+	long mtime_ns, ctime_ns;
+	char digest[HASH_STR_LEN];
+	char *path;
+};
+
+#define CACHE_BUCKETS	4096
 
-		if (!f) {
-			fprintf(stderr, "Failed to open '%s'\n", filename);
-			return 1;
+static struct cache_entry *cache[CACHE_BUCKETS];
+static int cache_entries, cache_lines;
+
+static unsigned int cache_bucket(const char *path)
+{
+	unsigned int h = 2166136261u;
+
+	while (*path)
+		h = (h ^ (unsigned char) *path++) * 16777619u;
+
+	return h % CACHE_BUCKETS;
+}
+
+static void cache_entry_init(struct cache_entry *e, const struct hash_type *t,
+	const struct stat *st)
+{
+	e->type = t;
+	e->dev = st->st_dev;
+	e->ino = st->st_ino;
+	e->size = st->st_size;
+	e->mtime_s = st->st_mtim.tv_sec;
+	e->mtime_ns = st->st_mtim.tv_nsec;
+	e->ctime_s = st->st_ctim.tv_sec;
+	e->ctime_ns = st->st_ctim.tv_nsec;
+}
+
+static bool cache_entry_match(const struct cache_entry *a, const struct cache_entry *b)
+{
+	return a->type == b->type && a->dev == b->dev && a->ino == b->ino &&
+	       a->size == b->size &&
+	       a->mtime_s == b->mtime_s && a->mtime_ns == b->mtime_ns &&
+	       a->ctime_s == b->ctime_s && a->ctime_ns == b->ctime_ns;
+}
+
+static struct cache_entry *cache_find(const struct hash_type *t, const char *path)
+{
+	struct cache_entry *e;
+
+	for (e = cache[cache_bucket(path)]; e; e = e->next)
+		if (e->type == t && !strcmp(e->path, path))
+			return e;
+
+	return NULL;
+}
+
+static void cache_insert(struct cache_entry *e)
+{
+	struct cache_entry *old = cache_find(e->type, e->path);
+	unsigned int b;
+
+	if (old) {
+		/* later lines replace earlier ones */
+		e->next = old->next;
+		free(old->path);
+		*old = *e;
+		free(e);
+		return;
+	}
+
+	b = cache_bucket(e->path);
+	e->next = cache[b];
+	cache[b] = e;
+	cache_entries++;
+}
+
+static void cache_load(FILE *f)
+{
+	char type[16], *line = NULL;
+	struct cache_entry *e;
+	size_t size = 0;
+	ssize_t len;
+	int path;
+
+	while ((len = getline(&line, &size, f)) > 0) {
+		if (line[len - 1] != '\n')
+			break;
+		line[len - 1] = 0;
+		cache_lines++;
+
+		e = calloc(1, sizeof(*e));
+		if (!e)
+			break;
+
+		path = 0;
+		if (sscanf(line, "%15s %llu %llu %llu %lld.%ld %lld.%ld %64s %n",
+			   type, &e->dev, &e->ino, &e->size,
+			   &e->mtime_s, &e->mtime_ns, &e->ctime_s, &e->ctime_ns,
+			   e->digest, &path) != 9 || !path ||
+		    !(e->type = get_hash_type(type)) ||
+		    strlen(e->digest) != e->type->len * 2 ||
+		    !(e->path = strdup(line + path))) {
+			free(e);
+			continue;
 		}
-		str = t->func(f);
+
+		cache_insert(e);
+	}
+
+	free(line);
+}
+
+static void cache_write_entry(FILE *f, const struct cache_entry *e)
+{
+	fprintf(f, "%s %llu %llu %llu %lld.%09ld %lld.%09ld %s %s\n",
+		e->type->name, e->dev, e->ino, e->size,
+		e->mtime_s, e->mtime_ns, e->ctime_s, e->ctime_ns,
+		e->digest, e->path);
+}
+
+static FILE *cache_open(const char *file)
+{
+	FILE *f;
+	int fd;
+
+	fd = open(file, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		return NULL;
+
+	f = fdopen(fd, "a+");
+	if (!f) {
+		close(fd);
+		return NULL;
+	}
+
+	if (flock(fd, LOCK_SH)) {
 		fclose(f);
+		return NULL;
 	}
 
-	if (!str) {
-		fprintf(stderr, "Failed to generate hash\n");
-		return 1;
+	rewind(f);
+	cache_load(f);
+	flock(fd, LOCK_UN);
+
+	return f;
+}
+
+/* Rewrite the file once stale and duplicate lines outnumber the live ones */
+static void cache_compact(const char *file)
+{
+	struct cache_entry *e;
+	char tmp[PATH_MAX];
+	FILE *f;
+	int i;
+
+	if (cache_lines < 1024 || cache_lines < 2 * cache_entries)
+		return;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", file, (int) getpid()) >= sizeof(tmp))
+		return;
+
+	f = fopen(tmp, "w");
+	if (!f)
+		return;
+
+	for (i = 0; i < CACHE_BUCKETS; i++)
+		for (e = cache[i]; e; e = e->next)
+			cache_write_entry(f, e);
+
+	if (fclose(f) || rename(tmp, file))
+		unlink(tmp);
+}
+
+static void cache_save(FILE *f, const char *file, struct cache_entry **new, int n_new)
+{
+	int i, fd = fileno(f);
+
+	if (!n_new || flock(fd, LOCK_EX))
+		goto out;
+
+	/* pick up what other instances added in the meantime */
+	clearerr(f);
+	cache_load(f);
+
+	for (i = 0; i < n_new; i++) {
+		cache_write_entry(f, new[i]);
+		cache_insert(new[i]);
+		cache_lines++;
 	}
+	fflush(f);
 
-	if (add_filename)
-		printf("%s %s%s", str, filename ? filename : "-",
-			no_newline ? "" : "\n");
-	else
-		printf("%s%s", str, no_newline ? "" : "\n");
-	return 0;
+	cache_compact(file);
+	flock(fd, LOCK_UN);
+
+out:
+	fclose(f);
+}
+
+
+enum {
+	HASH_OK,
+	HASH_ERR_OPEN,
+	HASH_ERR_ISDIR,
+	HASH_ERR_HASH,
+};
+
+struct hash_job {
+	const char *filename;
+	char str[HASH_STR_LEN];
+	int error;
+	struct cache_entry *new;
+	bool done;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct hash_type *type;
+	struct hash_job *jobs;
+	int n_jobs;
+	int next;
+	bool use_cache;
+	time_t start;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+/* Returns the cached digest for a regular file, or queues a new entry */
+static bool hash_job_cache(struct hash_job *job, int fd, const struct stat *st)
+{
+	struct cache_entry cur, *e;
+	char *path;
+
+	path = realpath(job->filename, NULL);
+	if (!path)
+		return false;
+
+	cache_entry_init(&cur, pool.type, st);
+	e = cache_find(pool.type, path);
+	if (e && cache_entry_match(e, &cur)) {
+		memcpy(job->str, e->digest, sizeof(job->str));
+		free(path);
+		return true;
+	}
+
+	/*
+	 * A file modified again within the timestamp granularity would
+	 * look unchanged, so files changed just now are not cached.
+	 */
+	if (strchr(path, '\n') || st->st_mtim.tv_sec >= pool.start - 1 ||
+	    st->st_ctim.tv_sec >= pool.start - 1 ||
+	    hash_fd(pool.type, fd, st, job->str) ||
+	    !(e = malloc(sizeof(*e)))) {
+		free(path);
+		return false;
+	}
+
+	*e = cur;
+	e->path = path;
+	memcpy(e->digest, job->str, sizeof(e->digest));
+	job->new = e;
+
+	return true;
+}
+
+static void hash_job_run(struct hash_job *job)
+{
+	const char *filename = job->filename;
+	struct stat st;
+	int fd = 0;
+
+	if (filename && strcmp(filename, "-") != 0) {
+		fd = open(filename, O_RDONLY);
+		if (fd < 0) {
+			job->error = errno == EISDIR ? HASH_ERR_ISDIR : HASH_ERR_OPEN;
+			return;
+		}
+	}
+
+	if (fstat(fd, &st)) {
+		job->error = HASH_ERR_OPEN;
+	} else if (S_ISDIR(st.st_mode)) {
+		job->error = HASH_ERR_ISDIR;
+	} else if (fd && pool.use_cache && S_ISREG(st.st_mode) &&
+		   hash_job_cache(job, fd, &st)) {
+		/* served from or added to the cache */
+	} else if (hash_fd(pool.type, fd, &st, job->str)) {
+		job->error = HASH_ERR_HASH;
+	}
+
+	if (fd)
+		close(fd);
+}
+
+static void *hash_worker(void *arg)
+{
+	struct hash_job *job;
+
+	pthread_mutex_lock(&pool.lock);
+	while (pool.next < pool.n_jobs) {
+		job = &pool.jobs[pool.next++];
+		pthread_mutex_unlock(&pool.lock);
+
+		hash_job_run(job);
+
+		pthread_mutex_lock(&pool.lock);
+		job->done = true;
+		pthread_cond_broadcast(&pool.cond);
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	return NULL;
+}
+
+
+static int usage(const char *progname)
+{
+	int i;
+
+	fprintf(stderr, "Usage: %s <hash type> [options] [<file>...]\n"
+		"Options:\n"
+		"	-n		Print filename(s)\n"
+		"	-N		Suppress trailing newline\n"
+		"	-j <jobs>	Hash up to <jobs> files in parallel (default: number of CPUs)\n"
+		"	-c <file>	Cache digests of unchanged files in <file> (default: $MKHASH_CACHE)\n"
+		"\n"
+		"Supported hash types:", progname);
+
+	for (i = 0; i < ARRAY_SIZE(types); i++)
+		fprintf(stderr, "%s %s", i ? "," : "", types[i].name);
+
+	fprintf(stderr, "\n");
+	return 1;
 }
 
 
 int main(int argc, char **argv)
 {
-	struct hash_type *t;
 	const char *progname = argv[0];
-	int i, ch;
+	const char *cache_file = getenv("MKHASH_CACHE");
+	struct cache_entry **new = NULL;
+	struct hash_job *job;
+	pthread_t *threads = NULL;
+	FILE *cache_f = NULL;
+	int i, ch, n_new = 0, n_threads = 0, ret = 0;
 	bool add_filename = false, no_newline = false;
+	long jobs = 0;
+	char *end;
 
-	while ((ch = getopt(argc, argv, "nN")) != -1) {
+	while ((ch = getopt(argc, argv, "nNj:c:")) != -1) {
 		switch (ch) {
 		case 'n':
 			add_filename = true;
@@ -826,6 +1291,14 @@ int main(int argc, char **argv)
 		case 'N':
 			no_newline = true;
 			break;
+		case 'j':
+			jobs = strtol(optarg, &end, 10);
+			if (*end || jobs < 1)
+				return usage(progname);
+			break;
+		case 'c':
+			cache_file = optarg;
+			break;
 		default:
 			return usage(progname);
 		}
@@ -837,18 +1310,90 @@ int main(int argc, char **argv)
 	if (argc < 1)
 		return usage(progname);
 
-	t = get_hash_type(argv[0]);
-	if (!t)
+	pool.type = get_hash_type(argv[0]);
+	if (!pool.type)
 		return usage(progname);
 
-	if (argc < 2)
-		return hash_file(t, NULL, add_filename, no_newline);
+#ifdef SHA256_X86
+	sha256_use_x86 = sha256_x86_supported();
+#endif
+
+	pool.n_jobs = argc > 1 ? argc - 1 : 1;
+	pool.jobs = calloc(pool.n_jobs, sizeof(*pool.jobs));
+	if (!pool.jobs)
+		return 1;
+
+	for (i = 0; i < argc - 1; i++)
+		pool.jobs[i].filename = argv[1 + i];
 
-	for (i = 0; i < argc - 1; i++) {
-		int ret = hash_file(t, argv[1 + i], add_filename, no_newline);
-		if (ret)
-			return ret;
+	if (cache_file && *cache_file && argc > 1) {
+		cache_f = cache_open(cache_file);
+		pool.use_cache = !!cache_f;
+		pool.start = time(NULL);
 	}
 
-	return 0;
+	if (!jobs)
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs > pool.n_jobs)
+		jobs = pool.n_jobs;
+
+	if (jobs > 1)
+		threads = calloc(jobs, sizeof(*threads));
+
+	for (i = 0; threads && i < jobs; i++) {
+		if (pthread_create(&threads[i], NULL, hash_worker, NULL))
+			break;
+		n_threads++;
+	}
+
+	if (!n_threads)
+		hash_worker(NULL);
+
+	/* report in argument order, stopping at the first failure */
+	for (i = 0; i < pool.n_jobs; i++) {
+		job = &pool.jobs[i];
+
+		pthread_mutex_lock(&pool.lock);
+		while (!job->done)
+			pthread_cond_wait(&pool.cond, &pool.lock);
+		pthread_mutex_unlock(&pool.lock);
+
+		if (job->error) {
+			if (job->error == HASH_ERR_HASH)
+				fprintf(stderr, "Failed to generate hash\n");
+			else
+				fprintf(stderr, "Failed to open '%s'%s\n",
+					job->filename ? job->filename : "-",
+					job->error == HASH_ERR_ISDIR ? ": Is a directory" : "");
+			ret = 1;
+			break;
+		}
+
+		if (add_filename)
+			printf("%s %s%s", job->str, job->filename ? job->filename : "-",
+				no_newline ? "" : "\n");
+		else
+			printf("%s%s", job->str, no_newline ? "" : "\n");
+	}
+
+	if (ret) {
+		/* skip the files not started yet */
+		pthread_mutex_lock(&pool.lock);
+		pool.n_jobs = pool.next;
+		pthread_mutex_unlock(&pool.lock);
+	}
+
+	for (i = 0; i < n_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	if (cache_f) {
+		new = calloc(pool.n_jobs, sizeof(*new));
+		for (i = 0; new && i < pool.n_jobs; i++)
+			if (pool.jobs[i].new)
+				new[n_new++] = pool.jobs[i].new;
+
+		cache_save(cache_f, cache_file, new, n_new);
+	}
+
+	return ret;
 }
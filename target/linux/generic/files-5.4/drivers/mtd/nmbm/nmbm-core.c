@@ -190,6 +190,29 @@ static void nmbm_reset_chip(struct nmbm_instance *ni)
 		ni->lower.reset_chip(ni->lower.arg);
 }
 
+/*
+ * nmbm_lock_mapping - Enter a section changing the mapping of logic blocks
+ * @ni: NMBM instance structure
+ *
+ * Concurrent readers are kept out of the mapping and block state tables
+ * until nmbm_unlock_mapping() if the lower device supports it.
+ */
+static void nmbm_lock_mapping(struct nmbm_instance *ni)
+{
+	if (ni->lower.lock_mapping)
+		ni->lower.lock_mapping(ni->lower.arg);
+}
+
+/*
+ * nmbm_unlock_mapping - Leave a section changing the mapping of logic blocks
+ * @ni: NMBM instance structure
+ */
+static void nmbm_unlock_mapping(struct nmbm_instance *ni)
+{
+	if (ni->lower.unlock_mapping)
+		ni->lower.unlock_mapping(ni->lower.arg);
+}
+
 /*
  * nmbm_read_phys_page - Read page with retry
  * @ni: NMBM instance structure
@@ -222,6 +245,57 @@ static int nmbm_read_phys_page(struct nmbm_instance *ni, uint64_t addr,
 	return ret;
 }
 
+/*
+ * nmbm_read_phys_pages - Read main data of contiguous pages within a block
+ * @ni: NMBM instance structure
+ * @addr: linear address where the data will be read from
+ * @count: number of pages to be read
+ * @data: the main data to be read
+ * @mode: mode for processing oob data
+ *
+ * Use the lower multi-page read if available. On failure, or without it,
+ * fall back to per-page reads so each page gets its own retries.
+ *
+ * Return 0 for success, positive value for corrected bitflip count,
+ * -EBADMSG for ecc error, other negative values for other errors
+ */
+static int nmbm_read_phys_pages(struct nmbm_instance *ni, uint64_t addr,
+				uint32_t count, void *data,
+				enum nmbm_oob_mode mode)
+{
+	uint8_t *ptr = data;
+	bool has_ecc_err = false;
+	int ret, max_bitflips = 0;
+	uint32_t i;
+
+	if (count > 1 && ni->lower.read_pages) {
+		ret = ni->lower.read_pages(ni->lower.arg, addr, count, data,
+					   mode);
+		if (ret >= 0)
+			return ret;
+	}
+
+	for (i = 0; i < count; i++) {
+		ret = nmbm_read_phys_page(ni, addr, ptr, NULL, mode);
+		if (ret < 0 && ret != -EBADMSG)
+			return ret;
+
+		if (ret == -EBADMSG)
+			has_ecc_err = true;
+
+		if (ret > max_bitflips)
+			max_bitflips = ret;
+
+		addr += ni->lower.writesize;
+		ptr += ni->lower.writesize;
+	}
+
+	if (has_ecc_err)
+		return -EBADMSG;
+
+	return max_bitflips;
+}
+
 /*
  * nmbm_write_phys_page - Write page with retry
  * @ni: NMBM instance structure
@@ -386,6 +460,24 @@ static bool nmbm_check_header(const void *data, uint32_t size)
 	return true;
 }
 
+/*
+ * nmbm_check_empty - Check whether data read back is all 0xff
+ * @data: pointer to the data
+ * @size: size of the data
+ */
+static bool nmbm_check_empty(const void *data, uint32_t size)
+{
+	const uint8_t *p = data;
+	uint32_t i;
+
+	for (i = 0; i < size; i++) {
+		if (p[i] != 0xff)
+			return false;
+	}
+
+	return true;
+}
+
 /*
  * nmbm_update_checksum - Update checksum of a NMBM structure
  * @header: pointer to a NMBM structure with a NMBM header at beginning
@@ -856,7 +948,18 @@ static int nmbn_read_data(struct nmbm_instance *ni, uint64_t addr, void *data,
 		if (chunksize > sizeremain)
 			chunksize = sizeremain;
 
-		if (chunksize == ni->lower.writesize) {
+		if (!leading && sizeremain >= 2 * ni->lower.writesize) {
+			/* Read whole pages up to the end of block at once */
+			chunksize = ni->lower.erasesize - (off & ni->erasesize_mask);
+			if (chunksize > sizeremain)
+				chunksize = sizeremain & ~ni->writesize_mask;
+
+			ret = nmbm_read_phys_pages(ni, off, chunksize >>
+						   ni->writesize_shift, ptr,
+						   NMBM_MODE_PLACE_OOB);
+			if (ret < 0)
+				return ret;
+		} else if (chunksize == ni->lower.writesize) {
 			ret = nmbm_read_phys_page(ni, off - leading, ptr, NULL,
 						  NMBM_MODE_PLACE_OOB);
 			if (ret < 0)
@@ -1066,6 +1169,171 @@ static void nmbm_mark_tables_clean(struct nmbm_instance *ni)
 	ni->block_mapping_changed = 0;
 }
 
+/*
+ * nmbm_reset_delta_log - Start a new delta log
+ * @ni: NMBM instance structure
+ *
+ * Must be called only after all existing info tables have been rewritten
+ * from the info table cache, i.e. they are identical and their delta logs
+ * have been erased.
+ */
+static void nmbm_reset_delta_log(struct nmbm_instance *ni)
+{
+	ni->delta_log_next = ni->delta_log_off;
+	ni->delta_seq = 0;
+	ni->delta_log_ready = !!(ni->lower.flags & NMBM_F_DELTA_LOG);
+}
+
+/*
+ * nmbm_add_delta_record - Add a record to the delta page being built
+ * @ni: NMBM instance structure
+ * @type: record type
+ * @index: block address of the changed entry
+ * @value: new value of the entry
+ *
+ * Return false if the delta page is full.
+ */
+static bool nmbm_add_delta_record(struct nmbm_instance *ni, uint32_t type,
+				  uint32_t index, int32_t value)
+{
+	struct nmbm_delta_header *dhdr = (void *)ni->delta_cache;
+	struct nmbm_delta_record *rec = (void *)(dhdr + 1);
+	uint32_t max_records;
+
+	max_records = (ni->lower.writesize - sizeof(*dhdr)) / sizeof(*rec);
+	if (dhdr->record_count >= max_records)
+		return false;
+
+	rec[dhdr->record_count].type = type;
+	rec[dhdr->record_count].index = index;
+	rec[dhdr->record_count].value = value;
+	dhdr->record_count++;
+
+	return true;
+}
+
+/*
+ * nmbm_write_delta_page - Write the delta page into the log of an info table
+ * @ni: NMBM instance structure
+ * @ba: start block address of the info table
+ *
+ * The delta log occupies the unused pages of the last block of an info table.
+ */
+static bool nmbm_write_delta_page(struct nmbm_instance *ni, uint32_t ba)
+{
+	struct nmbm_delta_header *dhdr = (void *)ni->delta_cache;
+	uint32_t last_ba;
+	bool success;
+
+	success = nmbm_block_walk(ni, true, ba, &last_ba,
+				  size2blk(ni, ni->info_table_size) - 1,
+				  ni->mapping_blocks_ba);
+	if (!success)
+		return false;
+
+	return nmbn_write_verify_data(ni,
+				      ba2addr(ni, last_ba) + ni->delta_log_next,
+				      dhdr, dhdr->header.size);
+}
+
+/*
+ * nmbm_append_delta_log - Record table changes into the delta log
+ * @ni: NMBM instance structure
+ *
+ * Compare the state table with the info table cache, which holds the
+ * contents already on flash, and append the differences as one page to the
+ * delta log of all info tables.
+ *
+ * Boot loaders only read the info tables, not the log. Mapping changes must
+ * reach them even if power is lost before the log is folded, so they are
+ * never logged.
+ *
+ * Return false if the delta log is not available, full, can not hold all
+ * changes, or the mapping table changed. A full info table update, which
+ * also folds the log, is required in this case.
+ */
+static bool nmbm_append_delta_log(struct nmbm_instance *ni)
+{
+	struct nmbm_delta_header *dhdr = (void *)ni->delta_cache;
+	nmbm_bitmap_t *state_cache;
+	int32_t *mapping_cache;
+	uint32_t unit, ba, state;
+	bool success;
+
+	if (!ni->delta_log_ready)
+		return false;
+
+	if (ni->delta_log_next + ni->lower.writesize > ni->lower.erasesize)
+		return false;
+
+	state_cache = (nmbm_bitmap_t *)(ni->info_table_cache +
+					ni->info_table.state_table_off);
+	mapping_cache = (int32_t *)(ni->info_table_cache +
+				    ni->info_table.mapping_table_off);
+
+	if (memcmp(mapping_cache, ni->block_mapping, ni->mapping_table_size))
+		return false;
+
+	dhdr->record_count = 0;
+
+	for (unit = 0; unit < ni->state_table_size / NMBM_BITMAP_UNIT_SIZE;
+	     unit++) {
+		if (state_cache[unit] == ni->block_state[unit])
+			continue;
+
+		for (ba = unit * NMBM_BITMAP_BLOCKS_PER_UNIT;
+		     ba < (unit + 1) * NMBM_BITMAP_BLOCKS_PER_UNIT &&
+		     ba < ni->block_count; ba++) {
+			state = nmbm_get_block_state(ni, ba);
+			if (nmbm_get_block_state_raw(state_cache, ba) == state)
+				continue;
+
+			success = nmbm_add_delta_record(ni, NMBM_DELTA_STATE,
+							ba, state);
+			if (!success)
+				return false;
+		}
+	}
+
+	if (!dhdr->record_count) {
+		nmbm_mark_tables_clean(ni);
+		return true;
+	}
+
+	dhdr->header.magic = NMBM_MAGIC_DELTA_LOG;
+	dhdr->header.version = NMBM_VER;
+	dhdr->header.size = sizeof(*dhdr) +
+		dhdr->record_count * sizeof(struct nmbm_delta_record);
+	dhdr->write_count = ni->info_table.write_count;
+	dhdr->seq = ni->delta_seq + 1;
+	dhdr->padding = 0;
+	nmbm_update_checksum(&dhdr->header);
+
+	/* Same order as full info table update: backup table goes first */
+	if (ni->backup_table_ba) {
+		success = nmbm_write_delta_page(ni, ni->backup_table_ba);
+		if (!success)
+			return false;
+	}
+
+	success = nmbm_write_delta_page(ni, ni->main_table_ba);
+	if (!success)
+		return false;
+
+	/* Info table cache now reflects what is on flash */
+	memcpy(state_cache, ni->block_state, ni->state_table_size);
+
+	ni->delta_log_next += ni->lower.writesize;
+	ni->delta_seq++;
+
+	nmbm_mark_tables_clean(ni);
+
+	nlog_debug(ni, "Delta log page %u written with %u record(s)\n",
+		   ni->delta_seq, dhdr->record_count);
+
+	return true;
+}
+
 /*
  * nmbm_try_reserve_blocks - Reserve blocks with compromisation
  * @ni: NMBM instance structure
@@ -1143,6 +1411,7 @@ static bool nmbm_rebuild_info_table(struct nmbm_instance *ni)
 	if (!success) {
 		/* There is no spare block. */
 		nlog_debug(ni, "No room for backup info table\n");
+		nmbm_reset_delta_log(ni);
 		return true;
 	}
 
@@ -1153,6 +1422,7 @@ static bool nmbm_rebuild_info_table(struct nmbm_instance *ni)
 	if (!success) {
 		/* There is no enough blocks for backup table. */
 		nlog_debug(ni, "No room for backup info table\n");
+		nmbm_reset_delta_log(ni);
 		return true;
 	}
 
@@ -1167,6 +1437,8 @@ static bool nmbm_rebuild_info_table(struct nmbm_instance *ni)
 
 	nlog_table_creation(ni, false, table_start_ba, table_end_ba);
 
+	nmbm_reset_delta_log(ni);
+
 	return true;
 }
 
@@ -1473,6 +1745,9 @@ static bool nmbm_update_info_table_once(struct nmbm_instance *ni, bool force)
 	if (!nmbm_generate_info_table_cache(ni) && !force)
 		return true;
 
+	/* Existing delta logs will be erased or become stale */
+	ni->delta_log_ready = false;
+
 	/* Check whether both two tables exist */
 	if (!ni->backup_table_ba) {
 		main_table_limit = ni->mapping_blocks_top_ba;
@@ -1551,6 +1826,8 @@ write_main_table:
 
 	nlog_table_update(ni, true, table_start_ba, table_end_ba);
 
+	nmbm_reset_delta_log(ni);
+
 	return true;
 
 rebuild_tables:
@@ -1565,6 +1842,8 @@ rebuild_tables:
  * has been successfully written.
  * This function will try to update info table repeatedly until no new bad
  * block found during updating.
+ * Changes of block states only are appended to the delta log instead if
+ * possible.
  */
 static bool nmbm_update_info_table(struct nmbm_instance *ni)
 {
@@ -1574,6 +1853,9 @@ static bool nmbm_update_info_table(struct nmbm_instance *ni)
 		return true;
 
 	while (ni->block_state_changed || ni->block_mapping_changed) {
+		if (nmbm_append_delta_log(ni))
+			continue;
+
 		success = nmbm_update_info_table_once(ni, false);
 		if (!success) {
 			nlog_err(ni, "Failed to update info table\n");
@@ -1671,6 +1953,7 @@ static bool nmbm_create_info_table(struct nmbm_instance *ni)
  */
 static bool nmbm_create_new(struct nmbm_instance *ni)
 {
+	uint32_t ba;
 	bool success;
 
 	/* Determine the boundary of management blocks */
@@ -1697,6 +1980,19 @@ static bool nmbm_create_new(struct nmbm_instance *ni)
 	ni->signature.spare_size = ni->lower.oobsize;
 	ni->signature.mgmt_start_pb = ni->mgmt_start_ba;
 	ni->signature.max_try_count = NMBM_TRY_COUNT;
+
+	/*
+	 * Record where the backup info table is going to be written, after
+	 * the main table and its spare blocks, so attach can try it first.
+	 * Boot loaders ignore this field. If new bad blocks move the table,
+	 * attach falls back to searching for it.
+	 */
+	if (nmbm_block_walk(ni, true, ni->mgmt_start_ba, &ba,
+			    size2blk(ni, ni->info_table_size) +
+			    ni->info_table_spare_blocks, ni->block_count) &&
+	    ba - ni->mgmt_start_ba <= 0xffff)
+		ni->signature.backup_table_hint = ba - ni->mgmt_start_ba;
+
 	nmbm_update_checksum(&ni->signature.header);
 
 	if (ni->lower.flags & NMBM_F_READ_ONLY) {
@@ -1789,24 +2085,126 @@ static bool nmbm_check_info_table(struct nmbm_instance *ni, uint32_t start_ba,
 	return true;
 }
 
+/*
+ * nmbm_check_delta_page - Check if records of a delta page are valid
+ * @ni: NMBM instance structure
+ * @dhdr: pointer to the delta page
+ */
+static bool nmbm_check_delta_page(struct nmbm_instance *ni,
+				  struct nmbm_delta_header *dhdr)
+{
+	struct nmbm_delta_record *rec = (void *)(dhdr + 1);
+	uint32_t i;
+
+	if (dhdr->header.size != sizeof(*dhdr) +
+	    dhdr->record_count * sizeof(*rec))
+		return false;
+
+	for (i = 0; i < dhdr->record_count; i++) {
+		if (rec[i].index >= ni->block_count)
+			return false;
+
+		switch (rec[i].type) {
+		case NMBM_DELTA_STATE:
+			if (rec[i].value < 0 || rec[i].value > BLOCK_ST_MASK)
+				return false;
+			break;
+
+		case NMBM_DELTA_MAPPING:
+			if (rec[i].value < -1 ||
+			    rec[i].value >= (int32_t)ni->block_count)
+				return false;
+			break;
+
+		default:
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * nmbm_replay_delta_log - Apply the delta log of an info table
+ * @ni: NMBM instance structure
+ * @ba: block address of the last block of the info table
+ * @data: pointer to the info table to be updated
+ *
+ * Return the number of delta pages applied.
+ */
+static uint32_t nmbm_replay_delta_log(struct nmbm_instance *ni, uint32_t ba,
+				      void *data)
+{
+	struct nmbm_info_table_header *ifthdr = data;
+	struct nmbm_delta_header *dhdr = (void *)ni->delta_cache;
+	struct nmbm_delta_record *rec = (void *)(dhdr + 1);
+	int32_t *block_mapping = (int32_t *)((uintptr_t)data + ifthdr->mapping_table_off);
+	nmbm_bitmap_t *block_state = (nmbm_bitmap_t *)((uintptr_t)data + ifthdr->state_table_off);
+	uint32_t off, i, unit, shift, seq = 0;
+
+	for (off = ni->delta_log_off; off < ni->lower.erasesize;
+	     off += ni->lower.writesize) {
+		WATCHDOG_RESET();
+
+		/* The log ends at the first page which is not a valid delta */
+		if (nmbn_read_data(ni, ba2addr(ni, ba) + off, dhdr,
+				   ni->lower.writesize))
+			break;
+
+		if (dhdr->header.magic != NMBM_MAGIC_DELTA_LOG)
+			break;
+
+		if (!nmbm_check_header(dhdr, ni->lower.writesize))
+			break;
+
+		if (dhdr->write_count != ifthdr->write_count ||
+		    dhdr->seq != seq + 1)
+			break;
+
+		if (!nmbm_check_delta_page(ni, dhdr))
+			break;
+
+		for (i = 0; i < dhdr->record_count; i++) {
+			if (rec[i].type == NMBM_DELTA_MAPPING) {
+				block_mapping[rec[i].index] = rec[i].value;
+				continue;
+			}
+
+			unit = rec[i].index / NMBM_BITMAP_BLOCKS_PER_UNIT;
+			shift = (rec[i].index % NMBM_BITMAP_BLOCKS_PER_UNIT) *
+				NMBM_BITMAP_BITS_PER_BLOCK;
+
+			block_state[unit] &= ~(BLOCK_ST_MASK << shift);
+			block_state[unit] |= rec[i].value << shift;
+		}
+
+		seq++;
+	}
+
+	return seq;
+}
+
 /*
  * nmbm_try_load_info_table - Try to load info table from a address
  * @ni: NMBM instance structure
  * @ba: start block address of the info table
  * @eba: return the block address after end of the table
  * @write_count: return the write count of this table
+ * @delta_seq: return the number of delta pages applied to this table
  * @mapping_blocks_top_ba: return the block address of top remapped block
  * @table_loaded: used to record whether ni->info_table has valid data
  */
 static bool nmbm_try_load_info_table(struct nmbm_instance *ni, uint32_t ba,
 				     uint32_t *eba, uint32_t *write_count,
+				     uint32_t *delta_seq,
 				     uint32_t *mapping_blocks_top_ba,
 				     bool table_loaded)
 {
 	struct nmbm_info_table_header *ifthdr = (void *)ni->info_table_cache;
 	uint8_t *off = ni->info_table_cache;
 	uint32_t limit = ba + size2blk(ni, ni->info_table_size);
-	uint32_t start_ba = 0, chunksize, sizeremain = ni->info_table_size;
+	uint32_t start_ba = 0, last_ba = 0, chunksize;
+	uint32_t sizeremain = ni->info_table_size;
 	bool success, checkhdr = true;
 	int ret;
 
@@ -1825,24 +2223,45 @@ static bool nmbm_try_load_info_table(struct nmbm_instance *ni, uint32_t ba,
 		if (chunksize > ni->lower.erasesize)
 			chunksize = ni->lower.erasesize;
 
-		/* Assume block with ECC error has no info table data */
-		ret = nmbn_read_data(ni, ba2addr(ni, ba), off, chunksize);
+		/*
+		 * Check the header page before reading the rest, so probing
+		 * a block without info table costs only one page read.
+		 * Assume block with ECC error has no info table data.
+		 */
+		if (checkhdr) {
+			ret = nmbn_read_data(ni, ba2addr(ni, ba), off,
+					     ni->lower.writesize);
+			if (ret < 0)
+				goto skip_bad_block;
+			else if (ret > 0)
+				return false;
+
+			success = nmbm_check_info_table_header(ni, off);
+			if (!success)
+				return false;
+
+			ret = nmbn_read_data(ni, ba2addr(ni, ba) +
+					     ni->lower.writesize,
+					     off + ni->lower.writesize,
+					     chunksize - ni->lower.writesize);
+		} else {
+			ret = nmbn_read_data(ni, ba2addr(ni, ba), off,
+					     chunksize);
+		}
+
 		if (ret < 0)
 			goto skip_bad_block;
 		else if (ret > 0)
 			return false;
 
 		if (checkhdr) {
-			success = nmbm_check_info_table_header(ni, off);
-			if (!success)
-				return false;
-
 			start_ba = ba;
 			checkhdr = false;
 		}
 
 		off += chunksize;
 		sizeremain -= chunksize;
+		last_ba = ba;
 
 		goto next_block;
 
@@ -1863,13 +2282,16 @@ static bool nmbm_try_load_info_table(struct nmbm_instance *ni, uint32_t ba,
 
 	*eba = ba;
 	*write_count = ifthdr->write_count;
+	*delta_seq = nmbm_replay_delta_log(ni, last_ba, ni->info_table_cache);
 
 	success = nmbm_check_info_table(ni, start_ba, ba, ni->info_table_cache,
 					mapping_blocks_top_ba);
 	if (!success)
 		return false;
 
-	if (!table_loaded || ifthdr->write_count > ni->info_table.write_count) {
+	if (!table_loaded || ifthdr->write_count > ni->info_table.write_count ||
+	    (ifthdr->write_count == ni->info_table.write_count &&
+	     *delta_seq > ni->delta_seq)) {
 		memcpy(&ni->info_table, ifthdr, sizeof(ni->info_table));
 		memcpy(ni->block_state,
 		       (uint8_t *)ifthdr + ifthdr->state_table_off,
@@ -1878,6 +2300,7 @@ static bool nmbm_try_load_info_table(struct nmbm_instance *ni, uint32_t ba,
 		       (uint8_t *)ifthdr + ifthdr->mapping_table_off,
 		       ni->mapping_table_size);
 		ni->info_table.write_count = ifthdr->write_count;
+		ni->delta_seq = *delta_seq;
 	}
 
 	return true;
@@ -1891,6 +2314,7 @@ static bool nmbm_try_load_info_table(struct nmbm_instance *ni, uint32_t ba,
  * @table_start_ba: return the start block address of this table
  * @table_end_ba: return the block address after end of this table
  * @write_count: return the write count of this table
+ * @delta_seq: return the number of delta pages applied to this table
  * @mapping_blocks_top_ba: return the block address of top remapped block
  * @table_loaded: used to record whether ni->info_table has valid data
  */
@@ -1898,6 +2322,7 @@ static bool nmbm_search_info_table(struct nmbm_instance *ni, uint32_t ba,
 				   uint32_t limit, uint32_t *table_start_ba,
 				   uint32_t *table_end_ba,
 				   uint32_t *write_count,
+				   uint32_t *delta_seq,
 				   uint32_t *mapping_blocks_top_ba,
 				   bool table_loaded)
 {
@@ -1907,7 +2332,7 @@ static bool nmbm_search_info_table(struct nmbm_instance *ni, uint32_t ba,
 		WATCHDOG_RESET();
 
 		success = nmbm_try_load_info_table(ni, ba, table_end_ba,
-						   write_count,
+						   write_count, delta_seq,
 						   mapping_blocks_top_ba,
 						   table_loaded);
 		if (success) {
@@ -1933,20 +2358,22 @@ static bool nmbm_load_info_table(struct nmbm_instance *ni, uint32_t ba,
 	uint32_t main_table_end_ba, backup_table_end_ba, table_end_ba;
 	uint32_t main_mapping_blocks_top_ba, backup_mapping_blocks_top_ba;
 	uint32_t main_table_write_count, backup_table_write_count;
-	uint32_t i;
+	uint32_t main_table_delta_seq, backup_table_delta_seq;
+	uint32_t hint_ba, i;
 	bool success;
 
 	/* Set initial value */
 	ni->main_table_ba = 0;
 	ni->backup_table_ba = 0;
 	ni->info_table.write_count = 0;
+	ni->delta_seq = 0;
 	ni->mapping_blocks_top_ba = ni->signature_ba - 1;
 	ni->data_block_count = ni->signature.mgmt_start_pb;
 
 	/* Find first info table */
 	success = nmbm_search_info_table(ni, ba, limit, &ni->main_table_ba,
 		&main_table_end_ba, &main_table_write_count,
-		&main_mapping_blocks_top_ba, false);
+		&main_table_delta_seq, &main_mapping_blocks_top_ba, false);
 	if (!success) {
 		nlog_warn(ni, "No valid info table found\n");
 		return false;
@@ -1957,10 +2384,28 @@ static bool nmbm_load_info_table(struct nmbm_instance *ni, uint32_t ba,
 	nlog_table_found(ni, true, main_table_write_count, ni->main_table_ba,
 			main_table_end_ba);
 
-	/* Find second info table */
-	success = nmbm_search_info_table(ni, main_table_end_ba, limit,
-		&ni->backup_table_ba, &backup_table_end_ba,
-		&backup_table_write_count, &backup_mapping_blocks_top_ba, true);
+	/* Find second info table, try the location in the signature first */
+	success = false;
+	hint_ba = ni->signature.mgmt_start_pb + ni->signature.backup_table_hint;
+
+	if (ni->signature.backup_table_hint && hint_ba >= main_table_end_ba &&
+	    hint_ba < limit - size2blk(ni, ni->info_table_size)) {
+		success = nmbm_try_load_info_table(ni, hint_ba,
+			&backup_table_end_ba, &backup_table_write_count,
+			&backup_table_delta_seq, &backup_mapping_blocks_top_ba,
+			true);
+		if (success)
+			ni->backup_table_ba = hint_ba;
+		else
+			nlog_debug(ni, "No backup info table at block %u\n",
+				   hint_ba);
+	}
+
+	if (!success)
+		success = nmbm_search_info_table(ni, main_table_end_ba, limit,
+			&ni->backup_table_ba, &backup_table_end_ba,
+			&backup_table_write_count, &backup_table_delta_seq,
+			&backup_mapping_blocks_top_ba, true);
 	if (!success) {
 		nlog_warn(ni, "Second info table not found\n");
 	} else {
@@ -1974,7 +2419,9 @@ static bool nmbm_load_info_table(struct nmbm_instance *ni, uint32_t ba,
 	if (!ni->backup_table_ba) {
 		ni->mapping_blocks_top_ba= main_mapping_blocks_top_ba;
 	} else {
-		if (main_table_write_count >= backup_table_write_count)
+		if (main_table_write_count > backup_table_write_count ||
+		    (main_table_write_count == backup_table_write_count &&
+		     main_table_delta_seq >= backup_table_delta_seq))
 			ni->mapping_blocks_top_ba = main_mapping_blocks_top_ba;
 		else
 			ni->mapping_blocks_top_ba = backup_mapping_blocks_top_ba;
@@ -2009,10 +2456,23 @@ static bool nmbm_load_info_table(struct nmbm_instance *ni, uint32_t ba,
 		return true;
 
 	/*
+	 * If the delta log is not going to be used, or two tables do not have
+	 * the same log, fold the log into new info tables.
 	 * If only one table exists, try to write another table.
 	 * If two tables have different write count, try to update info table
 	 */
-	if (!ni->backup_table_ba) {
+	if (ni->delta_seq && (!(ni->lower.flags & NMBM_F_DELTA_LOG) ||
+	    !ni->backup_table_ba ||
+	    main_table_write_count != backup_table_write_count ||
+	    main_table_delta_seq != backup_table_delta_seq)) {
+		/* Mark state & mapping tables changed */
+		ni->block_state_changed = 1;
+		ni->block_mapping_changed = 1;
+
+		success = nmbm_update_info_table_once(ni, false);
+		if (success && !ni->backup_table_ba)
+			success = nmbm_rescue_single_info_table(ni);
+	} else if (!ni->backup_table_ba) {
 		success = nmbm_rescue_single_info_table(ni);
 	} else if (main_table_write_count != backup_table_write_count) {
 		/* Mark state & mapping tables changed */
@@ -2022,6 +2482,10 @@ static bool nmbm_load_info_table(struct nmbm_instance *ni, uint32_t ba,
 		success = nmbm_update_single_info_table(ni,
 			main_table_write_count < backup_table_write_count);
 	} else {
+		/* Both tables are identical, continue appending to the log */
+		ni->delta_log_ready = !!(ni->lower.flags & NMBM_F_DELTA_LOG);
+		ni->delta_log_next = ni->delta_log_off +
+			ni->delta_seq * ni->lower.writesize;
 		success = true;
 	}
 
@@ -2087,6 +2551,67 @@ static bool nmbm_load_existing(struct nmbm_instance *ni)
 	return false;
 }
 
+/*
+ * nmbm_check_signature_block - Find signature in a block
+ * @ni: NMBM instance structure
+ * @ba: block address to check
+ * @empty_first: only check the block if its first page is empty
+ * @signature: used for storing the signature found
+ * @skipped: set to true if the block is skipped for its first page
+ *
+ * The signature is written starting from the first page, so a block with
+ * an empty first page is checked only if @empty_first is true, and a
+ * block with a non-empty first page only if @empty_first is false.
+ *
+ * Return true if found.
+ */
+static bool nmbm_check_signature_block(struct nmbm_instance *ni, uint32_t ba,
+				       bool empty_first,
+				       struct nmbm_signature *signature,
+				       bool *skipped)
+{
+	struct nmbm_signature sig;
+	uint64_t off, addr;
+	bool success, empty;
+	int ret;
+
+	addr = ba2addr(ni, ba);
+
+	/* Check every page.
+	 * As long as at leaset one page contains valid signature,
+	 * the block is treated as a valid signature block.
+	 */
+	for (off = 0; off < ni->lower.erasesize; off += ni->lower.writesize) {
+		WATCHDOG_RESET();
+
+		ret = nmbn_read_data(ni, addr + off, &sig, sizeof(sig));
+		if (!off) {
+			empty = !ret && nmbm_check_empty(&sig, sizeof(sig));
+			if (empty != empty_first) {
+				*skipped = true;
+				return false;
+			}
+		}
+
+		if (ret)
+			continue;
+
+		/* Check for header size and checksum */
+		success = nmbm_check_header(&sig, sizeof(sig));
+		if (!success)
+			continue;
+
+		/* Check for header magic */
+		if (sig.header.magic == NMBM_MAGIC_SIGNATURE) {
+			/* Found it */
+			memcpy(signature, &sig, sizeof(sig));
+			return true;
+		}
+	}
+
+	return false;
+}
+
 /*
  * nmbm_find_signature - Find signature in the lower NAND chip
  * @ni: NMBM instance structure
@@ -2096,62 +2621,48 @@ static bool nmbm_load_existing(struct nmbm_instance *ni)
  * Find a valid signature from a specific range in the lower NAND chip,
  * from bottom (highest address) to top (lowest address)
  *
+ * Blocks with an empty first page can not hold a signature written by
+ * NMBM, and are only scanned if no signature is found in other blocks.
+ *
  * Return true if found.
  */
 static bool nmbm_find_signature(struct nmbm_instance *ni,
 				struct nmbm_signature *signature,
 				uint32_t *signature_ba)
 {
-	struct nmbm_signature sig;
-	uint64_t off, addr;
 	uint32_t block_count, ba, limit;
-	bool success;
-	int ret;
+	bool empty_first = false, skipped = false;
 
 	/* Calculate top and bottom block address */
 	block_count = ni->lower.size >> ni->erasesize_shift;
-	ba = block_count;
 	limit = (block_count / NMBM_MGMT_DIV) * (NMBM_MGMT_DIV - ni->lower.max_ratio);
 	if (ni->lower.max_reserved_blocks && block_count - limit > ni->lower.max_reserved_blocks)
 		limit = block_count - ni->lower.max_reserved_blocks;
 
+scan:
+	ba = block_count;
+
 	while (ba >= limit) {
 		WATCHDOG_RESET();
 
 		ba--;
-		addr = ba2addr(ni, ba);
 
 		if (nmbm_check_bad_phys_block(ni, ba))
 			continue;
 
-		/* Check every page.
-		 * As long as at leaset one page contains valid signature,
-		 * the block is treated as a valid signature block.
-		 */
-		for (off = 0; off < ni->lower.erasesize;
-		     off += ni->lower.writesize) {
-			WATCHDOG_RESET();
-
-			ret = nmbn_read_data(ni, addr + off, &sig,
-					     sizeof(sig));
-			if (ret)
-				continue;
-
-			/* Check for header size and checksum */
-			success = nmbm_check_header(&sig, sizeof(sig));
-			if (!success)
-				continue;
-
-			/* Check for header magic */
-			if (sig.header.magic == NMBM_MAGIC_SIGNATURE) {
-				/* Found it */
-				memcpy(signature, &sig, sizeof(sig));
-				*signature_ba = ba;
-				return true;
-			}
+		if (nmbm_check_signature_block(ni, ba, empty_first, signature,
+					       &skipped)) {
+			*signature_ba = ba;
+			return true;
 		}
 	};
 
+	/* Fall back to the blocks skipped for their empty first page */
+	if (!empty_first && skipped) {
+		empty_first = true;
+		goto scan;
+	}
+
 	return false;
 }
 
@@ -2247,7 +2758,7 @@ size_t nmbm_calc_structure_size(struct nmbm_lower_device *nld)
 	info_table_size += NMBM_ALIGN(mapping_table_size, nld->writesize);
 
 	return info_table_size + state_table_size + mapping_table_size +
-		nld->writesize + nld->oobsize + sizeof(struct nmbm_instance);
+		2 * nld->writesize + nld->oobsize + sizeof(struct nmbm_instance);
 }
 
 /*
@@ -2294,6 +2805,11 @@ static void nmbm_init_structure(struct nmbm_instance *ni)
 	ni->info_table_spare_blocks = nmbm_get_spare_block_count(
 		size2blk(ni, ni->info_table_size));
 
+	/* Delta log uses the remaining pages of the last info table block */
+	ni->delta_log_off = ni->info_table_size & ni->erasesize_mask;
+	if (!ni->delta_log_off)
+		ni->delta_log_off = ni->lower.erasesize;
+
 	/* Assign memory to members */
 	ptr = (uintptr_t)ni + sizeof(*ni);
 
@@ -2307,6 +2823,9 @@ static void nmbm_init_structure(struct nmbm_instance *ni)
 	ptr += ni->mapping_table_size;
 
 	ni->page_cache = (uint8_t *)ptr;
+	ptr += ni->rawpage_size;
+
+	ni->delta_cache = (uint8_t *)ptr;
 
 	/* Initialize block state table */
 	ni->block_state_changed = 0;
@@ -2389,8 +2908,15 @@ int nmbm_detach(struct nmbm_instance *ni)
 	if (!ni)
 		return -EINVAL;
 
-	if (!(ni->lower.flags & NMBM_F_READ_ONLY))
+	if (!(ni->lower.flags & NMBM_F_READ_ONLY)) {
+		/* Leave complete info tables without delta log behind */
+		if (ni->delta_seq) {
+			ni->delta_log_ready = false;
+			ni->block_mapping_changed++;
+		}
+
 		nmbm_update_info_table(ni);
+	}
 
 	nmbm_mark_block_color_normal(ni, 0, ni->block_count - 1);
 
@@ -2442,6 +2968,8 @@ retry:
 	nmbm_set_block_state(ni, pb, BLOCK_ST_BAD);
 
 remap_logic_block:
+	nmbm_lock_mapping(ni);
+
 	/* Try to assign a new block */
 	success = nmbm_map_block(ni, block_addr);
 	if (!success) {
@@ -2449,13 +2977,17 @@ remap_logic_block:
 		ni->block_mapping[block_addr] = -1;
 		if (nmbm_get_block_state(ni, pb) != BLOCK_ST_NEED_REMAP)
 			nmbm_set_block_state(ni, pb, BLOCK_ST_BAD);
+		nmbm_unlock_mapping(ni);
 		nmbm_update_info_table(ni);
 		return -EIO;
 	}
 
-	/* Update info table before erasing */
 	if (nmbm_get_block_state(ni, pb) != BLOCK_ST_NEED_REMAP)
 		nmbm_set_block_state(ni, pb, BLOCK_ST_BAD);
+
+	nmbm_unlock_mapping(ni);
+
+	/* Update info table before erasing */
 	nmbm_update_info_table(ni);
 
 	goto retry;
@@ -2589,25 +3121,32 @@ int nmbm_read_single_page(struct nmbm_instance *ni, uint64_t addr, void *data,
 }
 
 /*
- * nmbm_read_range - Read data without oob
+ * nmbm_read_range_buf - Read data without oob through a given page buffer
  * @ni: NMBM instance structure
  * @addr: logic linear address
  * @size: data size to read
  * @data: buffer to store main data to be read
+ * @page_buf: buffer of one page for an unaligned head or tail of the range,
+ *            may be NULL if both ends are page aligned
  * @mode: read mode
  * @retlen: return actual data size read
  *
+ * Readers running concurrently with each other or with writers must pass
+ * a page buffer of their own.
+ *
  * Return 0 for success, positive value for corrected bitflip count,
  * -EBADMSG for ecc error, other negative values for other errors
  */
-int nmbm_read_range(struct nmbm_instance *ni, uint64_t addr, size_t size,
-		    void *data, enum nmbm_oob_mode mode, size_t *retlen)
+int nmbm_read_range_buf(struct nmbm_instance *ni, uint64_t addr, size_t size,
+			void *data, void *page_buf, enum nmbm_oob_mode mode,
+			size_t *retlen)
 {
-	uint64_t off = addr;
+	uint64_t off = addr, paddr;
 	uint8_t *ptr = data;
-	size_t sizeremain = size, chunksize, leading;
+	size_t sizeremain = size, chunksize, leading, blkremain;
+	uint32_t lb, pb, blkoff, pages;
 	bool has_ecc_err = false;
-	int ret, max_bitflips = 0;
+	int ret = 0, max_bitflips = 0;
 
 	if (!ni)
 		return -EINVAL;
@@ -2633,40 +3172,76 @@ int nmbm_read_range(struct nmbm_instance *ni, uint64_t addr, size_t size,
 		return 0;
 	}
 
+	if (!page_buf && ((addr | size) & ni->writesize_mask)) {
+		nlog_err(ni, "No page buffer for unaligned read range\n");
+		return -EINVAL;
+	}
+
 	while (sizeremain) {
 		WATCHDOG_RESET();
 
-		leading = off & ni->writesize_mask;
-		chunksize = ni->lower.writesize - leading;
-		if (chunksize > sizeremain)
-			chunksize = sizeremain;
+		/* Resolve the mapping once for each logic block */
+		lb = addr2ba(ni, off);
+		pb = ni->block_mapping[lb];
 
-		if (chunksize == ni->lower.writesize) {
-			ret = nmbm_read_logic_page(ni, off - leading, ptr,
-							NULL, mode);
-			if (ret < 0 && ret != -EBADMSG)
-				break;
-		} else {
-			ret = nmbm_read_logic_page(ni, off - leading,
-							ni->page_cache, NULL,
-							mode);
-			if (ret < 0 && ret != -EBADMSG)
-				break;
+		if ((int32_t)pb < 0) {
+			nlog_debug(ni, "Logic block %u is a bad block\n", lb);
+			ret = -EIO;
+			break;
+		}
 
-			memcpy(ptr, ni->page_cache + leading, chunksize);
+		if (nmbm_get_block_state(ni, pb) == BLOCK_ST_BAD) {
+			ret = -EIO;
+			break;
 		}
 
-		if (ret == -EBADMSG)
-			has_ecc_err = true;
+		paddr = ba2addr(ni, pb);
+		blkoff = off & ni->erasesize_mask;
+		blkremain = ni->lower.erasesize - blkoff;
+		if (blkremain > sizeremain)
+			blkremain = sizeremain;
+
+		while (blkremain) {
+			leading = off & ni->writesize_mask;
+			chunksize = ni->lower.writesize - leading;
+			if (chunksize > blkremain)
+				chunksize = blkremain;
+
+			if (chunksize == ni->lower.writesize) {
+				/* Aligned pages go straight to the caller */
+				pages = blkremain >> ni->writesize_shift;
+				chunksize = (size_t)pages << ni->writesize_shift;
+
+				ret = nmbm_read_phys_pages(ni, paddr + blkoff,
+							   pages, ptr, mode);
+			} else {
+				/* Unaligned head or tail goes through buffer */
+				ret = nmbm_read_phys_page(ni,
+							  paddr + blkoff - leading,
+							  page_buf, NULL, mode);
+				if (ret >= 0 || ret == -EBADMSG)
+					memcpy(ptr, (uint8_t *)page_buf + leading,
+					       chunksize);
+			}
 
-		if (ret > max_bitflips)
-			max_bitflips = ret;
+			if (ret < 0 && ret != -EBADMSG)
+				goto out;
 
-		off += chunksize;
-		ptr += chunksize;
-		sizeremain -= chunksize;
+			if (ret == -EBADMSG)
+				has_ecc_err = true;
+
+			if (ret > max_bitflips)
+				max_bitflips = ret;
+
+			off += chunksize;
+			ptr += chunksize;
+			blkoff += chunksize;
+			blkremain -= chunksize;
+			sizeremain -= chunksize;
+		}
 	}
 
+out:
 	if (retlen)
 		*retlen = size - sizeremain;
 
@@ -2679,6 +3254,31 @@ int nmbm_read_range(struct nmbm_instance *ni, uint64_t addr, size_t size,
 	return max_bitflips;
 }
 
+/*
+ * nmbm_read_range - Read data without oob
+ * @ni: NMBM instance structure
+ * @addr: logic linear address
+ * @size: data size to read
+ * @data: buffer to store main data to be read
+ * @mode: read mode
+ * @retlen: return actual data size read
+ *
+ * An unaligned head or tail of the range is read through the page cache of
+ * the instance, so the caller must have exclusive access to it.
+ *
+ * Return 0 for success, positive value for corrected bitflip count,
+ * -EBADMSG for ecc error, other negative values for other errors
+ */
+int nmbm_read_range(struct nmbm_instance *ni, uint64_t addr, size_t size,
+		    void *data, enum nmbm_oob_mode mode, size_t *retlen)
+{
+	if (!ni)
+		return -EINVAL;
+
+	return nmbm_read_range_buf(ni, addr, size, data, ni->page_cache, mode,
+				   retlen);
+}
+
 /*
  * nmbm_write_logic_page - Read page based on logic address
  * @ni: NMBM instance structure
@@ -2897,7 +3497,10 @@ int nmbm_mark_bad_block(struct nmbm_instance *ni, uint64_t addr)
 	if ((int32_t)pb < 0)
 		return 0;
 
+	nmbm_lock_mapping(ni);
 	ni->block_mapping[lb] = -1;
+	nmbm_unlock_mapping(ni);
+
 	nmbm_mark_phys_bad_block(ni, pb);
 	nmbm_set_block_state(ni, pb, BLOCK_ST_BAD);
 	nmbm_update_info_table(ni);
@@ -2905,6 +3508,182 @@ int nmbm_mark_bad_block(struct nmbm_instance *ni, uint64_t addr)
 	return 0;
 }
 
+/*
+ * nmbm_copy_block - Copy all non-empty pages of a block to another block
+ * @ni: NMBM instance structure
+ * @src_ba: source physical block address
+ * @dst_ba: destination physical block address, already erased
+ *
+ * Empty pages are not programmed, so the upper layer can still write them.
+ *
+ * Return 0 for success, -EBADMSG if the source has uncorrectable page(s),
+ * -EIO if the destination failed to be written.
+ */
+static int nmbm_copy_block(struct nmbm_instance *ni, uint32_t src_ba,
+			   uint32_t dst_ba)
+{
+	uint64_t src = ba2addr(ni, src_ba), dst = ba2addr(ni, dst_ba);
+	uint8_t *oob = ni->page_cache + ni->lower.writesize;
+	uint32_t off;
+	bool success;
+	int ret;
+
+	for (off = 0; off < ni->lower.erasesize; off += ni->lower.writesize) {
+		WATCHDOG_RESET();
+
+		memset(ni->page_cache, 0xff, ni->rawpage_size);
+
+		ret = nmbm_read_phys_page(ni, src + off, ni->page_cache, oob,
+					  NMBM_MODE_AUTO_OOB);
+		if (ret < 0)
+			return -EBADMSG;
+
+		if (nmbm_check_empty(ni->page_cache, ni->rawpage_size))
+			continue;
+
+		success = nmbm_write_phys_page(ni, dst + off, ni->page_cache,
+					       oob, NMBM_MODE_AUTO_OOB);
+		if (!success)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+/*
+ * nmbm_relocate_block - Move a logic block to a new physical block
+ * @ni: NMBM instance structure
+ * @addr: logic linear address within the block
+ * @reserve: number of spare blocks which must be left for bad blocks
+ *
+ * Copy the logic block to a spare block, then remap it. This is used to move
+ * data away from a block with rising bitflips before it becomes
+ * uncorrectable.
+ *
+ * Bitflips caused by read disturb are cleared by erasing the block, so the
+ * original physical block is then erased and the data is copied back. The
+ * original block is only retired if it fails to be erased or written. The
+ * spare block is given back if the data has been copied back.
+ *
+ * Readers keep using the original block until the copy is done. The old
+ * mapping also stays valid on flash until the info table is updated, so the
+ * data survives a power cut at any point.
+ */
+int nmbm_relocate_block(struct nmbm_instance *ni, uint64_t addr,
+			uint32_t reserve)
+{
+	uint32_t lb, pb, new_pb;
+	bool success;
+	int ret;
+
+	if (!ni)
+		return -EINVAL;
+
+	/* Sanity check */
+	if (ni->protected || (ni->lower.flags & NMBM_F_READ_ONLY)) {
+		nlog_debug(ni, "Device is forced read-only\n");
+		return -EROFS;
+	}
+
+	if (addr >= ba2addr(ni, ni->data_block_count)) {
+		nlog_err(ni, "Address 0x%llx is invalid\n", addr);
+		return -EINVAL;
+	}
+
+	lb = addr2ba(ni, addr);
+
+	/* Map logic block to physical block */
+	pb = ni->block_mapping[lb];
+
+	if ((int32_t)pb < 0 || nmbm_get_block_state(ni, pb) != BLOCK_ST_GOOD)
+		return -EIO;
+
+	while (1) {
+		if (ni->mapping_blocks_top_ba <= ni->mapping_blocks_ba + reserve) {
+			nlog_debug(ni, "No spare block to relocate logic block %u\n",
+				   lb);
+			ret = -ENOSPC;
+			break;
+		}
+
+		nmbm_lock_mapping(ni);
+
+		success = nmbm_map_block(ni, lb);
+		if (success) {
+			new_pb = ni->block_mapping[lb];
+			ni->block_mapping[lb] = pb;
+		}
+
+		nmbm_unlock_mapping(ni);
+
+		if (!success) {
+			ret = -ENOSPC;
+			break;
+		}
+
+		success = nmbm_erase_block_and_check(ni, new_pb);
+		if (success) {
+			ret = nmbm_copy_block(ni, pb, new_pb);
+			if (ret != -EIO)
+				break;
+		}
+
+		nmbm_mark_phys_bad_block(ni, new_pb);
+		nmbm_set_block_state(ni, new_pb, BLOCK_ST_BAD);
+	}
+
+	if (ret) {
+		/* Unused spare is back on attach */
+		nmbm_update_info_table(ni);
+		return ret;
+	}
+
+	nmbm_lock_mapping(ni);
+	ni->block_mapping[lb] = new_pb;
+	nmbm_unlock_mapping(ni);
+
+	/* The original block must not be erased before the copy is recorded */
+	success = nmbm_update_info_table(ni);
+	if (!success)
+		goto relocated;
+
+	success = nmbm_erase_block_and_check(ni, pb);
+	if (success)
+		ret = nmbm_copy_block(ni, new_pb, pb);
+
+	if (!success || ret == -EIO) {
+		/* The original block really failed, retire it */
+		nmbm_mark_phys_bad_block(ni, pb);
+		nmbm_set_block_state(ni, pb, BLOCK_ST_BAD);
+		nmbm_update_info_table(ni);
+		goto relocated;
+	}
+
+	if (ret)
+		goto relocated;
+
+	nmbm_lock_mapping(ni);
+	ni->block_mapping[lb] = pb;
+	ni->block_mapping_changed++;
+
+	/* Give back the spare block if nothing has been mapped below it */
+	if (new_pb == ni->mapping_blocks_top_ba + 1)
+		ni->mapping_blocks_top_ba++;
+	nmbm_unlock_mapping(ni);
+
+	nmbm_update_info_table(ni);
+
+	nlog_info(ni, "Logic block %u refreshed in physical block %u\n", lb, pb);
+
+	return 0;
+
+relocated:
+	nlog_info(ni, "Logic block %u relocated from physical block %u to %u\n",
+		  lb, pb, new_pb);
+
+	return 0;
+}
+
 /*
  * nmbm_get_avail_size - Get available user data size
  * @ni: NMBM instance structure
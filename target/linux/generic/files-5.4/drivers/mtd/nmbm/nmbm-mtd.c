@@ -14,10 +14,13 @@
 #include <linux/slab.h>
 #include <linux/interrupt.h>
 #include <linux/sched.h>
-#include <linux/wait.h>
-#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/ktime.h>
+#include <linux/jiffies.h>
+#include <linux/kthread.h>
+#include <linux/bitops.h>
 #include <linux/mtd/mtd.h>
-#include <linux/mtd/flashchip.h>
 #include <linux/mtd/partitions.h>
 #include <linux/of_platform.h>
 #include <linux/kern_levels.h>
@@ -28,6 +31,19 @@
 #define NMBM_MAX_RATIO_DEFAULT			1
 #define NMBM_MAX_BLOCKS_DEFAULT			256
 
+#define NMBM_SCRUB_INTERVAL_MS_DEFAULT		1000
+#define NMBM_SCRUB_IDLE_MS_DEFAULT		200
+
+struct nmbm_scrub_stats {
+	u64 passes;
+	u64 blocks;
+	u64 pages;
+	u64 bitflips;
+	u64 relocated;
+	u64 relocate_failed;
+	u64 uncorrectable;
+};
+
 struct nmbm_mtd {
 	struct mtd_info upper;
 	struct mtd_info *lower;
@@ -35,9 +51,30 @@ struct nmbm_mtd {
 	struct nmbm_instance *ni;
 	uint8_t *page_cache;
 
-	flstate_t state;
-	spinlock_t lock;
-	wait_queue_head_t wq;
+	/* lower page reads, reported after attach */
+	u64 page_reads;
+
+	/* background scrubber */
+	struct task_struct *scrub_thread;
+	struct mutex scrub_lock;
+	unsigned long last_io;
+	unsigned long *scrub_pending;
+	uint8_t *scrub_hwm;
+	uint8_t *scrub_buf;
+	uint32_t scrub_pos;
+	uint32_t scrub_interval_ms;
+	uint32_t scrub_idle_ms;
+	uint32_t scrub_reserve;
+	struct nmbm_scrub_stats scrub_stats;
+
+	/*
+	 * Readers hold map_lock shared. Erase, write and bad block marking
+	 * are serialized by write_lock and also hold map_lock shared, so they
+	 * run concurrently with readers. It is upgraded to exclusive only
+	 * while NMBM changes the mapping of a block.
+	 */
+	struct rw_semaphore map_lock;
+	struct mutex write_lock;
 
 	struct device *dev;
 	struct list_head node;
@@ -80,6 +117,8 @@ static int nmbm_lower_read_page(void *arg, uint64_t addr, void *buf, void *oob,
 		ops.ooblen = mtd_oobavail(nm->lower, &ops);
 	}
 
+	nm->page_reads++;
+
 	ret = mtd_read_oob(nm->lower, addr, &ops);
 	nm->upper.ecc_stats.corrected = nm->lower->ecc_stats.corrected;
 	nm->upper.ecc_stats.failed = nm->lower->ecc_stats.failed;
@@ -105,6 +144,52 @@ static int nmbm_lower_read_page(void *arg, uint64_t addr, void *buf, void *oob,
 	return 0;
 }
 
+static int nmbm_lower_read_pages(void *arg, uint64_t addr, uint32_t count,
+				 void *buf, enum nmbm_oob_mode mode)
+{
+	struct nmbm_mtd *nm = arg;
+	struct mtd_oob_ops ops;
+	int ret;
+
+	memset(&ops, 0, sizeof(ops));
+
+	switch (mode) {
+	case NMBM_MODE_PLACE_OOB:
+		ops.mode = MTD_OPS_PLACE_OOB;
+		break;
+	case NMBM_MODE_AUTO_OOB:
+		ops.mode = MTD_OPS_AUTO_OOB;
+		break;
+	case NMBM_MODE_RAW:
+		ops.mode = MTD_OPS_RAW;
+		break;
+	default:
+		pr_debug("%s: unsupported NMBM mode: %u\n", __func__, mode);
+		return -ENOTSUPP;
+	}
+
+	/* One lower request for the whole run, so the controller can stream */
+	ops.datbuf = buf;
+	ops.len = (size_t)count * nm->lower->writesize;
+
+	nm->page_reads += count;
+
+	ret = mtd_read_oob(nm->lower, addr, &ops);
+	nm->upper.ecc_stats.corrected = nm->lower->ecc_stats.corrected;
+	nm->upper.ecc_stats.failed = nm->lower->ecc_stats.failed;
+
+	if (ret < 0 && ret != -EUCLEAN)
+		return ret;
+
+	/* Same bitflip reporting as nmbm_lower_read_page() */
+	if (ret == -EUCLEAN) {
+		return min_t(u32, nm->lower->bitflip_threshold + 1,
+			     nm->lower->ecc_strength);
+	}
+
+	return 0;
+}
+
 static int nmbm_lower_write_page(void *arg, uint64_t addr, const void *buf,
 				 const void *oob, enum nmbm_oob_mode mode)
 {
@@ -203,40 +288,401 @@ static void nmbm_lower_log(void *arg, enum nmbm_log_category level,
 	kfree(msg);
 }
 
-static int nmbm_get_device(struct nmbm_mtd *nm, int new_state)
+/* Called by NMBM with write_lock and map_lock held */
+static void nmbm_lower_lock_mapping(void *arg)
 {
-	DECLARE_WAITQUEUE(wait, current);
+	struct nmbm_mtd *nm = arg;
 
-retry:
-	spin_lock(&nm->lock);
+	/* No one else can change the mapping meanwhile */
+	up_read(&nm->map_lock);
+	down_write(&nm->map_lock);
+}
 
-	if (nm->state == FL_READY) {
-		nm->state = new_state;
-		spin_unlock(&nm->lock);
-		return 0;
+static void nmbm_lower_unlock_mapping(void *arg)
+{
+	struct nmbm_mtd *nm = arg;
+
+	downgrade_write(&nm->map_lock);
+}
+
+static void nmbm_read_lock(struct nmbm_mtd *nm)
+{
+	down_read(&nm->map_lock);
+}
+
+static void nmbm_read_unlock(struct nmbm_mtd *nm)
+{
+	up_read(&nm->map_lock);
+}
+
+static void nmbm_write_lock(struct nmbm_mtd *nm)
+{
+	mutex_lock(&nm->write_lock);
+	down_read(&nm->map_lock);
+}
+
+static void nmbm_write_unlock(struct nmbm_mtd *nm)
+{
+	up_read(&nm->map_lock);
+	mutex_unlock(&nm->write_lock);
+}
+
+static void nmbm_scrub_note_io(struct nmbm_mtd *nm)
+{
+	WRITE_ONCE(nm->last_io, jiffies);
+}
+
+/*
+ * Blocks returning bitflips above the threshold to a foreground read are
+ * queued so that the scrubber checks them before continuing its walk.
+ */
+static void nmbm_scrub_note_bitflips(struct nmbm_mtd *nm, uint64_t addr,
+				     size_t len)
+{
+	uint32_t lb, end;
+
+	lb = addr >> nm->upper.erasesize_shift;
+	end = (addr + max_t(size_t, len, 1) - 1) >> nm->upper.erasesize_shift;
+
+	for (; lb <= end && lb < nm->ni->data_block_count; lb++)
+		set_bit(lb, nm->scrub_pending);
+}
+
+/* Wait until foreground I/O has been quiet for idle_ms */
+static bool nmbm_scrub_wait_idle(struct nmbm_mtd *nm)
+{
+	unsigned long deadline;
+
+	while (!kthread_should_stop()) {
+		deadline = READ_ONCE(nm->last_io) +
+			   msecs_to_jiffies(READ_ONCE(nm->scrub_idle_ms));
+
+		if (time_after_eq(jiffies, deadline))
+			return true;
+
+		schedule_timeout_interruptible(deadline - jiffies);
 	}
 
-	if (new_state == FL_PM_SUSPENDED) {
-		if (nm->state == FL_PM_SUSPENDED) {
-			spin_unlock(&nm->lock);
-			return 0;
+	return false;
+}
+
+static void nmbm_scrub_block(struct nmbm_mtd *nm, uint32_t lb)
+{
+	struct nmbm_scrub_stats *st = &nm->scrub_stats;
+	uint64_t addr = (uint64_t)lb << nm->upper.erasesize_shift;
+	unsigned int corrected, hwm = 0;
+	bool relocate = false;
+	uint32_t off;
+	int ret;
+
+	for (off = 0; off < nm->upper.erasesize; off += nm->upper.writesize) {
+		if (!nmbm_scrub_wait_idle(nm))
+			return;
+
+		/* May include bitflips corrected for concurrent readers */
+		nmbm_read_lock(nm);
+		corrected = nm->lower->ecc_stats.corrected;
+		ret = nmbm_read_single_page(nm->ni, addr + off, nm->scrub_buf,
+					    NULL, NMBM_MODE_PLACE_OOB);
+		corrected = nm->lower->ecc_stats.corrected - corrected;
+		nmbm_read_unlock(nm);
+
+		/* Bad or unmapped logic block, nothing to scrub */
+		if (ret < 0 && ret != -EBADMSG)
+			return;
+
+		st->pages++;
+		st->bitflips += corrected;
+
+		if (corrected > hwm)
+			hwm = corrected;
+
+		if (ret == -EBADMSG) {
+			/* Too late. Moving it would only make this permanent */
+			st->uncorrectable++;
+			dev_warn(nm->dev,
+				 "scrub: uncorrectable page at 0x%llx\n",
+				 addr + off);
+			relocate = false;
+			break;
+		}
+
+		/* Bitflips reached the threshold of the lower device */
+		if (ret > 0)
+			relocate = true;
+	}
+
+	st->blocks++;
+
+	hwm = min_t(unsigned int, hwm, U8_MAX);
+	if (hwm > nm->scrub_hwm[lb])
+		nm->scrub_hwm[lb] = hwm;
+
+	if (!relocate || !nmbm_scrub_wait_idle(nm))
+		return;
+
+	nmbm_write_lock(nm);
+	ret = nmbm_relocate_block(nm->ni, addr,
+				  READ_ONCE(nm->scrub_reserve));
+	nmbm_write_unlock(nm);
+
+	if (ret) {
+		st->relocate_failed++;
+		dev_warn(nm->dev, "scrub: failed to relocate block %u: %d\n",
+			 lb, ret);
+		return;
+	}
+
+	st->relocated++;
+	nm->scrub_hwm[lb] = 0;
+}
+
+static int nmbm_scrub_thread(void *data)
+{
+	struct nmbm_mtd *nm = data;
+	uint32_t lb, count = nm->ni->data_block_count;
+
+	while (!kthread_should_stop()) {
+		lb = find_first_bit(nm->scrub_pending, count);
+		if (lb < count) {
+			clear_bit(lb, nm->scrub_pending);
+		} else {
+			lb = nm->scrub_pos++;
+
+			if (nm->scrub_pos >= count) {
+				nm->scrub_pos = 0;
+				nm->scrub_stats.passes++;
+			}
 		}
+
+		nmbm_scrub_block(nm, lb);
+
+		schedule_timeout_interruptible(
+			msecs_to_jiffies(READ_ONCE(nm->scrub_interval_ms)));
+		cond_resched();
+	}
+
+	return 0;
+}
+
+/* Called with scrub_lock held */
+static int nmbm_scrub_start(struct nmbm_mtd *nm)
+{
+	struct task_struct *thread;
+
+	if (nm->scrub_thread)
+		return 0;
+
+	thread = kthread_run(nmbm_scrub_thread, nm, "nmbm_scrub/%s",
+			     dev_name(nm->dev));
+	if (IS_ERR(thread))
+		return PTR_ERR(thread);
+
+	nm->scrub_thread = thread;
+
+	return 0;
+}
+
+/* Called with scrub_lock held */
+static void nmbm_scrub_stop(struct nmbm_mtd *nm)
+{
+	if (!nm->scrub_thread)
+		return;
+
+	kthread_stop(nm->scrub_thread);
+	nm->scrub_thread = NULL;
+}
+
+static ssize_t enable_show(struct device *dev, struct device_attribute *attr,
+			   char *buf)
+{
+	struct nmbm_mtd *nm = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%d\n", !!READ_ONCE(nm->scrub_thread));
+}
+
+static ssize_t enable_store(struct device *dev, struct device_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct nmbm_mtd *nm = dev_get_drvdata(dev);
+	bool enable;
+	int ret;
+
+	ret = kstrtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	mutex_lock(&nm->scrub_lock);
+
+	if (enable)
+		ret = nmbm_scrub_start(nm);
+	else
+		nmbm_scrub_stop(nm);
+
+	mutex_unlock(&nm->scrub_lock);
+
+	return ret ? ret : count;
+}
+static DEVICE_ATTR_RW(enable);
+
+#define NMBM_SCRUB_CONFIG_ATTR(_name, _field, _min)			\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct nmbm_mtd *nm = dev_get_drvdata(dev);			\
+									\
+	return sprintf(buf, "%u\n", READ_ONCE(nm->_field));		\
+}									\
+									\
+static ssize_t _name##_store(struct device *dev,			\
+			     struct device_attribute *attr,		\
+			     const char *buf, size_t count)		\
+{									\
+	struct nmbm_mtd *nm = dev_get_drvdata(dev);			\
+	u32 val;							\
+	int ret;							\
+									\
+	ret = kstrtou32(buf, 0, &val);					\
+	if (ret)							\
+		return ret;						\
+									\
+	if (val < _min)							\
+		return -EINVAL;						\
+									\
+	WRITE_ONCE(nm->_field, val);					\
+									\
+	return count;							\
+}									\
+static DEVICE_ATTR_RW(_name)
+
+NMBM_SCRUB_CONFIG_ATTR(interval_ms, scrub_interval_ms, 1);
+NMBM_SCRUB_CONFIG_ATTR(idle_ms, scrub_idle_ms, 0);
+NMBM_SCRUB_CONFIG_ATTR(reserve, scrub_reserve, 0);
+
+#define NMBM_SCRUB_STAT_ATTR(_name)					\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	struct nmbm_mtd *nm = dev_get_drvdata(dev);			\
+									\
+	return sprintf(buf, "%llu\n", nm->scrub_stats._name);		\
+}									\
+static DEVICE_ATTR_RO(_name)
+
+NMBM_SCRUB_STAT_ATTR(passes);
+NMBM_SCRUB_STAT_ATTR(blocks);
+NMBM_SCRUB_STAT_ATTR(pages);
+NMBM_SCRUB_STAT_ATTR(bitflips);
+NMBM_SCRUB_STAT_ATTR(relocated);
+NMBM_SCRUB_STAT_ATTR(relocate_failed);
+NMBM_SCRUB_STAT_ATTR(uncorrectable);
+
+static ssize_t position_show(struct device *dev, struct device_attribute *attr,
+			     char *buf)
+{
+	struct nmbm_mtd *nm = dev_get_drvdata(dev);
+
+	return sprintf(buf, "%u/%u\n", READ_ONCE(nm->scrub_pos),
+		       nm->ni->data_block_count);
+}
+static DEVICE_ATTR_RO(position);
+
+/* Logic blocks with bitflips seen, as "<block> <max bitflips per page>" */
+static ssize_t hwm_show(struct device *dev, struct device_attribute *attr,
+			char *buf)
+{
+	struct nmbm_mtd *nm = dev_get_drvdata(dev);
+	ssize_t len = 0;
+	uint32_t lb;
+
+	for (lb = 0; lb < nm->ni->data_block_count; lb++) {
+		if (!nm->scrub_hwm[lb])
+			continue;
+
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u %u\n", lb,
+				 nm->scrub_hwm[lb]);
+	}
+
+	return len;
+}
+static DEVICE_ATTR_RO(hwm);
+
+static struct attribute *nmbm_scrub_attrs[] = {
+	&dev_attr_enable.attr,
+	&dev_attr_interval_ms.attr,
+	&dev_attr_idle_ms.attr,
+	&dev_attr_reserve.attr,
+	&dev_attr_position.attr,
+	&dev_attr_passes.attr,
+	&dev_attr_blocks.attr,
+	&dev_attr_pages.attr,
+	&dev_attr_bitflips.attr,
+	&dev_attr_relocated.attr,
+	&dev_attr_relocate_failed.attr,
+	&dev_attr_uncorrectable.attr,
+	&dev_attr_hwm.attr,
+	NULL,
+};
+
+static const struct attribute_group nmbm_scrub_group = {
+	.name = "scrub",
+	.attrs = nmbm_scrub_attrs,
+};
+
+static int nmbm_scrub_init(struct nmbm_mtd *nm, struct device_node *np)
+{
+	struct nmbm_instance *ni = nm->ni;
+	uint32_t interval_ms;
+	int ret;
+
+	nm->scrub_buf = devm_kmalloc(nm->dev, nm->lower->writesize,
+				     GFP_KERNEL);
+	nm->scrub_hwm = devm_kzalloc(nm->dev, ni->data_block_count,
+				     GFP_KERNEL);
+	nm->scrub_pending = devm_kcalloc(nm->dev,
+					 BITS_TO_LONGS(ni->data_block_count),
+					 sizeof(unsigned long), GFP_KERNEL);
+	if (!nm->scrub_buf || !nm->scrub_hwm || !nm->scrub_pending)
+		return -ENOMEM;
+
+	/* Leave half of the spare blocks for blocks really going bad */
+	nm->scrub_reserve = (ni->mapping_blocks_top_ba -
+			     ni->mapping_blocks_ba) / 2;
+	nm->scrub_interval_ms = NMBM_SCRUB_INTERVAL_MS_DEFAULT;
+	nm->scrub_idle_ms = NMBM_SCRUB_IDLE_MS_DEFAULT;
+
+	ret = sysfs_create_group(&nm->dev->kobj, &nmbm_scrub_group);
+	if (ret)
+		return ret;
+
+	if (of_property_read_u32(np, "scrub-interval-ms", &interval_ms))
+		return 0;
+
+	if (!interval_ms) {
+		dev_warn(nm->dev, "invalid scrub interval, using %u ms\n",
+			 nm->scrub_interval_ms);
+		interval_ms = nm->scrub_interval_ms;
 	}
 
-	set_current_state(TASK_UNINTERRUPTIBLE);
-	add_wait_queue(&nm->wq, &wait);
-	spin_unlock(&nm->lock);
-	schedule();
-	remove_wait_queue(&nm->wq, &wait);
-	goto retry;
+	nm->scrub_interval_ms = interval_ms;
+
+	mutex_lock(&nm->scrub_lock);
+	ret = nmbm_scrub_start(nm);
+	mutex_unlock(&nm->scrub_lock);
+
+	if (ret)
+		dev_warn(nm->dev, "failed to start scrubber: %d\n", ret);
+
+	return 0;
 }
 
-static void nmbm_release_device(struct nmbm_mtd *nm)
+static void nmbm_scrub_exit(struct nmbm_mtd *nm)
 {
-	spin_lock(&nm->lock);
-	nm->state = FL_READY;
-	wake_up(&nm->wq);
-	spin_unlock(&nm->lock);
+	sysfs_remove_group(&nm->dev->kobj, &nmbm_scrub_group);
+
+	mutex_lock(&nm->scrub_lock);
+	nmbm_scrub_stop(nm);
+	mutex_unlock(&nm->scrub_lock);
 }
 
 static int nmbm_mtd_erase(struct mtd_info *mtd, struct erase_info *instr)
@@ -244,12 +690,13 @@ static int nmbm_mtd_erase(struct mtd_info *mtd, struct erase_info *instr)
 	struct nmbm_mtd *nm = container_of(mtd, struct nmbm_mtd, upper);
 	int ret;
 
-	nmbm_get_device(nm, FL_ERASING);
+	nmbm_scrub_note_io(nm);
+	nmbm_write_lock(nm);
 
 	ret = nmbm_erase_block_range(nm->ni, instr->addr, instr->len,
 				     &instr->fail_addr);
 
-	nmbm_release_device(nm);
+	nmbm_write_unlock(nm);
 
 	if (!ret)
 		return 0;
@@ -257,15 +704,46 @@ static int nmbm_mtd_erase(struct mtd_info *mtd, struct erase_info *instr)
 	return -EIO;
 }
 
+/*
+ * Read through a page buffer of the caller's own. nm->page_cache belongs to
+ * the writer, and other readers may be running at the same time.
+ */
+static int nmbm_mtd_read_range(struct nmbm_mtd *nm, uint64_t addr,
+			       size_t size, uint8_t *buf,
+			       enum nmbm_oob_mode mode, size_t *retlen)
+{
+	uint8_t *bounce = NULL;
+	int ret;
+
+	/* Aligned pages need no buffer */
+	if ((addr | size) & nm->lower->writesize_mask) {
+		bounce = kmalloc(nm->lower->writesize, GFP_KERNEL);
+		if (!bounce)
+			return -ENOMEM;
+	}
+
+	ret = nmbm_read_range_buf(nm->ni, addr, size, buf, bounce, mode,
+				  retlen);
+
+	kfree(bounce);
+
+	return ret;
+}
+
 static int nmbm_mtd_read_data(struct nmbm_mtd *nm, uint64_t addr,
 			      struct mtd_oob_ops *ops, enum nmbm_oob_mode mode)
 {
 	size_t len, ooblen, maxooblen, chklen;
 	uint32_t col, ooboffs;
-	uint8_t *datcache, *oobcache;
+	uint8_t *cache, *datcache, *oobcache;
 	bool has_ecc_err = false;
 	int ret, max_bitflips = 0;
 
+	/* Not nm->page_cache, which belongs to the writer */
+	cache = kmalloc(nm->lower->writesize + nm->lower->oobsize, GFP_KERNEL);
+	if (!cache)
+		return -ENOMEM;
+
 	col = addr & nm->lower->writesize_mask;
 	addr &= ~nm->lower->writesize_mask;
 	maxooblen = mtd_oobavail(nm->lower, ops);
@@ -273,8 +751,8 @@ static int nmbm_mtd_read_data(struct nmbm_mtd *nm, uint64_t addr,
 	ooblen = ops->ooblen;
 	len = ops->len;
 
-	datcache = len ? nm->page_cache : NULL;
-	oobcache = ooblen ? nm->page_cache + nm->lower->writesize : NULL;
+	datcache = len ? cache : NULL;
+	oobcache = ooblen ? cache + nm->lower->writesize : NULL;
 
 	ops->oobretlen = 0;
 	ops->retlen = 0;
@@ -283,7 +761,7 @@ static int nmbm_mtd_read_data(struct nmbm_mtd *nm, uint64_t addr,
 		ret = nmbm_read_single_page(nm->ni, addr, datcache, oobcache,
 					    mode);
 		if (ret < 0 && ret != -EBADMSG)
-			return ret;
+			goto out;
 
 		/* Continue reading on ecc error */
 		if (ret == -EBADMSG)
@@ -323,9 +801,14 @@ static int nmbm_mtd_read_data(struct nmbm_mtd *nm, uint64_t addr,
 	}
 
 	if (has_ecc_err)
-		return -EBADMSG;
+		ret = -EBADMSG;
+	else
+		ret = max_bitflips;
 
-	return max_bitflips;
+out:
+	kfree(cache);
+
+	return ret;
 }
 
 static int nmbm_mtd_read_oob(struct mtd_info *mtd, loff_t from,
@@ -367,14 +850,19 @@ static int nmbm_mtd_read_oob(struct mtd_info *mtd, loff_t from,
 		return -EINVAL;
 	}
 
+	nmbm_scrub_note_io(nm);
+
 	if (!ops->oobbuf) {
-		nmbm_get_device(nm, FL_READING);
+		nmbm_read_lock(nm);
 
 		/* Optimized for reading data only */
-		ret = nmbm_read_range(nm->ni, from, ops->len, ops->datbuf,
-				      mode, &ops->retlen);
+		ret = nmbm_mtd_read_range(nm, from, ops->len, ops->datbuf,
+					  mode, &ops->retlen);
+
+		nmbm_read_unlock(nm);
 
-		nmbm_release_device(nm);
+		if (ret > 0)
+			nmbm_scrub_note_bitflips(nm, from, ops->len);
 
 		return ret;
 	}
@@ -393,9 +881,12 @@ static int nmbm_mtd_read_oob(struct mtd_info *mtd, loff_t from,
 		return -EINVAL;
 	}
 
-	nmbm_get_device(nm, FL_READING);
+	nmbm_read_lock(nm);
 	ret = nmbm_mtd_read_data(nm, from, ops, mode);
-	nmbm_release_device(nm);
+	nmbm_read_unlock(nm);
+
+	if (ret > 0)
+		nmbm_scrub_note_bitflips(nm, from, ops->retlen);
 
 	return ret;
 }
@@ -505,14 +996,16 @@ static int nmbm_mtd_write_oob(struct mtd_info *mtd, loff_t to,
 		return -EINVAL;
 	}
 
+	nmbm_scrub_note_io(nm);
+
 	if (!ops->oobbuf) {
-		nmbm_get_device(nm, FL_WRITING);
+		nmbm_write_lock(nm);
 
 		/* Optimized for writing data only */
 		ret = nmbm_write_range(nm->ni, to, ops->len, ops->datbuf,
 				       mode, &ops->retlen);
 
-		nmbm_release_device(nm);
+		nmbm_write_unlock(nm);
 
 		return ret;
 	}
@@ -531,9 +1024,9 @@ static int nmbm_mtd_write_oob(struct mtd_info *mtd, loff_t to,
 		return -EINVAL;
 	}
 
-	nmbm_get_device(nm, FL_WRITING);
+	nmbm_write_lock(nm);
 	ret = nmbm_mtd_write_data(nm, to, ops, mode);
-	nmbm_release_device(nm);
+	nmbm_write_unlock(nm);
 
 	return ret;
 }
@@ -543,9 +1036,9 @@ static int nmbm_mtd_block_isbad(struct mtd_info *mtd, loff_t offs)
 	struct nmbm_mtd *nm = container_of(mtd, struct nmbm_mtd, upper);
 	int ret;
 
-	nmbm_get_device(nm, FL_READING);
+	nmbm_read_lock(nm);
 	ret = nmbm_check_bad_block(nm->ni, offs);
-	nmbm_release_device(nm);
+	nmbm_read_unlock(nm);
 
 	return ret;
 }
@@ -555,9 +1048,9 @@ static int nmbm_mtd_block_markbad(struct mtd_info *mtd, loff_t offs)
 	struct nmbm_mtd *nm = container_of(mtd, struct nmbm_mtd, upper);
 	int ret;
 
-	nmbm_get_device(nm, FL_WRITING);
+	nmbm_write_lock(nm);
 	ret = nmbm_mark_bad_block(nm->ni, offs);
-	nmbm_release_device(nm);
+	nmbm_write_unlock(nm);
 
 	return ret;
 }
@@ -566,18 +1059,30 @@ static void nmbm_mtd_shutdown(struct mtd_info *mtd)
 {
 	struct nmbm_mtd *nm = container_of(mtd, struct nmbm_mtd, upper);
 
-	nmbm_get_device(nm, FL_PM_SUSPENDED);
+	mutex_lock(&nm->scrub_lock);
+	nmbm_scrub_stop(nm);
+	mutex_unlock(&nm->scrub_lock);
+
+	nmbm_write_lock(nm);
+
+	/* Fold the delta log so that the bootloader finds complete tables */
+	nmbm_detach(nm->ni);
+
+	/* Nothing may touch the flash until reboot. Never released */
+	up_read(&nm->map_lock);
+	down_write(&nm->map_lock);
 }
 
 static int nmbm_probe(struct platform_device *pdev)
 {
 	struct device_node *mtd_np, *np = pdev->dev.of_node;
 	uint32_t max_ratio, max_reserved_blocks, alloc_size;
-	bool forced_create, empty_page_ecc_ok;
+	bool forced_create, empty_page_ecc_ok, delta_log;
 	struct nmbm_lower_device nld;
 	struct mtd_info *lower, *mtd;
 	struct nmbm_mtd *nm;
 	const char *mtdname;
+	ktime_t start;
 	int ret;
 
 	mtd_np = of_parse_phandle(np, "lower-mtd-device", 0);
@@ -613,6 +1118,9 @@ do_attach_mtd:
 	empty_page_ecc_ok = of_property_read_bool(np,
 						  "empty-page-ecc-protected");
 
+	/* Remaps are never logged, boot loaders need not replay the log */
+	delta_log = of_property_read_bool(np, "delta-log");
+
 	memset(&nld, 0, sizeof(nld));
 
 	nld.flags = 0;
@@ -623,6 +1131,9 @@ do_attach_mtd:
 	if (empty_page_ecc_ok)
 		nld.flags |= NMBM_F_EMPTY_PAGE_ECC_OK;
 
+	if (delta_log)
+		nld.flags |= NMBM_F_DELTA_LOG;
+
 	nld.max_ratio = max_ratio;
 	nld.max_reserved_blocks = max_reserved_blocks;
 
@@ -633,10 +1144,13 @@ do_attach_mtd:
 	nld.oobavail = lower->oobavail;
 
 	nld.read_page = nmbm_lower_read_page;
+	nld.read_pages = nmbm_lower_read_pages;
 	nld.write_page = nmbm_lower_write_page;
 	nld.erase_block = nmbm_lower_erase_block;
 	nld.is_bad_block = nmbm_lower_is_bad_block;
 	nld.mark_bad_block = nmbm_lower_mark_bad_block;
+	nld.lock_mapping = nmbm_lower_lock_mapping;
+	nld.unlock_mapping = nmbm_lower_unlock_mapping;
 
 	nld.logprint = nmbm_lower_log;
 
@@ -655,15 +1169,21 @@ do_attach_mtd:
 	nm->dev = &pdev->dev;
 
 	INIT_LIST_HEAD(&nm->node);
-	spin_lock_init(&nm->lock);
-	init_waitqueue_head(&nm->wq);
+	init_rwsem(&nm->map_lock);
+	mutex_init(&nm->write_lock);
+	mutex_init(&nm->scrub_lock);
 
 	nld.arg = nm;
 
+	start = ktime_get();
+
 	ret = nmbm_attach(&nld, nm->ni);
 	if (ret)
 		goto out;
 
+	dev_info(&pdev->dev, "attached in %lld us, %llu page reads\n",
+		 ktime_us_delta(ktime_get(), start), nm->page_reads);
+
 	/* Initialize upper mtd */
 	mtd = &nm->upper;
 
@@ -712,6 +1232,14 @@ do_attach_mtd:
 
 	platform_set_drvdata(pdev, nm);
 
+	ret = nmbm_scrub_init(nm, np);
+	if (ret) {
+		dev_err(&pdev->dev, "failed to set up scrubber\n");
+		mtd_device_unregister(mtd);
+		nmbm_detach(nm->ni);
+		goto out;
+	}
+
 	mutex_lock(&nmbm_devs_lock);
 	list_add_tail(&nm->node, &nmbm_devs);
 	mutex_unlock(&nmbm_devs_lock);
@@ -737,6 +1265,8 @@ static int nmbm_remove(struct platform_device *pdev)
 	if (ret)
 		return ret;
 
+	nmbm_scrub_exit(nm);
+
 	nmbm_detach(nm->ni);
 
 	mutex_lock(&nmbm_devs_lock);
@@ -14,6 +14,7 @@
 
 #define NMBM_MAGIC_SIGNATURE			0x304d4d4e	/* NMM0 */
 #define NMBM_MAGIC_INFO_TABLE			0x314d4d4e	/* NMM1 */
+#define NMBM_MAGIC_DELTA_LOG			0x324d4d4e	/* NMM2 */
 
 #define NMBM_VERSION_MAJOR_S			0
 #define NMBM_VERSION_MAJOR_M			0xffff
@@ -63,7 +64,8 @@ struct nmbm_signature {
 	uint32_t spare_size;
 	uint32_t mgmt_start_pb;
 	uint8_t max_try_count;
-	uint8_t padding[3];
+	uint8_t padding;
+	uint16_t backup_table_hint;	/* from mgmt_start_pb, 0 if unknown */
 };
 
 struct nmbm_info_table_header {
@@ -74,6 +76,23 @@ struct nmbm_info_table_header {
 	uint32_t padding;
 };
 
+struct nmbm_delta_header {
+	struct nmbm_header header;
+	uint32_t write_count;
+	uint32_t seq;
+	uint32_t record_count;
+	uint32_t padding;
+};
+
+#define NMBM_DELTA_STATE			0
+#define NMBM_DELTA_MAPPING			1
+
+struct nmbm_delta_record {
+	uint32_t type;
+	uint32_t index;
+	int32_t value;
+};
+
 struct nmbm_instance {
 	struct nmbm_lower_device lower;
 
@@ -103,6 +122,12 @@ struct nmbm_instance {
 
 	uint8_t *page_cache;
 
+	uint8_t *delta_cache;
+	uint32_t delta_log_off;
+	uint32_t delta_log_next;
+	uint32_t delta_seq;
+	bool delta_log_ready;
+
 	int protected;
 
 	uint32_t block_count;
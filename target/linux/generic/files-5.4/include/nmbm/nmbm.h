@@ -51,12 +51,27 @@ struct nmbm_lower_device {
 	 *    return negative number for other errors
 	 */
 	int (*read_page)(void *arg, uint64_t addr, void *buf, void *oob, enum nmbm_oob_mode mode);
+
+	/*
+	 * read_pages: (optional)
+	 *    read main data of @count contiguous pages within one block
+	 *    return value is the same as read_page
+	 */
+	int (*read_pages)(void *arg, uint64_t addr, uint32_t count, void *buf, enum nmbm_oob_mode mode);
 	int (*write_page)(void *arg, uint64_t addr, const void *buf, const void *oob, enum nmbm_oob_mode mode);
 	int (*erase_block)(void *arg, uint64_t addr);
 
 	int (*is_bad_block)(void *arg, uint64_t addr);
 	int (*mark_bad_block)(void *arg, uint64_t addr);
 
+	/*
+	 * lock_mapping/unlock_mapping: (optional)
+	 *    bracket changes of the block mapping, so that the OS layer can
+	 *    let readers run concurrently with erase and write otherwise
+	 */
+	void (*lock_mapping)(void *arg);
+	void (*unlock_mapping)(void *arg);
+
 	/* OS-dependent logging function */
 	void (*logprint)(void *arg, enum nmbm_log_category level, const char *fmt, va_list ap);
 };
@@ -72,6 +87,13 @@ struct nmbm_instance;
 /* Do not write anything back to flash */
 #define NMBM_F_READ_ONLY		0x04
 
+/*
+ * Record table changes in an append-only log following the info tables
+ * instead of rewriting the tables for every change.
+ * The log is always replayed on attach regardless of this flag.
+ */
+#define NMBM_F_DELTA_LOG		0x08
+
 size_t nmbm_calc_structure_size(struct nmbm_lower_device *nld);
 int nmbm_attach(struct nmbm_lower_device *nld, struct nmbm_instance *ni);
 int nmbm_detach(struct nmbm_instance *ni);
@@ -85,6 +107,9 @@ int nmbm_read_single_page(struct nmbm_instance *ni, uint64_t addr, void *data,
 			  void *oob, enum nmbm_oob_mode mode);
 int nmbm_read_range(struct nmbm_instance *ni, uint64_t addr, size_t size,
 		    void *data, enum nmbm_oob_mode mode, size_t *retlen);
+int nmbm_read_range_buf(struct nmbm_instance *ni, uint64_t addr, size_t size,
+			void *data, void *page_buf, enum nmbm_oob_mode mode,
+			size_t *retlen);
 int nmbm_write_single_page(struct nmbm_instance *ni, uint64_t addr,
 			   const void *data, const void *oob,
 			   enum nmbm_oob_mode mode);
@@ -94,6 +119,8 @@ int nmbm_write_range(struct nmbm_instance *ni, uint64_t addr, size_t size,
 
 int nmbm_check_bad_block(struct nmbm_instance *ni, uint64_t addr);
 int nmbm_mark_bad_block(struct nmbm_instance *ni, uint64_t addr);
+int nmbm_relocate_block(struct nmbm_instance *ni, uint64_t addr,
+			uint32_t reserve);
 
 uint64_t nmbm_get_avail_size(struct nmbm_instance *ni);
 
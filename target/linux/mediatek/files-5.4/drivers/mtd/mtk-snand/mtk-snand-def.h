@@ -93,8 +93,12 @@ struct snand_flash_info {
 	const struct snand_io_cap *cap_rd;
 	const struct snand_io_cap *cap_pl;
 	snand_select_die_t select_die;
+	uint32_t flags;
 };
 
+/* Chip supports PAGE READ CACHE SEQUENTIAL (31h) / CACHE LAST (3Fh) */
+#define SNAND_F_READ_CACHE_SEQ		BIT(0)
+
 #define SNAND_INFO(_model, _id, _memorg, _cap_rd, _cap_pl, ...) \
 	{ .model = (_model), .id = _id, .memorg = _memorg, \
 	  .cap_rd = (_cap_rd), .cap_pl = (_cap_pl), __VA_ARGS__ }
@@ -155,6 +159,12 @@ struct mtk_snand {
 	uint32_t num_dies;
 	snand_select_die_t select_die;
 
+	/* Page read cache sequential state, see mtk_snand_read_seq_start() */
+	bool read_cache_seq;
+	bool seq_busy;
+	uint64_t seq_addr;
+	uint32_t seq_left;
+
 	uint8_t opcode_rfc;
 	uint8_t opcode_pl;
 	uint8_t dummy_rfc;
@@ -242,8 +252,10 @@ static inline int mtk_snand_ffs64(uint64_t x)
 #define SNAND_CMD_READ_FROM_CACHE_DUAL	0xbb
 #define SNAND_CMD_READID		0x9f
 #define SNAND_CMD_READ_FROM_CACHE_X4	0x6b
+#define SNAND_CMD_READ_CACHE_END	0x3f
 #define SNAND_CMD_READ_FROM_CACHE_X2	0x3b
 #define SNAND_CMD_PROGRAM_LOAD_X4	0x32
+#define SNAND_CMD_READ_CACHE_SEQ	0x31
 #define SNAND_CMD_SET_FEATURE		0x1f
 #define SNAND_CMD_READ_TO_CACHE		0x13
 #define SNAND_CMD_PROGRAM_EXECUTE	0x10
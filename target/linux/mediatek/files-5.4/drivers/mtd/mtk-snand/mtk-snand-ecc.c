@@ -142,8 +142,8 @@ static int mtk_ecc_wait_idle(struct mtk_snand *snf, uint32_t reg)
 int mtk_ecc_setup(struct mtk_snand *snf, void *fmdaddr, uint32_t max_ecc_bytes,
 		  uint32_t msg_size)
 {
-	uint32_t i, val, ecc_msg_bits, ecc_strength;
-	int ret;
+	uint32_t val, ecc_msg_bits, ecc_strength;
+	int i, ret;
 
 	snf->ecc_soc = &mtk_ecc_socs[snf->soc];
 
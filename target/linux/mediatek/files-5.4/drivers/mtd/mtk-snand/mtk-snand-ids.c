@@ -180,37 +180,45 @@ static const struct snand_flash_info snand_flash_ids[] = {
 	SNAND_INFO("MT29F1G01AAADD", SNAND_ID(SNAND_ID_DYMMY, 0x2c, 0x12),
 		   SNAND_MEMORG_1G_2K_64,
 		   &snand_cap_read_from_cache_x4,
-		   &snand_cap_program_load_x1),
+		   &snand_cap_program_load_x1,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 	SNAND_INFO("MT29F1G01ABAFD", SNAND_ID(SNAND_ID_DYMMY, 0x2c, 0x14),
 		   SNAND_MEMORG_1G_2K_128,
 		   &snand_cap_read_from_cache_quad,
-		   &snand_cap_program_load_x4),
+		   &snand_cap_program_load_x4,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 	SNAND_INFO("MT29F2G01AAAED", SNAND_ID(SNAND_ID_DYMMY, 0x2c, 0x9f),
 		   SNAND_MEMORG_2G_2K_64_2P,
 		   &snand_cap_read_from_cache_x4,
-		   &snand_cap_program_load_x1),
+		   &snand_cap_program_load_x1,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 	SNAND_INFO("MT29F2G01ABAGD", SNAND_ID(SNAND_ID_DYMMY, 0x2c, 0x24),
 		   SNAND_MEMORG_2G_2K_128_2P,
 		   &snand_cap_read_from_cache_quad,
-		   &snand_cap_program_load_x4),
+		   &snand_cap_program_load_x4,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 	SNAND_INFO("MT29F4G01AAADD", SNAND_ID(SNAND_ID_DYMMY, 0x2c, 0x32),
 		   SNAND_MEMORG_4G_2K_64_2P,
 		   &snand_cap_read_from_cache_x4,
-		   &snand_cap_program_load_x1),
+		   &snand_cap_program_load_x1,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 	SNAND_INFO("MT29F4G01ABAFD", SNAND_ID(SNAND_ID_DYMMY, 0x2c, 0x34),
 		   SNAND_MEMORG_4G_4K_256,
 		   &snand_cap_read_from_cache_quad,
-		   &snand_cap_program_load_x4),
+		   &snand_cap_program_load_x4,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 	SNAND_INFO("MT29F4G01ADAGD", SNAND_ID(SNAND_ID_DYMMY, 0x2c, 0x36),
 		   SNAND_MEMORG_4G_2K_128_2P_2D,
 		   &snand_cap_read_from_cache_quad,
 		   &snand_cap_program_load_x4,
-		   mtk_snand_micron_select_die),
+		   mtk_snand_micron_select_die,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 	SNAND_INFO("MT29F8G01ADAFD", SNAND_ID(SNAND_ID_DYMMY, 0x2c, 0x46),
 		   SNAND_MEMORG_8G_4K_256_2D,
 		   &snand_cap_read_from_cache_quad,
 		   &snand_cap_program_load_x4,
-		   mtk_snand_micron_select_die),
+		   mtk_snand_micron_select_die,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 
 	SNAND_INFO("TC58CVG0S3HRAIG", SNAND_ID(SNAND_ID_DYMMY, 0x98, 0xc2),
 		   SNAND_MEMORG_1G_2K_128,
@@ -227,19 +235,23 @@ static const struct snand_flash_info snand_flash_ids[] = {
 	SNAND_INFO("TC58CVG0S3HRAIJ", SNAND_ID(SNAND_ID_DYMMY, 0x98, 0xe2),
 		   SNAND_MEMORG_1G_2K_128,
 		   &snand_cap_read_from_cache_x4,
-		   &snand_cap_program_load_x4),
+		   &snand_cap_program_load_x4,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 	SNAND_INFO("TC58CVG1S3HRAIJ", SNAND_ID(SNAND_ID_DYMMY, 0x98, 0xeb),
 		   SNAND_MEMORG_2G_2K_128,
 		   &snand_cap_read_from_cache_x4,
-		   &snand_cap_program_load_x4),
+		   &snand_cap_program_load_x4,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 	SNAND_INFO("TC58CVG2S0HRAIJ", SNAND_ID(SNAND_ID_DYMMY, 0x98, 0xed),
 		   SNAND_MEMORG_4G_4K_256,
 		   &snand_cap_read_from_cache_x4,
-		   &snand_cap_program_load_x4),
+		   &snand_cap_program_load_x4,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 	SNAND_INFO("TH58CVG3S0HRAIJ", SNAND_ID(SNAND_ID_DYMMY, 0x98, 0xe4),
 		   SNAND_MEMORG_8G_4K_256,
 		   &snand_cap_read_from_cache_x4,
-		   &snand_cap_program_load_x4),
+		   &snand_cap_program_load_x4,
+		   .flags = SNAND_F_READ_CACHE_SEQ),
 
 	SNAND_INFO("F50L512M41A", SNAND_ID(SNAND_ID_DYMMY, 0xc8, 0x20),
 		   SNAND_MEMORG_512M_2K_64,
@@ -102,7 +102,7 @@ static int mtk_snand_mtd_read_data(struct mtk_snand_mtd *msm, uint64_t addr,
 {
 	struct mtd_info *mtd = &msm->mtd;
 	size_t len, ooblen, maxooblen, chklen;
-	uint32_t col, ooboffs;
+	uint32_t col, ooboffs, npages;
 	uint8_t *datcache, *oobcache;
 	bool ecc_failed = false, raw = ops->mode == MTD_OPS_RAW ? true : false;
 	int ret, max_bitflips = 0;
@@ -120,6 +120,11 @@ static int mtk_snand_mtd_read_data(struct mtk_snand_mtd *msm, uint64_t addr,
 	ops->oobretlen = 0;
 	ops->retlen = 0;
 
+	/* Let the chip prefetch the following pages of a multi-page read */
+	npages = max_t(uint32_t, DIV_ROUND_UP(col + len, mtd->writesize),
+		       DIV_ROUND_UP(ooboffs + ooblen, maxooblen));
+	mtk_snand_read_seq_start(msm->snf, addr, npages);
+
 	while (len || ooblen) {
 		if (ops->mode == MTD_OPS_AUTO_OOB)
 			ret = mtk_snand_read_page_auto_oob(msm->snf, addr,
@@ -129,7 +134,7 @@ static int mtk_snand_mtd_read_data(struct mtk_snand_mtd *msm, uint64_t addr,
 				oobcache, raw);
 
 		if (ret < 0 && ret != -EBADMSG)
-			return ret;
+			goto out;
 
 		if (ret == -EBADMSG) {
 			mtd->ecc_stats.failed++;
@@ -168,7 +173,12 @@ static int mtk_snand_mtd_read_data(struct mtk_snand_mtd *msm, uint64_t addr,
 		addr += mtd->writesize;
 	}
 
-	return ecc_failed ? -EBADMSG : max_bitflips;
+	ret = ecc_failed ? -EBADMSG : max_bitflips;
+
+out:
+	mtk_snand_read_seq_stop(msm->snf);
+
+	return ret;
 }
 
 static int mtk_snand_mtd_read_oob(struct mtd_info *mtd, loff_t from,
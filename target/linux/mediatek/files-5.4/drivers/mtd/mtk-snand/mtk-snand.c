@@ -495,6 +495,10 @@ int mtk_snand_chip_reset(struct mtk_snand *snf)
 	uint8_t op = SNAND_CMD_RESET;
 	int ret;
 
+	/* Reset also drops any sequential read in progress */
+	snf->seq_busy = false;
+	snf->seq_left = 0;
+
 	ret = mtk_snand_mac_io(snf, &op, 1, NULL, 0);
 	if (ret)
 		return ret;
@@ -664,6 +668,151 @@ static int mtk_snand_page_op(struct mtk_snand *snf, uint32_t page, uint8_t cmd)
 	return mtk_snand_mac_io(snf, op, sizeof(op), NULL, 0);
 }
 
+static int mtk_snand_cache_op(struct mtk_snand *snf, uint8_t cmd)
+{
+	int ret;
+
+	ret = mtk_snand_mac_io(snf, &cmd, 1, NULL, 0);
+	if (ret)
+		return ret;
+
+	ret = mtk_snand_poll_status(snf, SNFI_POLL_INTERVAL);
+	if (ret < 0) {
+		snand_log_chip(snf->pdev, "Cache command %02xh timed out\n",
+			       cmd);
+		return ret;
+	}
+
+	return 0;
+}
+
+static void mtk_snand_read_seq_abort(struct mtk_snand *snf)
+{
+	/* A sequential read must be terminated with PAGE READ CACHE LAST */
+	if (snf->seq_busy)
+		mtk_snand_cache_op(snf, SNAND_CMD_READ_CACHE_END);
+
+	snf->seq_busy = false;
+	snf->seq_left = 0;
+}
+
+static int mtk_snand_page_read(struct mtk_snand *snf, uint64_t addr,
+			       uint32_t *page)
+{
+	uint64_t die_addr;
+	int ret;
+
+	die_addr = mtk_snand_select_die_address(snf, addr);
+	*page = die_addr >> snf->writesize_shift;
+
+	ret = mtk_snand_page_op(snf, *page, SNAND_CMD_READ_TO_CACHE);
+	if (ret)
+		return ret;
+
+	ret = mtk_snand_poll_status(snf, SNFI_POLL_INTERVAL);
+	if (ret < 0) {
+		snand_log_chip(snf->pdev, "Read to cache command timed out\n");
+		return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Load the page at addr into the cache register of the chip. Pages announced
+ * by mtk_snand_read_seq_start() are loaded with PAGE READ CACHE SEQUENTIAL,
+ * which lets the chip fetch the next page from the array while the current
+ * one is being transferred out of the cache.
+ */
+static int mtk_snand_load_page(struct mtk_snand *snf, uint64_t addr,
+			       uint32_t *page)
+{
+	uint32_t npages;
+	uint8_t cmd;
+	int ret;
+
+	if (!snf->seq_left || addr != snf->seq_addr) {
+		mtk_snand_read_seq_abort(snf);
+		return mtk_snand_page_read(snf, addr, page);
+	}
+
+	/* A sequence never crosses a block boundary */
+	npages = (snf->erasesize - (addr & snf->erasesize_mask)) >>
+		 snf->writesize_shift;
+	if (npages > snf->seq_left)
+		npages = snf->seq_left;
+
+	if (!snf->seq_busy) {
+		ret = mtk_snand_page_read(snf, addr, page);
+		if (ret)
+			goto abort;
+
+		if (npages == 1)
+			goto next;
+
+		cmd = SNAND_CMD_READ_CACHE_SEQ;
+	} else {
+		*page = (addr & snf->die_mask) >> snf->writesize_shift;
+		cmd = npages > 1 ? SNAND_CMD_READ_CACHE_SEQ :
+				   SNAND_CMD_READ_CACHE_END;
+	}
+
+	ret = mtk_snand_cache_op(snf, cmd);
+	if (ret)
+		goto abort;
+
+	snf->seq_busy = cmd == SNAND_CMD_READ_CACHE_SEQ;
+
+next:
+	snf->seq_addr += snf->writesize;
+	snf->seq_left--;
+
+	return 0;
+
+abort:
+	mtk_snand_read_seq_abort(snf);
+
+	return ret;
+}
+
+int mtk_snand_read_seq_start(struct mtk_snand *snf, uint64_t addr,
+			     uint32_t count)
+{
+	uint64_t maxcount;
+
+	if (!snf)
+		return -EINVAL;
+
+	if (addr >= snf->size)
+		return -EINVAL;
+
+	mtk_snand_read_seq_abort(snf);
+
+	if (!snf->read_cache_seq || count < 2)
+		return 0;
+
+	addr &= ~(uint64_t)snf->writesize_mask;
+
+	maxcount = (snf->size - addr) >> snf->writesize_shift;
+	if (count > maxcount)
+		count = maxcount;
+
+	snf->seq_addr = addr;
+	snf->seq_left = count;
+
+	return 0;
+}
+
+int mtk_snand_read_seq_stop(struct mtk_snand *snf)
+{
+	if (!snf)
+		return -EINVAL;
+
+	mtk_snand_read_seq_abort(snf);
+
+	return 0;
+}
+
 static void mtk_snand_read_fdm(struct mtk_snand *snf, uint8_t *buf)
 {
 	uint32_t vall, valm;
@@ -904,25 +1053,15 @@ static void mtk_snand_from_raw_page(struct mtk_snand *snf, void *buf, void *oob)
 static int mtk_snand_do_read_page(struct mtk_snand *snf, uint64_t addr,
 				  void *buf, void *oob, bool raw, bool format)
 {
-	uint64_t die_addr;
 	uint32_t page, dly_ctrl3;
 	int ret, retry_cnt = 0;
 
-	die_addr = mtk_snand_select_die_address(snf, addr);
-	page = die_addr >> snf->writesize_shift;
-
 	dly_ctrl3 = nfi_read32(snf, SNF_DLY_CTL3);
 
-	ret = mtk_snand_page_op(snf, page, SNAND_CMD_READ_TO_CACHE);
+	ret = mtk_snand_load_page(snf, addr, &page);
 	if (ret)
 		return ret;
 
-	ret = mtk_snand_poll_status(snf, SNFI_POLL_INTERVAL);
-	if (ret < 0) {
-		snand_log_chip(snf->pdev, "Read to cache command timed out\n");
-		return ret;
-	}
-
 retry:
 	ret = mtk_snand_read_cache(snf, page, raw);
 	if (ret < 0 && ret != -EBADMSG)
@@ -1131,15 +1270,18 @@ static void mtk_snand_to_raw_page(struct mtk_snand *snf,
 	uint32_t i, ecc_bytes = snf->spare_per_sector - snf->nfi_soc->fdm_size;
 	const uint8_t *eccptr = oob + snf->ecc_steps * snf->nfi_soc->fdm_size;
 	const uint8_t *bufptr = buf, *oobptr = oob;
+	uint32_t rawlen = snf->ecc_steps * snf->raw_sector_size;
 	uint8_t *raw_sector;
 
-	memset(snf->page_cache, 0xff, snf->writesize + snf->oobsize);
+	/* Every byte is written once, only what is not copied is set to 0xff */
 	for (i = 0; i < snf->ecc_steps; i++) {
 		raw_sector = snf->page_cache + i * snf->raw_sector_size;
 
 		if (buf) {
 			memcpy(raw_sector, bufptr, snf->nfi_soc->sector_size);
 			bufptr += snf->nfi_soc->sector_size;
+		} else {
+			memset(raw_sector, 0xff, snf->nfi_soc->sector_size);
 		}
 
 		raw_sector += snf->nfi_soc->sector_size;
@@ -1154,22 +1296,57 @@ static void mtk_snand_to_raw_page(struct mtk_snand *snf,
 			else
 				memcpy(raw_sector, eccptr, ecc_bytes);
 			eccptr += ecc_bytes;
+		} else {
+			memset(raw_sector, 0xff, snf->spare_per_sector);
 		}
 	}
+
+	memset(snf->page_cache + rawlen, 0xff,
+	       snf->writesize + snf->oobsize - rawlen);
+}
+
+static bool mtk_snand_is_empty_buf(const void *buf, size_t len)
+{
+	const uint8_t *buf8 = buf;
+	const uint32_t *buf32;
+
+	while (len && ((uintptr_t)buf8) % sizeof(uint32_t)) {
+		if (*buf8 != 0xff)
+			return false;
+
+		buf8++;
+		len--;
+	}
+
+	buf32 = (const uint32_t *)buf8;
+	while (len >= sizeof(uint32_t)) {
+		if (*buf32 != ~0)
+			return false;
+
+		buf32++;
+		len -= sizeof(uint32_t);
+	}
+
+	buf8 = (const uint8_t *)buf32;
+	while (len) {
+		if (*buf8 != 0xff)
+			return false;
+
+		buf8++;
+		len--;
+	}
+
+	return true;
 }
 
 static bool mtk_snand_is_empty_page(struct mtk_snand *snf, const void *buf,
 				    const void *oob)
 {
-	const uint8_t *p = buf;
+	const uint8_t *p;
 	uint32_t i, j;
 
-	if (buf) {
-		for (i = 0; i < snf->writesize; i++) {
-			if (p[i] != 0xff)
-				return false;
-		}
-	}
+	if (buf && !mtk_snand_is_empty_buf(buf, snf->writesize))
+		return false;
 
 	if (oob) {
 		for (j = 0; j < snf->ecc_steps; j++) {
@@ -1194,6 +1371,8 @@ static int mtk_snand_do_write_page(struct mtk_snand *snf, uint64_t addr,
 	uint32_t page;
 	int ret;
 
+	mtk_snand_read_seq_abort(snf);
+
 	die_addr = mtk_snand_select_die_address(snf, addr);
 	page = die_addr >> snf->writesize_shift;
 
@@ -1293,6 +1472,8 @@ int mtk_snand_erase_block(struct mtk_snand *snf, uint64_t addr)
 	if (addr >= snf->size)
 		return -EINVAL;
 
+	mtk_snand_read_seq_abort(snf);
+
 	die_addr = mtk_snand_select_die_address(snf, addr);
 	block = die_addr >> snf->erasesize_shift;
 	page = block << (snf->erasesize_shift - snf->writesize_shift);
@@ -1540,7 +1721,7 @@ int mtk_snand_irq_process(struct mtk_snand *snf)
 static int mtk_snand_select_spare_per_sector(struct mtk_snand *snf)
 {
 	uint32_t spare_per_step = snf->oobsize / snf->ecc_steps;
-	int i, mul = 1;
+	int i, sel = -1, mul = 1;
 
 	/*
 	 * If we're using the 1KB sector size, HW will automatically
@@ -1551,25 +1732,33 @@ static int mtk_snand_select_spare_per_sector(struct mtk_snand *snf)
 
 	spare_per_step /= mul;
 
-	for (i = snf->nfi_soc->num_spare_size - 1; i >= 0; i--) {
-		if (snf->nfi_soc->spare_sizes[i] <= spare_per_step) {
-			snf->spare_per_sector = snf->nfi_soc->spare_sizes[i];
-			snf->spare_per_sector *= mul;
-			return i;
-		}
+	/* The table is indexed by register value and is not fully sorted */
+	for (i = 0; i < snf->nfi_soc->num_spare_size; i++) {
+		if (snf->nfi_soc->spare_sizes[i] > spare_per_step)
+			continue;
+
+		if (sel < 0 || snf->nfi_soc->spare_sizes[i] >
+			       snf->nfi_soc->spare_sizes[sel])
+			sel = i;
+	}
+
+	if (sel < 0) {
+		snand_log_nfi(snf->pdev,
+			      "Page size %u+%u is not supported\n",
+			      snf->writesize, snf->oobsize);
+		return -1;
 	}
 
-	snand_log_nfi(snf->pdev,
-		      "Page size %u+%u is not supported\n", snf->writesize,
-		      snf->oobsize);
+	snf->spare_per_sector = snf->nfi_soc->spare_sizes[sel] * mul;
 
-	return -1;
+	return sel;
 }
 
 static int mtk_snand_pagefmt_setup(struct mtk_snand *snf)
 {
-	uint32_t spare_size_idx, spare_size_shift, pagesize_idx;
+	uint32_t spare_size_shift, pagesize_idx;
 	uint32_t sector_size_512;
+	int spare_size_idx;
 
 	if (snf->nfi_soc->sector_size == 512) {
 		sector_size_512 = NFI_SEC_SEL_512;
@@ -1729,6 +1918,7 @@ static int mtk_snand_setup(struct mtk_snand *snf,
 	snf->die_shift = mtk_snand_ffs64(snf->die_size) - 1;
 
 	snf->select_die = snand_info->select_die;
+	snf->read_cache_seq = !!(snand_info->flags & SNAND_F_READ_CACHE_SEQ);
 
 	/* Determine opcodes for read from cache/program load */
 	snfi_caps = SPI_IO_1_1_1 | SPI_IO_1_1_2 | SPI_IO_1_2_2;
@@ -1745,7 +1935,7 @@ static int mtk_snand_setup(struct mtk_snand *snf,
 
 	/* ECC and page format */
 	snf->ecc_steps = snf->writesize / snf->nfi_soc->sector_size;
-	if (snf->ecc_steps > snf->nfi_soc->max_sectors) {
+	if (!snf->ecc_steps || snf->ecc_steps > snf->nfi_soc->max_sectors) {
 		snand_log_nfi(snf->pdev, "Page size %u is not supported\n",
 			      snf->writesize);
 		return -ENOTSUPP;
@@ -55,6 +55,9 @@ int mtk_snand_cleanup(struct mtk_snand *snf);
 int mtk_snand_chip_reset(struct mtk_snand *snf);
 int mtk_snand_read_page(struct mtk_snand *snf, uint64_t addr, void *buf,
 			void *oob, bool raw);
+int mtk_snand_read_seq_start(struct mtk_snand *snf, uint64_t addr,
+			     uint32_t count);
+int mtk_snand_read_seq_stop(struct mtk_snand *snf);
 int mtk_snand_write_page(struct mtk_snand *snf, uint64_t addr, const void *buf,
 			 const void *oob, bool raw);
 int mtk_snand_erase_block(struct mtk_snand *snf, uint64_t addr);
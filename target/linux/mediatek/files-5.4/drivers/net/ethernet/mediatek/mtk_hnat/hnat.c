@@ -145,14 +145,11 @@ void set_gmac_ppe_fwd(int id, int enable)
 	reg = hnat_priv->fe_base + (id ? GDMA2_FWD_CFG : GDMA1_FWD_CFG);
 
 	if (enable) {
-		if (id == 0)
- 			cr_set_bits(reg, BITS_GDM_ALL_FRC_P_PPE);
- 		else {
- 			if(CFG_PPE_NUM>1)
- 				cr_set_bits(reg, BITS_GDM_ALL_FRC_P_PPE1);
- 			else
- 				cr_set_bits(reg, BITS_GDM_ALL_FRC_P_PPE);
-			} 
+		/* follow the PPE placement, see hnat_ppe_lb.c */
+		if (hnat_priv->gmac_ppe[id ? 1 : 0])
+			cr_set_field(reg, GDM_ALL_FRC_MASK, BITS_GDM_ALL_FRC_P_PPE1);
+		else
+			cr_set_field(reg, GDM_ALL_FRC_MASK, BITS_GDM_ALL_FRC_P_PPE);
 		return;
 	}
 
@@ -616,6 +613,7 @@ int hnat_disable_hook(void)
 
 	/* clear HWNAT cache */
 	hnat_cache_ebl(1);
+	hnat_ovf_flush();
 
 	mod_timer(&hnat_priv->hnat_sma_build_entry_timer, jiffies + 3 * HZ);
 	ppe_del_entry_by_mac = NULL;
@@ -739,6 +737,9 @@ static int hnat_probe(struct platform_device *pdev)
 
 	dev_info(&pdev->dev, "ppe num = %d\n", hnat_priv->ppe_num);
 
+	hnat_priv->gmac_ppe[0] = 0;
+	hnat_priv->gmac_ppe[1] = (CFG_PPE_NUM > 1) ? 1 : 0;
+
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
 	if (!res)
 		return -ENOENT;
@@ -825,6 +826,13 @@ static int hnat_probe(struct platform_device *pdev)
 	}
 
 	timer_setup(&hnat_priv->hnat_sma_build_entry_timer, hnat_sma_build_entry, 0);
+	hnat_ppe_lb_init();
+	if (hnat_ovf_init())
+		dev_warn(hnat_priv->dev, "software overflow table unavailable\n");
+	if (hnat_qos_init())
+		dev_warn(hnat_priv->dev, "HQoS netlink API unavailable\n");
+	if (hnat_acct_init())
+		dev_warn(hnat_priv->dev, "per-MAC accounting netlink unavailable\n");
 	if (hnat_priv->data->version == MTK_HNAT_V3) {
 		timer_setup(&hnat_priv->hnat_reset_timestamp_timer, hnat_reset_timestamp, 0);
 		hnat_priv->hnat_reset_timestamp_timer.expires = jiffies;
@@ -865,11 +873,17 @@ static int hnat_remove(struct platform_device *pdev)
 	if (hnat_priv->data->mcast)
 		hnat_mcast_disable();
 
+	/* the timers and the accounting poll use the tables hnat_stop() frees */
+	hnat_ppe_lb_deinit();
+	hnat_ovf_deinit();
+	hnat_acct_deinit();
+
 	for (i = 0; i < CFG_PPE_NUM; i++)
 		hnat_stop(i);
 
 	hnat_deinit_debugfs(hnat_priv);
 	hnat_release_netdev();
+	hnat_qos_deinit();
 	del_timer_sync(&hnat_priv->hnat_sma_build_entry_timer);
 	if (hnat_priv->data->version == MTK_HNAT_V3)
 		del_timer_sync(&hnat_priv->hnat_reset_timestamp_timer);
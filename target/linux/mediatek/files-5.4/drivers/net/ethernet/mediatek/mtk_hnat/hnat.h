@@ -619,6 +619,189 @@ struct hnat_accounting {
 	u64 packets;
 };
 
+#define HNAT_GMAC_NUM		2
+
+/* PPE placement policy, see hnat_ppe_lb.c */
+#define PPE_LB_PERIOD		(5 * HZ)
+#define PPE_LB_DWELL		(60 * HZ)
+#define PPE_LB_OCCUPANCY_HIGH	900	/* permille of the FOE table */
+#define PPE_LB_MISS_HIGH	250	/* permille of bind attempts */
+#define PPE_LB_HYSTERESIS	100
+
+enum hnat_ppe_event {
+	PPE_EVENT_BIND,
+	PPE_EVENT_COLLISION,	/* bucket already taken by another flow */
+	PPE_EVENT_TABLE_FULL,	/* PPE found no entry to assign */
+};
+
+/* software overflow table, see hnat_ovf.c */
+#define HNAT_OVF_HASH_BITS	10
+#define HNAT_OVF_MAX		4096
+#define HNAT_OVF_PERIOD		(1 * HZ)
+#define HNAT_OVF_AGE		(30 * HZ)
+#define HNAT_OVF_HEAVY		1000	/* packets per period */
+#define HNAT_OVF_COLD_TS	4	/* FOE timestamp ticks without a hit */
+
+/* the packet and byte counts are kept per CPU, see hnat_ovf_get_stats() */
+struct hnat_ovf_stats {
+	u64 slow_packets;	/* packets handled by the CPU slow path */
+	u64 slow_bytes;
+	u64 ovf_packets;	/* packets forwarded from the overflow table */
+	u64 ovf_bytes;
+	u64 hit;		/* flows which found their FOE bucket taken */
+	u64 learn;
+	u64 evict;		/* cold FOE entries given to a heavy flow */
+	u64 rebind;		/* evicted flows bound in hardware again */
+	u64 table_full;
+	u32 flows;
+	u32 evicted;		/* evicted flows not bound again yet */
+};
+
+/* per-MAC accounting, see hnat_acct.c */
+#define HNAT_ACCT_HASH_BITS	8
+#define HNAT_ACCT_MAX		1024
+#define HNAT_ACCT_PERIOD	(5 * HZ)
+#define HNAT_ACCT_AGE		(3600 * HZ)
+
+struct hnat_mac_cnt {
+	u64 tx_bytes;		/* sent by the MAC */
+	u64 tx_packets;
+	u64 rx_bytes;		/* sent to the MAC */
+	u64 rx_packets;
+};
+
+/* generic netlink family "mtk_hnat_acct": HNAT_ACCT_CMD_GET dumps one
+ * message per MAC; with HNAT_ACCT_A_DELTA set in the request the counters
+ * are the change since the previous delta dump.
+ */
+#define HNAT_ACCT_GENL_NAME	"mtk_hnat_acct"
+#define HNAT_ACCT_GENL_VERSION	1
+
+enum hnat_acct_cmd {
+	HNAT_ACCT_CMD_UNSPEC,
+	HNAT_ACCT_CMD_GET,
+	__HNAT_ACCT_CMD_MAX,
+};
+
+enum hnat_acct_attr {
+	HNAT_ACCT_A_UNSPEC,
+	HNAT_ACCT_A_MAC,	/* binary, ETH_ALEN */
+	HNAT_ACCT_A_DELTA,	/* flag */
+	HNAT_ACCT_A_TX_BYTES,	/* u64 */
+	HNAT_ACCT_A_TX_PACKETS,	/* u64 */
+	HNAT_ACCT_A_RX_BYTES,	/* u64 */
+	HNAT_ACCT_A_RX_PACKETS,	/* u64 */
+	HNAT_ACCT_A_PAD,
+	__HNAT_ACCT_A_MAX,
+};
+#define HNAT_ACCT_A_MAX		(__HNAT_ACCT_A_MAX - 1)
+
+/* HQoS configuration API, see hnat_qos.c */
+#define HQOS_MAX_SCH		4
+#define HQOS_MAX_TXQ		64
+#define HQOS_WEIGHT_MAX		0xf
+#define HQOS_TREE_WRITE_MAX	8192	/* bytes accepted by qdma_tree */
+
+/* generic netlink family "mtk_hqos": HQOS_CMD_SET takes any number of
+ * HQOS_A_SCH/HQOS_A_TXQ nests and applies them as one transaction,
+ * HQOS_CMD_GET dumps every scheduler and queue with its counters.
+ */
+#define HQOS_GENL_NAME		"mtk_hqos"
+#define HQOS_GENL_VERSION	1
+
+enum hqos_cmd {
+	HQOS_CMD_UNSPEC,
+	HQOS_CMD_SET,
+	HQOS_CMD_GET,
+	__HQOS_CMD_MAX,
+};
+
+enum hqos_attr {
+	HQOS_A_UNSPEC,
+	HQOS_A_SCH,		/* nested hqos_sch_attr */
+	HQOS_A_TXQ,		/* nested hqos_txq_attr */
+	__HQOS_A_MAX,
+};
+#define HQOS_A_MAX		(__HQOS_A_MAX - 1)
+
+enum hqos_sch_attr {
+	HQOS_SCH_A_UNSPEC,
+	HQOS_SCH_A_ID,		/* u32 */
+	HQOS_SCH_A_ENABLE,	/* u8 */
+	HQOS_SCH_A_WRR,		/* u8 */
+	HQOS_SCH_A_RATE,	/* u32, Kbps */
+	__HQOS_SCH_A_MAX,
+};
+#define HQOS_SCH_A_MAX		(__HQOS_SCH_A_MAX - 1)
+
+enum hqos_txq_attr {
+	HQOS_TXQ_A_UNSPEC,
+	HQOS_TXQ_A_ID,		/* u32 */
+	HQOS_TXQ_A_SCH,		/* u8 */
+	HQOS_TXQ_A_MIN_EN,	/* u8 */
+	HQOS_TXQ_A_MIN_RATE,	/* u32, Kbps */
+	HQOS_TXQ_A_MAX_EN,	/* u8 */
+	HQOS_TXQ_A_MAX_RATE,	/* u32, Kbps */
+	HQOS_TXQ_A_WEIGHT,	/* u8 */
+	HQOS_TXQ_A_RESV,	/* u8 */
+	HQOS_TXQ_A_PACKETS,	/* u64, GET only */
+	HQOS_TXQ_A_DROPS,	/* u64, GET only */
+	HQOS_TXQ_A_PPS,		/* u32, GET only */
+	HQOS_TXQ_A_PAD,
+	__HQOS_TXQ_A_MAX,
+};
+#define HQOS_TXQ_A_MAX		(__HQOS_TXQ_A_MAX - 1)
+
+struct hqos_sch_cfg {
+	u8 enable;
+	u8 wrr;			/* 0: strict priority, 1: WRR */
+	u32 rate;		/* max rate in Kbps */
+};
+
+struct hqos_txq_cfg {
+	u8 sch;
+	u8 min_en;
+	u8 max_en;
+	u8 weight;
+	u8 resv;		/* hw and sw reserved descriptors */
+	u8 hw_resv;		/* read back only, a commit sets it to resv */
+	u32 min_rate;		/* Kbps */
+	u32 max_rate;		/* Kbps */
+};
+
+/* a scheduler/queue tree; only the entries set in the masks are changed */
+struct hqos_tree {
+	u32 sch_mask;
+	u64 txq_mask;
+	struct hqos_sch_cfg sch[HQOS_MAX_SCH];
+	struct hqos_txq_cfg txq[HQOS_MAX_TXQ];
+};
+
+struct hqos_txq_stats {
+	u64 packets;
+	u64 drops;
+	u32 pps;		/* packets per second since the previous read */
+};
+
+/* raw QDMA register access, so the API can run against a register stub */
+struct hqos_regs {
+	u32 (*sch_read)(u32 id);
+	void (*sch_write)(u32 id, u32 val);
+	void (*txq_read)(u32 id, u32 *qtx_sch, u32 *qtx_cfg);
+	void (*txq_write)(u32 id, u32 qtx_sch, u32 qtx_cfg);
+	void (*txq_mib)(u32 id, u32 *pkt_cnt, u32 *drop_cnt);
+};
+
+struct hnat_ppe_stat {
+	u32 bound;		/* bound entries at the last table scan */
+	u32 bind;		/* counters of the current sampling period */
+	u32 collision;
+	u32 table_full;
+	u64 bind_total;
+	u64 collision_total;
+	u64 table_full_total;
+};
+
 enum mtk_hnat_version {
 	MTK_HNAT_V1 = 1, /* version 1: mt7621, mt7623 */
 	MTK_HNAT_V2, /* version 2: mt7622 */
@@ -674,6 +857,15 @@ struct mtk_hnat {
 	struct timer_list hnat_sma_build_entry_timer;
 	struct timer_list hnat_reset_timestamp_timer;
 	struct timer_list hnat_mcast_check_timer;
+	struct timer_list hnat_ppe_lb_timer;
+	struct hnat_ppe_stat ppe_stat[MAX_PPE_NUM];
+	u8 gmac_ppe[HNAT_GMAC_NUM]; /* PPE serving each GMAC */
+	unsigned long ppe_lb_stamp;
+	bool ppe_lb_en;
+	struct timer_list hnat_ovf_timer;
+	struct hnat_ovf_stats ovf_stat;
+	bool ovf_en;
+	bool acct_en;
 	bool nf_stat_en;
 	bool ipv6_en;
 	bool guest_en;
@@ -994,6 +1186,42 @@ int hnat_warm_init(void);
 struct hnat_accounting *hnat_get_count(struct mtk_hnat *h, u32 ppe_id,
 				       u32 index, struct hnat_accounting *diff);
 
+bool hnat_ppe_lb_saturated(const struct hnat_ppe_stat *stat, u32 etry_num);
+u32 hnat_ppe_lb_select(const struct hnat_ppe_stat *stat, u32 ppe_num,
+		       u32 etry_num, u32 cur);
+u32 hnat_ppe_lb_count_bound(const struct foe_entry *table, u32 etry_num);
+void hnat_ppe_lb_account(u32 ppe_id, enum hnat_ppe_event event);
+void hnat_ppe_lb_snapshot(struct hnat_ppe_stat *stat, bool reset);
+void hnat_ppe_lb_enable(bool en);
+void hnat_ppe_lb_init(void);
+void hnat_ppe_lb_deinit(void);
+int hnat_ovf_add(struct foe_entry *entry, int ifindex, u32 ppe_id, u32 foe_idx);
+int hnat_ovf_forward(struct sk_buff *skb, const struct net_device *out);
+void hnat_ovf_count_slow(unsigned int len);
+void hnat_ovf_get_stats(struct hnat_ovf_stats *stat);
+void hnat_ovf_rebind(const struct foe_entry *entry);
+void hnat_ovf_flush(void);
+int hnat_ovf_stub_run(void);
+void hnat_ovf_enable(bool en);
+int hnat_ovf_init(void);
+void hnat_ovf_deinit(void);
+void hnat_acct_add(const u8 *mac, bool rx, u64 bytes, u64 packets);
+void hnat_acct_entry(u32 ppe_id, u32 index, u64 bytes, u64 packets);
+void hnat_acct_bind(u32 ppe_id, u32 index, const u8 *src);
+void hnat_acct_slow(struct sk_buff *skb, bool routed);
+void hnat_acct_show(struct seq_file *m);
+void hnat_acct_flush(void);
+int hnat_acct_init(void);
+void hnat_acct_deinit(void);
+int hnat_qos_validate(const struct hqos_tree *tree, u32 num_of_sch,
+		      const char **reason);
+int hnat_qos_commit(const struct hqos_tree *tree, const char **reason);
+void hnat_qos_get_sch(u32 id, struct hqos_sch_cfg *cfg);
+void hnat_qos_get_txq(u32 id, struct hqos_txq_cfg *cfg);
+void hnat_qos_get_stats(u32 id, struct hqos_txq_stats *stats);
+int hnat_qos_init(void);
+void hnat_qos_deinit(void);
+
 static inline u16 foe_timestamp(struct mtk_hnat *h)
 {
 	return (readl(hnat_priv->fe_base + 0x0010)) & 0xffff;
@@ -0,0 +1,433 @@
+/*   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/etherdevice.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/seq_file.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include <net/dst.h>
+#include <net/neighbour.h>
+#include <net/genetlink.h>
+
+#include "nf_hnat_mtk.h"
+#include "hnat.h"
+
+static bool acct_stub;
+module_param(acct_stub, bool, 0);
+MODULE_PARM_DESC(acct_stub, "feed per-MAC accounting from a synthetic counter source");
+
+#define HNAT_ACCT_STUB_MACS	16
+
+/* Bytes of bound flows are read from the PPE MIB by hnat_get_count(), which
+ * clears the counters; every reader feeds the delta through
+ * hnat_acct_entry(), and a periodic poll reads the entries nobody else did.
+ * The egress dmac comes from the FOE entry itself, the ingress smac is
+ * remembered per entry when the flow is bound.
+ */
+
+struct hnat_mac_acct {
+	struct hlist_node hlist;
+	u8 mac[ETH_ALEN];
+	struct hnat_mac_cnt cnt;
+	struct hnat_mac_cnt last;	/* cnt at the previous delta dump */
+	unsigned long last_seen;
+};
+
+static DEFINE_HASHTABLE(hnat_acct_hash, HNAT_ACCT_HASH_BITS);
+static DEFINE_SPINLOCK(hnat_acct_lock);
+static u32 hnat_acct_num;
+static u64 hnat_acct_full;
+static u8 (*hnat_acct_src[MAX_PPE_NUM])[ETH_ALEN];
+static struct delayed_work hnat_acct_work;
+static struct genl_family hnat_acct_genl_family;
+
+static u32 hnat_acct_hashfn(const u8 *mac)
+{
+	return jhash(mac, ETH_ALEN, 0);
+}
+
+static struct hnat_mac_acct *hnat_acct_find(const u8 *mac)
+{
+	struct hnat_mac_acct *acct;
+
+	hash_for_each_possible(hnat_acct_hash, acct, hlist,
+			       hnat_acct_hashfn(mac)) {
+		if (ether_addr_equal(acct->mac, mac))
+			return acct;
+	}
+
+	return NULL;
+}
+
+/* hnat_acct_add - charge traffic to a MAC
+ * @mac:	station the traffic belongs to
+ * @rx:		true if the traffic was sent to @mac, false if sent by it
+ */
+void hnat_acct_add(const u8 *mac, bool rx, u64 bytes, u64 packets)
+{
+	struct hnat_mac_acct *acct;
+
+	if (!is_valid_ether_addr(mac) || (!bytes && !packets))
+		return;
+
+	spin_lock_bh(&hnat_acct_lock);
+
+	acct = hnat_acct_find(mac);
+	if (!acct) {
+		if (hnat_acct_num >= HNAT_ACCT_MAX) {
+			hnat_acct_full++;
+			goto out;
+		}
+
+		acct = kzalloc(sizeof(*acct), GFP_ATOMIC);
+		if (!acct)
+			goto out;
+
+		ether_addr_copy(acct->mac, mac);
+		hash_add(hnat_acct_hash, &acct->hlist, hnat_acct_hashfn(mac));
+		hnat_acct_num++;
+	}
+
+	if (rx) {
+		acct->cnt.rx_bytes += bytes;
+		acct->cnt.rx_packets += packets;
+	} else {
+		acct->cnt.tx_bytes += bytes;
+		acct->cnt.tx_packets += packets;
+	}
+	acct->last_seen = jiffies;
+
+out:
+	spin_unlock_bh(&hnat_acct_lock);
+}
+
+static void hnat_acct_foe_mac(u32 hi, u16 lo, u8 *mac)
+{
+	mac[0] = hi >> 24;
+	mac[1] = hi >> 16;
+	mac[2] = hi >> 8;
+	mac[3] = hi;
+	mac[4] = lo >> 8;
+	mac[5] = lo;
+}
+
+/* the MIB delta of a FOE entry: the egress dmac received it, the station
+ * that sent the flow into the PPE sent it
+ */
+void hnat_acct_entry(u32 ppe_id, u32 index, u64 bytes, u64 packets)
+{
+	struct foe_entry *entry;
+	u8 dmac[ETH_ALEN];
+
+	if (!hnat_priv->acct_en || ppe_id >= CFG_PPE_NUM ||
+	    index >= hnat_priv->foe_etry_num)
+		return;
+
+	entry = &hnat_priv->foe_table_cpu[ppe_id][index];
+	if (IS_IPV4_GRP(entry))
+		hnat_acct_foe_mac(entry->ipv4_hnapt.dmac_hi,
+				  entry->ipv4_hnapt.dmac_lo, dmac);
+	else
+		hnat_acct_foe_mac(entry->ipv6_5t_route.dmac_hi,
+				  entry->ipv6_5t_route.dmac_lo, dmac);
+
+	hnat_acct_add(dmac, true, bytes, packets);
+
+	if (hnat_acct_src[ppe_id])
+		hnat_acct_add(hnat_acct_src[ppe_id][index], false, bytes, packets);
+}
+
+void hnat_acct_bind(u32 ppe_id, u32 index, const u8 *src)
+{
+	if (ppe_id >= CFG_PPE_NUM || index >= hnat_priv->foe_etry_num ||
+	    !hnat_acct_src[ppe_id])
+		return;
+
+	ether_addr_copy(hnat_acct_src[ppe_id][index], src);
+}
+
+/* hnat_acct_slow - charge a packet forwarded by the CPU
+ * Called before the nexthop lookup rewrites the ethernet header, so
+ * h_source is still the sending station. For routed packets the receiving
+ * station is the neighbour of the route.
+ *
+ * Each packet is charged at one hook only: routed packets at IP
+ * post-routing, bridged ones at the bridge hook. A packet routed into a
+ * bridge passes the bridge hook as well, with the header this host built
+ * for it, and is skipped there, as is traffic this host sends itself.
+ */
+void hnat_acct_slow(struct sk_buff *skb, bool routed)
+{
+	struct ethhdr *eth = eth_hdr(skb);
+	struct dst_entry *dst = skb_dst(skb);
+	struct neighbour *neigh;
+	u8 dmac[ETH_ALEN];
+
+	/* copies of packets the PPE already forwarded, counted by the MIB */
+	if (is_magic_tag_valid(skb) &&
+	    skb_hnat_reason(skb) == HIT_BIND_KEEPALIVE_DUP_OLD_HDR)
+		return;
+
+	/* bridged packets carry at most the fake rtable of br_netfilter */
+	if (!routed && dst && !(dst->flags & DST_FAKE_RTABLE))
+		return;
+
+	if (ether_addr_equal(eth->h_source, skb->dev->dev_addr))
+		return;
+
+	hnat_acct_add(eth->h_source, false, skb->len, 1);
+
+	if (!routed) {
+		hnat_acct_add(eth->h_dest, true, skb->len, 1);
+		return;
+	}
+
+	if (!dst)
+		return;
+
+	neigh = dst_neigh_lookup_skb(dst, skb);
+	if (neigh) {
+		neigh_ha_snapshot(dmac, neigh, neigh->dev);
+		hnat_acct_add(dmac, true, skb->len, 1);
+		neigh_release(neigh);
+	}
+}
+
+static void hnat_acct_hw_poll(void)
+{
+	struct foe_entry *entry;
+	u32 ppe_id, index;
+
+	if (!hnat_priv->data->per_flow_accounting)
+		return;
+
+	for (ppe_id = 0; ppe_id < CFG_PPE_NUM; ppe_id++) {
+		entry = hnat_priv->foe_table_cpu[ppe_id];
+		for (index = 0; index < hnat_priv->foe_etry_num; index++) {
+			if (entry[index].bfib1.state == BIND)
+				hnat_get_count(hnat_priv, ppe_id, index, NULL);
+
+			if (!(index % 1024))
+				cond_resched();
+		}
+	}
+}
+
+/* stand-in for the MIB: a fixed set of locally administered MACs with
+ * traffic proportional to their index
+ */
+static void hnat_acct_stub_poll(void)
+{
+	u8 mac[ETH_ALEN] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x00 };
+	int i;
+
+	for (i = 0; i < HNAT_ACCT_STUB_MACS; i++) {
+		mac[5] = i + 1;
+		hnat_acct_add(mac, false, 1500 * (i + 1), i + 1);
+		hnat_acct_add(mac, true, 15000 * (i + 1), 10 * (i + 1));
+	}
+}
+
+/* idle stations whose counters were fully handed out are dropped */
+static void hnat_acct_age(void)
+{
+	struct hnat_mac_acct *acct;
+	struct hlist_node *n;
+	int bkt;
+
+	spin_lock_bh(&hnat_acct_lock);
+	hash_for_each_safe(hnat_acct_hash, bkt, n, acct, hlist) {
+		if (!time_after(jiffies, acct->last_seen + HNAT_ACCT_AGE) ||
+		    memcmp(&acct->cnt, &acct->last, sizeof(acct->cnt)))
+			continue;
+
+		hash_del(&acct->hlist);
+		kfree(acct);
+		hnat_acct_num--;
+	}
+	spin_unlock_bh(&hnat_acct_lock);
+}
+
+static void hnat_acct_poll(struct work_struct *work)
+{
+	if (hnat_priv->acct_en) {
+		if (acct_stub)
+			hnat_acct_stub_poll();
+		else
+			hnat_acct_hw_poll();
+
+		hnat_acct_age();
+	}
+
+	schedule_delayed_work(&hnat_acct_work, HNAT_ACCT_PERIOD);
+}
+
+void hnat_acct_flush(void)
+{
+	struct hnat_mac_acct *acct;
+	struct hlist_node *n;
+	int bkt;
+
+	spin_lock_bh(&hnat_acct_lock);
+	hash_for_each_safe(hnat_acct_hash, bkt, n, acct, hlist) {
+		hash_del(&acct->hlist);
+		kfree(acct);
+	}
+	hnat_acct_num = 0;
+	spin_unlock_bh(&hnat_acct_lock);
+}
+
+void hnat_acct_show(struct seq_file *m)
+{
+	struct hnat_mac_acct *acct;
+	int bkt;
+
+	seq_printf(m, "stations %u/%u, untracked updates %llu\n",
+		   hnat_acct_num, HNAT_ACCT_MAX, hnat_acct_full);
+	seq_puts(m, "MAC\t\t\ttx bytes\ttx packets\trx bytes\trx packets\n");
+
+	spin_lock_bh(&hnat_acct_lock);
+	hash_for_each(hnat_acct_hash, bkt, acct, hlist)
+		seq_printf(m, "%pM\t%llu\t%llu\t%llu\t%llu\n", acct->mac,
+			   acct->cnt.tx_bytes, acct->cnt.tx_packets,
+			   acct->cnt.rx_bytes, acct->cnt.rx_packets);
+	spin_unlock_bh(&hnat_acct_lock);
+}
+
+static const struct nla_policy hnat_acct_policy[HNAT_ACCT_A_MAX + 1] = {
+	[HNAT_ACCT_A_DELTA] = { .type = NLA_FLAG },
+};
+
+static int hnat_acct_nl_fill(struct sk_buff *skb, struct netlink_callback *cb,
+			     struct hnat_mac_acct *acct, bool delta)
+{
+	struct hnat_mac_cnt cnt = acct->cnt;
+	void *hdr;
+
+	if (delta) {
+		cnt.tx_bytes -= acct->last.tx_bytes;
+		cnt.tx_packets -= acct->last.tx_packets;
+		cnt.rx_bytes -= acct->last.rx_bytes;
+		cnt.rx_packets -= acct->last.rx_packets;
+	}
+
+	hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid, cb->nlh->nlmsg_seq,
+			  &hnat_acct_genl_family, NLM_F_MULTI,
+			  HNAT_ACCT_CMD_GET);
+	if (!hdr)
+		return -EMSGSIZE;
+
+	if (nla_put(skb, HNAT_ACCT_A_MAC, ETH_ALEN, acct->mac) ||
+	    nla_put_u64_64bit(skb, HNAT_ACCT_A_TX_BYTES, cnt.tx_bytes,
+			      HNAT_ACCT_A_PAD) ||
+	    nla_put_u64_64bit(skb, HNAT_ACCT_A_TX_PACKETS, cnt.tx_packets,
+			      HNAT_ACCT_A_PAD) ||
+	    nla_put_u64_64bit(skb, HNAT_ACCT_A_RX_BYTES, cnt.rx_bytes,
+			      HNAT_ACCT_A_PAD) ||
+	    nla_put_u64_64bit(skb, HNAT_ACCT_A_RX_PACKETS, cnt.rx_packets,
+			      HNAT_ACCT_A_PAD)) {
+		genlmsg_cancel(skb, hdr);
+		return -EMSGSIZE;
+	}
+
+	genlmsg_end(skb, hdr);
+
+	/* only what reached the message is taken out of the next delta */
+	if (delta)
+		acct->last = acct->cnt;
+
+	return 0;
+}
+
+static int hnat_acct_nl_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	bool delta = !!nlmsg_find_attr(cb->nlh, GENL_HDRLEN, HNAT_ACCT_A_DELTA);
+	struct hnat_mac_acct *acct;
+	u32 bkt = cb->args[0];
+	u32 skip = cb->args[1];
+	u32 n;
+
+	spin_lock_bh(&hnat_acct_lock);
+	for (; bkt < HASH_SIZE(hnat_acct_hash); bkt++, skip = 0) {
+		n = 0;
+		hlist_for_each_entry(acct, &hnat_acct_hash[bkt], hlist) {
+			if (n++ < skip)
+				continue;
+
+			if (hnat_acct_nl_fill(skb, cb, acct, delta)) {
+				skip = n - 1;
+				goto out;
+			}
+		}
+	}
+out:
+	spin_unlock_bh(&hnat_acct_lock);
+
+	cb->args[0] = bkt;
+	cb->args[1] = skip;
+
+	return skb->len;
+}
+
+static const struct genl_ops hnat_acct_genl_ops[] = {
+	{
+		.cmd = HNAT_ACCT_CMD_GET,
+		.validate = GENL_DONT_VALIDATE_STRICT | GENL_DONT_VALIDATE_DUMP,
+		.dumpit = hnat_acct_nl_dump,
+		.flags = GENL_ADMIN_PERM,
+	},
+};
+
+static struct genl_family hnat_acct_genl_family = {
+	.name = HNAT_ACCT_GENL_NAME,
+	.version = HNAT_ACCT_GENL_VERSION,
+	.maxattr = HNAT_ACCT_A_MAX,
+	.policy = hnat_acct_policy,
+	.module = THIS_MODULE,
+	.ops = hnat_acct_genl_ops,
+	.n_ops = ARRAY_SIZE(hnat_acct_genl_ops),
+};
+
+int hnat_acct_init(void)
+{
+	int i;
+
+	/* without the smac of each entry only the receiving side is counted */
+	for (i = 0; hnat_priv->data->per_flow_accounting && i < CFG_PPE_NUM; i++) {
+		hnat_acct_src[i] = vzalloc(hnat_priv->foe_etry_num * ETH_ALEN);
+		if (!hnat_acct_src[i])
+			dev_warn(hnat_priv->dev, "no memory for PPE%d sources\n", i);
+	}
+
+	INIT_DELAYED_WORK(&hnat_acct_work, hnat_acct_poll);
+	schedule_delayed_work(&hnat_acct_work, HNAT_ACCT_PERIOD);
+
+	return genl_register_family(&hnat_acct_genl_family);
+}
+
+void hnat_acct_deinit(void)
+{
+	int i;
+
+	genl_unregister_family(&hnat_acct_genl_family);
+	cancel_delayed_work_sync(&hnat_acct_work);
+	hnat_priv->acct_en = false;
+	hnat_acct_flush();
+
+	for (i = 0; i < MAX_PPE_NUM; i++) {
+		vfree(hnat_acct_src[i]);
+		hnat_acct_src[i] = NULL;
+	}
+}
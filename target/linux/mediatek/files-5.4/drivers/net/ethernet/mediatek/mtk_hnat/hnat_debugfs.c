@@ -840,6 +840,11 @@ int read_mib(struct mtk_hnat *h, u32 ppe_id,
 
 }
 
+/* the MIB is read through one select/result register set per PPE, which
+ * the hooks, the accounting poll and debugfs all use
+ */
+static DEFINE_SPINLOCK(hnat_mib_lock);
+
 struct hnat_accounting *hnat_get_count(struct mtk_hnat *h, u32 ppe_id,
 				       u32 index, struct hnat_accounting *diff)
 
@@ -852,11 +857,17 @@ struct hnat_accounting *hnat_get_count(struct mtk_hnat *h, u32 ppe_id,
 	if (!hnat_priv->data->per_flow_accounting)
 		return NULL;
 
-	if (read_mib(h, ppe_id, index, &bytes, &packets))
+	spin_lock_bh(&hnat_mib_lock);
+	if (read_mib(h, ppe_id, index, &bytes, &packets)) {
+		spin_unlock_bh(&hnat_mib_lock);
 		return NULL;
+	}
 
 	h->acct[ppe_id][index].bytes += bytes;
 	h->acct[ppe_id][index].packets += packets;
+	spin_unlock_bh(&hnat_mib_lock);
+
+	hnat_acct_entry(ppe_id, index, bytes, packets);
 	
 	if (diff) {
 		diff->bytes = bytes;
@@ -1724,6 +1735,59 @@ static const struct file_operations hnat_mcast_fops = {
 	.release = single_release,
 };
 
+static int mcast_cache_read(struct seq_file *m, void *private)
+{
+	hnat_mcast_cache_show(m);
+
+	return 0;
+}
+
+static int mcast_cache_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mcast_cache_read, file->private_data);
+}
+
+/* replays an IGMP/MLD trace, one "join|leave <group> <vid> <ifname>" per line */
+static ssize_t mcast_cache_write(struct file *file, const char __user *buffer,
+				 size_t count, loff_t *data)
+{
+	char *buf, *cur, *line;
+	int ret = 0;
+
+	if (count > PAGE_SIZE)
+		return -EINVAL;
+
+	buf = memdup_user_nul(buffer, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	cur = buf;
+	while ((line = strsep(&cur, "\n")) != NULL) {
+		line = strim(line);
+		if (!*line || *line == '#')
+			continue;
+
+		ret = hnat_mcast_replay(line);
+		if (ret == -EINVAL || ret == -ENODEV) {
+			pr_info("mcast: cannot replay \"%s\"\n", line);
+			break;
+		}
+		ret = 0;
+	}
+
+	kfree(buf);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations hnat_mcast_cache_fops = {
+	.open = mcast_cache_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.write = mcast_cache_write,
+	.release = single_release,
+};
+
 static int hnat_ext_show(struct seq_file *m, void *private)
 {
 	int i;
@@ -1756,49 +1820,26 @@ static ssize_t hnat_sched_show(struct file *file, char __user *user_buf,
 			       size_t count, loff_t *ppos)
 {
 	long id = (long)file->private_data;
-	struct mtk_hnat *h = hnat_priv;
-	u32 qdma_tx_sch;
-	int enable;
-	int scheduling;
-	int max_rate;
+	struct hqos_sch_cfg sch;
+	struct hqos_txq_cfg txq;
 	char *buf;
 	unsigned int len = 0, buf_len = 1500;
 	ssize_t ret_cnt;
-	int scheduler, i;
-	u32 sch_reg;
+	int i;
 
 	buf = kzalloc(buf_len, GFP_KERNEL);
 	if (!buf)
 		return -ENOMEM;
 
-	if (hnat_priv->data->num_of_sch == 4)
-		qdma_tx_sch = readl(h->fe_base + QDMA_TX_4SCH_BASE(id));
-	else
-		qdma_tx_sch = readl(h->fe_base + QDMA_TX_2SCH_BASE);
-
-	if (id & 0x1)
-		qdma_tx_sch >>= 16;
-	qdma_tx_sch &= 0xffff;
-	enable = !!(qdma_tx_sch & BIT(11));
-	scheduling = !!(qdma_tx_sch & BIT(15));
-	max_rate = ((qdma_tx_sch >> 4) & 0x7f);
-	qdma_tx_sch &= 0xf;
-	while (qdma_tx_sch--)
-		max_rate *= 10;
+	hnat_qos_get_sch(id, &sch);
 
 	len += scnprintf(buf + len, buf_len - len,
-			 "EN\tScheduling\tMAX\tQueue#\n%d\t%s%16d\t", enable,
-			 (scheduling == 1) ? "WRR" : "SP", max_rate);
+			 "EN\tScheduling\tMAX\tQueue#\n%d\t%s%16d\t", sch.enable,
+			 (sch.wrr) ? "WRR" : "SP", sch.rate);
 
 	for (i = 0; i < MTK_QDMA_TX_NUM; i++) {
-		cr_set_field(h->fe_base + QDMA_PAGE, QTX_CFG_PAGE,
-			     (i / NUM_OF_Q_PER_PAGE));
-		sch_reg = readl(h->fe_base + QTX_SCH(i % NUM_OF_Q_PER_PAGE));
-		if (hnat_priv->data->num_of_sch == 4)
-			scheduler = (sch_reg >> 30) & 0x3;
-		else
-			scheduler = !!(sch_reg & BIT(31));
-		if (id == scheduler)
+		hnat_qos_get_txq(i, &txq);
+		if (id == txq.sch)
 			len += scnprintf(buf + len, buf_len - len, "%d  ", i);
 	}
 
@@ -1816,13 +1857,13 @@ static ssize_t hnat_sched_write(struct file *file, const char __user *buf,
 				size_t length, loff_t *offset)
 {
 	long id = (long)file->private_data;
-	struct mtk_hnat *h = hnat_priv;
+	struct hqos_tree *tree;
 	char line[64] = {0};
-	int enable, rate, exp = 0, shift = 0;
+	int enable;
+	u32 rate;
 	char scheduling[32];
 	size_t size;
-	u32 qdma_tx_sch;
-	u32 val = 0;
+	int ret;
 
 	if (length >= sizeof(line))
 		return -EINVAL;
@@ -1830,36 +1871,23 @@ static ssize_t hnat_sched_write(struct file *file, const char __user *buf,
 	if (copy_from_user(line, buf, length))
 		return -EFAULT;
 
-	if (sscanf(line, "%d %s %d", &enable, scheduling, &rate) != 3)
+	if (sscanf(line, "%d %31s %u", &enable, scheduling, &rate) != 3)
 		return -EFAULT;
 
-	while (rate > 127) {
-		rate /= 10;
-		exp++;
-	}
-
 	line[length] = '\0';
 
-	if (enable)
-		val |= BIT(11);
-	if (strcmp(scheduling, "sp") != 0)
-		val |= BIT(15);
-	val |= (rate & 0x7f) << 4;
-	val |= exp & 0xf;
-	if (id & 0x1)
-		shift = 16;
-
-	if (hnat_priv->data->num_of_sch == 4)
-		qdma_tx_sch = readl(h->fe_base + QDMA_TX_4SCH_BASE(id));
-	else
-		qdma_tx_sch = readl(h->fe_base + QDMA_TX_2SCH_BASE);
+	tree = kzalloc(sizeof(*tree), GFP_KERNEL);
+	if (!tree)
+		return -ENOMEM;
 
-	qdma_tx_sch &= ~(0xffff << shift);
-	qdma_tx_sch |= val << shift;
-	if (hnat_priv->data->num_of_sch == 4)
-		writel(qdma_tx_sch, h->fe_base + QDMA_TX_4SCH_BASE(id));
-	else
-		writel(qdma_tx_sch, h->fe_base + QDMA_TX_2SCH_BASE);
+	tree->sch_mask = BIT(id);
+	tree->sch[id].enable = !!enable;
+	tree->sch[id].wrr = strcmp(scheduling, "sp") != 0;
+	tree->sch[id].rate = rate;
+	ret = hnat_qos_commit(tree, NULL);
+	kfree(tree);
+	if (ret)
+		return ret;
 
 	size = strlen(line);
 	*offset += size;
@@ -1877,18 +1905,9 @@ static const struct file_operations hnat_sched_fops = {
 static ssize_t hnat_queue_show(struct file *file, char __user *user_buf,
 			       size_t count, loff_t *ppos)
 {
-	struct mtk_hnat *h = hnat_priv;
 	long id = (long)file->private_data;
-	u32 qtx_sch;
-	u32 qtx_cfg;
-	int scheduler;
-	int min_rate_en;
-	int min_rate;
-	int min_rate_exp;
-	int max_rate_en;
-	int max_weight;
-	int max_rate;
-	int max_rate_exp;
+	struct hqos_txq_stats stats;
+	struct hqos_txq_cfg txq;
 	char *buf;
 	unsigned int len = 0, buf_len = 1500;
 	ssize_t ret_cnt;
@@ -1897,45 +1916,20 @@ static ssize_t hnat_queue_show(struct file *file, char __user *user_buf,
 	if (!buf)
 		return -ENOMEM;
 
-	cr_set_field(h->fe_base + QDMA_PAGE, QTX_CFG_PAGE, (id / NUM_OF_Q_PER_PAGE));
-	qtx_cfg = readl(h->fe_base + QTX_CFG(id % NUM_OF_Q_PER_PAGE));
-	qtx_sch = readl(h->fe_base + QTX_SCH(id % NUM_OF_Q_PER_PAGE));
-	if (hnat_priv->data->num_of_sch == 4)
-		scheduler = (qtx_sch >> 30) & 0x3;
-	else
-		scheduler = !!(qtx_sch & BIT(31));
-	min_rate_en = !!(qtx_sch & BIT(27));
-	min_rate = (qtx_sch >> 20) & 0x7f;
-	min_rate_exp = (qtx_sch >> 16) & 0xf;
-	max_rate_en = !!(qtx_sch & BIT(11));
-	max_weight = (qtx_sch >> 12) & 0xf;
-	max_rate = (qtx_sch >> 4) & 0x7f;
-	max_rate_exp = qtx_sch & 0xf;
-	while (min_rate_exp--)
-		min_rate *= 10;
-
-	while (max_rate_exp--)
-		max_rate *= 10;
+	hnat_qos_get_txq(id, &txq);
 
 	len += scnprintf(buf + len, buf_len - len,
-			 "scheduler: %d\nhw resv: %d\nsw resv: %d\n", scheduler,
-			 (qtx_cfg >> 8) & 0xff, qtx_cfg & 0xff);
+			 "scheduler: %d\nhw resv: %d\nsw resv: %d\n", txq.sch,
+			 txq.hw_resv, txq.resv);
 
 	if (hnat_priv->data->version != MTK_HNAT_V1) {
-		/* Switch to debug mode */
-		cr_set_field(h->fe_base + QTX_MIB_IF, MIB_ON_QTX_CFG, 1);
-		cr_set_field(h->fe_base + QTX_MIB_IF, VQTX_MIB_EN, 1);
-		qtx_cfg = readl(h->fe_base + QTX_CFG(id % NUM_OF_Q_PER_PAGE));
-		qtx_sch = readl(h->fe_base + QTX_SCH(id % NUM_OF_Q_PER_PAGE));
+		hnat_qos_get_stats(id, &stats);
 		len += scnprintf(buf + len, buf_len - len,
-				 "packet count: %u\n", qtx_cfg);
+				 "packet count: %llu\n", stats.packets);
 		len += scnprintf(buf + len, buf_len - len,
-				 "packet drop: %u\n\n", qtx_sch);
-
-		/* Recover to normal mode */
-		cr_set_field(hnat_priv->fe_base + QTX_MIB_IF,
-			     MIB_ON_QTX_CFG, 0);
-		cr_set_field(hnat_priv->fe_base + QTX_MIB_IF, VQTX_MIB_EN, 0);
+				 "packet drop: %llu\n", stats.drops);
+		len += scnprintf(buf + len, buf_len - len,
+				 "packet rate: %u pps\n\n", stats.pps);
 	}
 
 	len += scnprintf(buf + len, buf_len - len,
@@ -1943,9 +1937,9 @@ static ssize_t hnat_queue_show(struct file *file, char __user *user_buf,
 	len += scnprintf(buf + len, buf_len - len,
 			 "----------------------------\n");
 	len += scnprintf(buf + len, buf_len - len,
-			 "max%5d%9d%9d\n", max_rate_en, max_rate, max_weight);
+			 "max%5d%9d%9d\n", txq.max_en, txq.max_rate, txq.weight);
 	len += scnprintf(buf + len, buf_len - len,
-			 "min%5d%9d        -\n", min_rate_en, min_rate);
+			 "min%5d%9d        -\n", txq.min_en, txq.min_rate);
 
 	if (len > buf_len)
 		len = buf_len;
@@ -1960,59 +1954,49 @@ static ssize_t hnat_queue_write(struct file *file, const char __user *buf,
 				size_t length, loff_t *offset)
 {
 	long id = (long)file->private_data;
-	struct mtk_hnat *h = hnat_priv;
+	struct hqos_txq_cfg *txq;
+	struct hqos_tree *tree;
 	char line[64] = {0};
-	int max_enable, max_rate, max_exp = 0;
-	int min_enable, min_rate, min_exp = 0;
+	int max_enable, min_enable;
+	u32 max_rate, min_rate;
 	int weight;
 	int resv;
 	int scheduler;
 	size_t size;
-	u32 qtx_sch = 0;
+	int ret;
 
-	cr_set_field(h->fe_base + QDMA_PAGE, QTX_CFG_PAGE, (id / NUM_OF_Q_PER_PAGE));
 	if (length >= sizeof(line))
 		return -EINVAL;
 
 	if (copy_from_user(line, buf, length))
 		return -EFAULT;
 
-	if (sscanf(line, "%d %d %d %d %d %d %d", &scheduler, &min_enable, &min_rate,
+	if (sscanf(line, "%d %d %u %d %u %d %d", &scheduler, &min_enable, &min_rate,
 		   &max_enable, &max_rate, &weight, &resv) != 7)
 		return -EFAULT;
 
-	line[length] = '\0';
+	if (weight < 0 || weight > HQOS_WEIGHT_MAX || resv < 0 || resv > 0xff)
+		return -EINVAL;
 
-	while (max_rate > 127) {
-		max_rate /= 10;
-		max_exp++;
-	}
+	line[length] = '\0';
 
-	while (min_rate > 127) {
-		min_rate /= 10;
-		min_exp++;
-	}
+	tree = kzalloc(sizeof(*tree), GFP_KERNEL);
+	if (!tree)
+		return -ENOMEM;
 
-	if (hnat_priv->data->num_of_sch == 4)
-		qtx_sch |= (scheduler & 0x3) << 30;
-	else
-		qtx_sch |= (scheduler & 0x1) << 31;
-	if (min_enable)
-		qtx_sch |= BIT(27);
-	qtx_sch |= (min_rate & 0x7f) << 20;
-	qtx_sch |= (min_exp & 0xf) << 16;
-	if (max_enable)
-		qtx_sch |= BIT(11);
-	qtx_sch |= (weight & 0xf) << 12;
-	qtx_sch |= (max_rate & 0x7f) << 4;
-	qtx_sch |= max_exp & 0xf;
-	writel(qtx_sch, h->fe_base + QTX_SCH(id % NUM_OF_Q_PER_PAGE));
-
-	resv &= 0xff;
-	qtx_sch = readl(h->fe_base + QTX_CFG(id % NUM_OF_Q_PER_PAGE));
-	qtx_sch &= 0xffff0000;
-	qtx_sch |= (resv << 8) | resv;
-	writel(qtx_sch, h->fe_base + QTX_CFG(id % NUM_OF_Q_PER_PAGE));
+	tree->txq_mask = BIT_ULL(id);
+	txq = &tree->txq[id];
+	txq->sch = scheduler;
+	txq->min_en = !!min_enable;
+	txq->min_rate = min_rate;
+	txq->max_en = !!max_enable;
+	txq->max_rate = max_rate;
+	txq->weight = weight;
+	txq->resv = resv;
+	ret = hnat_qos_commit(tree, NULL);
+	kfree(tree);
+	if (ret)
+		return ret;
 
 	size = strlen(line);
 	*offset += size;
@@ -2027,6 +2011,132 @@ static const struct file_operations hnat_queue_fops = {
 	.llseek = default_llseek,
 };
 
+/* whole scheduler/queue tree in one file, one line per node:
+ *   sch <id> <enable> <sp|wrr> <rate>
+ *   txq <id> <sch> <min_en> <min_rate> <max_en> <max_rate> <weight> <resv>
+ * a write is applied as one transaction, reading gives the current tree.
+ */
+static int hnat_qos_tree_read(struct seq_file *m, void *private)
+{
+	struct hqos_sch_cfg sch;
+	struct hqos_txq_cfg txq;
+	int i;
+
+	for (i = 0; i < hnat_priv->data->num_of_sch; i++) {
+		hnat_qos_get_sch(i, &sch);
+		seq_printf(m, "sch %d %d %s %u\n", i, sch.enable,
+			   (sch.wrr) ? "wrr" : "sp", sch.rate);
+	}
+
+	for (i = 0; i < MTK_QDMA_TX_NUM; i++) {
+		hnat_qos_get_txq(i, &txq);
+		seq_printf(m, "txq %d %d %d %u %d %u %d %d\n", i, txq.sch,
+			   txq.min_en, txq.min_rate, txq.max_en, txq.max_rate,
+			   txq.weight, txq.resv);
+	}
+
+	return 0;
+}
+
+static int hnat_qos_tree_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hnat_qos_tree_read, file->private_data);
+}
+
+static int hnat_qos_tree_parse(char *line, struct hqos_tree *tree)
+{
+	struct hqos_txq_cfg *txq;
+	int id, en, min_en, max_en, sch, weight, resv;
+	u32 rate, min_rate, max_rate;
+	char mode[8];
+
+	if (sscanf(line, "sch %d %d %7s %u", &id, &en, mode, &rate) == 4) {
+		if (id < 0 || id >= HQOS_MAX_SCH)
+			return -EINVAL;
+
+		tree->sch_mask |= BIT(id);
+		tree->sch[id].enable = !!en;
+		tree->sch[id].wrr = strcmp(mode, "sp") != 0;
+		tree->sch[id].rate = rate;
+
+		return 0;
+	}
+
+	if (sscanf(line, "txq %d %d %d %u %d %u %d %d", &id, &sch, &min_en,
+		   &min_rate, &max_en, &max_rate, &weight, &resv) == 8) {
+		if (id < 0 || id >= HQOS_MAX_TXQ || sch < 0 || weight < 0 ||
+		    weight > HQOS_WEIGHT_MAX || resv < 0 || resv > 0xff)
+			return -EINVAL;
+
+		tree->txq_mask |= BIT_ULL(id);
+		txq = &tree->txq[id];
+		txq->sch = sch;
+		txq->min_en = !!min_en;
+		txq->min_rate = min_rate;
+		txq->max_en = !!max_en;
+		txq->max_rate = max_rate;
+		txq->weight = weight;
+		txq->resv = resv;
+
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static ssize_t hnat_qos_tree_write(struct file *file, const char __user *buffer,
+				   size_t count, loff_t *data)
+{
+	const char *reason = NULL;
+	struct hqos_tree *tree;
+	char *buf, *cur, *line;
+	int ret = 0;
+
+	if (count > HQOS_TREE_WRITE_MAX)
+		return -EINVAL;
+
+	buf = memdup_user_nul(buffer, count);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+
+	tree = kzalloc(sizeof(*tree), GFP_KERNEL);
+	if (!tree) {
+		kfree(buf);
+		return -ENOMEM;
+	}
+
+	cur = buf;
+	while ((line = strsep(&cur, "\n")) != NULL) {
+		line = strim(line);
+		if (!*line || *line == '#')
+			continue;
+
+		ret = hnat_qos_tree_parse(line, tree);
+		if (ret) {
+			pr_info("HQoS tree: cannot parse \"%s\"\n", line);
+			goto out;
+		}
+	}
+
+	ret = hnat_qos_commit(tree, &reason);
+	if (ret)
+		pr_info("HQoS tree rejected: %s\n", reason ? reason : "unknown");
+
+out:
+	kfree(tree);
+	kfree(buf);
+
+	return ret ? ret : count;
+}
+
+static const struct file_operations hnat_qos_tree_fops = {
+	.open = hnat_qos_tree_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.write = hnat_qos_tree_write,
+	.release = single_release,
+};
+
 static ssize_t hnat_ppd_if_write(struct file *file, const char __user *buffer,
 				 size_t count, loff_t *data)
 {
@@ -2141,6 +2251,194 @@ static const struct file_operations hnat_mape_toggle_fops = {
 	.release = single_release,
 };
 
+static int hnat_ppe_lb_read(struct seq_file *m, void *private)
+{
+	struct hnat_ppe_stat stats[MAX_PPE_NUM], *stat;
+	int i;
+
+	seq_printf(m, "PPE_LB=%d\n", hnat_priv->ppe_lb_en);
+
+	for (i = 0; i < HNAT_GMAC_NUM; i++)
+		seq_printf(m, "GMAC%d_PPE=%d\n", i + 1, hnat_priv->gmac_ppe[i]);
+
+	hnat_ppe_lb_snapshot(stats, false);
+
+	for (i = 0; i < CFG_PPE_NUM; i++) {
+		stat = &stats[i];
+		/* the periodic scan only runs while load balancing is on */
+		if (!hnat_priv->ppe_lb_en)
+			stat->bound = hnat_ppe_lb_count_bound(hnat_priv->foe_table_cpu[i],
+							      hnat_priv->foe_etry_num);
+		seq_printf(m, "PPE%d: bound=%u/%u%s\n", i, stat->bound,
+			   hnat_priv->foe_etry_num,
+			   hnat_ppe_lb_saturated(stat, hnat_priv->foe_etry_num) ?
+			   " (saturated)" : "");
+		seq_printf(m, "PPE%d: bind=%llu collision=%llu table_full=%llu\n",
+			   i, stat->bind_total, stat->collision_total,
+			   stat->table_full_total);
+	}
+
+	return 0;
+}
+
+static int hnat_ppe_lb_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hnat_ppe_lb_read, file->private_data);
+}
+
+static ssize_t hnat_ppe_lb_write(struct file *file, const char __user *buffer,
+				 size_t count, loff_t *data)
+{
+	char buf = 0;
+
+	if ((count < 1) || copy_from_user(&buf, buffer, sizeof(buf)))
+		return -EFAULT;
+
+	if (buf == '1') {
+		pr_info("PPE load balancing is going to be enabled !\n");
+		hnat_ppe_lb_enable(true);
+	} else if (buf == '0') {
+		pr_info("PPE load balancing is going to be disabled !\n");
+		hnat_ppe_lb_enable(false);
+	} else {
+		pr_info("Invalid parameter.\n");
+		return -EFAULT;
+	}
+
+	return count;
+}
+
+static const struct file_operations hnat_ppe_lb_fops = {
+	.open = hnat_ppe_lb_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.write = hnat_ppe_lb_write,
+	.release = single_release,
+};
+
+static int hnat_ovf_read(struct seq_file *m, void *private)
+{
+	struct hnat_ovf_stats stats, *stat = &stats;
+	struct hnat_accounting *acct;
+	struct foe_entry *entry;
+	u64 bytes = 0, packets = 0;
+	u32 bound = 0;
+	int i, index;
+
+	for (i = 0; i < CFG_PPE_NUM; i++) {
+		entry = hnat_priv->foe_table_cpu[i];
+		acct = hnat_priv->acct[i];
+		for (index = 0; index < hnat_priv->foe_etry_num; index++, entry++) {
+			if (entry->bfib1.state != BIND)
+				continue;
+			bound++;
+			if (hnat_priv->data->per_flow_accounting && acct) {
+				bytes += acct[index].bytes;
+				packets += acct[index].packets;
+			}
+		}
+	}
+
+	hnat_ovf_get_stats(stat);
+
+	seq_printf(m, "OVF=%d\n", hnat_priv->ovf_en);
+	seq_printf(m, "hw: bound=%u packets=%llu bytes=%llu\n",
+		   bound, packets, bytes);
+	seq_printf(m, "overflow: flows=%u/%u packets=%llu bytes=%llu\n",
+		   stat->flows, HNAT_OVF_MAX, stat->ovf_packets, stat->ovf_bytes);
+	seq_printf(m, "slow: packets=%llu bytes=%llu\n",
+		   stat->slow_packets, stat->slow_bytes);
+	seq_printf(m, "hit=%llu learn=%llu evict=%llu rebind=%llu table_full=%llu\n",
+		   stat->hit, stat->learn, stat->evict, stat->rebind,
+		   stat->table_full);
+
+	return 0;
+}
+
+static int hnat_ovf_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hnat_ovf_read, file->private_data);
+}
+
+static ssize_t hnat_ovf_write(struct file *file, const char __user *buffer,
+			      size_t count, loff_t *data)
+{
+	char buf = 0;
+
+	if ((count < 1) || copy_from_user(&buf, buffer, sizeof(buf)))
+		return -EFAULT;
+
+	if (buf == '1') {
+		pr_info("HNAT overflow table is going to be enabled !\n");
+		hnat_ovf_enable(true);
+	} else if (buf == '0') {
+		pr_info("HNAT overflow table is going to be disabled !\n");
+		hnat_ovf_enable(false);
+	} else if (buf == 's') {
+		if (hnat_ovf_stub_run()) {
+			pr_info("Load with ovf_stub=1 and enable the overflow table first.\n");
+			return -EINVAL;
+		}
+	} else {
+		pr_info("Invalid parameter.\n");
+		return -EFAULT;
+	}
+
+	return count;
+}
+
+static const struct file_operations hnat_ovf_fops = {
+	.open = hnat_ovf_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.write = hnat_ovf_write,
+	.release = single_release,
+};
+
+static int hnat_acct_read(struct seq_file *m, void *private)
+{
+	seq_printf(m, "per-MAC accounting %s\n",
+		   hnat_priv->acct_en ? "enabled" : "disabled");
+	hnat_acct_show(m);
+
+	return 0;
+}
+
+static int hnat_acct_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, hnat_acct_read, file->private_data);
+}
+
+static ssize_t hnat_acct_write(struct file *file, const char __user *buffer,
+			       size_t count, loff_t *data)
+{
+	char buf[8];
+	int len = count;
+
+	if ((len > 8) || copy_from_user(buf, buffer, len))
+		return -EFAULT;
+
+	if (buf[0] == '0') {
+		pr_info("per-MAC accounting is going to be disabled !\n");
+		hnat_priv->acct_en = false;
+	} else if (buf[0] == '1') {
+		pr_info("per-MAC accounting is going to be enabled !\n");
+		hnat_priv->acct_en = true;
+	} else if (buf[0] == 'f') {
+		hnat_acct_flush();
+	}
+
+	return len;
+}
+
+static const struct file_operations hnat_acct_fops = {
+	.open = hnat_acct_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.write = hnat_acct_write,
+	.release = single_release,
+};
+
 static int hnat_hook_toggle_read(struct seq_file *m, void *private)
 {
 	seq_printf(m, "%s\n", (hook_toggle) ? "enabled" : "disabled");
@@ -2464,16 +2762,26 @@ int hnat_init_debugfs(struct mtk_hnat *h)
 			    &hnat_setting_fops);
 	debugfs_create_file("mcast_table", S_IRUGO | S_IRUGO, root, h,
 			    &hnat_mcast_fops);
+	debugfs_create_file("mcast_cache", S_IRUGO | S_IRUGO, root, h,
+			    &hnat_mcast_cache_fops);
 	debugfs_create_file("hook_toggle", S_IRUGO | S_IRUGO, root, h,
 			    &hnat_hook_toggle_fops);
 	debugfs_create_file("mape_toggle", S_IRUGO | S_IRUGO, root, h,
 			    &hnat_mape_toggle_fops);
 	debugfs_create_file("qos_toggle", S_IRUGO | S_IRUGO, root, h,
 			    &hnat_qos_toggle_fops);
+	debugfs_create_file("qdma_tree", S_IRUGO | S_IRUGO, root, h,
+			    &hnat_qos_tree_fops);
 	debugfs_create_file("hnat_version", S_IRUGO | S_IRUGO, root, h,
 			    &hnat_version_fops);
 	debugfs_create_file("hnat_ppd_if", S_IRUGO | S_IRUGO, root, h,
 			    &hnat_ppd_if_fops);
+	debugfs_create_file("ppe_lb", S_IRUGO | S_IRUGO, root, h,
+			    &hnat_ppe_lb_fops);
+	debugfs_create_file("hnat_ovf", S_IRUGO | S_IRUGO, root, h,
+			    &hnat_ovf_fops);
+	debugfs_create_file("mac_acct", S_IRUGO | S_IRUGO, root, h,
+			    &hnat_acct_fops);
 
 	for (i = 0; i < hnat_priv->data->num_of_sch; i++) {
 		snprintf(name, sizeof(name), "qdma_sch%ld", i);
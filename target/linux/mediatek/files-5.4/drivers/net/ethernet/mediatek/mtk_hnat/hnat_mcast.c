@@ -10,51 +10,59 @@
  *   Copyright (C) 2014-2016 Zhiqiang Yang <zhiqiang.yang@mediatek.com>
  */
 #include <net/sock.h>
+#include <linux/module.h>
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <linux/if_bridge.h>
+#include <linux/if_vlan.h>
+#include <linux/inet.h>
+#include <linux/jhash.h>
+#include <net/ipv6.h>
 #include "hnat.h"
 
+static bool mcast_stub;
+module_param(mcast_stub, bool, 0);
+MODULE_PARM_DESC(mcast_stub, "program an in-RAM stand-in instead of the PPE multicast table");
+
+static struct ppe_mcast_group mcast_stub_tbl[MAX_MCAST_ENTRY];
+static u32 mcast_stub_writes;
+
 /* *
  * mcast_entry_get - Returns the index of an unused entry
  * or an already existed entry in mtbl
  */
-static int mcast_entry_get(u16 vlan_id, u32 dst_mac)
+static int mcast_entry_get(u16 vlan_id, u32 mac_hi, u16 mac_lo)
 {
 	int index = -1;
 	u8 i;
 	struct ppe_mcast_group *p = hnat_priv->pmcast->mtbl;
 	u8 max = hnat_priv->pmcast->max_entry;
 
-	for (i = 0; i < max; i++) {
-		if ((index == -1) && (!p->valid)) {
-			index = i; /*get the first unused entry index*/
+	for (i = 0; i < max; i++, p++) {
+		if (!p->valid) {
+			if (index == -1)
+				index = i; /*get the first unused entry index*/
 			continue;
 		}
-		if ((p->vid == vlan_id) && (p->mac_hi == dst_mac)) {
-			index = i;
-			break;
-		}
-		p++;
+		if ((p->vid == vlan_id) && (p->mac_hi == mac_hi) &&
+		    (p->mac_lo == mac_lo))
+			return i;
 	}
-	if (index == -1)
-		pr_info("%s:group table is full\n", __func__);
 
 	return index;
 }
 
-static void get_mac_from_mdb_entry(struct br_mdb_entry *entry,
-				   u32 *mac_hi, u16 *mac_lo)
+/* group mac of a cache key, 01:00:5e for IPv4 and 33:33 for IPv6 */
+static void get_mac_from_key(const struct mcast_flow_key *key,
+			     u32 *mac_hi, u16 *mac_lo)
 {
-	switch (ntohs(entry->addr.proto)) {
-	case ETH_P_IP:
+	if (ipv6_addr_v4mapped(&key->group)) {
 		*mac_lo = 0x0100;
-		*mac_hi = swab32((entry->addr.u.ip4 & 0xfffffe00) + 0x5e);
-		break;
-	case ETH_P_IPV6:
+		*mac_hi = 0x5e000000 |
+			  (ntohl(key->group.s6_addr32[3]) & 0x7fffff);
+	} else {
 		*mac_lo = 0x3333;
-		*mac_hi = swab32(entry->addr.u.ip6.s6_addr32[3]);
-		break;
+		*mac_hi = ntohl(key->group.s6_addr32[3]);
 	}
 	trace_printk("%s:group mac_h=0x%08x, mac_l=0x%04x\n",
 		     __func__, *mac_hi, *mac_lo);
@@ -81,6 +89,8 @@ static int set_hnat_mtbl(struct ppe_mcast_group *group, u32 ppe_id, int index)
 		mcast_h.u.info.mc_mpre_sel = 1;
 
 	mcast_h.u.info.mc_px_en = mc_port;
+	mcast_h.u.info.mc_vid = group->vid;
+	mcast_h.u.info.mc_vid_cmp = !!group->vid;
 	mcast_l.addr = mac_hi;
 	mcast_h.u.info.valid = group->valid;
 	trace_printk("%s:index=%d,group info=0x%x,addr=0x%x\n",
@@ -95,84 +105,411 @@ static int set_hnat_mtbl(struct ppe_mcast_group *group, u32 ppe_id, int index)
 		reg = hnat_priv->fe_base + PPE_MCAST_H_10 + ((index) * 8);
 		writel(mcast_h.u.value, reg);
 		reg = hnat_priv->fe_base + PPE_MCAST_L_10 + ((index) * 8);
-		writel(mcast_h.u.value, reg);
+		writel(mcast_l.addr, reg);
 	}
 
 	return 0;
 }
 
+static void mcast_hw_write(struct ppe_mcast_group *group, int index)
+{
+	int i;
+
+	for (i = 0; i < CFG_PPE_NUM; i++)
+		set_hnat_mtbl(group, i, index);
+}
+
+static const struct mcast_table_ops mcast_hw_ops = {
+	.write = mcast_hw_write,
+};
+
+static void mcast_stub_write(struct ppe_mcast_group *group, int index)
+{
+	mcast_stub_tbl[index] = *group;
+	mcast_stub_writes++;
+}
+
+static const struct mcast_table_ops mcast_stub_ops = {
+	.write = mcast_stub_write,
+};
+
 /**
- * hnat_mcast_table_update -
- *	1.get a valid group entry
- *	2.update group info
- *		a.update eif&oif count
- *		b.eif ==0 & oif == 0,delete it from group table
- *		c.oif != 0,set mc forward port to cpu,else do not forward to cpu
- *	3.set the group info to ppe register
+ * mcast_group_sync - update the forward ports of an mtbl entry
+ *	a.no flow left, clear the entry
+ *	b.oif != 0,set mc forward port to cpu,else do not forward to cpu
+ *	c.set the group info to ppe register
  */
-static int hnat_mcast_table_update(int type, struct br_mdb_entry *entry)
+static void mcast_group_sync(struct ppe_mcast_table *pmcast, int index)
 {
-	struct net_device *dev;
-	u32 mac_hi = 0;
-	u16 mac_lo = 0;
-	int i, index;
-	struct ppe_mcast_group *group;
+	struct ppe_mcast_group *group = &pmcast->mtbl[index];
 
-	rcu_read_lock();
-	dev = dev_get_by_index_rcu(&init_net, entry->ifindex);
-	if (!dev) {
-		rcu_read_unlock();
-		return -ENODEV;
+	if (!group->flows) {
+		/*nobody in this group,clear the entry*/
+		memset(group, 0, sizeof(struct ppe_mcast_group));
+	} else {
+		group->valid = true;
+		if (group->oif && group->eif)
+			/*eth&wifi both in group,forward to cpu&GDMA1*/
+			group->mc_port = MCAST_TO_PDMA | MCAST_TO_GDMA1;
+		else if (group->oif)
+			/*only wifi in group,forward to cpu only*/
+			group->mc_port = MCAST_TO_PDMA;
+		else
+			/*only eth in group,forward to GDMA1 only*/
+			group->mc_port = MCAST_TO_GDMA1;
 	}
-	rcu_read_unlock();
 
-	get_mac_from_mdb_entry(entry, &mac_hi, &mac_lo);
-	index = mcast_entry_get(entry->vid, mac_hi);
+	trace_printk("%s:index=%d,eif=%d,oif=%d,flows=%d\n", __func__,
+		     index, group->eif, group->oif, group->flows);
+	pmcast->ops->write(group, index);
+}
+
+/* IPv4 groups alias on the group mac, flows sharing one entry add up */
+static bool mcast_flow_attach(struct ppe_mcast_table *pmcast,
+			      struct mcast_flow *flow)
+{
+	struct ppe_mcast_group *group;
+	int index;
+
+	index = mcast_entry_get(flow->key.vid, flow->mac_hi, flow->mac_lo);
 	if (index == -1)
-		return -1;
+		return false;
+
+	group = &pmcast->mtbl[index];
+	if (!group->valid) {
+		group->mac_hi = flow->mac_hi;
+		group->mac_lo = flow->mac_lo;
+		group->vid = flow->key.vid;
+	}
+	group->flows++;
+	group->eif += flow->eif;
+	group->oif += flow->oif;
+	flow->index = index;
+	mcast_group_sync(pmcast, index);
+
+	return true;
+}
+
+static void mcast_flow_detach(struct ppe_mcast_table *pmcast,
+			      struct mcast_flow *flow)
+{
+	struct ppe_mcast_group *group = &pmcast->mtbl[flow->index];
+
+	group->flows--;
+	group->eif -= flow->eif;
+	group->oif -= flow->oif;
+	mcast_group_sync(pmcast, flow->index);
+	flow->index = -1;
+}
+
+/* give freed entries to flows that found the table full */
+static void mcast_cache_promote(struct ppe_mcast_table *pmcast)
+{
+	struct mcast_flow *flow;
+	int bkt;
+
+	hash_for_each(pmcast->cache, bkt, flow, hlist) {
+		if (!pmcast->unmapped)
+			return;
+
+		if (flow->index == -1 && mcast_flow_attach(pmcast, flow))
+			pmcast->unmapped--;
+	}
+}
+
+static u32 mcast_key_hash(const struct mcast_flow_key *key)
+{
+	return jhash(key, sizeof(*key), 0);
+}
+
+static struct mcast_flow *mcast_cache_find(struct ppe_mcast_table *pmcast,
+					   const struct mcast_flow_key *key)
+{
+	struct mcast_flow *flow;
+
+	hash_for_each_possible(pmcast->cache, flow, hlist, mcast_key_hash(key)) {
+		if (!memcmp(&flow->key, key, sizeof(*key)))
+			return flow;
+	}
+
+	return NULL;
+}
+
+/**
+ * mcast_cache_update - apply a join or leave of one port
+ *	1.get or create the flow of (group, source, vid)
+ *	2.update eif&oif count of the flow and its mtbl entry
+ *	3.a flow nobody listens to anymore is removed and its mtbl entry
+ *	  handed to a flow waiting for one
+ */
+static int mcast_cache_update(struct ppe_mcast_table *pmcast, int type,
+			      const struct mcast_flow_key *key, bool eth)
+{
+	struct ppe_mcast_group *group;
+	struct mcast_flow *flow;
+	int ret = 0;
+
+	spin_lock_bh(&pmcast->lock);
+	flow = mcast_cache_find(pmcast, key);
 
-	group = &hnat_priv->pmcast->mtbl[index];
-	group->mac_hi = mac_hi;
-	group->mac_lo = mac_lo;
 	switch (type) {
 	case RTM_NEWMDB:
-		if (IS_LAN(dev) || IS_WAN(dev))
-			group->eif++;
+		if (!flow) {
+			if (pmcast->flows >= MCAST_CACHE_MAX) {
+				pmcast->table_full++;
+				ret = -ENOSPC;
+				break;
+			}
+
+			flow = kzalloc(sizeof(*flow), GFP_ATOMIC);
+			if (!flow) {
+				ret = -ENOMEM;
+				break;
+			}
+
+			flow->key = *key;
+			get_mac_from_key(key, &flow->mac_hi, &flow->mac_lo);
+			flow->index = -1;
+			hash_add(pmcast->cache, &flow->hlist, mcast_key_hash(key));
+			pmcast->flows++;
+
+			flow->joins++;
+			if (eth)
+				flow->eif++;
+			else
+				flow->oif++;
+
+			if (!mcast_flow_attach(pmcast, flow)) {
+				pmcast->unmapped++;
+				pmcast->table_full++;
+			}
+			break;
+		}
+
+		flow->joins++;
+		if (eth)
+			flow->eif++;
 		else
-			group->oif++;
-		group->vid = entry->vid;
-		group->valid = true;
+			flow->oif++;
+
+		if (flow->index != -1) {
+			group = &pmcast->mtbl[flow->index];
+			if (eth)
+				group->eif++;
+			else
+				group->oif++;
+			mcast_group_sync(pmcast, flow->index);
+		}
 		break;
 	case RTM_DELMDB:
-		if (group->valid) {
-			if (IS_LAN(dev) || IS_WAN(dev))
+		if (!flow) {
+			ret = -ENOENT;
+			break;
+		}
+
+		flow->leaves++;
+		if (eth && !flow->eif)
+			break;
+		if (!eth && !flow->oif)
+			break;
+
+		if (flow->eif + flow->oif == 1) {
+			/* last member gone */
+			if (flow->index != -1)
+				mcast_flow_detach(pmcast, flow);
+			else
+				pmcast->unmapped--;
+			hash_del(&flow->hlist);
+			kfree(flow);
+			pmcast->flows--;
+			mcast_cache_promote(pmcast);
+			break;
+		}
+
+		if (eth)
+			flow->eif--;
+		else
+			flow->oif--;
+
+		if (flow->index != -1) {
+			group = &pmcast->mtbl[flow->index];
+			if (eth)
 				group->eif--;
 			else
 				group->oif--;
-			}
+			mcast_group_sync(pmcast, flow->index);
+		}
 		break;
 	}
-	trace_printk("%s:devname=%s,eif=%d,oif=%d\n", __func__,
-		     dev->name, group->eif, group->oif);
-	if (group->valid) {
-		if (group->oif && group->eif)
-			/*eth&wifi both in group,forward to cpu&GDMA1*/
-			group->mc_port = (MCAST_TO_PDMA || MCAST_TO_GDMA1);
-		else if (group->oif)
-			/*only wifi in group,forward to cpu only*/
-			group->mc_port = MCAST_TO_PDMA;
-		else
-			/*only eth in group,forward to GDMA1 only*/
-			group->mc_port = MCAST_TO_GDMA1;
-		if (!group->oif && !group->eif)
-			/*nobody in this group,clear the entry*/
-			memset(group, 0, sizeof(struct ppe_mcast_group));
 
-		for (i = 0; i < CFG_PPE_NUM; i++)
-			set_hnat_mtbl(group, i, index);
+	spin_unlock_bh(&pmcast->lock);
+
+	return ret;
+}
+
+static void mcast_key_from_mdb(const struct br_mdb_entry *entry,
+			       struct mcast_flow_key *key)
+{
+	memset(key, 0, sizeof(*key));
+	if (entry->addr.proto == htons(ETH_P_IP))
+		ipv6_addr_set_v4mapped(entry->addr.u.ip4, &key->group);
+	else
+		key->group = entry->addr.u.ip6;
+	key->vid = entry->vid;
+}
+
+static int hnat_mcast_table_update(int type, struct br_mdb_entry *entry)
+{
+	struct mcast_flow_key key;
+	struct net_device *dev;
+	bool eth;
+
+	rcu_read_lock();
+	dev = dev_get_by_index_rcu(&init_net, entry->ifindex);
+	if (!dev) {
+		rcu_read_unlock();
+		return -ENODEV;
 	}
+	eth = IS_LAN(dev) || IS_WAN(dev);
+	trace_printk("%s:devname=%s\n", __func__, dev->name);
+	rcu_read_unlock();
 
-	return 0;
+	mcast_key_from_mdb(entry, &key);
+
+	return mcast_cache_update(hnat_priv->pmcast, type, &key, eth);
+}
+
+static int mcast_parse_addr(const char *str, struct in6_addr *addr)
+{
+	__be32 ip4;
+
+	if (in4_pton(str, -1, (u8 *)&ip4, -1, NULL)) {
+		ipv6_addr_set_v4mapped(ip4, addr);
+		return 0;
+	}
+
+	if (in6_pton(str, -1, addr->s6_addr, -1, NULL))
+		return 0;
+
+	return -EINVAL;
+}
+
+/**
+ * hnat_mcast_replay - feed one line of an IGMP/MLD trace to the cache
+ *	"join <group> <vid> <ifname> [source]" or "leave ..."
+ *	ifname that is not a device counts as eth if it is "eth",
+ *	as another interface otherwise.
+ */
+int hnat_mcast_replay(char *line)
+{
+	struct ppe_mcast_table *pmcast = hnat_priv->pmcast;
+	char cmd[8], group[INET6_ADDRSTRLEN], ifname[IFNAMSIZ];
+	char source[INET6_ADDRSTRLEN];
+	struct mcast_flow_key key;
+	struct net_device *dev;
+	unsigned int vid;
+	bool eth;
+	int n, type;
+
+	if (!pmcast)
+		return -ENODEV;
+
+	n = sscanf(line, "%7s %45s %u %15s %45s", cmd, group, &vid, ifname,
+		   source);
+	if (n < 4 || vid >= VLAN_N_VID)
+		return -EINVAL;
+
+	if (!strcmp(cmd, "join"))
+		type = RTM_NEWMDB;
+	else if (!strcmp(cmd, "leave"))
+		type = RTM_DELMDB;
+	else
+		return -EINVAL;
+
+	memset(&key, 0, sizeof(key));
+	if (mcast_parse_addr(group, &key.group))
+		return -EINVAL;
+	if (n == 5 && mcast_parse_addr(source, &key.source))
+		return -EINVAL;
+	key.vid = vid;
+
+	dev = dev_get_by_name(&init_net, ifname);
+	if (dev) {
+		eth = IS_LAN(dev) || IS_WAN(dev);
+		dev_put(dev);
+	} else {
+		eth = !strcmp(ifname, "eth");
+	}
+
+	return mcast_cache_update(pmcast, type, &key, eth);
+}
+
+/* per-group counters of multicast the PPE handed to the CPU */
+void hnat_mcast_account(struct sk_buff *skb)
+{
+	struct ppe_mcast_table *pmcast = hnat_priv->pmcast;
+	struct mcast_flow_key key;
+	struct mcast_flow *flow;
+
+	if (!pmcast)
+		return;
+
+	memset(&key, 0, sizeof(key));
+	if (skb->protocol == htons(ETH_P_IP))
+		ipv6_addr_set_v4mapped(ip_hdr(skb)->daddr, &key.group);
+	else if (skb->protocol == htons(ETH_P_IPV6))
+		key.group = ipv6_hdr(skb)->daddr;
+	else
+		return;
+
+	if (skb_vlan_tag_present(skb))
+		key.vid = skb_vlan_tag_get_id(skb);
+
+	spin_lock_bh(&pmcast->lock);
+	flow = mcast_cache_find(pmcast, &key);
+	if (flow) {
+		flow->packets++;
+		flow->bytes += skb->len;
+	}
+	spin_unlock_bh(&pmcast->lock);
+}
+
+void hnat_mcast_cache_show(struct seq_file *m)
+{
+	struct ppe_mcast_table *pmcast = hnat_priv->pmcast;
+	struct mcast_flow *flow;
+	int bkt, i;
+
+	if (!pmcast)
+		return;
+
+	spin_lock_bh(&pmcast->lock);
+	seq_printf(m, "flows %u/%u, without table entry %u, table full %llu\n",
+		   pmcast->flows, MCAST_CACHE_MAX, pmcast->unmapped,
+		   pmcast->table_full);
+	seq_puts(m, "group\tsource\tvid\tentry\teif\toif\tjoins\tleaves\tpackets\tbytes\n");
+	hash_for_each(pmcast->cache, bkt, flow, hlist)
+		seq_printf(m, "%pI6c\t%pI6c\t%u\t%d\t%u\t%u\t%llu\t%llu\t%llu\t%llu\n",
+			   &flow->key.group, &flow->key.source, flow->key.vid,
+			   flow->index, flow->eif, flow->oif, flow->joins,
+			   flow->leaves, flow->packets, flow->bytes);
+
+	if (pmcast->ops == &mcast_stub_ops) {
+		seq_printf(m, "stub table, %u writes\n", mcast_stub_writes);
+		for (i = 0; i < pmcast->max_entry; i++) {
+			if (!mcast_stub_tbl[i].valid)
+				continue;
+			seq_printf(m, "%d: %04x%08x vid %u port %x eif %u oif %u flows %u\n",
+				   i, mcast_stub_tbl[i].mac_lo,
+				   mcast_stub_tbl[i].mac_hi,
+				   mcast_stub_tbl[i].vid,
+				   mcast_stub_tbl[i].mc_port,
+				   mcast_stub_tbl[i].eif,
+				   mcast_stub_tbl[i].oif,
+				   mcast_stub_tbl[i].flows);
+		}
+	}
+	spin_unlock_bh(&pmcast->lock);
 }
 
 static void hnat_mcast_nlmsg_handler(struct work_struct *work)
@@ -195,7 +532,7 @@ static void hnat_mcast_nlmsg_handler(struct work_struct *work)
 			continue;
 		}
 		bpm = nlmsg_data(nlh);
-		nest = nlmsg_find_attr(nlh, sizeof(bpm), MDBA_MDB);
+		nest = nlmsg_find_attr(nlh, sizeof(*bpm), MDBA_MDB);
 		if (!nest) {
 			kfree_skb(skb);
 			continue;
@@ -285,10 +622,18 @@ int hnat_mcast_enable(u32 ppe_id)
 	if (ppe_id >= CFG_PPE_NUM)
 		return -EINVAL;
 
+	/* the group table and its cache are shared by all PPEs */
+	if (hnat_priv->pmcast)
+		goto ppe_cfg;
+
 	pmcast = kzalloc(sizeof(*pmcast), GFP_KERNEL);
 	if (!pmcast)
 		return -1;
 
+	spin_lock_init(&pmcast->lock);
+	hash_init(pmcast->cache);
+	pmcast->ops = mcast_stub ? &mcast_stub_ops : &mcast_hw_ops;
+
 	if (hnat_priv->data->version == MTK_HNAT_V1)
 		pmcast->max_entry = 0x10;
 	else
@@ -313,6 +658,7 @@ int hnat_mcast_enable(u32 ppe_id)
 		add_timer(&hnat_priv->hnat_mcast_check_timer);
 	}
 
+ppe_cfg:
 	/* Enable multicast table lookup */
 	cr_set_field(hnat_priv->ppe_base[ppe_id] + PPE_GLO_CFG, MCAST_TB_EN, 1);
 	/* multicast port0 map to PDMA */
@@ -338,6 +684,9 @@ err:
 int hnat_mcast_disable(void)
 {
 	struct ppe_mcast_table *pmcast = hnat_priv->pmcast;
+	struct mcast_flow *flow;
+	struct hlist_node *n;
+	int bkt;
 
 	if (!pmcast)
 		return -EINVAL;
@@ -348,6 +697,13 @@ int hnat_mcast_disable(void)
 	flush_work(&pmcast->work);
 	destroy_workqueue(pmcast->queue);
 	sock_release(pmcast->msock);
+
+	hash_for_each_safe(pmcast->cache, bkt, n, flow, hlist) {
+		hash_del(&flow->hlist);
+		kfree(flow);
+	}
+
+	hnat_priv->pmcast = NULL;
 	kfree(pmcast);
 
 	return 0;
@@ -13,6 +13,9 @@
 #ifndef NF_HNAT_MCAST_H
 #define NF_HNAT_MCAST_H
 
+#include <linux/hashtable.h>
+#include <linux/in6.h>
+
 #define RTMGRP_IPV4_MROUTE 0x20
 #define RTMGRP_MDB 0x2000000
 
@@ -22,22 +25,58 @@
 #define MCAST_TO_GDMA1 (0x1 << 1)
 #define MCAST_TO_GDMA2 (0x1 << 2)
 
+/* multicast forwarding cache, many groups share the hardware table */
+#define MCAST_CACHE_HASH_BITS 8
+#define MCAST_CACHE_MAX 1024
+
 struct ppe_mcast_group {
 	u32 mac_hi; /*multicast mac addr*/
 	u16 mac_lo; /*multicast mac addr*/
 	u16 vid;
 	u8 mc_port; /*1:forward to cpu,2:forward to GDMA1,4:forward to GDMA2*/
-	u8 eif; /*num of eth if added to multi group. */
-	u8 oif; /* num of other if added to multi group ,ex wifi.*/
+	u16 eif; /*num of eth if added to multi group. */
+	u16 oif; /* num of other if added to multi group ,ex wifi.*/
+	u16 flows; /* cache flows mapped to this entry */
 	bool valid;
 };
 
+struct mcast_flow_key {
+	struct in6_addr group; /* IPv4 groups are v4-mapped */
+	struct in6_addr source; /* unspecified for any source */
+	u16 vid;
+};
+
+struct mcast_flow {
+	struct hlist_node hlist;
+	struct mcast_flow_key key;
+	u32 mac_hi;
+	u16 mac_lo;
+	u16 eif;
+	u16 oif;
+	int index; /* entry in mtbl, -1 while the table is full */
+	u64 joins;
+	u64 leaves;
+	u64 packets; /* forwarded by the CPU */
+	u64 bytes;
+};
+
+/* hardware table access, replaced by an in-RAM table with mcast_stub=1 */
+struct mcast_table_ops {
+	void (*write)(struct ppe_mcast_group *group, int index);
+};
+
 struct ppe_mcast_table {
 	struct workqueue_struct *queue;
 	struct work_struct work;
 	struct socket *msock;
 	struct ppe_mcast_group mtbl[MAX_MCAST_ENTRY];
 	u8 max_entry;
+	spinlock_t lock; /* cache and mtbl */
+	DECLARE_HASHTABLE(cache, MCAST_CACHE_HASH_BITS);
+	u32 flows;
+	u32 unmapped; /* flows without an mtbl entry */
+	u64 table_full;
+	const struct mcast_table_ops *ops;
 };
 
 struct ppe_mcast_h {
@@ -65,5 +104,8 @@ struct ppe_mcast_l {
 
 int hnat_mcast_enable(u32 ppe_id);
 int hnat_mcast_disable(void);
+int hnat_mcast_replay(char *line);
+void hnat_mcast_account(struct sk_buff *skb);
+void hnat_mcast_cache_show(struct seq_file *m);
 
 #endif
@@ -13,6 +13,7 @@
 
 #include <linux/netfilter_bridge.h>
 #include <linux/netfilter_ipv6.h>
+#include <linux/if_arp.h>
 
 #include <linux/of.h>
 #include <net/arp.h>
@@ -45,6 +46,10 @@
 		 get_wandev_from_index(skb->vlan_tci & VLAN_VID_MASK)))
 #define do_mape_w2l_fast(dev, skb)                                          \
 		(mape_toggle && IS_WAN(dev) && (!is_from_mape(skb)))
+#define do_ovf_fast(skb)							\
+	(hnat_priv->ovf_en && hnat_priv->ovf_stat.flows &&			\
+	 (FROM_GE_LAN(skb) || FROM_GE_WAN(skb) || FROM_GE_VIRTUAL(skb)) &&	\
+	 !skb_hnat_alg(skb) && !is_from_extge(skb))
 
 static struct ipv6hdr mape_l2w_v6h;
 static struct ipv6hdr mape_w2l_v6h;
@@ -261,6 +266,7 @@ void foe_clear_all_bind_entries(struct net_device *dev)
 
 	/* clear HWNAT cache */
 	hnat_cache_ebl(1);
+	hnat_ovf_flush();
 
 	mod_timer(&hnat_priv->hnat_sma_build_entry_timer, jiffies + 3 * HZ);
 }
@@ -386,8 +392,11 @@ int nf_hnat_netevent_handler(struct notifier_block *unused, unsigned long event,
 	case NETEVENT_NEIGH_UPDATE:
 		neigh = ptr;
 		dev = neigh->dev;
-		if (dev)
+		if (dev) {
 			foe_clear_entry(neigh);
+			if (hnat_priv->ovf_stat.flows)
+				hnat_ovf_flush();
+		}
 		break;
 	}
 
@@ -1270,10 +1279,15 @@ struct foe_entry ppe_fill_info_blk(struct ethhdr *eth, struct foe_entry entry,
 	return entry;
 }
 
+/* skb_to_hnat_info - complete the FOE entry of a flow
+ * @shadow: @foe is an overflow entry kept in software, which is only
+ * computed and never handed to the PPE
+ */
 static unsigned int skb_to_hnat_info(struct sk_buff *skb,
 				     const struct net_device *dev,
 				     struct foe_entry *foe,
-				     struct flow_offload_hw_path *hw_path)
+				     struct flow_offload_hw_path *hw_path,
+				     bool shadow)
 {
 	struct foe_entry entry = { 0 };
 	int whnat = IS_WHNAT(dev);
@@ -1790,6 +1804,11 @@ static unsigned int skb_to_hnat_info(struct sk_buff *skb,
 		entry.bfib1.state = BIND;
 	}
 
+	if (shadow) {
+		memcpy(foe, &entry, sizeof(entry));
+		return 0;
+	}
+
 	wmb();
 	memcpy(foe, &entry, sizeof(entry));
 	/*reset statistic for this entry*/
@@ -2142,6 +2161,48 @@ static void mtk_hnat_nf_update(struct sk_buff *skb)
 	}
 }
 
+/* hnat_ovf_learn - keep a flow whose FOE bucket is taken in software
+ * The unbind entry the PPE would have filled in is rebuilt from the
+ * conntrack tuple, then completed by skb_to_hnat_info() as usual.
+ */
+static void hnat_ovf_learn(struct sk_buff *skb, const struct net_device *out,
+			   const struct net_device *arp_dev,
+			   struct flow_offload_hw_path *hw_path)
+{
+	struct foe_entry shadow = { 0 };
+	const struct nf_conntrack_tuple *t;
+	enum ip_conntrack_info ctinfo;
+	struct nf_conn *ct;
+
+	if (skb->protocol != htons(ETH_P_IP) ||
+	    (hw_path->flags & FLOW_OFFLOAD_PATH_PPPOE) ||
+	    arp_dev->type != ARPHRD_ETHER ||
+	    (!IS_LAN(out) && !IS_WAN(out)) || (mape_toggle && IS_WAN(out)))
+		return;
+
+	ct = nf_ct_get(skb, &ctinfo);
+	if (!ct)
+		return;
+
+	t = &ct->tuplehash[CTINFO2DIR(ctinfo)].tuple;
+	if (t->dst.protonum != IPPROTO_TCP && t->dst.protonum != IPPROTO_UDP)
+		return;
+
+	shadow.udib1.state = UNBIND;
+	shadow.udib1.pkt_type = IPV4_HNAPT;
+	shadow.ipv4_hnapt.sip = ntohl(t->src.u3.ip);
+	shadow.ipv4_hnapt.dip = ntohl(t->dst.u3.ip);
+	shadow.ipv4_hnapt.sport = ntohs(t->src.u.all);
+	shadow.ipv4_hnapt.dport = ntohs(t->dst.u.all);
+
+	skb_to_hnat_info(skb, out, &shadow, hw_path, true);
+	if (shadow.bfib1.state != BIND)
+		return;
+
+	hnat_ovf_add(&shadow, arp_dev->ifindex, skb_hnat_ppe(skb),
+		     skb_hnat_entry(skb));
+}
+
 static unsigned int mtk_hnat_nf_post_routing(
 	struct sk_buff *skb, const struct net_device *out,
 	unsigned int (*fn)(struct sk_buff *, const struct net_device *,
@@ -2153,6 +2214,10 @@ static unsigned int mtk_hnat_nf_post_routing(
 						.virt_dev = (struct net_device*)out,
 						.flags = 0 };
 	const struct net_device *arp_dev = out;
+	u8 src[ETH_ALEN];
+
+	if (hnat_priv->acct_en && skb_mac_header_was_set(skb))
+		hnat_acct_slow(skb, !!fn);
 
 	if (skb->protocol == htons(ETH_P_IPV6) && !hnat_priv->ipv6_en) {
 		return 0;
@@ -2165,6 +2230,9 @@ static unsigned int mtk_hnat_nf_post_routing(
 	if (unlikely(!skb_mac_header_was_set(skb)))
 		return 0;
 
+	if (unlikely(skb_hnat_reason(skb) == NO_FLOW_IS_ASSIGNED))
+		hnat_ppe_lb_account(skb_hnat_ppe(skb), PPE_EVENT_TABLE_FULL);
+
 	if (unlikely(!skb_hnat_is_hashed(skb)))
 		return 0;
 		
@@ -2187,20 +2255,42 @@ static unsigned int mtk_hnat_nf_post_routing(
 	trace_printk("[%s] case hit, %x-->%s, reason=%x\n", __func__,
 		     skb_hnat_iface(skb), out->name, skb_hnat_reason(skb));
 
+	if (hnat_priv->ovf_en &&
+	    skb_hnat_reason(skb) != HIT_BIND_KEEPALIVE_DUP_OLD_HDR)
+		hnat_ovf_count_slow(skb->len);
+
 	entry = &hnat_priv->foe_table_cpu[skb_hnat_ppe(skb)][skb_hnat_entry(skb)];
 
 	switch (skb_hnat_reason(skb)) {
 	case HIT_UNBIND_RATE_REACH:
-		if (entry_hnat_is_bound(entry))
+		if (entry_hnat_is_bound(entry)) {
+			/* the bucket was won by another flow */
+			hnat_ppe_lb_account(skb_hnat_ppe(skb), PPE_EVENT_COLLISION);
+
+			if (hnat_priv->ovf_en && fn &&
+			    mtk_hnat_accel_type(skb) && !fn(skb, arp_dev, &hw_path))
+				hnat_ovf_learn(skb, out, arp_dev, &hw_path);
 			break;
+		}
 
 		if (fn && !mtk_hnat_accel_type(skb))
 			break;
 
+		/* the nexthop lookup below rewrites h_source */
+		ether_addr_copy(src, eth_hdr(skb)->h_source);
+
 		if (fn && fn(skb, arp_dev, &hw_path))
 			break;
 
-		skb_to_hnat_info(skb, out, entry, &hw_path);
+		skb_to_hnat_info(skb, out, entry, &hw_path, false);
+		if (is_hnat_info_filled(skb)) {
+			hnat_ppe_lb_account(skb_hnat_ppe(skb), PPE_EVENT_BIND);
+			if (hnat_priv->acct_en)
+				hnat_acct_bind(skb_hnat_ppe(skb),
+					       skb_hnat_entry(skb), src);
+			if (READ_ONCE(hnat_priv->ovf_stat.evicted))
+				hnat_ovf_rebind(entry);
+		}
 		break;
 	case HIT_BIND_KEEPALIVE_DUP_OLD_HDR:
 		/* update hnat count to nf_conntrack by keepalive */
@@ -2226,6 +2316,8 @@ static unsigned int mtk_hnat_nf_post_routing(
 		break;
 	case HIT_BIND_MULTICAST_TO_CPU:
 	case HIT_BIND_MULTICAST_TO_GMAC_CPU:
+		if (hnat_priv->data->mcast)
+			hnat_mcast_account(skb);
 		/*do not forward to gdma again,if ppe already done it*/
 		if (IS_LAN(out) || IS_WAN(out))
 			return -1;
@@ -2334,6 +2426,19 @@ drop:
 	return NF_DROP;
 }
 
+static unsigned int
+mtk_hnat_ipv4_nf_forward(void *priv, struct sk_buff *skb,
+			 const struct nf_hook_state *state)
+{
+	/* flows that lost their FOE bucket, forwarded in software once the
+	 * forward chain has accepted the packet
+	 */
+	if (do_ovf_fast(skb) && !hnat_ovf_forward(skb, state->out))
+		return NF_STOLEN;
+
+	return NF_ACCEPT;
+}
+
 static unsigned int
 mtk_hnat_ipv4_nf_post_routing(void *priv, struct sk_buff *skb,
 			      const struct nf_hook_state *state)
@@ -2496,6 +2601,12 @@ static struct nf_hook_ops mtk_hnat_nf_ops[] __read_mostly = {
 		.hooknum = NF_INET_LOCAL_OUT,
 		.priority = NF_IP_PRI_LAST,
 	},
+	{
+		.hook = mtk_hnat_ipv4_nf_forward,
+		.pf = NFPROTO_IPV4,
+		.hooknum = NF_INET_FORWARD,
+		.priority = NF_IP_PRI_LAST,
+	},
 	{
 		.hook = mtk_hnat_ipv4_nf_post_routing,
 		.pf = NFPROTO_IPV4,
@@ -0,0 +1,602 @@
+/*   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/jhash.h>
+#include <linux/hashtable.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/u64_stats_sync.h>
+#include <net/ip.h>
+#include <net/neighbour.h>
+#include <net/route.h>
+#include <net/tcp.h>
+#include <net/udp.h>
+#include <net/checksum.h>
+#include <net/netfilter/nf_conntrack.h>
+
+#include "nf_hnat_mtk.h"
+#include "hnat.h"
+
+static bool ovf_stub;
+module_param(ovf_stub, bool, 0);
+MODULE_PARM_DESC(ovf_stub, "collide synthetic flows on an in-RAM stand-in FOE bucket");
+
+#define HNAT_OVF_STUB_FLOWS	8
+#define HNAT_OVF_STUB_PPE	CFG_PPE_NUM	/* never a real PPE */
+
+/* Software overflow table: IPv4 flows whose FOE bucket is already bound
+ * to another flow are forwarded with the entry skb_to_hnat_info() computed
+ * for them, SFE style. This is done from the end of the forward hook, so
+ * conntrack and the forward chain still see every packet, and only the
+ * post-routing stage is skipped.
+ */
+
+struct hnat_ovf_flow {
+	struct hlist_node node;
+	struct rcu_head rcu;
+	struct foe_entry entry;		/* as computed by skb_to_hnat_info() */
+	int ifindex;			/* egress netdev */
+	u32 ppe_id;			/* FOE bucket the flow lost */
+	u32 foe_idx;
+	unsigned long last_seen;
+	atomic64_t packets;
+	u64 last_packets;		/* owned by the check timer */
+	bool evicted;			/* waiting to be bound again */
+};
+
+struct hnat_ovf_pcpu {
+	struct u64_stats_sync syncp;
+	u64 slow_packets;
+	u64 slow_bytes;
+	u64 ovf_packets;
+	u64 ovf_bytes;
+};
+
+static DEFINE_HASHTABLE(hnat_ovf_hash, HNAT_OVF_HASH_BITS);
+static DEFINE_SPINLOCK(hnat_ovf_lock);
+static struct hnat_ovf_pcpu __percpu *hnat_ovf_pcpu;
+
+/* stand-in for the FOE bucket all the ovf_stub flows hash to */
+static struct foe_entry hnat_ovf_stub_foe;
+
+static u32 hnat_ovf_hashfn(u32 sip, u32 dip, u16 sport, u16 dport)
+{
+	return jhash_3words(sip, dip, ((u32)sport << 16) | dport, 0);
+}
+
+static struct hnat_ovf_flow *hnat_ovf_lookup(u32 sip, u32 dip,
+					     u16 sport, u16 dport, u8 udp)
+{
+	struct hnat_ovf_flow *flow;
+	struct hnat_ipv4_hnapt *e;
+
+	hash_for_each_possible_rcu(hnat_ovf_hash, flow, node,
+				   hnat_ovf_hashfn(sip, dip, sport, dport)) {
+		e = &flow->entry.ipv4_hnapt;
+		if (e->sip == sip && e->dip == dip && e->sport == sport &&
+		    e->dport == dport && e->bfib1.udp == udp)
+			return flow;
+	}
+
+	return NULL;
+}
+
+static void hnat_ovf_del(struct hnat_ovf_flow *flow)
+{
+	hash_del_rcu(&flow->node);
+	kfree_rcu(flow, rcu);
+	hnat_priv->ovf_stat.flows--;
+	if (flow->evicted)
+		hnat_priv->ovf_stat.evicted--;
+}
+
+static struct foe_entry *hnat_ovf_bucket(u32 ppe_id, u32 foe_idx)
+{
+	if (ppe_id == HNAT_OVF_STUB_PPE)
+		return ovf_stub ? &hnat_ovf_stub_foe : NULL;
+
+	if (ppe_id >= CFG_PPE_NUM || foe_idx >= hnat_priv->foe_etry_num)
+		return NULL;
+
+	return hnat_priv->foe_table_cpu[ppe_id] + foe_idx;
+}
+
+int hnat_ovf_add(struct foe_entry *entry, int ifindex, u32 ppe_id, u32 foe_idx)
+{
+	struct hnat_ipv4_hnapt *e = &entry->ipv4_hnapt;
+	struct hnat_ovf_flow *flow;
+
+	if (!hnat_ovf_pcpu)
+		return -ENODEV;
+
+	if (!IS_IPV4_HNAPT(entry) || !entry_hnat_is_bound(entry))
+		return -EINVAL;
+
+	spin_lock_bh(&hnat_ovf_lock);
+
+	hnat_priv->ovf_stat.hit++;
+
+	if (hnat_ovf_lookup(e->sip, e->dip, e->sport, e->dport, e->bfib1.udp)) {
+		spin_unlock_bh(&hnat_ovf_lock);
+		return -EEXIST;
+	}
+
+	if (hnat_priv->ovf_stat.flows >= HNAT_OVF_MAX) {
+		hnat_priv->ovf_stat.table_full++;
+		spin_unlock_bh(&hnat_ovf_lock);
+		return -ENOSPC;
+	}
+
+	flow = kzalloc(sizeof(*flow), GFP_ATOMIC);
+	if (!flow) {
+		spin_unlock_bh(&hnat_ovf_lock);
+		return -ENOMEM;
+	}
+
+	memcpy(&flow->entry, entry, sizeof(*entry));
+	flow->ifindex = ifindex;
+	flow->ppe_id = ppe_id;
+	flow->foe_idx = foe_idx;
+	flow->last_seen = jiffies;
+
+	hash_add_rcu(hnat_ovf_hash, &flow->node,
+		     hnat_ovf_hashfn(e->sip, e->dip, e->sport, e->dport));
+	hnat_priv->ovf_stat.flows++;
+	hnat_priv->ovf_stat.learn++;
+
+	/* the check timer only runs while there are flows to look after */
+	if (READ_ONCE(hnat_priv->ovf_en) &&
+	    !timer_pending(&hnat_priv->hnat_ovf_timer))
+		mod_timer(&hnat_priv->hnat_ovf_timer, jiffies + HNAT_OVF_PERIOD);
+
+	spin_unlock_bh(&hnat_ovf_lock);
+
+	if (debug_level >= 2)
+		pr_info("%s: %pI4h:%d->%pI4h:%d lost PPE%d entry %d\n",
+			__func__, &e->sip, e->sport, &e->dip, e->dport,
+			ppe_id, foe_idx);
+
+	return 0;
+}
+
+/* hnat_ovf_rebind - an evicted flow was bound in hardware again
+ * Called from the bind path while evicted flows are waiting, which then
+ * leave the table.
+ */
+void hnat_ovf_rebind(const struct foe_entry *entry)
+{
+	const struct hnat_ipv4_hnapt *e = &entry->ipv4_hnapt;
+	struct hnat_ovf_flow *flow;
+
+	if (!IS_IPV4_HNAPT(entry))
+		return;
+
+	spin_lock_bh(&hnat_ovf_lock);
+	flow = hnat_ovf_lookup(e->sip, e->dip, e->sport, e->dport, e->bfib1.udp);
+	if (flow && flow->evicted) {
+		hnat_priv->ovf_stat.rebind++;
+		hnat_ovf_del(flow);
+	}
+	spin_unlock_bh(&hnat_ovf_lock);
+}
+
+void hnat_ovf_flush(void)
+{
+	struct hnat_ovf_flow *flow;
+	struct hlist_node *tmp;
+	int bkt;
+
+	spin_lock_bh(&hnat_ovf_lock);
+	hash_for_each_safe(hnat_ovf_hash, bkt, tmp, flow, node)
+		hnat_ovf_del(flow);
+	spin_unlock_bh(&hnat_ovf_lock);
+}
+
+static void hnat_ovf_mangle(struct sk_buff *skb, struct hnat_ipv4_hnapt *e)
+{
+	struct iphdr *iph = ip_hdr(skb);
+	__sum16 *check = NULL;
+	struct tcpudphdr *ports;
+	bool udp = false;
+	__be32 addr;
+	__be16 port;
+
+	ports = (struct tcpudphdr *)((u8 *)iph + iph->ihl * 4);
+	if (iph->protocol == IPPROTO_TCP) {
+		check = &((struct tcphdr *)ports)->check;
+	} else if (((struct udphdr *)ports)->check) {
+		/* a zero UDP checksum means none, and stays zero */
+		check = &((struct udphdr *)ports)->check;
+		udp = true;
+	}
+
+	addr = htonl(e->new_sip);
+	if (iph->saddr != addr) {
+		if (check)
+			inet_proto_csum_replace4(check, skb, iph->saddr, addr, true);
+		csum_replace4(&iph->check, iph->saddr, addr);
+		iph->saddr = addr;
+	}
+
+	addr = htonl(e->new_dip);
+	if (iph->daddr != addr) {
+		if (check)
+			inet_proto_csum_replace4(check, skb, iph->daddr, addr, true);
+		csum_replace4(&iph->check, iph->daddr, addr);
+		iph->daddr = addr;
+	}
+
+	port = htons(e->new_sport);
+	if (ports->src != port) {
+		if (check)
+			inet_proto_csum_replace2(check, skb, ports->src, port, false);
+		ports->src = port;
+	}
+
+	port = htons(e->new_dport);
+	if (ports->dst != port) {
+		if (check)
+			inet_proto_csum_replace2(check, skb, ports->dst, port, false);
+		ports->dst = port;
+	}
+
+	if (udp && !*check)
+		*check = CSUM_MANGLED_0;
+}
+
+void hnat_ovf_count_slow(unsigned int len)
+{
+	struct hnat_ovf_pcpu *pcpu;
+
+	if (!hnat_ovf_pcpu)
+		return;
+
+	pcpu = this_cpu_ptr(hnat_ovf_pcpu);
+	u64_stats_update_begin(&pcpu->syncp);
+	pcpu->slow_packets++;
+	pcpu->slow_bytes += len;
+	u64_stats_update_end(&pcpu->syncp);
+}
+
+static void hnat_ovf_count_fast(unsigned int len)
+{
+	struct hnat_ovf_pcpu *pcpu = this_cpu_ptr(hnat_ovf_pcpu);
+
+	u64_stats_update_begin(&pcpu->syncp);
+	pcpu->ovf_packets++;
+	pcpu->ovf_bytes += len;
+	u64_stats_update_end(&pcpu->syncp);
+}
+
+void hnat_ovf_get_stats(struct hnat_ovf_stats *stat)
+{
+	const struct hnat_ovf_pcpu *pcpu;
+	u64 slow_packets, slow_bytes, ovf_packets, ovf_bytes;
+	unsigned int start;
+	int cpu;
+
+	spin_lock_bh(&hnat_ovf_lock);
+	*stat = hnat_priv->ovf_stat;
+	spin_unlock_bh(&hnat_ovf_lock);
+
+	if (!hnat_ovf_pcpu)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		pcpu = per_cpu_ptr(hnat_ovf_pcpu, cpu);
+		do {
+			start = u64_stats_fetch_begin_irq(&pcpu->syncp);
+			slow_packets = pcpu->slow_packets;
+			slow_bytes = pcpu->slow_bytes;
+			ovf_packets = pcpu->ovf_packets;
+			ovf_bytes = pcpu->ovf_bytes;
+		} while (u64_stats_fetch_retry_irq(&pcpu->syncp, start));
+
+		stat->slow_packets += slow_packets;
+		stat->slow_bytes += slow_bytes;
+		stat->ovf_packets += ovf_packets;
+		stat->ovf_bytes += ovf_bytes;
+	}
+}
+
+/* hnat_ovf_forward - forward a packet of an overflow flow
+ * Called at the end of the IPv4 forward hook, after the forward chain
+ * accepted the packet and ip_forward() decremented the TTL. DNAT has been
+ * done by conntrack, SNAT is taken from the entry. The packet leaves
+ * through the neighbour of its route, so VLAN and DSA tags are added by
+ * the egress device as usual.
+ * Return 0 if the skb was consumed, -1 to leave it to the slow path.
+ */
+int hnat_ovf_forward(struct sk_buff *skb, const struct net_device *out)
+{
+	const struct nf_conntrack_tuple *t;
+	enum ip_conntrack_info ctinfo;
+	struct hnat_ovf_flow *flow;
+	struct rtable *rt = skb_rtable(skb);
+	struct net_device *dev;
+	struct neighbour *neigh;
+	struct iphdr *iph = ip_hdr(skb);
+	const struct tcphdr *th;
+	struct tcphdr _th;
+	struct nf_conn *ct;
+	unsigned int l4_len;
+	bool is_v6gw = false;
+	u32 len;
+
+	if (iph->ihl != 5 || ip_is_fragment(iph) || !rt || !out)
+		return -1;
+
+	ct = nf_ct_get(skb, &ctinfo);
+	if (!ct || (ctinfo != IP_CT_ESTABLISHED &&
+		    ctinfo != IP_CT_ESTABLISHED_REPLY))
+		return -1;
+
+	if (iph->protocol == IPPROTO_TCP) {
+		th = skb_header_pointer(skb, sizeof(*iph), sizeof(_th), &_th);
+		if (unlikely(!th))
+			return -1;
+		l4_len = sizeof(struct tcphdr);
+	} else if (iph->protocol == IPPROTO_UDP) {
+		th = NULL;
+		l4_len = sizeof(struct udphdr);
+	} else {
+		return -1;
+	}
+
+	/* the flows are keyed by the headers as received, before DNAT */
+	t = &ct->tuplehash[CTINFO2DIR(ctinfo)].tuple;
+
+	rcu_read_lock();
+	flow = hnat_ovf_lookup(ntohl(t->src.u3.ip), ntohl(t->dst.u3.ip),
+			       ntohs(t->src.u.all), ntohs(t->dst.u.all),
+			       iph->protocol == IPPROTO_UDP);
+	/* an evicted flow goes back to the PPE through the slow path */
+	if (!flow || READ_ONCE(flow->evicted))
+		goto out;
+
+	if (th && (th->fin || th->syn || th->rst)) {
+		spin_lock_bh(&hnat_ovf_lock);
+		if (!hlist_unhashed(&flow->node))
+			hnat_ovf_del(flow);
+		spin_unlock_bh(&hnat_ovf_lock);
+		goto out;
+	}
+
+	/* the route changed since the flow was learned */
+	dev = rt->dst.dev;
+	if (dev != out || dev->ifindex != flow->ifindex)
+		goto out;
+
+	if (skb_ensure_writable(skb, sizeof(*iph) + l4_len))
+		goto out;
+
+	if (skb_cow_head(skb, LL_RESERVED_SPACE(dev)))
+		goto out;
+
+	len = skb->len;
+	hnat_ovf_mangle(skb, &flow->entry.ipv4_hnapt);
+
+	atomic64_inc(&flow->packets);
+	WRITE_ONCE(flow->last_seen, jiffies);
+	hnat_ovf_count_fast(len);
+
+	/* keep the egress hooks from learning this packet again */
+	skb_hnat_magic_tag(skb) = 0;
+	skb->dev = dev;
+	skb->protocol = htons(ETH_P_IP);
+
+	rcu_read_lock_bh();
+	neigh = ip_neigh_for_gw(rt, skb, &is_v6gw);
+	if (IS_ERR(neigh)) {
+		rcu_read_unlock_bh();
+		rcu_read_unlock();
+		kfree_skb(skb);
+		return 0;
+	}
+	neigh_output(neigh, skb, is_v6gw);
+	rcu_read_unlock_bh();
+	rcu_read_unlock();
+
+	return 0;
+
+out:
+	rcu_read_unlock();
+
+	return -1;
+}
+
+static u16 hnat_ovf_ts_mask(void)
+{
+	return (hnat_priv->data->version == MTK_HNAT_V4) ? 0xff : 0x7fff;
+}
+
+static bool hnat_ovf_hw_is_cold(const struct foe_entry *entry)
+{
+	u16 idle;
+
+	if (!entry || !entry_hnat_is_bound(entry) || entry->bfib1.sta)
+		return false;
+
+	idle = (foe_timestamp(hnat_priv) - entry->bfib1.time_stamp) &
+	       hnat_ovf_ts_mask();
+
+	return idle >= HNAT_OVF_COLD_TS;
+}
+
+/* age out idle flows, and give the FOE bucket to a heavy overflow flow
+ * when the flow holding it has gone cold
+ */
+static void hnat_ovf_check(struct timer_list *t)
+{
+	struct hnat_ovf_flow *flow;
+	struct foe_entry *bucket;
+	struct hlist_node *tmp;
+	u64 packets, rate;
+	int bkt;
+
+	spin_lock_bh(&hnat_ovf_lock);
+	hash_for_each_safe(hnat_ovf_hash, bkt, tmp, flow, node) {
+		if (time_after(jiffies, READ_ONCE(flow->last_seen) + HNAT_OVF_AGE)) {
+			hnat_ovf_del(flow);
+			continue;
+		}
+
+		if (flow->evicted)
+			continue;
+
+		packets = atomic64_read(&flow->packets);
+		rate = packets - flow->last_packets;
+		flow->last_packets = packets;
+
+		if (rate < HNAT_OVF_HEAVY)
+			continue;
+
+		bucket = hnat_ovf_bucket(flow->ppe_id, flow->foe_idx);
+		if (!hnat_ovf_hw_is_cold(bucket))
+			continue;
+
+		if (debug_level >= 2)
+			pr_info("%s: evict PPE%d entry %d for a %llu pps flow\n",
+				__func__, flow->ppe_id, flow->foe_idx, rate);
+
+		/* the next packets rebind the heavy flow in hardware */
+		memset(bucket, 0, sizeof(*bucket));
+		if (bucket != &hnat_ovf_stub_foe)
+			hnat_cache_ebl(1);
+		hnat_priv->ovf_stat.evict++;
+		hnat_priv->ovf_stat.evicted++;
+		WRITE_ONCE(flow->evicted, true);
+	}
+
+	if (READ_ONCE(hnat_priv->ovf_en) && hnat_priv->ovf_stat.flows)
+		mod_timer(&hnat_priv->hnat_ovf_timer, jiffies + HNAT_OVF_PERIOD);
+	spin_unlock_bh(&hnat_ovf_lock);
+}
+
+void hnat_ovf_enable(bool en)
+{
+	WRITE_ONCE(hnat_priv->ovf_en, en);
+
+	/* the timer is armed again by the first flow learned */
+	if (!en) {
+		del_timer_sync(&hnat_priv->hnat_ovf_timer);
+		hnat_ovf_flush();
+		memset(&hnat_ovf_stub_foe, 0, sizeof(hnat_ovf_stub_foe));
+	}
+}
+
+static void hnat_ovf_stub_traffic(const struct foe_entry *entry, u64 packets)
+{
+	const struct hnat_ipv4_hnapt *e = &entry->ipv4_hnapt;
+	struct hnat_ovf_flow *flow;
+
+	rcu_read_lock();
+	flow = hnat_ovf_lookup(e->sip, e->dip, e->sport, e->dport, e->bfib1.udp);
+	if (flow && !READ_ONCE(flow->evicted)) {
+		atomic64_add(packets, &flow->packets);
+		WRITE_ONCE(flow->last_seen, jiffies);
+	}
+	rcu_read_unlock();
+}
+
+/* hnat_ovf_stub_run - one round of synthetic traffic for ovf_stub=1
+ * TCP flows 198.18.0.<i>:1024 -> 198.19.0.1:80 all hash to the stand-in
+ * bucket. Flow 0 binds it on the first round and then goes idle, the
+ * others collide with it, and flow 1 is heavy. Once the check timer
+ * evicted flow 0, the next round binds flow 1 in its place. Compare the
+ * hit, evict and rebind counters of the hnat_ovf debugfs file between
+ * rounds.
+ */
+int hnat_ovf_stub_run(void)
+{
+	struct foe_entry entry = { 0 };
+	struct foe_entry *bucket = &hnat_ovf_stub_foe;
+	bool bound;
+	int i;
+
+	if (!ovf_stub)
+		return -EOPNOTSUPP;
+
+	if (!hnat_ovf_pcpu || !READ_ONCE(hnat_priv->ovf_en))
+		return -ENODEV;
+
+	entry.bfib1.state = BIND;
+	entry.bfib1.pkt_type = IPV4_HNAPT;
+	entry.ipv4_hnapt.dip = 0xc6130001;
+	entry.ipv4_hnapt.sport = 1024;
+	entry.ipv4_hnapt.dport = 80;
+	entry.ipv4_hnapt.new_dip = entry.ipv4_hnapt.dip;
+	entry.ipv4_hnapt.new_sport = entry.ipv4_hnapt.sport;
+	entry.ipv4_hnapt.new_dport = entry.ipv4_hnapt.dport;
+
+	for (i = 0; i < HNAT_OVF_STUB_FLOWS; i++) {
+		entry.ipv4_hnapt.sip = 0xc6120000 + i;
+		entry.ipv4_hnapt.new_sip = entry.ipv4_hnapt.sip;
+
+		/* flow 0 only sends before the collisions start, and its
+		 * entry is old enough to be cold right away
+		 */
+		if (!i && hnat_priv->ovf_stat.flows)
+			continue;
+		entry.bfib1.time_stamp = foe_timestamp(hnat_priv);
+		if (!i)
+			entry.bfib1.time_stamp -= HNAT_OVF_COLD_TS;
+		entry.bfib1.time_stamp &= hnat_ovf_ts_mask();
+
+		/* what the PPE does with the packet */
+		spin_lock_bh(&hnat_ovf_lock);
+		bound = !entry_hnat_is_bound(bucket);
+		if (bound)
+			memcpy(bucket, &entry, sizeof(entry));
+		else if (bucket->ipv4_hnapt.sip == entry.ipv4_hnapt.sip)
+			bound = true;
+		spin_unlock_bh(&hnat_ovf_lock);
+
+		if (bound) {
+			hnat_ovf_rebind(&entry);
+			continue;
+		}
+
+		hnat_ovf_add(&entry, 0, HNAT_OVF_STUB_PPE, 0);
+		hnat_ovf_stub_traffic(&entry, i == 1 ? 2 * HNAT_OVF_HEAVY : 1);
+	}
+
+	return 0;
+}
+
+int hnat_ovf_init(void)
+{
+	int cpu;
+
+	/* set up first, hnat_ovf_enable() may still be called on failure */
+	timer_setup(&hnat_priv->hnat_ovf_timer, hnat_ovf_check, 0);
+
+	hnat_ovf_pcpu = alloc_percpu(struct hnat_ovf_pcpu);
+	if (!hnat_ovf_pcpu)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(hnat_ovf_pcpu, cpu)->syncp);
+
+	return 0;
+}
+
+void hnat_ovf_deinit(void)
+{
+	if (!hnat_ovf_pcpu)
+		return;
+
+	hnat_ovf_enable(false);
+	rcu_barrier();
+	free_percpu(hnat_ovf_pcpu);
+	hnat_ovf_pcpu = NULL;
+}
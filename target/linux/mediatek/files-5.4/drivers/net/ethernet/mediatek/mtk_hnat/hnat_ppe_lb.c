@@ -0,0 +1,247 @@
+/*   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/jiffies.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+
+#include "nf_hnat_mtk.h"
+#include "hnat.h"
+
+/* The PPE hashes a packet into the table of the PPE its GDMA forwards to,
+ * so placement is done per ingress GMAC: hnat_priv->gmac_ppe[] says which
+ * PPE serves each GMAC, and skb_hnat_ppe() follows it on the RX side.
+ */
+
+/* ppe_stat, updated from the hooks and read by the timer and debugfs */
+static DEFINE_SPINLOCK(hnat_ppe_lb_lock);
+
+/* miss ratio in permille: binds lost to a taken bucket or a full table */
+static u32 hnat_ppe_lb_miss(const struct hnat_ppe_stat *stat)
+{
+	u32 miss = stat->collision + stat->table_full;
+	u32 total = miss + stat->bind;
+
+	if (!total)
+		return 0;
+
+	return (u32)div_u64((u64)miss * 1000, total);
+}
+
+/* occupancy in permille of the FOE table */
+static u32 hnat_ppe_lb_occupancy(const struct hnat_ppe_stat *stat, u32 etry_num)
+{
+	if (!etry_num)
+		return 1000;
+
+	return (u32)div_u64((u64)stat->bound * 1000, etry_num);
+}
+
+bool hnat_ppe_lb_saturated(const struct hnat_ppe_stat *stat, u32 etry_num)
+{
+	return hnat_ppe_lb_occupancy(stat, etry_num) >= PPE_LB_OCCUPANCY_HIGH ||
+	       hnat_ppe_lb_miss(stat) >= PPE_LB_MISS_HIGH;
+}
+
+/* hnat_ppe_lb_select - choose the PPE that should take new binds
+ * @stat:	per-PPE statistics of the last sampling period
+ * @ppe_num:	number of PPEs in @stat
+ * @etry_num:	entries per FOE table
+ * @cur:	PPE currently serving the ingress port
+ *
+ * Stays on @cur until it saturates, then moves to the PPE with the lowest
+ * occupancy plus miss ratio, provided that is clearly better than @cur.
+ * Works on plain statistics so it can be fed with synthetic tables.
+ */
+u32 hnat_ppe_lb_select(const struct hnat_ppe_stat *stat, u32 ppe_num,
+		       u32 etry_num, u32 cur)
+{
+	u32 i, score, best = cur, best_score;
+
+	if (cur >= ppe_num)
+		return 0;
+
+	if (!hnat_ppe_lb_saturated(&stat[cur], etry_num))
+		return cur;
+
+	best_score = hnat_ppe_lb_occupancy(&stat[cur], etry_num) +
+		     hnat_ppe_lb_miss(&stat[cur]);
+
+	for (i = 0; i < ppe_num; i++) {
+		if (i == cur || hnat_ppe_lb_saturated(&stat[i], etry_num))
+			continue;
+
+		score = hnat_ppe_lb_occupancy(&stat[i], etry_num) +
+			hnat_ppe_lb_miss(&stat[i]);
+		if (score + PPE_LB_HYSTERESIS < best_score) {
+			best = i;
+			best_score = score;
+		}
+	}
+
+	return best;
+}
+
+/* hnat_ppe_lb_count_bound - number of bound entries in a FOE table */
+u32 hnat_ppe_lb_count_bound(const struct foe_entry *table, u32 etry_num)
+{
+	u32 i, cnt = 0;
+
+	if (!table)
+		return 0;
+
+	for (i = 0; i < etry_num; i++) {
+		if (table[i].bfib1.state == BIND)
+			cnt++;
+	}
+
+	return cnt;
+}
+
+void hnat_ppe_lb_account(u32 ppe_id, enum hnat_ppe_event event)
+{
+	struct hnat_ppe_stat *stat;
+
+	if (ppe_id >= CFG_PPE_NUM)
+		return;
+
+	stat = &hnat_priv->ppe_stat[ppe_id];
+	spin_lock_bh(&hnat_ppe_lb_lock);
+	switch (event) {
+	case PPE_EVENT_BIND:
+		stat->bind++;
+		stat->bind_total++;
+		break;
+	case PPE_EVENT_COLLISION:
+		stat->collision++;
+		stat->collision_total++;
+		break;
+	case PPE_EVENT_TABLE_FULL:
+		stat->table_full++;
+		stat->table_full_total++;
+		break;
+	}
+	spin_unlock_bh(&hnat_ppe_lb_lock);
+}
+
+/* hnat_ppe_lb_snapshot - consistent copy of the statistics
+ * @stat:	CFG_PPE_NUM entries to fill
+ * @reset:	start a new sampling period
+ */
+void hnat_ppe_lb_snapshot(struct hnat_ppe_stat *stat, bool reset)
+{
+	u32 i;
+
+	spin_lock_bh(&hnat_ppe_lb_lock);
+	for (i = 0; i < CFG_PPE_NUM; i++) {
+		stat[i] = hnat_priv->ppe_stat[i];
+		if (!reset)
+			continue;
+
+		hnat_priv->ppe_stat[i].bind = 0;
+		hnat_priv->ppe_stat[i].collision = 0;
+		hnat_priv->ppe_stat[i].table_full = 0;
+	}
+	spin_unlock_bh(&hnat_ppe_lb_lock);
+}
+
+/* move new binds of a GMAC to another PPE; entries left in the old table
+ * age out, and entry building is held off while in-flight packets drain.
+ */
+static void hnat_ppe_lb_remap(u32 gmac, u32 ppe_id)
+{
+	void __iomem *reg;
+	u32 val;
+	int i;
+
+	for (i = 0; i < CFG_PPE_NUM; i++)
+		cr_set_field(hnat_priv->ppe_base[i] + PPE_TB_CFG,
+			     SMA, SMA_ONLY_FWD_CPU);
+
+	dev_info(hnat_priv->dev, "GMAC%d binds move from PPE%d to PPE%d\n",
+		 gmac + 1, hnat_priv->gmac_ppe[gmac], ppe_id);
+
+	hnat_priv->gmac_ppe[gmac] = ppe_id;
+
+	/* only re-point a GDMA that is currently forwarding to a PPE */
+	reg = hnat_priv->fe_base + (gmac ? GDMA2_FWD_CFG : GDMA1_FWD_CFG);
+	val = readl(reg) & GDM_ALL_FRC_MASK;
+	if (val == BITS_GDM_ALL_FRC_P_PPE || val == BITS_GDM_ALL_FRC_P_PPE1)
+		set_gmac_ppe_fwd(gmac, 1);
+
+	mod_timer(&hnat_priv->hnat_sma_build_entry_timer, jiffies + 3 * HZ);
+}
+
+static void hnat_ppe_lb_check(struct timer_list *t)
+{
+	struct hnat_ppe_stat stat[MAX_PPE_NUM];
+	u32 i, gmac, ppe_id;
+
+	hnat_ppe_lb_snapshot(stat, true);
+
+	/* the tables are freed only after the timer is gone */
+	for (i = 0; i < CFG_PPE_NUM; i++)
+		stat[i].bound = hnat_ppe_lb_count_bound(hnat_priv->foe_table_cpu[i],
+							hnat_priv->foe_etry_num);
+
+	spin_lock_bh(&hnat_ppe_lb_lock);
+	for (i = 0; i < CFG_PPE_NUM; i++)
+		hnat_priv->ppe_stat[i].bound = stat[i].bound;
+	spin_unlock_bh(&hnat_ppe_lb_lock);
+
+	if (CFG_PPE_NUM > 1 &&
+	    time_after(jiffies, hnat_priv->ppe_lb_stamp + PPE_LB_DWELL)) {
+		for (gmac = 0; gmac < HNAT_GMAC_NUM; gmac++) {
+			ppe_id = hnat_ppe_lb_select(stat, CFG_PPE_NUM,
+						    hnat_priv->foe_etry_num,
+						    hnat_priv->gmac_ppe[gmac]);
+			if (ppe_id != hnat_priv->gmac_ppe[gmac]) {
+				hnat_ppe_lb_remap(gmac, ppe_id);
+				hnat_priv->ppe_lb_stamp = jiffies;
+				/* one move per period, let the tables settle */
+				break;
+			}
+		}
+	}
+
+	if (READ_ONCE(hnat_priv->ppe_lb_en))
+		mod_timer(&hnat_priv->hnat_ppe_lb_timer, jiffies + PPE_LB_PERIOD);
+}
+
+/* the periodic table walk only runs while load balancing is enabled */
+void hnat_ppe_lb_enable(bool en)
+{
+	struct hnat_ppe_stat stat[MAX_PPE_NUM];
+
+	WRITE_ONCE(hnat_priv->ppe_lb_en, en);
+
+	if (!en) {
+		del_timer_sync(&hnat_priv->hnat_ppe_lb_timer);
+		return;
+	}
+
+	/* start with a fresh sampling period */
+	hnat_ppe_lb_snapshot(stat, true);
+	hnat_priv->ppe_lb_stamp = jiffies;
+	mod_timer(&hnat_priv->hnat_ppe_lb_timer, jiffies + PPE_LB_PERIOD);
+}
+
+void hnat_ppe_lb_init(void)
+{
+	timer_setup(&hnat_priv->hnat_ppe_lb_timer, hnat_ppe_lb_check, 0);
+	if (hnat_priv->ppe_lb_en)
+		hnat_ppe_lb_enable(true);
+}
+
+void hnat_ppe_lb_deinit(void)
+{
+	hnat_ppe_lb_enable(false);
+}
@@ -0,0 +1,760 @@
+/*   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/jiffies.h>
+#include <net/genetlink.h>
+
+#include "hnat.h"
+#include "../mtk_eth_soc.h"
+
+static bool hqos_stub;
+module_param(hqos_stub, bool, 0);
+MODULE_PARM_DESC(hqos_stub, "run the HQoS API against a register stub");
+
+static int hqos_stub_stuck_txq = -1;
+module_param(hqos_stub_stuck_txq, int, 0);
+MODULE_PARM_DESC(hqos_stub_stuck_txq, "stub queue ignoring writes, to exercise rollback");
+
+/* defined bits of QTX_SCH, scheduler select included */
+#define HQOS_QTX_SCH_MASK	0xcfffffff
+#define HQOS_QTX_RESV_MASK	0xffff
+
+struct hqos_txq_sample {
+	u32 pkt_cnt;		/* last raw MIB values */
+	u32 drop_cnt;
+	u64 packets;
+	u64 drops;
+	u32 pps;
+	unsigned long stamp;
+};
+
+/* serializes register access: MIB reads switch QTX_CFG/QTX_SCH to counters */
+static DEFINE_MUTEX(hqos_lock);
+static u32 hqos_num_of_sch;
+static struct hqos_txq_sample hqos_sample[HQOS_MAX_TXQ];
+
+static struct {
+	u32 sch[HQOS_MAX_SCH];
+	u32 qtx_sch[HQOS_MAX_TXQ];
+	u32 qtx_cfg[HQOS_MAX_TXQ];
+} hqos_undo;
+
+static u32 hqos_hw_sch_read(u32 id)
+{
+	u32 val;
+
+	if (hnat_priv->data->num_of_sch == 4)
+		val = readl(hnat_priv->fe_base + QDMA_TX_4SCH_BASE(id));
+	else
+		val = readl(hnat_priv->fe_base + QDMA_TX_2SCH_BASE);
+
+	if (id & 0x1)
+		val >>= 16;
+
+	return val & 0xffff;
+}
+
+static void hqos_hw_sch_write(u32 id, u32 val)
+{
+	void __iomem *reg;
+	int shift = (id & 0x1) ? 16 : 0;
+	u32 qdma_tx_sch;
+
+	if (hnat_priv->data->num_of_sch == 4)
+		reg = hnat_priv->fe_base + QDMA_TX_4SCH_BASE(id);
+	else
+		reg = hnat_priv->fe_base + QDMA_TX_2SCH_BASE;
+
+	qdma_tx_sch = readl(reg);
+	qdma_tx_sch &= ~(0xffff << shift);
+	qdma_tx_sch |= (val & 0xffff) << shift;
+	writel(qdma_tx_sch, reg);
+}
+
+static void hqos_hw_txq_read(u32 id, u32 *qtx_sch, u32 *qtx_cfg)
+{
+	struct mtk_hnat *h = hnat_priv;
+
+	cr_set_field(h->fe_base + QDMA_PAGE, QTX_CFG_PAGE, (id / NUM_OF_Q_PER_PAGE));
+	*qtx_sch = readl(h->fe_base + QTX_SCH(id % NUM_OF_Q_PER_PAGE));
+	*qtx_cfg = readl(h->fe_base + QTX_CFG(id % NUM_OF_Q_PER_PAGE));
+}
+
+static void hqos_hw_txq_write(u32 id, u32 qtx_sch, u32 qtx_cfg)
+{
+	struct mtk_hnat *h = hnat_priv;
+
+	cr_set_field(h->fe_base + QDMA_PAGE, QTX_CFG_PAGE, (id / NUM_OF_Q_PER_PAGE));
+	writel(qtx_sch, h->fe_base + QTX_SCH(id % NUM_OF_Q_PER_PAGE));
+	writel(qtx_cfg, h->fe_base + QTX_CFG(id % NUM_OF_Q_PER_PAGE));
+}
+
+static void hqos_hw_txq_mib(u32 id, u32 *pkt_cnt, u32 *drop_cnt)
+{
+	struct mtk_hnat *h = hnat_priv;
+
+	if (h->data->version == MTK_HNAT_V1) {
+		*pkt_cnt = 0;
+		*drop_cnt = 0;
+		return;
+	}
+
+	cr_set_field(h->fe_base + QDMA_PAGE, QTX_CFG_PAGE, (id / NUM_OF_Q_PER_PAGE));
+
+	/* Switch to debug mode */
+	cr_set_field(h->fe_base + QTX_MIB_IF, MIB_ON_QTX_CFG, 1);
+	cr_set_field(h->fe_base + QTX_MIB_IF, VQTX_MIB_EN, 1);
+	*pkt_cnt = readl(h->fe_base + QTX_CFG(id % NUM_OF_Q_PER_PAGE));
+	*drop_cnt = readl(h->fe_base + QTX_SCH(id % NUM_OF_Q_PER_PAGE));
+
+	/* Recover to normal mode */
+	cr_set_field(h->fe_base + QTX_MIB_IF, MIB_ON_QTX_CFG, 0);
+	cr_set_field(h->fe_base + QTX_MIB_IF, VQTX_MIB_EN, 0);
+}
+
+static const struct hqos_regs hqos_hw_regs = {
+	.sch_read = hqos_hw_sch_read,
+	.sch_write = hqos_hw_sch_write,
+	.txq_read = hqos_hw_txq_read,
+	.txq_write = hqos_hw_txq_write,
+	.txq_mib = hqos_hw_txq_mib,
+};
+
+static const struct hqos_regs *hqos_regs = &hqos_hw_regs;
+
+/* register stub: same layout as QDMA, two schedulers per 32-bit word */
+static u32 hqos_stub_sch[HQOS_MAX_SCH / 2];
+static u32 hqos_stub_qtx_sch[HQOS_MAX_TXQ];
+static u32 hqos_stub_qtx_cfg[HQOS_MAX_TXQ];
+static u32 hqos_stub_pkt[HQOS_MAX_TXQ];
+static u32 hqos_stub_drop[HQOS_MAX_TXQ];
+
+static u32 hqos_stub_sch_read(u32 id)
+{
+	return (hqos_stub_sch[id >> 1] >> ((id & 0x1) * 16)) & 0xffff;
+}
+
+static void hqos_stub_sch_write(u32 id, u32 val)
+{
+	int shift = (id & 0x1) * 16;
+
+	hqos_stub_sch[id >> 1] &= ~(0xffff << shift);
+	hqos_stub_sch[id >> 1] |= (val & 0xffff) << shift;
+}
+
+static void hqos_stub_txq_read(u32 id, u32 *qtx_sch, u32 *qtx_cfg)
+{
+	*qtx_sch = hqos_stub_qtx_sch[id];
+	*qtx_cfg = hqos_stub_qtx_cfg[id];
+}
+
+static void hqos_stub_txq_write(u32 id, u32 qtx_sch, u32 qtx_cfg)
+{
+	if ((int)id == hqos_stub_stuck_txq)
+		return;
+
+	hqos_stub_qtx_sch[id] = qtx_sch;
+	hqos_stub_qtx_cfg[id] = qtx_cfg;
+}
+
+/* counters advance on every read so deltas and rates can be observed */
+static void hqos_stub_txq_mib(u32 id, u32 *pkt_cnt, u32 *drop_cnt)
+{
+	hqos_stub_pkt[id] += 1000 * (id + 1);
+	hqos_stub_drop[id] += id;
+	*pkt_cnt = hqos_stub_pkt[id];
+	*drop_cnt = hqos_stub_drop[id];
+}
+
+static const struct hqos_regs hqos_stub_regs = {
+	.sch_read = hqos_stub_sch_read,
+	.sch_write = hqos_stub_sch_write,
+	.txq_read = hqos_stub_txq_read,
+	.txq_write = hqos_stub_txq_write,
+	.txq_mib = hqos_stub_txq_mib,
+};
+
+static void hqos_stub_reset(void)
+{
+	int i;
+
+	for (i = 0; i < HQOS_MAX_SCH / 2; i++)
+		hqos_stub_sch[i] = QDMA_TX_SCH_WFQ_EN | (QDMA_TX_SCH_WFQ_EN << 16);
+
+	for (i = 0; i < HQOS_MAX_TXQ; i++) {
+		hqos_stub_qtx_sch[i] = 0;
+		hqos_stub_qtx_cfg[i] = (4 << QTX_CFG_HW_RESV_CNT_OFFSET) |
+				       (4 << QTX_CFG_SW_RESV_CNT_OFFSET);
+		hqos_stub_pkt[i] = 0;
+		hqos_stub_drop[i] = 0;
+	}
+}
+
+/* rates are a 7-bit mantissa times a power of ten */
+static void hqos_rate_encode(u32 rate, u32 *man, u32 *exp)
+{
+	*exp = 0;
+	while (rate > 127) {
+		rate /= 10;
+		(*exp)++;
+	}
+	*man = rate;
+}
+
+static u32 hqos_rate_decode(u32 man, u32 exp)
+{
+	while (exp--) {
+		if (man > U32_MAX / 10)
+			return U32_MAX;
+		man *= 10;
+	}
+
+	return man;
+}
+
+static u32 hqos_sch_encode(const struct hqos_sch_cfg *cfg)
+{
+	u32 man, exp, val = 0;
+
+	hqos_rate_encode(cfg->rate, &man, &exp);
+	if (cfg->enable)
+		val |= BIT(11);
+	if (cfg->wrr)
+		val |= QDMA_TX_SCH_WFQ_EN;
+	val |= (man & 0x7f) << 4;
+	val |= exp & 0xf;
+
+	return val;
+}
+
+static void hqos_sch_decode(u32 val, struct hqos_sch_cfg *cfg)
+{
+	cfg->enable = !!(val & BIT(11));
+	cfg->wrr = !!(val & QDMA_TX_SCH_WFQ_EN);
+	cfg->rate = hqos_rate_decode((val >> 4) & 0x7f, val & 0xf);
+}
+
+static u32 hqos_txq_encode(const struct hqos_txq_cfg *cfg, u32 num_of_sch)
+{
+	u32 man, exp, qtx_sch = 0;
+
+	if (num_of_sch == 4)
+		qtx_sch |= (cfg->sch & 0x3) << 30;
+	else
+		qtx_sch |= (cfg->sch & 0x1) << 31;
+
+	hqos_rate_encode(cfg->min_rate, &man, &exp);
+	if (cfg->min_en)
+		qtx_sch |= QTX_SCH_MIN_RATE_EN;
+	qtx_sch |= (man & 0x7f) << QTX_SCH_MIN_RATE_MAN_OFFSET;
+	qtx_sch |= (exp & 0xf) << QTX_SCH_MIN_RATE_EXP_OFFSET;
+
+	hqos_rate_encode(cfg->max_rate, &man, &exp);
+	if (cfg->max_en)
+		qtx_sch |= QTX_SCH_MAX_RATE_EN;
+	qtx_sch |= (cfg->weight & 0xf) << QTX_SCH_MAX_RATE_WGHT_OFFSET;
+	qtx_sch |= (man & 0x7f) << QTX_SCH_MAX_RATE_MAN_OFFSET;
+	qtx_sch |= (exp & 0xf) << QTX_SCH_MAX_RATE_EXP_OFFSET;
+
+	return qtx_sch;
+}
+
+static void hqos_txq_decode(u32 qtx_sch, u32 qtx_cfg, u32 num_of_sch,
+			    struct hqos_txq_cfg *cfg)
+{
+	if (num_of_sch == 4)
+		cfg->sch = (qtx_sch >> 30) & 0x3;
+	else
+		cfg->sch = !!(qtx_sch & BIT(31));
+	cfg->min_en = !!(qtx_sch & QTX_SCH_MIN_RATE_EN);
+	cfg->min_rate = hqos_rate_decode((qtx_sch >> QTX_SCH_MIN_RATE_MAN_OFFSET) & 0x7f,
+					 (qtx_sch >> QTX_SCH_MIN_RATE_EXP_OFFSET) & 0xf);
+	cfg->max_en = !!(qtx_sch & QTX_SCH_MAX_RATE_EN);
+	cfg->weight = (qtx_sch >> QTX_SCH_MAX_RATE_WGHT_OFFSET) & 0xf;
+	cfg->max_rate = hqos_rate_decode((qtx_sch >> QTX_SCH_MAX_RATE_MAN_OFFSET) & 0x7f,
+					 (qtx_sch >> QTX_SCH_MAX_RATE_EXP_OFFSET) & 0xf);
+	cfg->resv = (qtx_cfg >> QTX_CFG_SW_RESV_CNT_OFFSET) & 0xff;
+	cfg->hw_resv = (qtx_cfg >> QTX_CFG_HW_RESV_CNT_OFFSET) & 0xff;
+}
+
+static int hqos_invalid(const char **reason, const char *msg)
+{
+	if (reason)
+		*reason = msg;
+
+	return -EINVAL;
+}
+
+/* hnat_qos_validate - check a tree before any register is touched
+ * @tree:	schedulers and queues to change
+ * @num_of_sch:	schedulers of the QDMA the tree is meant for
+ * @reason:	set to a static description when the tree is rejected
+ */
+int hnat_qos_validate(const struct hqos_tree *tree, u32 num_of_sch,
+		      const char **reason)
+{
+	const struct hqos_txq_cfg *cfg;
+	int i;
+
+	if (!num_of_sch || num_of_sch > HQOS_MAX_SCH)
+		return hqos_invalid(reason, "unsupported scheduler count");
+
+	if (tree->sch_mask & ~GENMASK(num_of_sch - 1, 0))
+		return hqos_invalid(reason, "scheduler id out of range");
+
+	for (i = 0; i < HQOS_MAX_TXQ; i++) {
+		if (!(tree->txq_mask & BIT_ULL(i)))
+			continue;
+
+		cfg = &tree->txq[i];
+		if (i >= MTK_QDMA_TX_NUM)
+			return hqos_invalid(reason, "queue id out of range");
+		if (cfg->sch >= num_of_sch)
+			return hqos_invalid(reason, "queue attached to a missing scheduler");
+		if (cfg->weight > HQOS_WEIGHT_MAX)
+			return hqos_invalid(reason, "queue weight out of range");
+		if (cfg->min_en && cfg->max_en && cfg->min_rate > cfg->max_rate)
+			return hqos_invalid(reason, "queue min rate above max rate");
+	}
+
+	return 0;
+}
+
+static void hqos_rollback(const struct hqos_tree *tree)
+{
+	int i;
+
+	for (i = 0; i < hqos_num_of_sch; i++) {
+		if (tree->sch_mask & BIT(i))
+			hqos_regs->sch_write(i, hqos_undo.sch[i]);
+	}
+
+	for (i = 0; i < MTK_QDMA_TX_NUM; i++) {
+		if (tree->txq_mask & BIT_ULL(i))
+			hqos_regs->txq_write(i, hqos_undo.qtx_sch[i],
+					     hqos_undo.qtx_cfg[i]);
+	}
+}
+
+/* hnat_qos_commit - validate and apply a tree as one transaction
+ *
+ * Every register the tree touches is saved, written and read back under
+ * hqos_lock; if any of them does not take the new value, all of them are
+ * restored and the previous configuration stays in place.
+ */
+int hnat_qos_commit(const struct hqos_tree *tree, const char **reason)
+{
+	const struct hqos_txq_cfg *cfg;
+	u32 val, qtx_sch, qtx_cfg;
+	int i, ret;
+
+	ret = hnat_qos_validate(tree, hqos_num_of_sch, reason);
+	if (ret)
+		return ret;
+
+	mutex_lock(&hqos_lock);
+
+	for (i = 0; i < hqos_num_of_sch; i++) {
+		if (tree->sch_mask & BIT(i))
+			hqos_undo.sch[i] = hqos_regs->sch_read(i);
+	}
+
+	for (i = 0; i < MTK_QDMA_TX_NUM; i++) {
+		if (tree->txq_mask & BIT_ULL(i))
+			hqos_regs->txq_read(i, &hqos_undo.qtx_sch[i],
+					    &hqos_undo.qtx_cfg[i]);
+	}
+
+	for (i = 0; i < hqos_num_of_sch; i++) {
+		if (!(tree->sch_mask & BIT(i)))
+			continue;
+
+		val = hqos_sch_encode(&tree->sch[i]);
+		hqos_regs->sch_write(i, val);
+		if (hqos_regs->sch_read(i) != val)
+			goto rollback;
+	}
+
+	for (i = 0; i < MTK_QDMA_TX_NUM; i++) {
+		if (!(tree->txq_mask & BIT_ULL(i)))
+			continue;
+
+		cfg = &tree->txq[i];
+		val = hqos_txq_encode(cfg, hqos_num_of_sch);
+		qtx_cfg = (hqos_undo.qtx_cfg[i] & ~HQOS_QTX_RESV_MASK) |
+			  (cfg->resv << QTX_CFG_HW_RESV_CNT_OFFSET) |
+			  (cfg->resv << QTX_CFG_SW_RESV_CNT_OFFSET);
+		hqos_regs->txq_write(i, val, qtx_cfg);
+
+		hqos_regs->txq_read(i, &qtx_sch, &qtx_cfg);
+		if ((qtx_sch & HQOS_QTX_SCH_MASK) != val ||
+		    ((qtx_cfg >> QTX_CFG_SW_RESV_CNT_OFFSET) & 0xff) != cfg->resv)
+			goto rollback;
+	}
+
+	mutex_unlock(&hqos_lock);
+
+	return 0;
+
+rollback:
+	hqos_rollback(tree);
+	mutex_unlock(&hqos_lock);
+
+	if (reason)
+		*reason = "register readback mismatch, rolled back";
+
+	return -EIO;
+}
+
+void hnat_qos_get_sch(u32 id, struct hqos_sch_cfg *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	if (id >= hqos_num_of_sch)
+		return;
+
+	mutex_lock(&hqos_lock);
+	hqos_sch_decode(hqos_regs->sch_read(id), cfg);
+	mutex_unlock(&hqos_lock);
+}
+
+void hnat_qos_get_txq(u32 id, struct hqos_txq_cfg *cfg)
+{
+	u32 qtx_sch, qtx_cfg;
+
+	memset(cfg, 0, sizeof(*cfg));
+	if (id >= MTK_QDMA_TX_NUM)
+		return;
+
+	mutex_lock(&hqos_lock);
+	hqos_regs->txq_read(id, &qtx_sch, &qtx_cfg);
+	mutex_unlock(&hqos_lock);
+
+	hqos_txq_decode(qtx_sch, qtx_cfg, hqos_num_of_sch, cfg);
+}
+
+/* the MIB counters are 32-bit and free running, accumulate their deltas */
+void hnat_qos_get_stats(u32 id, struct hqos_txq_stats *stats)
+{
+	struct hqos_txq_sample *s;
+	unsigned long now = jiffies;
+	u32 pkt_cnt, drop_cnt, delta;
+
+	memset(stats, 0, sizeof(*stats));
+	if (id >= MTK_QDMA_TX_NUM)
+		return;
+
+	s = &hqos_sample[id];
+
+	mutex_lock(&hqos_lock);
+	hqos_regs->txq_mib(id, &pkt_cnt, &drop_cnt);
+
+	delta = pkt_cnt - s->pkt_cnt;
+	s->packets += delta;
+	s->drops += (u32)(drop_cnt - s->drop_cnt);
+	if (s->stamp && time_after(now, s->stamp))
+		s->pps = (u32)div_u64((u64)delta * HZ, now - s->stamp);
+	s->pkt_cnt = pkt_cnt;
+	s->drop_cnt = drop_cnt;
+	s->stamp = now;
+
+	stats->packets = s->packets;
+	stats->drops = s->drops;
+	stats->pps = s->pps;
+	mutex_unlock(&hqos_lock);
+}
+
+static struct genl_family hqos_genl_family;
+
+static const struct nla_policy hqos_policy[HQOS_A_MAX + 1] = {
+	[HQOS_A_SCH] = { .type = NLA_NESTED },
+	[HQOS_A_TXQ] = { .type = NLA_NESTED },
+};
+
+static const struct nla_policy hqos_sch_policy[HQOS_SCH_A_MAX + 1] = {
+	[HQOS_SCH_A_ID] = { .type = NLA_U32 },
+	[HQOS_SCH_A_ENABLE] = { .type = NLA_U8 },
+	[HQOS_SCH_A_WRR] = { .type = NLA_U8 },
+	[HQOS_SCH_A_RATE] = { .type = NLA_U32 },
+};
+
+static const struct nla_policy hqos_txq_policy[HQOS_TXQ_A_MAX + 1] = {
+	[HQOS_TXQ_A_ID] = { .type = NLA_U32 },
+	[HQOS_TXQ_A_SCH] = { .type = NLA_U8 },
+	[HQOS_TXQ_A_MIN_EN] = { .type = NLA_U8 },
+	[HQOS_TXQ_A_MIN_RATE] = { .type = NLA_U32 },
+	[HQOS_TXQ_A_MAX_EN] = { .type = NLA_U8 },
+	[HQOS_TXQ_A_MAX_RATE] = { .type = NLA_U32 },
+	[HQOS_TXQ_A_WEIGHT] = { .type = NLA_U8 },
+	[HQOS_TXQ_A_RESV] = { .type = NLA_U8 },
+};
+
+/* attributes left out of a nest keep their current value */
+static int hqos_nl_parse_sch(const struct nlattr *nla, struct hqos_tree *tree,
+			     struct netlink_ext_ack *extack)
+{
+	struct nlattr *tb[HQOS_SCH_A_MAX + 1];
+	struct hqos_sch_cfg *cfg;
+	u32 id;
+	int ret;
+
+	ret = nla_parse_nested(tb, HQOS_SCH_A_MAX, nla, hqos_sch_policy, extack);
+	if (ret)
+		return ret;
+
+	if (!tb[HQOS_SCH_A_ID]) {
+		NL_SET_ERR_MSG(extack, "scheduler without id");
+		return -EINVAL;
+	}
+
+	id = nla_get_u32(tb[HQOS_SCH_A_ID]);
+	if (id >= hqos_num_of_sch) {
+		NL_SET_ERR_MSG(extack, "scheduler id out of range");
+		return -EINVAL;
+	}
+
+	cfg = &tree->sch[id];
+	if (!(tree->sch_mask & BIT(id))) {
+		hnat_qos_get_sch(id, cfg);
+		tree->sch_mask |= BIT(id);
+	}
+
+	if (tb[HQOS_SCH_A_ENABLE])
+		cfg->enable = !!nla_get_u8(tb[HQOS_SCH_A_ENABLE]);
+	if (tb[HQOS_SCH_A_WRR])
+		cfg->wrr = !!nla_get_u8(tb[HQOS_SCH_A_WRR]);
+	if (tb[HQOS_SCH_A_RATE])
+		cfg->rate = nla_get_u32(tb[HQOS_SCH_A_RATE]);
+
+	return 0;
+}
+
+static int hqos_nl_parse_txq(const struct nlattr *nla, struct hqos_tree *tree,
+			     struct netlink_ext_ack *extack)
+{
+	struct nlattr *tb[HQOS_TXQ_A_MAX + 1];
+	struct hqos_txq_cfg *cfg;
+	u32 id;
+	int ret;
+
+	ret = nla_parse_nested(tb, HQOS_TXQ_A_MAX, nla, hqos_txq_policy, extack);
+	if (ret)
+		return ret;
+
+	if (!tb[HQOS_TXQ_A_ID]) {
+		NL_SET_ERR_MSG(extack, "queue without id");
+		return -EINVAL;
+	}
+
+	id = nla_get_u32(tb[HQOS_TXQ_A_ID]);
+	if (id >= MTK_QDMA_TX_NUM) {
+		NL_SET_ERR_MSG(extack, "queue id out of range");
+		return -EINVAL;
+	}
+
+	cfg = &tree->txq[id];
+	if (!(tree->txq_mask & BIT_ULL(id))) {
+		hnat_qos_get_txq(id, cfg);
+		tree->txq_mask |= BIT_ULL(id);
+	}
+
+	if (tb[HQOS_TXQ_A_SCH])
+		cfg->sch = nla_get_u8(tb[HQOS_TXQ_A_SCH]);
+	if (tb[HQOS_TXQ_A_MIN_EN])
+		cfg->min_en = !!nla_get_u8(tb[HQOS_TXQ_A_MIN_EN]);
+	if (tb[HQOS_TXQ_A_MIN_RATE])
+		cfg->min_rate = nla_get_u32(tb[HQOS_TXQ_A_MIN_RATE]);
+	if (tb[HQOS_TXQ_A_MAX_EN])
+		cfg->max_en = !!nla_get_u8(tb[HQOS_TXQ_A_MAX_EN]);
+	if (tb[HQOS_TXQ_A_MAX_RATE])
+		cfg->max_rate = nla_get_u32(tb[HQOS_TXQ_A_MAX_RATE]);
+	if (tb[HQOS_TXQ_A_WEIGHT])
+		cfg->weight = nla_get_u8(tb[HQOS_TXQ_A_WEIGHT]);
+	if (tb[HQOS_TXQ_A_RESV])
+		cfg->resv = nla_get_u8(tb[HQOS_TXQ_A_RESV]);
+
+	return 0;
+}
+
+static int hqos_nl_set(struct sk_buff *skb, struct genl_info *info)
+{
+	const char *reason = NULL;
+	struct hqos_tree *tree;
+	struct nlattr *nla;
+	int rem, ret = 0;
+
+	tree = kzalloc(sizeof(*tree), GFP_KERNEL);
+	if (!tree)
+		return -ENOMEM;
+
+	nlmsg_for_each_attr(nla, info->nlhdr, GENL_HDRLEN, rem) {
+		switch (nla_type(nla)) {
+		case HQOS_A_SCH:
+			ret = hqos_nl_parse_sch(nla, tree, info->extack);
+			break;
+		case HQOS_A_TXQ:
+			ret = hqos_nl_parse_txq(nla, tree, info->extack);
+			break;
+		default:
+			break;
+		}
+		if (ret)
+			goto out;
+	}
+
+	ret = hnat_qos_commit(tree, &reason);
+	if (ret && reason)
+		NL_SET_ERR_MSG(info->extack, reason);
+
+out:
+	kfree(tree);
+	return ret;
+}
+
+static int hqos_nl_fill_sch(struct sk_buff *skb, u32 id)
+{
+	struct hqos_sch_cfg cfg;
+	struct nlattr *nest;
+
+	hnat_qos_get_sch(id, &cfg);
+
+	nest = nla_nest_start(skb, HQOS_A_SCH);
+	if (!nest)
+		return -EMSGSIZE;
+
+	if (nla_put_u32(skb, HQOS_SCH_A_ID, id) ||
+	    nla_put_u8(skb, HQOS_SCH_A_ENABLE, cfg.enable) ||
+	    nla_put_u8(skb, HQOS_SCH_A_WRR, cfg.wrr) ||
+	    nla_put_u32(skb, HQOS_SCH_A_RATE, cfg.rate)) {
+		nla_nest_cancel(skb, nest);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(skb, nest);
+
+	return 0;
+}
+
+static int hqos_nl_fill_txq(struct sk_buff *skb, u32 id)
+{
+	struct hqos_txq_stats stats;
+	struct hqos_txq_cfg cfg;
+	struct nlattr *nest;
+
+	hnat_qos_get_txq(id, &cfg);
+	hnat_qos_get_stats(id, &stats);
+
+	nest = nla_nest_start(skb, HQOS_A_TXQ);
+	if (!nest)
+		return -EMSGSIZE;
+
+	if (nla_put_u32(skb, HQOS_TXQ_A_ID, id) ||
+	    nla_put_u8(skb, HQOS_TXQ_A_SCH, cfg.sch) ||
+	    nla_put_u8(skb, HQOS_TXQ_A_MIN_EN, cfg.min_en) ||
+	    nla_put_u32(skb, HQOS_TXQ_A_MIN_RATE, cfg.min_rate) ||
+	    nla_put_u8(skb, HQOS_TXQ_A_MAX_EN, cfg.max_en) ||
+	    nla_put_u32(skb, HQOS_TXQ_A_MAX_RATE, cfg.max_rate) ||
+	    nla_put_u8(skb, HQOS_TXQ_A_WEIGHT, cfg.weight) ||
+	    nla_put_u8(skb, HQOS_TXQ_A_RESV, cfg.resv) ||
+	    nla_put_u64_64bit(skb, HQOS_TXQ_A_PACKETS, stats.packets,
+			      HQOS_TXQ_A_PAD) ||
+	    nla_put_u64_64bit(skb, HQOS_TXQ_A_DROPS, stats.drops,
+			      HQOS_TXQ_A_PAD) ||
+	    nla_put_u32(skb, HQOS_TXQ_A_PPS, stats.pps)) {
+		nla_nest_cancel(skb, nest);
+		return -EMSGSIZE;
+	}
+
+	nla_nest_end(skb, nest);
+
+	return 0;
+}
+
+/* one message per scheduler, then one per queue */
+static int hqos_nl_get_dump(struct sk_buff *skb, struct netlink_callback *cb)
+{
+	u32 idx = cb->args[0];
+	void *hdr;
+	int ret;
+
+	for (; idx < hqos_num_of_sch + MTK_QDMA_TX_NUM; idx++) {
+		hdr = genlmsg_put(skb, NETLINK_CB(cb->skb).portid,
+				  cb->nlh->nlmsg_seq, &hqos_genl_family,
+				  NLM_F_MULTI, HQOS_CMD_GET);
+		if (!hdr)
+			break;
+
+		if (idx < hqos_num_of_sch)
+			ret = hqos_nl_fill_sch(skb, idx);
+		else
+			ret = hqos_nl_fill_txq(skb, idx - hqos_num_of_sch);
+
+		if (ret) {
+			genlmsg_cancel(skb, hdr);
+			break;
+		}
+		genlmsg_end(skb, hdr);
+	}
+
+	cb->args[0] = idx;
+
+	return skb->len;
+}
+
+static const struct genl_ops hqos_genl_ops[] = {
+	{
+		.cmd = HQOS_CMD_SET,
+		.validate = GENL_DONT_VALIDATE_STRICT | GENL_DONT_VALIDATE_DUMP,
+		.doit = hqos_nl_set,
+		.flags = GENL_ADMIN_PERM,
+	},
+	{
+		.cmd = HQOS_CMD_GET,
+		.validate = GENL_DONT_VALIDATE_STRICT | GENL_DONT_VALIDATE_DUMP,
+		.dumpit = hqos_nl_get_dump,
+		/* a read reprograms the MIB control and moves the rate base */
+		.flags = GENL_ADMIN_PERM,
+	},
+};
+
+static struct genl_family hqos_genl_family = {
+	.name = HQOS_GENL_NAME,
+	.version = HQOS_GENL_VERSION,
+	.maxattr = HQOS_A_MAX,
+	.policy = hqos_policy,
+	.module = THIS_MODULE,
+	.ops = hqos_genl_ops,
+	.n_ops = ARRAY_SIZE(hqos_genl_ops),
+};
+
+int hnat_qos_init(void)
+{
+	BUILD_BUG_ON(MTK_QDMA_TX_NUM > HQOS_MAX_TXQ);
+
+	hqos_num_of_sch = min_t(u32, hnat_priv->data->num_of_sch, HQOS_MAX_SCH);
+	memset(hqos_sample, 0, sizeof(hqos_sample));
+
+	if (hqos_stub) {
+		hqos_stub_reset();
+		hqos_regs = &hqos_stub_regs;
+		dev_info(hnat_priv->dev, "HQoS API runs on a register stub\n");
+	} else {
+		hqos_regs = &hqos_hw_regs;
+	}
+
+	return genl_register_family(&hqos_genl_family);
+}
+
+void hnat_qos_deinit(void)
+{
+	genl_unregister_family(&hqos_genl_family);
+}
@@ -80,8 +80,9 @@ struct hnat_desc {
 #define skb_hnat_rx_id(skb) (((struct hnat_desc *)((skb)->head))->rxid)
 #define skb_hnat_wc_id(skb) (((struct hnat_desc *)((skb)->head))->wcid)
 #define skb_hnat_bss_id(skb) (((struct hnat_desc *)((skb)->head))->bssid)
-#define skb_hnat_ppe(skb)				\
-	(((skb_hnat_sport(skb) == NR_GMAC2_PORT) && (CFG_PPE_NUM >= 2)) ? 1 : 0)
+#define skb_hnat_ppe(skb)						\
+	((skb_hnat_sport(skb) == NR_GMAC1_PORT) ? hnat_priv->gmac_ppe[0] :	\
+	 (skb_hnat_sport(skb) == NR_GMAC2_PORT) ? hnat_priv->gmac_ppe[1] : 0)
 #define do_ext2ge_fast_try(dev, skb)						\
 	((skb_hnat_iface(skb) == FOE_MAGIC_EXT) && !is_from_extge(skb))
 #define set_from_extge(skb) (HNAT_SKB_CB2(skb)->magic = 0x78786688)
@@ -0,0 +1,250 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Batch mode for the image tools, see batch.h
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "batch.h"
+
+#define BATCH_LINE_MAX	4096
+
+struct batch_job {
+	int line;
+	int argc;
+	char **argv;
+	pid_t pid;
+};
+
+static void batch_reset_getopt(void)
+{
+#ifdef __GLIBC__
+	optind = 0;
+#else
+	optind = 1;
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+	optreset = 1;
+#endif
+#endif
+}
+
+/* Splits a line into arguments, in place. Returns -1 on unbalanced quotes */
+static int batch_split(char *line, char *progname, char ***argvp)
+{
+	char **argv = NULL, *in = line, *out = line;
+	int argc = 0, alloc = 0;
+	char quote;
+
+	for (;;) {
+		while (*in == ' ' || *in == '\t' || *in == '\r' || *in == '\n')
+			in++;
+		if (!*in)
+			break;
+
+		if (argc + 2 > alloc) {
+			alloc = alloc ? 2 * alloc : 8;
+			argv = realloc(argv, alloc * sizeof(*argv));
+			if (!argv) {
+				perror("realloc");
+				exit(1);
+			}
+			if (!argc)
+				argv[argc++] = progname;
+		}
+
+		argv[argc++] = out;
+		quote = 0;
+
+		for (; *in; in++) {
+			if (quote) {
+				if (*in == quote)
+					quote = 0;
+				else if (*in == '\\' && quote == '"' && in[1])
+					*out++ = *++in;
+				else
+					*out++ = *in;
+			} else if (*in == '\'' || *in == '"') {
+				quote = *in;
+			} else if (*in == '\\' && in[1]) {
+				*out++ = *++in;
+			} else if (*in == ' ' || *in == '\t' || *in == '\r' || *in == '\n') {
+				in++;
+				break;
+			} else {
+				*out++ = *in;
+			}
+		}
+
+		if (quote) {
+			free(argv);
+			return -1;
+		}
+
+		*out++ = 0;
+	}
+
+	if (argv)
+		argv[argc] = NULL;
+
+	*argvp = argv;
+	return argc;
+}
+
+static int batch_load(const char *manifest, char *progname, struct batch_job **jobsp)
+{
+	struct batch_job *jobs = NULL;
+	int n_jobs = 0, lineno = 0;
+	char *line;
+	FILE *f;
+
+	f = fopen(manifest, "r");
+	if (!f) {
+		fprintf(stderr, "Failed to open %s: %s\n", manifest, strerror(errno));
+		exit(1);
+	}
+
+	for (;;) {
+		char **argv;
+		int argc;
+
+		/* the arguments point into the line, so each one is kept */
+		line = malloc(BATCH_LINE_MAX);
+		if (!line) {
+			perror("malloc");
+			exit(1);
+		}
+
+		if (!fgets(line, BATCH_LINE_MAX, f))
+			break;
+
+		lineno++;
+		if (!strchr(line, '\n') && !feof(f)) {
+			fprintf(stderr, "%s:%d: line too long\n", manifest, lineno);
+			exit(1);
+		}
+
+		if (line[strspn(line, " \t")] == '#') {
+			free(line);
+			continue;
+		}
+
+		argc = batch_split(line, progname, &argv);
+		if (argc < 0) {
+			fprintf(stderr, "%s:%d: unbalanced quotes\n", manifest, lineno);
+			exit(1);
+		}
+		if (!argc) {
+			free(line);
+			continue;
+		}
+
+		jobs = realloc(jobs, (n_jobs + 1) * sizeof(*jobs));
+		if (!jobs) {
+			perror("realloc");
+			exit(1);
+		}
+
+		jobs[n_jobs].line = lineno;
+		jobs[n_jobs].argc = argc;
+		jobs[n_jobs].argv = argv;
+		jobs[n_jobs].pid = 0;
+		n_jobs++;
+	}
+
+	free(line);
+	fclose(f);
+
+	*jobsp = jobs;
+	return n_jobs;
+}
+
+static int batch_wait(const char *manifest, struct batch_job *jobs, int n_jobs)
+{
+	int i, status;
+	pid_t pid;
+
+	do {
+		pid = wait(&status);
+	} while (pid < 0 && errno == EINTR);
+
+	if (pid < 0)
+		return -1;
+
+	for (i = 0; i < n_jobs; i++) {
+		if (jobs[i].pid != pid)
+			continue;
+
+		jobs[i].pid = 0;
+		if (WIFEXITED(status) && !WEXITSTATUS(status))
+			return 0;
+
+		fprintf(stderr, "%s:%d: failed\n", manifest, jobs[i].line);
+		return 1;
+	}
+
+	return 0;
+}
+
+int batch_main(int argc, char **argv, batch_fn run, batch_fn prepare)
+{
+	const char *manifest;
+	struct batch_job *jobs;
+	int i, n_jobs, running = 0, failed = 0;
+	long max_jobs = 0;
+
+	if (argc < 3 || argc > 4 || strcmp(argv[1], "-b") != 0)
+		return run(argc, argv);
+
+	manifest = argv[2];
+	if (argc > 3)
+		max_jobs = atol(argv[3]);
+	if (max_jobs < 1)
+		max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (max_jobs < 1)
+		max_jobs = 1;
+
+	n_jobs = batch_load(manifest, argv[0], &jobs);
+
+	for (i = 0; prepare && i < n_jobs; i++) {
+		batch_reset_getopt();
+		if (prepare(jobs[i].argc, jobs[i].argv)) {
+			fprintf(stderr, "%s:%d: invalid arguments\n", manifest, jobs[i].line);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < n_jobs; i++) {
+		while (running >= max_jobs) {
+			failed |= batch_wait(manifest, jobs, n_jobs) > 0;
+			running--;
+		}
+
+		fflush(NULL);
+
+		jobs[i].pid = fork();
+		if (jobs[i].pid < 0) {
+			perror("fork");
+			failed = 1;
+			break;
+		}
+
+		if (!jobs[i].pid) {
+			batch_reset_getopt();
+			exit(run(jobs[i].argc, jobs[i].argv));
+		}
+
+		running++;
+	}
+
+	while (running-- > 0)
+		failed |= batch_wait(manifest, jobs, n_jobs) > 0;
+
+	return failed;
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * Batch mode for the image tools
+ *
+ *   <tool> -b <manifest> [<jobs>]
+ *
+ * runs the tool once for every line of the manifest, with the line split
+ * into arguments the way a shell would (quotes and backslashes, but no
+ * expansion). Empty lines and lines starting with '#' are skipped.
+ *
+ * Each run is forked from the batch process, so the tools keep their
+ * global state and exit() based error handling, and a failing line does
+ * not stop the others. Up to <jobs> runs (default: number of CPUs) are
+ * active at once.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+typedef int (*batch_fn)(int argc, char **argv);
+
+/*
+ * Runs run(argc, argv) directly unless argv requests batch mode. If
+ * prepare is set, it is called in the batch process for every line
+ * before any run starts, e.g. to map input files shared by the runs.
+ */
+int batch_main(int argc, char **argv, batch_fn run, batch_fn prepare);
+
+#endif /* BATCH_H */
@@ -0,0 +1,289 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * CRC32 (IEEE 802.3) with slicing-by-8 tables and, where available,
+ * carry-less multiplication (x86 PCLMULQDQ) or the ARMv8 CRC32 instructions.
+ *
+ * The PCLMULQDQ folding follows "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ Instruction" (Intel, 2009), using the bit
+ * reflected constants for the CRC32 polynomial given there.
+ *
+ * Build with -DCRC32_BENCH for a standalone throughput benchmark.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "crc32.h"
+
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 5)
+#define CRC32_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CRC32_ARM
+#include <arm_acle.h>
+#endif
+
+static uint32_t crc32_table[8][256];
+
+#ifdef CRC32_X86
+static bool crc32_use_x86;
+#endif
+
+__attribute__((constructor))
+static void crc32_setup(void)
+{
+	uint32_t crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (crc & 1 ? 0xedb88320 : 0);
+		crc32_table[0][i] = crc;
+	}
+
+	for (i = 0; i < 256; i++) {
+		crc = crc32_table[0][i];
+		for (j = 1; j < 8; j++) {
+			crc = crc32_table[0][crc & 0xff] ^ (crc >> 8);
+			crc32_table[j][i] = crc;
+		}
+	}
+
+#ifdef CRC32_X86
+	{
+		unsigned int eax, ebx, ecx, edx;
+
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			crc32_use_x86 = (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1);
+	}
+#endif
+}
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static uint32_t crc32_sliced(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint32_t a, b;
+
+	while (len >= 8) {
+		a = crc ^ get_le32(p);
+		b = get_le32(p + 4);
+
+		crc = crc32_table[7][a & 0xff] ^
+		      crc32_table[6][(a >> 8) & 0xff] ^
+		      crc32_table[5][(a >> 16) & 0xff] ^
+		      crc32_table[4][a >> 24] ^
+		      crc32_table[3][b & 0xff] ^
+		      crc32_table[2][(b >> 8) & 0xff] ^
+		      crc32_table[1][(b >> 16) & 0xff] ^
+		      crc32_table[0][b >> 24];
+
+		p += 8;
+		len -= 8;
+	}
+
+	while (len--)
+		crc = crc32_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#ifdef CRC32_X86
+/* len must be at least 64 and a multiple of 16 */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_x86(uint32_t crc, const uint8_t *p, size_t len)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, t1, t2, t3, t4;
+
+	x1 = _mm_loadu_si128((const __m128i *) (p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *) (p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *) (p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *) (p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+	p += 64;
+	len -= 64;
+
+	/* fold four 128 bit lanes in parallel */
+	while (len >= 64) {
+		t1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		t2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		t3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		t4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, t1),
+				   _mm_loadu_si128((const __m128i *) (p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, t2),
+				   _mm_loadu_si128((const __m128i *) (p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, t3),
+				   _mm_loadu_si128((const __m128i *) (p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, t4),
+				   _mm_loadu_si128((const __m128i *) (p + 0x30)));
+		p += 64;
+		len -= 64;
+	}
+
+	/* fold the lanes into one */
+	t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), t1);
+	t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), t1);
+	t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), t1);
+
+	while (len >= 16) {
+		t1 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, t1),
+				   _mm_loadu_si128((const __m128i *) p));
+		p += 16;
+		len -= 16;
+	}
+
+	/* 128 -> 64 bits */
+	t1 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t1);
+	t1 = _mm_srli_si128(x1, 4);
+	x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), k5, 0x00);
+	x1 = _mm_xor_si128(x1, t1);
+
+	/* Barrett reduction to 32 bits */
+	t1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask), poly, 0x10);
+	t1 = _mm_clmulepi64_si128(_mm_and_si128(t1, mask), poly, 0x00);
+	x1 = _mm_xor_si128(x1, t1);
+
+	return _mm_extract_epi32(x1, 1);
+}
+#endif
+
+#ifdef CRC32_ARM
+static uint32_t crc32_arm(uint32_t crc, const uint8_t *p, size_t len)
+{
+	uint64_t v;
+
+	while (len && ((uintptr_t) p & 7)) {
+		crc = __crc32b(crc, *p++);
+		len--;
+	}
+
+	for (; len >= 8; len -= 8, p += 8) {
+		memcpy(&v, p, sizeof(v));
+		crc = __crc32d(crc, v);
+	}
+
+	while (len--)
+		crc = __crc32b(crc, *p++);
+
+	return crc;
+}
+#endif
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+
+#ifdef CRC32_ARM
+	return crc32_arm(crc, p, len);
+#endif
+
+#ifdef CRC32_X86
+	if (crc32_use_x86 && len >= 64) {
+		crc = crc32_x86(crc, p, len & ~(size_t) 15);
+		p += len & ~(size_t) 15;
+		len &= 15;
+	}
+#endif
+
+	return crc32_sliced(crc, p, len);
+}
+
+#ifdef CRC32_BENCH
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static uint32_t crc32_bytewise(uint32_t crc, const uint8_t *p, size_t len)
+{
+	while (len--)
+		crc = crc32_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+static double bench(const char *name, uint32_t (*fn)(uint32_t, const uint8_t *, size_t),
+		    const uint8_t *buf, size_t len, int rounds)
+{
+	struct timespec t0, t1;
+	uint32_t crc = 0;
+	double secs;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < rounds; i++)
+		crc = fn(crc, buf, len);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("%-10s %8.1f MiB/s  (crc %08x)\n", name,
+	       (double) len * rounds / secs / (1024 * 1024), crc);
+
+	return secs;
+}
+
+static uint32_t update(uint32_t crc, const uint8_t *p, size_t len)
+{
+	return crc32_update(crc, p, len);
+}
+
+int main(int argc, char **argv)
+{
+	size_t i, len = argc > 1 ? strtoul(argv[1], NULL, 0) : 16 << 20;
+	int rounds = argc > 2 ? atoi(argv[2]) : 8;
+	uint8_t *buf;
+
+	buf = malloc(len);
+	if (!buf)
+		return 1;
+
+	for (i = 0; i < len; i++)
+		buf[i] = rand();
+
+	/* check every path against the bytewise reference on odd lengths */
+	for (i = 0; i < 4096 && i <= len; i += 7) {
+		uint32_t ref = crc32_bytewise(0x12345678, buf + 1, i ? i - 1 : 0);
+
+		if (update(0x12345678, buf + 1, i ? i - 1 : 0) != ref ||
+		    crc32_sliced(0x12345678, buf + 1, i ? i - 1 : 0) != ref) {
+			fprintf(stderr, "CRC mismatch at length %zu\n", i);
+			return 1;
+		}
+	}
+
+	bench("bytewise", crc32_bytewise, buf, len, rounds);
+	bench("slice-by-8", crc32_sliced, buf, len, rounds);
+	bench("default", update, buf, len, rounds);
+
+	free(buf);
+	return 0;
+}
+#endif
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+/*
+ * CRC32 (IEEE 802.3, reflected polynomial 0xedb88320)
+ *
+ * crc32_update() works on the raw register value, without the initial and
+ * final inversion, so it can be used both for the Ethernet/zlib CRC and for
+ * the many image formats that store the register as is:
+ *
+ *	crc = crc32_init();
+ *	crc = crc32_update(crc, buf, len);
+ *	...
+ *	crc = crc32_final(crc);
+ */
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+
+static inline uint32_t crc32_init(void)
+{
+	return 0xffffffff;
+}
+
+static inline uint32_t crc32_final(uint32_t crc)
+{
+	return crc ^ 0xffffffff;
+}
+
+/* Ethernet/zlib CRC32 of a single buffer */
+static inline uint32_t crc32_buf(const void *buf, size_t len)
+{
+	return crc32_final(crc32_update(crc32_init(), buf, len));
+}
+
+#endif /* CRC32_H */
@@ -27,6 +27,7 @@
 #include <sys/stat.h>
 #include <zlib.h>		/*for crc32 */
 
+#include "batch.h"
 #include "mkdlinkfw-lib.h"
 
 /* ARM update header 2.0
@@ -596,7 +597,7 @@ int wrap_fw(void)
 	return ret;
 }
 
-int main(int argc, char *argv[])
+static int mkdlinkfw_main(int argc, char *argv[])
 {
 	int ret = EXIT_FAILURE;
 
@@ -666,3 +667,8 @@ int main(int argc, char *argv[])
 	return ret;
 
 }
+
+int main(int argc, char *argv[])
+{
+	return batch_main(argc, argv, mkdlinkfw_main, NULL);
+}
@@ -27,6 +27,7 @@
 #include <arpa/inet.h>
 #include <netinet/in.h>
 
+#include "batch.h"
 #include "md5.h"
 #include "mktplinkfw-lib.h"
 
@@ -542,7 +543,7 @@ static int inspect_fw(void)
 	return ret;
 }
 
-int main(int argc, char *argv[])
+static int mktplinkfw_main(int argc, char *argv[])
 {
 	int ret = EXIT_FAILURE;
 
@@ -646,3 +647,8 @@ int main(int argc, char *argv[])
  out:
 	return ret;
 }
+
+int main(int argc, char *argv[])
+{
+	return batch_main(argc, argv, mktplinkfw_main, NULL);
+}
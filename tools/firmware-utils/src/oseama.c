@@ -18,6 +18,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "batch.h"
 #include "md5.h"
 
 #if !defined(__BYTE_ORDER)
@@ -541,7 +542,7 @@ static void usage() {
 	printf("\t-o file\t\t\t\toutput file\n");
 }
 
-int main(int argc, char **argv) {
+static int oseama_main(int argc, char **argv) {
 	if (argc > 1) {
 		if (!strcmp(argv[1], "info"))
 			return oseama_info(argc, argv);
@@ -554,3 +555,8 @@ int main(int argc, char **argv) {
 	usage();
 	return 0;
 }
+
+int main(int argc, char *argv[])
+{
+	return batch_main(argc, argv, oseama_main, NULL);
+}
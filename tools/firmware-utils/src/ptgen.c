@@ -35,8 +35,27 @@
 #include <inttypes.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <errno.h>
 #include "cyg_crc.h"
 
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#ifndef SEEK_DATA
+#define SEEK_DATA	3
+#define SEEK_HOLE	4
+#endif
+
+/* from linux/fs.h, which clashes with the asm/types.h of the host tools */
+struct clone_range {
+	int64_t src_fd;
+	uint64_t src_offset;
+	uint64_t src_length;
+	uint64_t dest_offset;
+};
+#define FICLONERANGE _IOW(0x94, 13, struct clone_range)
+#endif
+
 #if __BYTE_ORDER == __BIG_ENDIAN
 #define cpu_to_le16(x) bswap_16(x)
 #define cpu_to_le32(x) bswap_32(x)
@@ -95,6 +114,12 @@ typedef struct {
 
 #define DISK_SECTOR_SIZE        512
 
+/* Images are copied through a buffer of this size if they can't be cloned */
+#define COPY_BUF_SIZE           (1024 * 1024)
+
+/* Zero blocks of this size are skipped and left as holes in the output */
+#define SPARSE_BLOCK_SIZE       4096
+
 /* Partition table entry */
 struct pte {
 	uint8_t active;
@@ -109,6 +134,9 @@ struct partinfo {
 	unsigned long start;
 	unsigned long size;
 	int type;
+	char *image;
+	uint64_t offset;	/* placement in bytes, set when the table is generated */
+	uint64_t length;
 };
 
 /* GPT Partition table header */
@@ -147,6 +175,13 @@ int sectors = -1;
 int kb_align = 0;
 bool ignore_null_sized_partition = false;
 bool use_guid_partition_table = false;
+#ifdef WANT_ALTERNATE_PTABLE
+bool alternate_ptable = true;
+#else
+bool alternate_ptable = false;
+#endif
+bool compose = false;
+bool pad_output = false;
 struct partinfo parts[GPT_ENTRY_MAX];
 char *filename = NULL;
 
@@ -271,6 +306,151 @@ static inline void init_utf16(char *str, uint16_t *buf, unsigned bufsize)
 	}
 }
 
+static bool is_zero(const char *buf, size_t len)
+{
+	return !buf[0] && !memcmp(buf, buf + 1, len - 1);
+}
+
+/* copy a range of in to out, leaving blocks of zeroes as holes */
+static int copy_range(int in, int out, off_t src, off_t dst, off_t len)
+{
+	static char buf[COPY_BUF_SIZE];
+	ssize_t r, i, j;
+
+#ifdef __NR_copy_file_range
+	while (len > 0) {
+		loff_t s = src, d = dst;
+
+		r = syscall(__NR_copy_file_range, in, &s, out, &d, (size_t)len, 0);
+		if (r <= 0)
+			break;
+		src += r;
+		dst += r;
+		len -= r;
+	}
+	/* otherwise not supported between these files, use read/write */
+#endif
+
+	while (len > 0) {
+		r = pread(in, buf, len < COPY_BUF_SIZE ? len : COPY_BUF_SIZE, src);
+		if (r <= 0)
+			return -1;
+
+		for (i = 0; i < r; i = j) {
+			while (i < r && is_zero(buf + i, r - i < SPARSE_BLOCK_SIZE ? r - i : SPARSE_BLOCK_SIZE))
+				i += SPARSE_BLOCK_SIZE;
+			if (i >= r)
+				break;
+			for (j = i; j < r && !is_zero(buf + j, r - j < SPARSE_BLOCK_SIZE ? r - j : SPARSE_BLOCK_SIZE);)
+				j += SPARSE_BLOCK_SIZE;
+			if (j > r)
+				j = r;
+			if (pwrite(out, buf + i, j - i, dst + i) != j - i)
+				return -1;
+		}
+
+		src += r;
+		dst += r;
+		len -= r;
+	}
+
+	return 0;
+}
+
+/* write the image of a partition at its offset, skipping holes */
+static int write_image(int fd, struct partinfo *part, uint64_t *end)
+{
+	off_t pos, data, hole;
+	struct stat st;
+	int in, ret = -1;
+
+	if ((in = open(part->image, O_RDONLY)) < 0 || fstat(in, &st)) {
+		fprintf(stderr, "Can't open image file '%s'\n", part->image);
+		goto out;
+	}
+
+	if ((uint64_t)st.st_size > part->length) {
+		fprintf(stderr, "Image '%s' is larger than its partition (%" PRIu64 " > %" PRIu64 " bytes)\n",
+			part->image, (uint64_t)st.st_size, part->length);
+		goto out;
+	}
+
+	*end = part->offset + st.st_size;
+
+#ifdef FICLONERANGE
+	/* share the extents if both files are on a reflink capable filesystem */
+	if (st.st_blksize && !(part->offset % st.st_blksize)) {
+		struct clone_range fcr = {
+			.src_fd = in,
+			.dest_offset = part->offset,
+		};
+
+		if (!ioctl(fd, FICLONERANGE, &fcr)) {
+			ret = 0;
+			goto out;
+		}
+	}
+#endif
+
+	for (pos = 0; pos < st.st_size; pos = hole) {
+		data = pos;
+		hole = st.st_size;
+#ifdef SEEK_DATA
+		data = lseek(in, pos, SEEK_DATA);
+		if (data < 0) {
+			if (errno == ENXIO)
+				break;
+			data = pos;
+		} else if ((hole = lseek(in, data, SEEK_HOLE)) < 0) {
+			hole = st.st_size;
+		}
+#endif
+		if (copy_range(in, fd, data, part->offset + data, hole - data)) {
+			fprintf(stderr, "Failed to copy '%s': %s\n", part->image, strerror(errno));
+			goto out;
+		}
+	}
+
+	ret = 0;
+out:
+	if (in >= 0)
+		close(in);
+	return ret;
+}
+
+/*
+ * write the partition images, the output ends after the last image unless
+ * it is padded to the whole disk
+ */
+static int write_images(int fd, int nr, uint64_t disk_size)
+{
+	uint64_t end, size = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (!parts[i].image)
+			continue;
+		if (!parts[i].length) {
+			fprintf(stderr, "Image given for empty partition %d!\n", i);
+			return -1;
+		}
+		if (write_image(fd, &parts[i], &end))
+			return -1;
+		if (end > size)
+			size = end;
+		if (verbose)
+			fprintf(stderr, "Partition %d: wrote %s\n", i, parts[i].image);
+	}
+
+	/* holes are not written, so trailing zeroes only exist once sized */
+	if (ftruncate(fd, pad_output ? disk_size : size)) {
+		fprintf(stderr, "Can't resize output file: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
 /* check the partition sizes and write the partition table */
 static int gen_ptable(uint32_t signature, int nr)
 {
@@ -307,6 +487,8 @@ static int gen_ptable(uint32_t signature, int nr)
 		if (kb_align == 0)
 			sect = round_to_cyl(sect);
 		pte[i].length = cpu_to_le32(len = sect - start);
+		parts[i].offset = (uint64_t)start * DISK_SECTOR_SIZE;
+		parts[i].length = (uint64_t)len * DISK_SECTOR_SIZE;
 
 		to_chs(start, pte[i].chs_start);
 		to_chs(start + len - 1, pte[i].chs_end);
@@ -326,6 +508,9 @@ static int gen_ptable(uint32_t signature, int nr)
 		return ret;
 	}
 
+	if (compose && write_images(fd, nr, (uint64_t)sect * DISK_SECTOR_SIZE))
+		goto fail;
+
 	lseek(fd, MBR_DISK_SIGNATURE_OFFSET, SEEK_SET);
 	if (write(fd, &signature, sizeof(signature)) != sizeof(signature)) {
 		fputs("write failed.\n", stderr);
@@ -394,6 +579,8 @@ static int gen_gptable(uint32_t signature, guid_t guid, unsigned nr)
 		if (kb_align == 0)
 			sect = round_to_cyl(sect);
 		gpte[i].end = cpu_to_le64(sect -1);
+		parts[i].offset = start * DISK_SECTOR_SIZE;
+		parts[i].length = (sect - start) * DISK_SECTOR_SIZE;
 		gpte[i].guid = guid;
 		gpte[i].guid.b[sizeof(guid_t) -1] += i + 1;
 		if (parts[i].type == 0xEF || (i + 1) == (unsigned)active) {
@@ -436,6 +623,9 @@ static int gen_gptable(uint32_t signature, guid_t guid, unsigned nr)
 		return ret;
 	}
 
+	if (compose && write_images(fd, nr, (end + 1) * DISK_SECTOR_SIZE))
+		goto fail;
+
 	lseek(fd, MBR_DISK_SIGNATURE_OFFSET, SEEK_SET);
 	if (write(fd, &signature, sizeof(signature)) != sizeof(signature)) {
 		fputs("write failed.\n", stderr);
@@ -465,30 +655,33 @@ static int gen_gptable(uint32_t signature, guid_t guid, unsigned nr)
 		goto fail;
 	}
 
-#ifdef WANT_ALTERNATE_PTABLE
-	/* The alternate partition table (We omit it by default) */
-	swap(gpth.self, gpth.alternate);
-	gpth.first_entry = cpu_to_le64(end - GPT_ENTRY_SIZE * GPT_ENTRY_MAX / DISK_SECTOR_SIZE),
-	gpth.crc32 = 0;
-	gpth.crc32 = cpu_to_le32(gpt_crc32(&gpth, GPT_HEADER_SIZE));
-
-	lseek(fd, end * DISK_SECTOR_SIZE - GPT_ENTRY_SIZE * GPT_ENTRY_MAX, SEEK_SET);
-	if (write(fd, &gpte, GPT_ENTRY_SIZE * GPT_ENTRY_MAX) != GPT_ENTRY_SIZE * GPT_ENTRY_MAX) {
-		fputs("write failed.\n", stderr);
-		goto fail;
-	}
+	/*
+	 * The alternate partition table, omitted by default unless the
+	 * output is padded to the whole disk
+	 */
+	if (alternate_ptable || pad_output) {
+		swap(gpth.self, gpth.alternate);
+		gpth.first_entry = cpu_to_le64(end - GPT_ENTRY_SIZE * GPT_ENTRY_MAX / DISK_SECTOR_SIZE),
+		gpth.crc32 = 0;
+		gpth.crc32 = cpu_to_le32(gpt_crc32(&gpth, GPT_HEADER_SIZE));
+
+		lseek(fd, end * DISK_SECTOR_SIZE - GPT_ENTRY_SIZE * GPT_ENTRY_MAX, SEEK_SET);
+		if (write(fd, &gpte, GPT_ENTRY_SIZE * GPT_ENTRY_MAX) != GPT_ENTRY_SIZE * GPT_ENTRY_MAX) {
+			fputs("write failed.\n", stderr);
+			goto fail;
+		}
 
-	lseek(fd, end * DISK_SECTOR_SIZE, SEEK_SET);
-	if (write(fd, &gpth, GPT_HEADER_SIZE) != GPT_HEADER_SIZE) {
-		fputs("write failed.\n", stderr);
-		goto fail;
-	}
-	lseek(fd, (end + 1) * DISK_SECTOR_SIZE -1, SEEK_SET);
-	if (write(fd, "\x00", 1) != 1) {
-		fputs("write failed.\n", stderr);
-		goto fail;
+		lseek(fd, end * DISK_SECTOR_SIZE, SEEK_SET);
+		if (write(fd, &gpth, GPT_HEADER_SIZE) != GPT_HEADER_SIZE) {
+			fputs("write failed.\n", stderr);
+			goto fail;
+		}
+		lseek(fd, (end + 1) * DISK_SECTOR_SIZE -1, SEEK_SET);
+		if (write(fd, "\x00", 1) != 1) {
+			fputs("write failed.\n", stderr);
+			goto fail;
+		}
 	}
-#endif
 
 	ret = 0;
 fail:
@@ -498,13 +691,19 @@ fail:
 
 static void usage(char *prog)
 {
-	fprintf(stderr, "Usage: %s [-v] [-n] [-g] -h <heads> -s <sectors> -o <outputfile> [-a 0..4] [-l <align kB>] [-G <guid>] [[-t <type>] -p <size>[@<start>]...] \n", prog);
+	fprintf(stderr, "Usage: %s [-v] [-n] [-g] [-P] -h <heads> -s <sectors> -o <outputfile> [-a 0..4] [-l <align kB>] [-G <guid>] [[-t <type>] [-i <image>] -p <size>[@<start>]...] \n", prog);
+	fprintf(stderr, "\n"
+		"  -i <image>   write <image> into the next partition; the output then\n"
+		"               becomes the disk image, ending after the last image\n"
+		"  -P           pad the disk image to the whole disk (sparse), with the\n"
+		"               alternate GPT at its end\n");
 	exit(EXIT_FAILURE);
 }
 
 int main (int argc, char **argv)
 {
 	unsigned char type = 0x83;
+	char *image = NULL;
 	char *p;
 	int ch;
 	int part = 0;
@@ -512,7 +711,7 @@ int main (int argc, char **argv)
 	guid_t guid = GUID_INIT( signature, 0x2211, 0x4433, \
 			0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB, 0x00);
 
-	while ((ch = getopt(argc, argv, "h:s:p:a:t:o:vngl:S:G:")) != -1) {
+	while ((ch = getopt(argc, argv, "h:s:p:a:t:o:i:vngPl:S:G:")) != -1) {
 		switch (ch) {
 		case 'o':
 			filename = optarg;
@@ -526,6 +725,10 @@ int main (int argc, char **argv)
 		case 'g':
 			use_guid_partition_table = 1;
 			break;
+		case 'P':
+			pad_output = true;
+			compose = true;
+			break;
 		case 'h':
 			heads = (int)strtoul(optarg, NULL, 0);
 			break;
@@ -544,7 +747,13 @@ int main (int argc, char **argv)
 			}
 			parts[part].size = to_kbytes(optarg);
 			fprintf(stderr, "part %ld %ld\n", parts[part].start, parts[part].size);
+			parts[part].image = image;
 			parts[part++].type = type;
+			image = NULL;
+			break;
+		case 'i':
+			image = optarg;
+			compose = true;
 			break;
 		case 't':
 			type = (char)strtoul(optarg, NULL, 16);
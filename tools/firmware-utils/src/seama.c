@@ -48,6 +48,7 @@
 #include <string.h>
 #include <arpa/inet.h>
 
+#include "batch.h"
 #include "md5.h"
 #include "seama.h"
 
@@ -510,7 +511,7 @@ static void extract_file(const char * output)
 #ifdef RGBIN_BOX
 int seama_main(int argc, char * argv[], char * env[])
 #else
-int main(int argc, char * argv[], char * env[])
+static int seama_run(int argc, char * argv[])
 #endif
 {
 	verbose("SEAMA version " VERSION "\n");
@@ -527,3 +528,10 @@ int main(int argc, char * argv[], char * env[])
 	cleanup_exit(0);
 	return 0;
 }
+
+#ifndef RGBIN_BOX
+int main(int argc, char * argv[])
+{
+	return batch_main(argc, argv, seama_run, NULL);
+}
+#endif
@@ -43,11 +43,15 @@
 #include <unistd.h>
 
 #include <arpa/inet.h>
+#include <fcntl.h>
 
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <limits.h>
 
+#include "batch.h"
 #include "md5.h"
 
 
@@ -56,11 +60,37 @@
 
 #define MAX_PARTITIONS	32
 
-/** An image partition table entry */
+#ifndef IOV_MAX
+#define IOV_MAX		1024
+#endif
+
+/** An image partition table entry
+ * The first data_len bytes are read from data, the remaining
+ * size - data_len bytes (if any) from tail. */
 struct image_partition_entry {
 	const char *name;
 	size_t size;
 	uint8_t *data;
+	size_t data_len;
+	uint8_t *tail;
+	bool mapped;
+};
+
+/** An input file, mapped once and shared by all images built from it */
+struct input_file {
+	const char *name;
+	uint8_t *data;
+	size_t size;
+	bool cached;
+	struct input_file *next;
+};
+
+/** An image being assembled as a list of buffers */
+struct image_chunks {
+	struct iovec *iov;
+	size_t count;
+	size_t alloc;
+	size_t len;
 };
 
 /** A flash partition table entry */
@@ -2470,7 +2500,8 @@ static struct image_partition_entry init_meta_partition_entry(
 	struct image_partition_entry entry = {
 		.name = name,
 		.size = total_len,
-		.data = malloc(total_len)
+		.data = malloc(total_len),
+		.data_len = total_len
 	};
 	if (!entry.data)
 		error(1, errno, "failed to allocate meta partition entry");
@@ -2490,7 +2521,7 @@ static struct image_partition_entry init_meta_partition_entry(
 
 /** Allocates a new image partition */
 static struct image_partition_entry alloc_image_partition(const char *name, size_t len) {
-	struct image_partition_entry entry = {name, len, malloc(len)};
+	struct image_partition_entry entry = {name, len, malloc(len), len};
 	if (!entry.data)
 		error(1, errno, "malloc");
 
@@ -2499,7 +2530,9 @@ static struct image_partition_entry alloc_image_partition(const char *name, size
 
 /** Frees an image partition */
 static void free_image_partition(struct image_partition_entry entry) {
-	free(entry.data);
+	if (!entry.mapped)
+		free(entry.data);
+	free(entry.tail);
 }
 
 static time_t source_date_epoch = -1;
@@ -2614,14 +2647,74 @@ static struct image_partition_entry make_extra_para(
 		info->part_trail);
 }
 
-/** Creates a new image partition with an arbitrary name from a file */
-static struct image_partition_entry read_file(const char *part_name, const char *filename, bool add_jffs2_eof, struct flash_partition_entry *file_system_partition) {
+/** Inputs mapped before forking in batch mode */
+static struct input_file *input_cache;
+
+/** Maps an input file */
+static void map_input(struct input_file *file, const char *filename) {
+	struct input_file *cached;
 	struct stat statbuf;
+	int fd;
+
+	for (cached = input_cache; cached; cached = cached->next) {
+		if (!strcmp(cached->name, filename)) {
+			*file = *cached;
+			file->cached = true;
+			return;
+		}
+	}
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		error(1, errno, "unable to open file `%s'", filename);
 
-	if (stat(filename, &statbuf) < 0)
+	if (fstat(fd, &statbuf) < 0)
 		error(1, errno, "unable to stat file `%s'", filename);
 
-	size_t len = statbuf.st_size;
+	file->name = filename;
+	file->size = statbuf.st_size;
+	file->data = NULL;
+	file->cached = false;
+
+	if (file->size) {
+		file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (file->data == MAP_FAILED)
+			error(1, errno, "unable to map file `%s'", filename);
+	}
+
+	close(fd);
+}
+
+static void unmap_input(struct input_file *file) {
+	if (file->data && !file->cached)
+		munmap(file->data, file->size);
+}
+
+/** Maps an input file ahead of time, for all batch runs using it */
+static void cache_input(const char *filename) {
+	struct input_file *file;
+
+	/* missing inputs are reported by the run that needs them */
+	if (access(filename, R_OK))
+		return;
+
+	for (file = input_cache; file; file = file->next)
+		if (!strcmp(file->name, filename))
+			return;
+
+	file = malloc(sizeof(*file));
+	if (!file)
+		error(1, errno, "malloc");
+
+	map_input(file, filename);
+	file->next = input_cache;
+	input_cache = file;
+}
+
+/** Creates a new image partition with an arbitrary name from a file
+ * The file data is not copied, only the jffs2 padding is allocated */
+static struct image_partition_entry read_file(const char *part_name, const struct input_file *file, bool add_jffs2_eof, struct flash_partition_entry *file_system_partition) {
+	size_t len = file->size;
 
 	if (add_jffs2_eof) {
 		if (file_system_partition)
@@ -2630,29 +2723,105 @@ static struct image_partition_entry read_file(const char *part_name, const char
 			len = ALIGN(len, 0x10000) + sizeof(jffs2_eof_mark);
 	}
 
-	struct image_partition_entry entry = alloc_image_partition(part_name, len);
+	struct image_partition_entry entry = {
+		.name = part_name,
+		.size = len,
+		.data = file->data,
+		.data_len = file->size,
+		.mapped = true
+	};
 
-	FILE *file = fopen(filename, "rb");
-	if (!file)
-		error(1, errno, "unable to open file `%s'", filename);
+	if (add_jffs2_eof) {
+		size_t tail_len = entry.size - entry.data_len;
 
-	if (fread(entry.data, statbuf.st_size, 1, file) != 1)
-		error(1, errno, "unable to read file `%s'", filename);
+		entry.tail = malloc(tail_len);
+		if (!entry.tail)
+			error(1, errno, "malloc");
 
-	if (add_jffs2_eof) {
-		uint8_t *eof = entry.data + statbuf.st_size, *end = entry.data+entry.size;
+		memset(entry.tail, 0xff, tail_len - sizeof(jffs2_eof_mark));
+		memcpy(entry.tail + tail_len - sizeof(jffs2_eof_mark), jffs2_eof_mark, sizeof(jffs2_eof_mark));
+	}
+
+	return entry;
+}
 
-		memset(eof, 0xff, end - eof - sizeof(jffs2_eof_mark));
-		memcpy(end - sizeof(jffs2_eof_mark), jffs2_eof_mark, sizeof(jffs2_eof_mark));
+/** Appends a buffer to an image */
+static void chunks_add(struct image_chunks *c, const void *data, size_t len) {
+	if (!len)
+		return;
+
+	if (c->count == c->alloc) {
+		c->alloc = c->alloc ? 2 * c->alloc : 16;
+		c->iov = realloc(c->iov, c->alloc * sizeof(*c->iov));
+		if (!c->iov)
+			error(1, errno, "realloc");
 	}
 
-	fclose(file);
+	c->iov[c->count].iov_base = (void *)data;
+	c->iov[c->count].iov_len = len;
+	c->count++;
+	c->len += len;
+}
 
-	return entry;
+/** Appends len bytes of 0xff padding to an image */
+static void chunks_add_ff(struct image_chunks *c, size_t len) {
+	static uint8_t ff[0x10000];
+
+	if (!ff[0])
+		memset(ff, 0xff, sizeof(ff));
+
+	while (len) {
+		size_t n = len < sizeof(ff) ? len : sizeof(ff);
+
+		chunks_add(c, ff, n);
+		len -= n;
+	}
+}
+
+static void chunks_add_partition(struct image_chunks *c, const struct image_partition_entry *part) {
+	chunks_add(c, part->data, part->data_len);
+	chunks_add(c, part->tail, part->size - part->data_len);
+}
+
+/** Writes an image to a file, in batches of at most IOV_MAX buffers
+ * The buffer list is consumed while writing. */
+static void chunks_write(struct image_chunks *c, const char *output) {
+	struct iovec *iov = c->iov;
+	size_t count = c->count;
+	int fd;
+
+	fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		error(1, errno, "unable to open output file");
+
+	while (count) {
+		ssize_t w = writev(fd, iov, count < IOV_MAX ? count : IOV_MAX);
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			error(1, errno, "unable to write output file");
+		}
+
+		/* skip what was written, resuming partial buffers */
+		while (count && (size_t)w >= iov->iov_len) {
+			w -= iov->iov_len;
+			iov++;
+			count--;
+		}
+
+		if (count) {
+			iov->iov_base = (uint8_t *)iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+
+	if (close(fd))
+		error(1, errno, "unable to write output file");
 }
 
 /**
-   Copies a list of image partitions into an image buffer and generates the image partition table while doing so
+   Appends a list of image partitions to an image and generates the image partition table while doing so
 
    Example image partition table:
 
@@ -2678,7 +2847,7 @@ static struct image_partition_entry read_file(const char *part_name, const char
 
    I think partition-table must be the first partition in the firmware image.
 */
-static void put_partitions(uint8_t *buffer, const struct flash_partition_entry *flash_parts, const struct image_partition_entry *parts) {
+static void put_partitions(uint8_t *buffer, struct image_chunks *chunks, const struct flash_partition_entry *flash_parts, const struct image_partition_entry *parts) {
 	size_t i, j;
 	char *image_pt = (char *)buffer, *end = image_pt + 0x800;
 
@@ -2694,7 +2863,7 @@ static void put_partitions(uint8_t *buffer, const struct flash_partition_entry *
 
 		assert(flash_parts[j].name);
 
-		memcpy(buffer + base, parts[i].data, parts[i].size);
+		chunks_add_partition(chunks, &parts[i]);
 
 		size_t len = end-image_pt;
 		size_t w = snprintf(image_pt, len, "fwup-ptn %s base 0x%05x size 0x%05x\t\r\n", parts[i].name, (unsigned)base, (unsigned)parts[i].size);
@@ -2708,13 +2877,27 @@ static void put_partitions(uint8_t *buffer, const struct flash_partition_entry *
 	}
 }
 
-/** Generates and writes the image MD5 checksum */
-static void put_md5(uint8_t *md5, uint8_t *buffer, unsigned int len) {
+/** Generates and writes the image MD5 checksum, over everything after the first skip bytes */
+static void put_md5(uint8_t *md5, const struct image_chunks *chunks, size_t skip) {
 	MD5_CTX ctx;
+	size_t i;
 
 	MD5_Init(&ctx);
 	MD5_Update(&ctx, md5_salt, (unsigned int)sizeof(md5_salt));
-	MD5_Update(&ctx, buffer, len);
+
+	for (i = 0; i < chunks->count; i++) {
+		const uint8_t *data = chunks->iov[i].iov_base;
+		size_t len = chunks->iov[i].iov_len;
+
+		if (skip >= len) {
+			skip -= len;
+			continue;
+		}
+
+		MD5_Update(&ctx, data + skip, len - skip);
+		skip = 0;
+	}
+
 	MD5_Final(md5, &ctx);
 }
 
@@ -2734,19 +2917,12 @@ static void put_md5(uint8_t *md5, uint8_t *buffer, unsigned int len) {
      1014-1813    Image partition table (2048 bytes, padded with 0xff)
      1814-xxxx    Firmware partitions
 */
-static void * generate_factory_image(struct device_info *info, const struct image_partition_entry *parts, size_t *len) {
-	*len = 0x1814;
-
-	size_t i;
-	for (i = 0; parts[i].name; i++)
-		*len += parts[i].size;
-
-	uint8_t *image = malloc(*len);
+static void * generate_factory_image(struct device_info *info, const struct image_partition_entry *parts, struct image_chunks *chunks) {
+	uint8_t *image = malloc(0x1814);
 	if (!image)
 		error(1, errno, "malloc");
 
-	memset(image, 0xff, *len);
-	put32(image, *len);
+	memset(image, 0xff, 0x1814);
 
 	if (info->vendor) {
 		size_t vendor_len = strlen(info->vendor);
@@ -2754,8 +2930,10 @@ static void * generate_factory_image(struct device_info *info, const struct imag
 		memcpy(image+0x18, info->vendor, vendor_len);
 	}
 
-	put_partitions(image + 0x1014, info->partitions, parts);
-	put_md5(image+0x04, image+0x14, *len-0x14);
+	chunks_add(chunks, image, 0x1814);
+	put_partitions(image + 0x1014, chunks, info->partitions, parts);
+	put32(image, chunks->len);
+	put_md5(image+0x04, chunks, 0x14);
 
 	return image;
 }
@@ -2767,7 +2945,7 @@ static void * generate_factory_image(struct device_info *info, const struct imag
    should be generalized when TP-LINK starts building its safeloader into hardware with
    different flash layouts.
 */
-static void * generate_sysupgrade_image(struct device_info *info, const struct image_partition_entry *image_parts, size_t *len) {
+static void generate_sysupgrade_image(struct device_info *info, const struct image_partition_entry *image_parts, struct image_chunks *chunks) {
 	size_t i, j;
 	size_t flash_first_partition_index = 0;
 	size_t flash_last_partition_index = 0;
@@ -2799,39 +2977,37 @@ static void * generate_sysupgrade_image(struct device_info *info, const struct i
 
 	assert(image_last_partition);
 
-	*len = flash_last_partition->base - flash_first_partition->base + image_last_partition->size;
-
-	uint8_t *image = malloc(*len);
-	if (!image)
-		error(1, errno, "malloc");
-
-	memset(image, 0xff, *len);
-
 	for (i = flash_first_partition_index; i <= flash_last_partition_index; i++) {
 		for (j = 0; image_parts[j].name; j++) {
 			if (!strcmp(info->partitions[i].name, image_parts[j].name)) {
+				size_t base = info->partitions[i].base - flash_first_partition->base;
+
 				if (image_parts[j].size > info->partitions[i].size)
 					error(1, 0, "%s partition too big (more than %u bytes)", info->partitions[i].name, (unsigned)info->partitions[i].size);
-				memcpy(image + info->partitions[i].base - flash_first_partition->base, image_parts[j].data, image_parts[j].size);
+				if (base < chunks->len)
+					error(1, 0, "%s partition overlaps the previous one", info->partitions[i].name);
+
+				chunks_add_ff(chunks, base - chunks->len);
+				chunks_add_partition(chunks, &image_parts[j]);
 				break;
 			}
-
-			assert(image_parts[j].name);
 		}
 	}
 
-	return image;
+	assert(chunks->len == flash_last_partition->base - flash_first_partition->base + image_last_partition->size);
 }
 
 /** Generates an image according to a given layout and writes it to a file */
 static void build_image(const char *output,
-		const char *kernel_image,
-		const char *rootfs_image,
+		const struct input_file *kernel_image,
+		const struct input_file *rootfs_image,
 		uint32_t rev,
 		bool add_jffs2_eof,
 		bool sysupgrade,
-		struct device_info *info) {
+		const struct device_info *board) {
 
+	/* The flash layout is adjusted below, keep the board table intact */
+	struct device_info board_info = *board, *info = &board_info;
 	size_t i;
 
 	struct image_partition_entry parts[7] = {};
@@ -2854,27 +3030,23 @@ static void build_image(const char *output,
 		os_image_partition = &info->partitions[firmware_partition_index];
 		file_system_partition = &info->partitions[firmware_partition_index + 1];
 
-		struct stat kernel;
-		if (stat(kernel_image, &kernel) < 0)
-			error(1, errno, "unable to stat file `%s'", kernel_image);
-
-		if (kernel.st_size > firmware_partition->size)
+		if (kernel_image->size > firmware_partition->size)
 			error(1, 0, "kernel overflowed firmware partition\n");
 
 		for (i = MAX_PARTITIONS-1; i >= firmware_partition_index + 1; i--)
 			info->partitions[i+1] = info->partitions[i];
 
 		file_system_partition->name = "file-system";
-		file_system_partition->base = firmware_partition->base + kernel.st_size;
+		file_system_partition->base = firmware_partition->base + kernel_image->size;
 
 		/* Align partition start to erase blocks for factory images only */
 		if (!sysupgrade)
-			file_system_partition->base = ALIGN(firmware_partition->base + kernel.st_size, 0x10000);
+			file_system_partition->base = ALIGN(firmware_partition->base + kernel_image->size, 0x10000);
 
 		file_system_partition->size = firmware_partition->size - file_system_partition->base;
 
 		os_image_partition->name = "os-image";
-		os_image_partition->size = kernel.st_size;
+		os_image_partition->size = kernel_image->size;
 	}
 
 	parts[0] = make_partition_table(info->partitions);
@@ -2909,23 +3081,17 @@ static void build_image(const char *output,
 			sizeof(extra_para));
 	}
 
-	size_t len;
-	void *image;
+	struct image_chunks chunks = {};
+	void *header = NULL;
 	if (sysupgrade)
-		image = generate_sysupgrade_image(info, parts, &len);
+		generate_sysupgrade_image(info, parts, &chunks);
 	else
-		image = generate_factory_image(info, parts, &len);
+		header = generate_factory_image(info, parts, &chunks);
 
-	FILE *file = fopen(output, "wb");
-	if (!file)
-		error(1, errno, "unable to open output file");
-
-	if (fwrite(image, len, 1, file) != 1)
-		error(1, 0, "unable to write output file");
+	chunks_write(&chunks, output);
 
-	fclose(file);
-
-	free(image);
+	free(chunks.iov);
+	free(header);
 
 	for (i = 0; parts[i].name; i++)
 		free_image_partition(parts[i]);
@@ -2940,13 +3106,16 @@ static void usage(const char *argv0) {
 		"  -h              show this help\n"
 		"\n"
 		"Create a new image:\n"
-		"  -B <board>      create image for the board specified with <board>\n"
+		"  -B <board>      create image for the board specified with <board>, several\n"
+		"                  comma separated boards may be given if -o contains %%s\n"
 		"  -k <file>       read kernel image from the file <file>\n"
 		"  -r <file>       read rootfs image from the file <file>\n"
-		"  -o <file>       write output to the file <file>\n"
+		"  -o <file>       write output to the file <file>, %%s is replaced by the board\n"
 		"  -V <rev>        sets the revision number to <rev>\n"
 		"  -j              add jffs2 end-of-filesystem markers\n"
 		"  -S              create sysupgrade instead of factory image\n"
+		"  -b <file> [<n>] run once per line of the manifest <file>, each line holding\n"
+		"                  the options above, with up to <n> runs in parallel\n"
 		"Extract an old image:\n"
 		"  -x <file>       extract all oem firmware partition\n"
 		"  -d <dir>        destination to extract the firmware partition\n"
@@ -2956,6 +3125,24 @@ static void usage(const char *argv0) {
 };
 
 
+/** Returns the output filename for a board, with %s replaced by its id */
+static char *board_output(const char *output, const char *id)
+{
+	const char *p = strstr(output, "%s");
+	char *file;
+
+	if (!p)
+		return strdup(output);
+
+	file = malloc(strlen(output) + strlen(id) - 1);
+	if (!file)
+		error(1, errno, "malloc");
+
+	sprintf(file, "%.*s%s%s", (int)(p - output), output, id, p + 2);
+
+	return file;
+}
+
 static struct device_info *find_board(const char *id)
 {
 	struct device_info *board = NULL;
@@ -3285,7 +3472,23 @@ static void convert_firmware(const char *input, const char *output)
 	fclose(input_file);
 }
 
-int main(int argc, char *argv[]) {
+#define OPTIONS "B:k:r:o:V:jSh:x:d:z:"
+
+/** Maps the kernel and rootfs of a batch line before the runs are forked */
+static int prepare_batch(int argc, char *argv[]) {
+	int c;
+
+	while ((c = getopt(argc, argv, OPTIONS)) != -1) {
+		if (c == 'k' || c == 'r')
+			cache_input(optarg);
+		else if (c == '?')
+			return 1;
+	}
+
+	return 0;
+}
+
+static int safeloader_main(int argc, char *argv[]) {
 	const char *board = NULL, *kernel_image = NULL, *rootfs_image = NULL, *output = NULL;
 	const char *extract_image = NULL, *output_directory = NULL, *convert_image = NULL;
 	bool add_jffs2_eof = false, sysupgrade = false;
@@ -3296,7 +3499,7 @@ int main(int argc, char *argv[]) {
 	while (true) {
 		int c;
 
-		c = getopt(argc, argv, "B:k:r:o:V:jSh:x:d:z:");
+		c = getopt(argc, argv, OPTIONS);
 		if (c == -1)
 			break;
 
@@ -3362,6 +3565,9 @@ int main(int argc, char *argv[]) {
 			error(1, 0, "Can not convert a factory/oem image into sysupgrade image without output file. Use -o <file>");
 		convert_firmware(convert_image, output);
 	} else {
+		struct input_file kernel, rootfs;
+		char *boards, *id, *saveptr;
+
 		if (!board)
 			error(1, 0, "no board has been specified");
 		if (!kernel_image)
@@ -3370,14 +3576,38 @@ int main(int argc, char *argv[]) {
 			error(1, 0, "no rootfs image has been specified");
 		if (!output)
 			error(1, 0, "no output filename has been specified");
+		if (strchr(board, ',') && !strstr(output, "%s"))
+			error(1, 0, "output filename must contain %%s to build several boards");
+
+		/* Check all boards before building any image */
+		boards = strdup(board);
+		for (id = strtok_r(boards, ",", &saveptr); id; id = strtok_r(NULL, ",", &saveptr)) {
+			if (find_board(id) == NULL)
+				error(1, 0, "unsupported board %s", id);
+		}
+		free(boards);
 
-		info = find_board(board);
+		/* The inputs are shared by all boards */
+		map_input(&kernel, kernel_image);
+		map_input(&rootfs, rootfs_image);
 
-		if (info == NULL)
-			error(1, 0, "unsupported board %s", board);
+		boards = strdup(board);
+		for (id = strtok_r(boards, ",", &saveptr); id; id = strtok_r(NULL, ",", &saveptr)) {
+			char *file = board_output(output, id);
+
+			info = find_board(id);
+			build_image(file, &kernel, &rootfs, rev, add_jffs2_eof, sysupgrade, info);
+			free(file);
+		}
+		free(boards);
 
-		build_image(output, kernel_image, rootfs_image, rev, add_jffs2_eof, sysupgrade, info);
+		unmap_input(&kernel);
+		unmap_input(&rootfs);
 	}
 
 	return 0;
 }
+
+int main(int argc, char *argv[]) {
+	return batch_main(argc, argv, safeloader_main, prepare_batch);
+}
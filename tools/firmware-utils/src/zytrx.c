@@ -26,33 +26,7 @@
 #include <netinet/in.h>
 #include <inttypes.h>
 
-#define BPB 8 /* bits/byte */
-
-static uint32_t crc32[1<<BPB];
-
-static void init_crc32(void)
-{
-	const uint32_t poly = ntohl(0x2083b8ed);
-	int n;
-
-	for (n = 0; n < 1<<BPB; n++) {
-		uint32_t crc = n;
-		int bit;
-
-		for (bit = 0; bit < BPB; bit++)
-			crc = (crc & 1) ? (poly ^ (crc >> 1)) : (crc >> 1);
-		crc32[n] = crc;
-	}
-}
-
-static uint32_t crc32buf(const unsigned char *buf, size_t len)
-{
-	uint32_t crc = 0xFFFFFFFF;
-
-	for (; len; len--, buf++)
-		crc = crc32[(uint8_t)crc ^ *buf] ^ (crc >> BPB);
-	return ~crc;
-}
+#include "crc32.h"
 
 /* HDR0 reversed, to be stored as BE */
 #define MAGIC		0x30524448  /* HDR0 reversed, to be stored as BE */
@@ -209,10 +183,9 @@ int main(int argc, char **argv)
 	h.len_p = htonl(file_len);
 
 	/* crc fields */
-	init_crc32();
-	crc = crc32buf(input_file, file_len);
+	crc = crc32_buf(input_file, file_len);
 	h.crc32_p = htonl(~crc);
-	crc = crc32buf((unsigned char *)&h, sizeof(h));
+	crc = crc32_buf(&h, sizeof(h));
 	h.crc32_h = htonl(~crc);
 
 	/* dump new image */
@@ -0,0 +1,396 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Binary BCH encoder/decoder over GF(2^m)
+ *
+ * A plain textbook implementation: systematic encoding with a byte-wise
+ * LFSR, syndromes from the remainder, Berlekamp-Massey and a Chien search.
+ * The code is shortened to the length of the data passed in. Bits are fed
+ * LSB first, and the parity is stored LSB first so that a partial last
+ * parity byte uses its low bits, as the MediaTek ECC engine does.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bch.h"
+
+/* Primitive polynomials for m = 5 ... 15 */
+static const uint32_t prim_poly[] = {
+	0x25, 0x43, 0x83, 0x11d, 0x211, 0x409, 0x805, 0x1053, 0x201b, 0x402b,
+	0x8003
+};
+
+static inline uint16_t gf_mul(const struct bch *bch, uint16_t a, uint16_t b)
+{
+	if (!a || !b)
+		return 0;
+
+	return bch->exp[bch->log[a] + bch->log[b]];
+}
+
+static inline uint16_t gf_div(const struct bch *bch, uint16_t a, uint16_t b)
+{
+	if (!a)
+		return 0;
+
+	return bch->exp[bch->log[a] + bch->n - bch->log[b]];
+}
+
+static int bch_init_gf(struct bch *bch)
+{
+	uint32_t i, x = 1;
+
+	bch->exp = calloc(2 * bch->n + 1, sizeof(*bch->exp));
+	bch->log = calloc(bch->n + 1, sizeof(*bch->log));
+	if (!bch->exp || !bch->log)
+		return -1;
+
+	for (i = 0; i < bch->n; i++) {
+		bch->exp[i] = x;
+		bch->exp[i + bch->n] = x;
+		bch->log[x] = i;
+
+		x <<= 1;
+		if (x & (1 << bch->m))
+			x ^= prim_poly[bch->m - 5];
+	}
+
+	bch->exp[2 * bch->n] = bch->exp[0];
+
+	return 0;
+}
+
+/* Product of the minimal polynomials of alpha^1 ... alpha^2t */
+static int bch_init_gen(struct bch *bch, uint8_t *g)
+{
+	uint16_t mp[16];
+	uint32_t i, j, k, d, deg = 0;
+	uint8_t *prod;
+	bool *done;
+	int ret = -1;
+
+	done = calloc(bch->n, sizeof(*done));
+	prod = calloc(bch->m * bch->t + 1, 1);
+	if (!done || !prod)
+		goto out;
+
+	g[0] = 1;
+
+	for (i = 1; i < 2 * bch->t; i += 2) {
+		if (done[i])
+			continue;
+
+		mp[0] = 1;
+		d = 0;
+		k = i;
+
+		do {
+			done[k] = true;
+
+			/* mp *= (x + alpha^k) */
+			mp[d + 1] = 0;
+			for (j = d + 1; j > 0; j--)
+				mp[j] = mp[j - 1] ^ gf_mul(bch, mp[j], bch->exp[k]);
+			mp[0] = gf_mul(bch, mp[0], bch->exp[k]);
+			d++;
+
+			k = (2 * k) % bch->n;
+		} while (k != i);
+
+		if (deg + d > bch->m * bch->t)
+			goto out;
+
+		memset(prod, 0, deg + d + 1);
+		for (j = 0; j <= d; j++) {
+			if (mp[j] > 1)
+				goto out;
+
+			if (!mp[j])
+				continue;
+
+			for (k = 0; k <= deg; k++)
+				prod[j + k] ^= g[k];
+		}
+
+		deg += d;
+		memcpy(g, prod, deg + 1);
+	}
+
+	bch->ecc_bits = deg;
+	ret = 0;
+
+out:
+	free(done);
+	free(prod);
+	return ret;
+}
+
+static inline void bch_shr(uint64_t *r, uint32_t words, uint32_t bits)
+{
+	uint32_t w;
+
+	for (w = 0; w < words - 1; w++)
+		r[w] = (r[w] >> bits) | (r[w + 1] << (64 - bits));
+	r[words - 1] >>= bits;
+}
+
+struct bch *bch_init(uint32_t m, uint32_t t)
+{
+	uint64_t *grev = NULL, *r;
+	uint32_t i, v, w, words;
+	struct bch *bch;
+	uint8_t *g = NULL;
+
+	if (m < 5 || m > 15 || !t || m * t >= (1U << m))
+		return NULL;
+
+	bch = calloc(1, sizeof(*bch));
+	if (!bch)
+		return NULL;
+
+	bch->m = m;
+	bch->t = t;
+	bch->n = (1 << m) - 1;
+
+	words = (m * t + 63) / 64;
+	bch->words = words;
+
+	g = calloc(m * t + 1, 1);
+	grev = calloc(words, sizeof(*grev));
+	bch->tab = calloc(256 * words, sizeof(*bch->tab));
+	bch->rem = calloc(words, sizeof(*bch->rem));
+	bch->syn = calloc(2 * t + 1, sizeof(*bch->syn));
+	bch->lambda = calloc(2 * t + 1, sizeof(*bch->lambda));
+	bch->prev = calloc(2 * t + 1, sizeof(*bch->prev));
+	bch->tmp = calloc(2 * t + 1, sizeof(*bch->tmp));
+	bch->errloc = calloc(t, sizeof(*bch->errloc));
+	if (!g || !grev || !bch->tab || !bch->rem || !bch->syn ||
+	    !bch->lambda || !bch->prev || !bch->tmp || !bch->errloc)
+		goto err;
+
+	if (bch_init_gf(bch) || bch_init_gen(bch, g))
+		goto err;
+
+	/* The byte-wise LFSR below needs at least 8 bits of remainder */
+	if (bch->ecc_bits < 8)
+		goto err;
+
+	/* Register bit i holds the coefficient of x^(ecc_bits - 1 - i) */
+	for (i = 0; i < bch->ecc_bits; i++) {
+		if (g[bch->ecc_bits - 1 - i])
+			grev[i / 64] |= 1ULL << (i % 64);
+	}
+
+	for (v = 0; v < 256; v++) {
+		r = bch->tab + v * words;
+		r[0] = v;
+
+		for (i = 0; i < 8; i++) {
+			bool fb = r[0] & 1;
+
+			bch_shr(r, words, 1);
+			if (fb) {
+				for (w = 0; w < words; w++)
+					r[w] ^= grev[w];
+			}
+		}
+	}
+
+	free(g);
+	free(grev);
+
+	return bch;
+
+err:
+	free(g);
+	free(grev);
+	bch_free(bch);
+	return NULL;
+}
+
+void bch_free(struct bch *bch)
+{
+	if (!bch)
+		return;
+
+	free(bch->exp);
+	free(bch->log);
+	free(bch->tab);
+	free(bch->rem);
+	free(bch->syn);
+	free(bch->lambda);
+	free(bch->prev);
+	free(bch->tmp);
+	free(bch->errloc);
+	free(bch);
+}
+
+static void bch_remainder(const struct bch *bch, const uint8_t *data,
+			  uint32_t len, uint64_t *r)
+{
+	uint32_t w, words = bch->words;
+	const uint64_t *t;
+
+	memset(r, 0, words * sizeof(*r));
+
+	while (len--) {
+		t = bch->tab + ((r[0] ^ *data++) & 0xff) * words;
+
+		for (w = 0; w < words - 1; w++)
+			r[w] = ((r[w] >> 8) | (r[w + 1] << 56)) ^ t[w];
+		r[words - 1] = (r[words - 1] >> 8) ^ t[words - 1];
+	}
+}
+
+void bch_encode(struct bch *bch, const uint8_t *data, uint32_t len,
+		uint8_t *ecc)
+{
+	uint32_t i;
+
+	bch_remainder(bch, data, len, bch->rem);
+
+	for (i = 0; i < (bch->ecc_bits + 7) / 8; i++)
+		ecc[i] = bch->rem[i / 8] >> ((i % 8) * 8);
+}
+
+static void bch_syndromes(struct bch *bch)
+{
+	uint32_t i, j, pw, t2 = 2 * bch->t;
+	uint64_t word;
+
+	memset(bch->syn, 0, (t2 + 1) * sizeof(*bch->syn));
+
+	for (i = 0; i < bch->ecc_bits; i++) {
+		word = bch->rem[i / 64];
+		if (!(word >> (i % 64) & 1))
+			continue;
+
+		pw = bch->ecc_bits - 1 - i;
+		for (j = 1; j <= t2; j += 2)
+			bch->syn[j] ^= bch->exp[(j * pw) % bch->n];
+	}
+
+	for (j = 2; j <= t2; j += 2)
+		bch->syn[j] = gf_mul(bch, bch->syn[j / 2], bch->syn[j / 2]);
+}
+
+/* Returns the degree of the error locator polynomial */
+static uint32_t bch_berlekamp_massey(struct bch *bch)
+{
+	uint32_t i, r, k = 1, l = 0, t2 = 2 * bch->t;
+	uint16_t d, b = 1, coef;
+	size_t size = (t2 + 1) * sizeof(uint16_t);
+
+	memset(bch->lambda, 0, size);
+	memset(bch->prev, 0, size);
+	bch->lambda[0] = 1;
+	bch->prev[0] = 1;
+
+	for (r = 0; r < t2; r++) {
+		d = bch->syn[r + 1];
+		for (i = 1; i <= l; i++)
+			d ^= gf_mul(bch, bch->lambda[i], bch->syn[r + 1 - i]);
+
+		if (!d) {
+			k++;
+			continue;
+		}
+
+		coef = gf_div(bch, d, b);
+		memcpy(bch->tmp, bch->lambda, size);
+
+		for (i = 0; i + k <= t2; i++)
+			bch->lambda[i + k] ^= gf_mul(bch, coef, bch->prev[i]);
+
+		if (2 * l <= r) {
+			l = r + 1 - l;
+			memcpy(bch->prev, bch->tmp, size);
+			b = d;
+			k = 1;
+		} else {
+			k++;
+		}
+	}
+
+	return l;
+}
+
+/* Finds the roots of lambda at alpha^-p for the p within the codeword */
+static uint32_t bch_chien_search(struct bch *bch, uint32_t l, uint32_t nbits)
+{
+	uint16_t *lg = bch->tmp;
+	uint32_t i, p, found = 0;
+	uint16_t sum;
+
+	for (i = 1; i <= l; i++)
+		lg[i] = bch->lambda[i] ? bch->log[bch->lambda[i]] : 0xffff;
+
+	for (p = 0; p < nbits; p++) {
+		sum = bch->lambda[0];
+
+		for (i = 1; i <= l; i++) {
+			if (lg[i] == 0xffff)
+				continue;
+
+			sum ^= bch->exp[lg[i]];
+
+			lg[i] += bch->n - i;
+			if (lg[i] >= bch->n)
+				lg[i] -= bch->n;
+		}
+
+		if (sum)
+			continue;
+
+		if (found == l)
+			return l + 1;
+
+		bch->errloc[found++] = p;
+	}
+
+	return found;
+}
+
+int bch_decode(struct bch *bch, uint8_t *data, uint32_t len, uint8_t *ecc)
+{
+	uint32_t i, l, s, nbits = len * 8 + bch->ecc_bits;
+	uint64_t diff = 0;
+
+	if (nbits > bch->n)
+		return -1;
+
+	bch_remainder(bch, data, len, bch->rem);
+
+	/* Remainder of the received codeword */
+	for (i = 0; i < bch->ecc_bits; i++) {
+		if (ecc[i / 8] >> (i % 8) & 1)
+			bch->rem[i / 64] ^= 1ULL << (i % 64);
+	}
+
+	for (i = 0; i < bch->words; i++)
+		diff |= bch->rem[i];
+
+	if (!diff)
+		return 0;
+
+	bch_syndromes(bch);
+
+	l = bch_berlekamp_massey(bch);
+	if (!l || l > bch->t)
+		return -1;
+
+	if (bch_chien_search(bch, l, nbits) != l)
+		return -1;
+
+	for (i = 0; i < l; i++) {
+		s = nbits - 1 - bch->errloc[i];
+
+		if (s < len * 8)
+			data[s / 8] ^= 1 << (s % 8);
+		else
+			ecc[(s - len * 8) / 8] ^= 1 << ((s - len * 8) % 8);
+	}
+
+	return l;
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Binary BCH encoder/decoder over GF(2^m)
+ */
+
+#ifndef _BCH_H_
+#define _BCH_H_
+
+#include <stdint.h>
+
+struct bch {
+	uint32_t m;		/* GF(2^m) */
+	uint32_t t;		/* correctable bits */
+	uint32_t n;		/* 2^m - 1 */
+	uint32_t ecc_bits;	/* degree of the generator polynomial */
+	uint32_t words;		/* 64-bit words of the remainder */
+
+	uint16_t *exp;
+	uint16_t *log;
+	uint64_t *tab;		/* byte-wise remainder table, 256 * words */
+
+	/* decoder scratch */
+	uint64_t *rem;
+	uint16_t *syn;
+	uint16_t *lambda;
+	uint16_t *prev;
+	uint16_t *tmp;
+	uint32_t *errloc;
+};
+
+struct bch *bch_init(uint32_t m, uint32_t t);
+void bch_free(struct bch *bch);
+
+/* Parity is stored LSB first, (ecc_bits + 7) / 8 bytes */
+void bch_encode(struct bch *bch, const uint8_t *data, uint32_t len,
+		uint8_t *ecc);
+
+/*
+ * Corrects data and parity in place. Returns the number of corrected bits,
+ * or -1 if the errors are not correctable.
+ */
+int bch_decode(struct bch *bch, uint8_t *data, uint32_t len, uint8_t *ecc);
+
+#endif /* _BCH_H_ */
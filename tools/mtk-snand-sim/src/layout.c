@@ -0,0 +1,799 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Page format and raw layout checks for the MediaTek SPI-NAND driver
+ *
+ * mtk-snand.c is included rather than linked so that its static page format
+ * and raw layout helpers can be called directly. Expected values come from
+ * a model written from the NFI and ECC register descriptions, not from the
+ * driver. Pages written with ECC are checked against a software BCH code of
+ * the strength the model selects.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "mtk-snand.c"
+
+#include "bch.h"
+#include "layout.h"
+
+#define MODEL_FDM_SIZE			8
+#define MODEL_FDM_ECC_SIZE		1
+
+#define MODEL_ECC_ENCCNFG		0x004
+#define MODEL_ECC_DECCNFG		0x104
+
+struct model_soc {
+	uint32_t sector_size;
+	uint32_t max_sectors;
+	uint32_t page_sizes[4];		/* NFI_PAGE_SIZE index */
+	uint32_t spare_shift;
+	const uint8_t *spare_sizes;	/* NFI_SPARE_SIZE index */
+	uint32_t num_spare_sizes;
+	uint32_t max_strength;		/* ECC capabilities are 4, 6, 8, ... */
+	uint32_t ecc_mode_shift;
+	bool bbm_swap;
+};
+
+static const uint8_t model_spare_sizes_v1[] = { 16, 26, 27, 28 };
+
+/* Not sorted, 61 is above 62 */
+static const uint8_t model_spare_sizes_v2[] = {
+	16, 26, 27, 28, 32, 36, 40, 44, 48, 49, 50, 51, 52, 62, 61, 63, 64,
+	67, 74
+};
+
+static const struct model_soc model_socs[__SNAND_SOC_MAX] = {
+	[SNAND_SOC_MT7622] = {
+		.sector_size = 512,
+		.max_sectors = 8,
+		.page_sizes = { 512, 2048, 4096, 8192 },
+		.spare_shift = 4,
+		.spare_sizes = model_spare_sizes_v1,
+		.num_spare_sizes = ARRAY_SIZE(model_spare_sizes_v1),
+		.max_strength = 12,
+		.ecc_mode_shift = 4,
+		.bbm_swap = false,
+	},
+	[SNAND_SOC_MT7629] = {
+		.sector_size = 512,
+		.max_sectors = 8,
+		.page_sizes = { 512, 2048, 4096, 8192 },
+		.spare_shift = 4,
+		.spare_sizes = model_spare_sizes_v1,
+		.num_spare_sizes = ARRAY_SIZE(model_spare_sizes_v1),
+		.max_strength = 12,
+		.ecc_mode_shift = 4,
+		.bbm_swap = true,
+	},
+	[SNAND_SOC_MT7981] = {
+		.sector_size = 1024,
+		.max_sectors = 16,
+		.page_sizes = { 2048, 4096, 8192, 16384 },
+		.spare_shift = 16,
+		.spare_sizes = model_spare_sizes_v2,
+		.num_spare_sizes = ARRAY_SIZE(model_spare_sizes_v2),
+		.max_strength = 24,
+		.ecc_mode_shift = 5,
+		.bbm_swap = true,
+	},
+	[SNAND_SOC_MT7986] = {
+		.sector_size = 1024,
+		.max_sectors = 16,
+		.page_sizes = { 2048, 4096, 8192, 16384 },
+		.spare_shift = 16,
+		.spare_sizes = model_spare_sizes_v2,
+		.num_spare_sizes = ARRAY_SIZE(model_spare_sizes_v2),
+		.max_strength = 24,
+		.ecc_mode_shift = 5,
+		.bbm_swap = true,
+	},
+};
+
+static const char *const layout_soc_names[__SNAND_SOC_MAX] = {
+	[SNAND_SOC_MT7622] = "mt7622",
+	[SNAND_SOC_MT7629] = "mt7629",
+	[SNAND_SOC_MT7981] = "mt7981",
+	[SNAND_SOC_MT7986] = "mt7986",
+};
+
+/* One chip of every page geometry in mtk-snand-ids.c, the largest last */
+static const uint8_t layout_chips[][4] = {
+	{ 0xef, 0xaa, 0x21 },		/* 2K+64 */
+	{ 0xd5, 0x11 },			/* 2K+120 */
+	{ 0x2c, 0x14 },			/* 2K+128 */
+	{ 0xd5, 0x23 },			/* 4K+240 */
+	{ 0xd5, 0x0b },			/* 4K+256 */
+};
+
+struct model_fmt {
+	uint32_t steps;
+	uint32_t spare_per_sector;
+	uint32_t raw_sector_size;
+	uint32_t parity_bits;
+	uint32_t strength;
+	uint32_t ecc_bytes;
+	uint32_t pagefmt;
+	uint32_t enccnfg;
+	uint32_t deccnfg;
+};
+
+struct layout {
+	struct snfi_sim sim;
+	struct mtk_snand_plat_dev pdev;
+	struct mtk_snand *snf;
+	const struct snand_flash_info *info;
+	uint64_t rng;
+
+	uint8_t *buf;
+	uint8_t *oob;
+	uint8_t *rbuf;
+	uint8_t *roob;
+	uint8_t *img;
+	uint8_t *rimg;
+
+	uint32_t formats;
+	uint32_t checks;
+	uint32_t failures;
+};
+
+static int model_format(enum mtk_snand_soc soc, uint32_t pagesize,
+			uint32_t sparesize, struct model_fmt *mf)
+{
+	const struct model_soc *ms = &model_socs[soc];
+	uint32_t i, mul, per, best = 0, spare_idx = 0, page_idx, msg, cap;
+
+	for (page_idx = 0; page_idx < ARRAY_SIZE(ms->page_sizes); page_idx++) {
+		if (ms->page_sizes[page_idx] == pagesize)
+			break;
+	}
+
+	if (page_idx == ARRAY_SIZE(ms->page_sizes))
+		return -ENOTSUPP;
+
+	mf->steps = pagesize / ms->sector_size;
+	if (!mf->steps || mf->steps > ms->max_sectors)
+		return -ENOTSUPP;
+
+	/* The spare size field counts per 512 bytes of sector */
+	mul = ms->sector_size / 512;
+	per = sparesize / mf->steps / mul;
+
+	for (i = 0; i < ms->num_spare_sizes; i++) {
+		if (ms->spare_sizes[i] <= per && ms->spare_sizes[i] > best) {
+			best = ms->spare_sizes[i];
+			spare_idx = i;
+		}
+	}
+
+	if (!best)
+		return -ENOTSUPP;
+
+	mf->spare_per_sector = best * mul;
+	mf->raw_sector_size = ms->sector_size + mf->spare_per_sector;
+
+	msg = ms->sector_size + MODEL_FDM_ECC_SIZE;
+	mf->parity_bits = fls(1 + 8 * msg);
+
+	for (cap = ms->max_strength; cap >= 4; cap -= 2) {
+		if (cap * mf->parity_bits <=
+		    (mf->spare_per_sector - MODEL_FDM_SIZE) * 8)
+			break;
+	}
+
+	if (cap < 4)
+		return -ENOTSUPP;
+
+	mf->strength = cap;
+	mf->ecc_bytes = DIV_ROUND_UP(cap * mf->parity_bits, 8);
+
+	mf->pagefmt = (MODEL_FDM_ECC_SIZE << 12) | (MODEL_FDM_SIZE << 8) |
+		      (spare_idx << ms->spare_shift) | page_idx |
+		      (ms->sector_size == 512 ? BIT(2) : 0);
+
+	mf->enccnfg = (msg * 8 << 16) | (1 << ms->ecc_mode_shift) |
+		      (cap - 4) / 2;
+
+	mf->deccnfg = BIT(31) | ((msg * 8 + cap * mf->parity_bits) << 16) |
+		      (3 << 12) | (1 << ms->ecc_mode_shift) | (cap - 4) / 2;
+
+	return 0;
+}
+
+/*
+ * Raw page as stored on flash. With bbm_swap the marker byte of the first
+ * FDM goes to the first spare byte of the page, the data byte stored there
+ * to the first byte of the last FDM, and that byte to the first FDM.
+ */
+static void model_raw_image(struct layout *l, const struct model_fmt *mf,
+			    const uint8_t *buf, const uint8_t *oob,
+			    bool empty_ecc, uint8_t *img)
+{
+	const struct model_soc *ms = &model_socs[l->snf->soc];
+	uint32_t i, ecc_bytes = mf->spare_per_sector - MODEL_FDM_SIZE;
+	uint32_t fdm0, fdml, w = l->snf->writesize;
+	uint8_t *sect, bbm;
+
+	memset(img, 0xff, w + l->snf->oobsize);
+
+	for (i = 0; i < mf->steps; i++) {
+		sect = img + i * mf->raw_sector_size;
+
+		if (buf)
+			memcpy(sect, buf + i * ms->sector_size,
+			       ms->sector_size);
+
+		if (!oob)
+			continue;
+
+		memcpy(sect + ms->sector_size, oob + i * MODEL_FDM_SIZE,
+		       MODEL_FDM_SIZE);
+
+		if (!empty_ecc)
+			memcpy(sect + ms->sector_size + MODEL_FDM_SIZE,
+			       oob + mf->steps * MODEL_FDM_SIZE + i * ecc_bytes,
+			       ecc_bytes);
+	}
+
+	if (!ms->bbm_swap || mf->steps == 1)
+		return;
+
+	fdm0 = ms->sector_size;
+	fdml = (mf->steps - 1) * mf->raw_sector_size + ms->sector_size;
+
+	bbm = img[fdm0];
+	img[fdm0] = img[fdml];
+	img[fdml] = img[w];
+	img[w] = bbm;
+}
+
+static void layout_fill(struct layout *l, uint8_t *buf, uint32_t len)
+{
+	uint64_t x = l->rng;
+	uint32_t i;
+
+	for (i = 0; i < len; i++) {
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		buf[i] = (x * 0x2545f4914f6cdd1dULL) >> 56;
+	}
+
+	l->rng = x;
+}
+
+static uint32_t layout_rand(struct layout *l, uint32_t n)
+{
+	uint8_t r[4];
+
+	layout_fill(l, r, sizeof(r));
+
+	return ((uint32_t)r[0] | r[1] << 8 | r[2] << 16 |
+		(uint32_t)r[3] << 24) % n;
+}
+
+static bool layout_check(struct layout *l, bool ok, const char *fmt, ...)
+{
+	va_list ap;
+
+	l->checks++;
+
+	if (ok)
+		return true;
+
+	l->failures++;
+
+	fprintf(stderr, "%s %u+%u: ", layout_soc_names[l->snf->soc],
+		l->snf->writesize, l->snf->oobsize);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	return false;
+}
+
+static int layout_open(struct layout *l, const struct snfi_sim_config *cfg,
+		       enum mtk_snand_soc soc, const uint8_t *id)
+{
+	struct mtk_snand_platdata pdata = {};
+	struct snfi_sim_config c = *cfg;
+	size_t size;
+	int ret;
+
+	memset(l, 0, sizeof(*l));
+	l->rng = cfg->seed ? cfg->seed : 1;
+
+	l->info = snand_flash_id_lookup(SNAND_ID_DYMMY, id);
+	if (!l->info)
+		return -EINVAL;
+
+	memcpy(c.id, id, sizeof(c.id));
+	c.pagesize = l->info->memorg.pagesize;
+	c.sparesize = l->info->memorg.sparesize;
+	c.pages_per_block = l->info->memorg.pages_per_block;
+	c.blocks_per_die = l->info->memorg.blocks_per_die;
+	c.ndies = l->info->memorg.ndies;
+	c.soc = soc;
+	c.bitflip_ppm = 0;
+
+	ret = snfi_sim_init(&l->sim, &c);
+	if (ret)
+		return ret;
+
+	l->pdev.sim = &l->sim;
+
+	pdata.nfi_base = l->sim.nfi_regs;
+	pdata.ecc_base = l->sim.ecc_regs;
+	pdata.soc = soc;
+
+	ret = mtk_snand_init(&l->pdev, &pdata, &l->snf);
+	if (ret) {
+		snfi_sim_cleanup(&l->sim);
+		return ret;
+	}
+
+	size = c.pagesize + c.sparesize;
+	l->buf = malloc(size);
+	l->oob = malloc(size);
+	l->rbuf = malloc(size);
+	l->roob = malloc(size);
+	l->img = malloc(size);
+	l->rimg = malloc(size);
+	if (!l->buf || !l->oob || !l->rbuf || !l->roob || !l->img || !l->rimg)
+		return -ENOMEM;
+
+	return 0;
+}
+
+static void layout_close(struct layout *l)
+{
+	if (l->snf)
+		mtk_snand_cleanup(l->snf);
+
+	snfi_sim_cleanup(&l->sim);
+
+	free(l->buf);
+	free(l->oob);
+	free(l->rbuf);
+	free(l->roob);
+	free(l->img);
+	free(l->rimg);
+}
+
+static void layout_check_raw(struct layout *l, const struct model_fmt *mf)
+{
+	static const struct {
+		bool buf;
+		bool oob;
+		bool empty_ecc;
+	} variants[] = {
+		{ true, true, false },
+		{ true, false, false },
+		{ false, true, false },
+		{ true, true, true },
+	};
+	struct mtk_snand *snf = l->snf;
+	uint32_t i, v, w = snf->writesize, sect = snf->nfi_soc->sector_size;
+	uint32_t fdm = snf->nfi_soc->fdm_size;
+	uint32_t rawlen = w + snf->oobsize;
+	const uint8_t *buf, *oob;
+
+	for (v = 0; v < ARRAY_SIZE(variants); v++) {
+		layout_fill(l, l->buf, w);
+		layout_fill(l, l->oob, snf->oobsize);
+
+		buf = variants[v].buf ? l->buf : NULL;
+		oob = variants[v].oob ? l->oob : NULL;
+
+		/* As mtk_snand_do_write_page() for raw, formatted writes */
+		mtk_snand_to_raw_page(snf, buf, oob, variants[v].empty_ecc);
+		mtk_snand_fdm_bm_swap_raw(snf);
+		mtk_snand_bm_swap_raw(snf);
+
+		model_raw_image(l, mf, buf, oob, variants[v].empty_ecc, l->img);
+
+		if (!layout_check(l, !memcmp(snf->page_cache, l->img, rawlen),
+				  "to_raw_page(%s, %s%s) mismatch\n",
+				  buf ? "buf" : "NULL", oob ? "oob" : "NULL",
+				  variants[v].empty_ecc ? ", empty_ecc" : ""))
+			continue;
+
+		if (!buf || !oob || variants[v].empty_ecc)
+			continue;
+
+		/* As mtk_snand_do_read_page() for raw, formatted reads */
+		memset(l->roob, 0xff, snf->oobsize);
+		mtk_snand_bm_swap_raw(snf);
+		mtk_snand_fdm_bm_swap_raw(snf);
+		mtk_snand_from_raw_page(snf, l->rbuf, l->roob);
+
+		layout_check(l, !memcmp(l->rbuf, buf, w) &&
+			     !memcmp(l->roob, oob, mf->steps * snf->spare_per_sector),
+			     "from_raw_page() mismatch\n");
+	}
+
+	/* ECC writes: the NFI interleaves data and FDM with AUTO_FMT */
+	layout_fill(l, l->buf, w);
+	layout_fill(l, l->oob, snf->oobsize);
+	model_raw_image(l, mf, l->buf, l->oob, false, l->img);
+
+	memset(snf->page_cache, 0xff, rawlen);
+	memcpy(snf->page_cache, l->buf, w);
+	memcpy(snf->page_cache + w, l->oob, mf->steps * fdm);
+
+	mtk_snand_fdm_bm_swap(snf);
+	mtk_snand_bm_swap(snf);
+
+	for (i = 0; i < mf->steps; i++) {
+		if (!layout_check(l, !memcmp(snf->page_cache + i * sect,
+					     l->img + i * mf->raw_sector_size,
+					     sect) &&
+				  !memcmp(snf->page_cache + w + i * fdm,
+					  l->img + i * mf->raw_sector_size + sect,
+					  fdm),
+				  "bm_swap() sector %u mismatch\n", i))
+			break;
+	}
+
+	mtk_snand_bm_swap(snf);
+	mtk_snand_fdm_bm_swap(snf);
+
+	layout_check(l, !memcmp(snf->page_cache, l->buf, w) &&
+		     !memcmp(snf->page_cache + w, l->oob, mf->steps * fdm),
+		     "bm_swap() is not its own inverse\n");
+}
+
+static bool layout_check_format(struct layout *l, uint32_t pagesize,
+				uint32_t sparesize, struct model_fmt *mf)
+{
+	const struct snand_flash_info *base = l->info;
+	const struct snand_flash_info info = {
+		.model = base->model,
+		.id = base->id,
+		.memorg = SNAND_MEMORG(pagesize, sparesize,
+				       base->memorg.pages_per_block,
+				       base->memorg.blocks_per_die,
+				       base->memorg.planes_per_die,
+				       base->memorg.ndies),
+		.cap_rd = base->cap_rd,
+		.cap_pl = base->cap_pl,
+		.select_die = base->select_die,
+		.flags = base->flags,
+	};
+	struct mtk_snand *snf = l->snf;
+	struct bch *bch;
+	int ret, expect;
+
+	l->formats++;
+
+	expect = model_format(snf->soc, pagesize, sparesize, mf);
+	ret = mtk_snand_setup(snf, &info);
+
+	/* Report against the geometry even if setup bailed out early */
+	snf->writesize = pagesize;
+	snf->oobsize = sparesize;
+
+	if (!layout_check(l, ret == expect, "setup returned %d, expected %d\n",
+			  ret, expect) || ret)
+		return false;
+
+	layout_check(l, snf->ecc_steps == mf->steps &&
+		     snf->spare_per_sector == mf->spare_per_sector &&
+		     snf->raw_sector_size == mf->raw_sector_size,
+		     "%u sectors of %u spare bytes, expected %u of %u\n",
+		     snf->ecc_steps, snf->spare_per_sector, mf->steps,
+		     mf->spare_per_sector);
+
+	layout_check(l, l->sim.nfi_regs[NFI_PAGEFMT / 4] == mf->pagefmt,
+		     "NFI_PAGEFMT %08x, expected %08x\n",
+		     l->sim.nfi_regs[NFI_PAGEFMT / 4], mf->pagefmt);
+
+	layout_check(l, snf->ecc_strength == mf->strength &&
+		     snf->ecc_bytes == mf->ecc_bytes,
+		     "ECC %u bits in %u bytes, expected %u in %u\n",
+		     snf->ecc_strength, snf->ecc_bytes, mf->strength,
+		     mf->ecc_bytes);
+
+	layout_check(l, l->sim.ecc_regs[MODEL_ECC_ENCCNFG / 4] == mf->enccnfg &&
+		     l->sim.ecc_regs[MODEL_ECC_DECCNFG / 4] == mf->deccnfg,
+		     "ECC_ENCCNFG/DECCNFG %08x/%08x, expected %08x/%08x\n",
+		     l->sim.ecc_regs[MODEL_ECC_ENCCNFG / 4],
+		     l->sim.ecc_regs[MODEL_ECC_DECCNFG / 4],
+		     mf->enccnfg, mf->deccnfg);
+
+	/* The BCH code of that strength must fit next to the FDM */
+	bch = bch_init(mf->parity_bits, mf->strength);
+	layout_check(l, bch && bch->ecc_bits <= snf->ecc_bytes * 8 &&
+		     snf->nfi_soc->fdm_size + snf->ecc_bytes <=
+		     snf->spare_per_sector,
+		     "no room for %u bit BCH parity\n",
+		     bch ? bch->ecc_bits : 0);
+	bch_free(bch);
+
+	layout_check_raw(l, mf);
+
+	return true;
+}
+
+static uint8_t *layout_flash_page(struct layout *l, uint64_t addr)
+{
+	uint64_t page = addr >> l->snf->writesize_shift;
+	uint32_t ba = page / l->sim.cfg.pages_per_block;
+	uint32_t pg = page % l->sim.cfg.pages_per_block;
+
+	if (!l->sim.blocks[ba])
+		return NULL;
+
+	return l->sim.blocks[ba] + (size_t)pg * l->sim.rawpage_size;
+}
+
+/* Flips distinct bits among the ECC protected bits of a raw sector */
+static void layout_flip(struct layout *l, const struct model_fmt *mf,
+			uint8_t *raw, uint32_t sect, uint32_t nbits,
+			bool data_only)
+{
+	uint32_t sector_size = l->snf->nfi_soc->sector_size;
+	uint32_t msg_bits = (sector_size + MODEL_FDM_ECC_SIZE) * 8;
+	uint32_t range = data_only ? sector_size * 8 :
+			 msg_bits + mf->strength * mf->parity_bits;
+	uint32_t i, j, bit, offs, flipped[32];
+	uint8_t *s = raw + sect * mf->raw_sector_size;
+
+	for (i = 0; i < nbits && i < ARRAY_SIZE(flipped); i++) {
+		do {
+			bit = layout_rand(l, range);
+			for (j = 0; j < i && flipped[j] != bit; j++)
+				;
+		} while (j < i);
+
+		flipped[i] = bit;
+
+		if (bit < msg_bits) {
+			offs = bit / 8;
+		} else {
+			bit -= msg_bits;
+			offs = sector_size + MODEL_FDM_SIZE + bit / 8;
+		}
+
+		s[offs] ^= 1 << (bit % 8);
+	}
+}
+
+static void layout_check_flash(struct layout *l, const struct model_fmt *mf)
+{
+	struct mtk_snand *snf = l->snf;
+	uint32_t i, j, w = snf->writesize, sect = snf->nfi_soc->sector_size;
+	uint32_t fdm = snf->nfi_soc->fdm_size;
+	uint32_t nflips, maxflips = 0, ecc_offs = mf->steps * fdm;
+	uint64_t addr = snf->erasesize;
+	uint8_t parity[64], *raw;
+	struct bch *bch;
+	bool match;
+	int ret;
+
+	bch = bch_init(mf->parity_bits, mf->strength);
+	if (!layout_check(l, !!bch, "BCH code not available\n"))
+		return;
+
+	layout_fill(l, l->buf, w);
+	layout_fill(l, l->oob, snf->oobsize);
+
+	mtk_snand_erase_block(snf, addr);
+
+	ret = mtk_snand_write_page(snf, addr, l->buf, l->oob, false);
+	if (!layout_check(l, !ret, "ECC write failed with %d\n", ret))
+		goto out;
+
+	/* Unformatted raw read returns the page as stored */
+	ret = mtk_snand_do_read_page(snf, addr, l->rimg, l->rimg + w, true,
+				     false);
+	if (!layout_check(l, !ret, "raw read failed with %d\n", ret))
+		goto out;
+
+	model_raw_image(l, mf, l->buf, l->oob, false, l->img);
+
+	for (i = 0; i < mf->steps; i++) {
+		const uint8_t *s = l->rimg + i * mf->raw_sector_size;
+
+		match = !memcmp(s, l->img + i * mf->raw_sector_size,
+				sect + fdm);
+
+		/* Parity over data and the ECC protected FDM bytes */
+		bch_encode(bch, s, sect + MODEL_FDM_ECC_SIZE, parity);
+		for (j = 0; j < bch->ecc_bits; j++) {
+			if ((parity[j / 8] ^ s[sect + fdm + j / 8]) >> (j % 8) & 1)
+				match = false;
+		}
+
+		layout_check(l, match, "raw sector %u does not match\n", i);
+	}
+
+	/* Formatted raw read splits data, FDM and parity */
+	ret = mtk_snand_read_page(snf, addr, l->rbuf, l->roob, true);
+	match = !ret && !memcmp(l->rbuf, l->buf, w) &&
+		!memcmp(l->roob, l->oob, ecc_offs);
+	for (i = 0; match && i < mf->steps; i++)
+		match = !memcmp(l->roob + ecc_offs + i * (mf->spare_per_sector - fdm),
+				l->rimg + i * mf->raw_sector_size + sect + fdm,
+				mf->spare_per_sector - fdm);
+	layout_check(l, match, "formatted raw read mismatch (%d)\n", ret);
+
+	/* Up to the ECC strength of bitflips per sector */
+	raw = layout_flash_page(l, addr);
+	for (i = 0; raw && i < mf->steps; i++) {
+		nflips = mf->strength - i % 3;
+		if (nflips > maxflips)
+			maxflips = nflips;
+
+		layout_flip(l, mf, raw, i, nflips, false);
+	}
+
+	ret = mtk_snand_read_page(snf, addr, l->rbuf, l->roob, false);
+	layout_check(l, ret == maxflips && !memcmp(l->rbuf, l->buf, w) &&
+		     !memcmp(l->roob, l->oob, ecc_offs),
+		     "ECC read with %u bitflips returned %d or wrong data\n",
+		     maxflips, ret);
+
+	/* Erased page with bitflips */
+	addr += w;
+	memset(l->buf, 0xff, w);
+	memset(l->oob, 0xff, snf->oobsize);
+	mtk_snand_write_page(snf, addr, l->buf, l->oob, false);
+
+	raw = layout_flash_page(l, addr);
+	for (i = 0; raw && i < mf->steps; i++)
+		layout_flip(l, mf, raw, i, maxflips, true);
+
+	ret = mtk_snand_read_page(snf, addr, l->rbuf, NULL, false);
+	layout_check(l, ret == maxflips && !memcmp(l->rbuf, l->buf, w),
+		     "erased read with %u bitflips returned %d or wrong data\n",
+		     maxflips, ret);
+
+out:
+	bch_free(bch);
+}
+
+int layout_verify(const struct snfi_sim_config *cfg)
+{
+	static const uint32_t page_sizes[] = { 512, 2048, 4096 };
+	const uint8_t *largest = layout_chips[ARRAY_SIZE(layout_chips) - 1];
+	uint32_t soc, i, ps, ss, rawmax, failures = 0;
+	struct model_fmt mf;
+	struct layout l;
+	int ret;
+
+	for (soc = 0; soc < __SNAND_SOC_MAX; soc++) {
+		uint32_t formats = 0, checks = 0;
+
+		/* Every geometry that fits the page cache of the largest chip */
+		ret = layout_open(&l, cfg, soc, largest);
+		if (ret) {
+			fprintf(stderr, "Failed to set up %s with %d\n",
+				layout_soc_names[soc], ret);
+			layout_close(&l);
+			return ret;
+		}
+
+		rawmax = l.info->memorg.pagesize + l.info->memorg.sparesize;
+		l.pdev.quiet = true;
+
+		for (i = 0; i < ARRAY_SIZE(page_sizes); i++) {
+			ps = page_sizes[i];
+			for (ss = 16; ss <= 256 && ps + ss <= rawmax; ss += 2)
+				layout_check_format(&l, ps, ss, &mf);
+		}
+
+		formats += l.formats;
+		checks += l.checks;
+		failures += l.failures + l.sim.stats.violations;
+		layout_close(&l);
+
+		/* Real chips, through the simulated flash */
+		for (i = 0; i < ARRAY_SIZE(layout_chips); i++) {
+			ret = layout_open(&l, cfg, soc, layout_chips[i]);
+			if (ret) {
+				layout_close(&l);
+				return ret;
+			}
+
+			if (layout_check_format(&l, l.info->memorg.pagesize,
+						l.info->memorg.sparesize, &mf))
+				layout_check_flash(&l, &mf);
+
+			formats += l.formats;
+			checks += l.checks;
+			failures += l.failures + l.sim.stats.violations;
+			layout_close(&l);
+		}
+
+		printf("%s: %u page formats, %u checks\n",
+		       layout_soc_names[soc], formats, checks);
+	}
+
+	printf("failures: %u\n", failures);
+
+	return failures ? -EIO : 0;
+}
+
+static uint64_t layout_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void layout_bench_print(struct layout *l, const char *op,
+			       uint32_t iterations, uint64_t ns)
+{
+	uint32_t bytes = l->snf->writesize + l->snf->oobsize;
+
+	printf("%-8s %-15s %-12s %10.1f %10.1f\n",
+	       layout_soc_names[l->snf->soc], l->info->model, op,
+	       (double)ns / iterations, (double)bytes * iterations * 1000 / ns);
+}
+
+int layout_bench(const struct snfi_sim_config *cfg, uint32_t iterations)
+{
+	static const uint8_t chips[][4] = {
+		{ 0x2c, 0x14 },		/* 2K+128 */
+		{ 0xd5, 0x0b },		/* 4K+256 */
+	};
+	struct mtk_snand *snf;
+	uint32_t soc, i, n;
+	volatile uint32_t empty = 0;
+	struct layout l;
+	uint64_t start;
+	int ret;
+
+	printf("%-8s %-15s %-12s %10s %10s\n", "soc", "chip", "operation",
+	       "ns/page", "MB/s");
+
+	for (soc = 0; soc < __SNAND_SOC_MAX; soc++) {
+		for (i = 0; i < ARRAY_SIZE(chips); i++) {
+			ret = layout_open(&l, cfg, soc, chips[i]);
+			if (ret) {
+				layout_close(&l);
+				return ret;
+			}
+
+			snf = l.snf;
+			layout_fill(&l, l.buf, snf->writesize);
+			layout_fill(&l, l.oob, snf->oobsize);
+
+			start = layout_ns();
+			for (n = 0; n < iterations; n++) {
+				mtk_snand_to_raw_page(snf, l.buf, l.oob, false);
+				mtk_snand_fdm_bm_swap_raw(snf);
+				mtk_snand_bm_swap_raw(snf);
+			}
+			layout_bench_print(&l, "to raw", iterations,
+					   layout_ns() - start);
+
+			start = layout_ns();
+			for (n = 0; n < iterations; n++) {
+				mtk_snand_bm_swap_raw(snf);
+				mtk_snand_fdm_bm_swap_raw(snf);
+				mtk_snand_from_raw_page(snf, l.rbuf, l.roob);
+			}
+			layout_bench_print(&l, "from raw", iterations,
+					   layout_ns() - start);
+
+			memset(l.buf, 0xff, snf->writesize);
+			memset(l.oob, 0xff, snf->oobsize);
+
+			start = layout_ns();
+			for (n = 0; n < iterations; n++)
+				empty += mtk_snand_is_empty_page(snf, l.buf,
+								 l.oob);
+			layout_bench_print(&l, "empty check", iterations,
+					   layout_ns() - start);
+
+			layout_close(&l);
+		}
+	}
+
+	return empty == __SNAND_SOC_MAX * ARRAY_SIZE(chips) * iterations ?
+	       0 : -EIO;
+}
@@ -0,0 +1,16 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Page format and raw layout checks for the MediaTek SPI-NAND driver
+ */
+
+#ifndef _LAYOUT_H_
+#define _LAYOUT_H_
+
+#include <stdint.h>
+
+#include "snfi-sim.h"
+
+int layout_verify(const struct snfi_sim_config *cfg);
+int layout_bench(const struct snfi_sim_config *cfg, uint32_t iterations);
+
+#endif /* _LAYOUT_H_ */
@@ -0,0 +1,192 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Host OS-dependent definitions for the MediaTek SPI-NAND driver
+ *
+ * Lets mtk-snand.c be built as a userspace program. Register accesses go to
+ * the simulated controller in snfi-sim.c, and all timing is taken from its
+ * simulated clock so that polling loops and timeouts behave like on
+ * hardware.
+ */
+
+#ifndef _MTK_SNAND_OS_H_
+#define _MTK_SNAND_OS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+
+#include "snfi-sim.h"
+
+#ifndef EBADMSG
+#define EBADMSG		74
+#endif
+
+#ifndef ENOTSUPP
+#define ENOTSUPP	524
+#endif
+
+#define __iomem
+
+#define BIT(nr)			(1U << (nr))
+#define GENMASK(h, l)		(((~0U) >> (31 - (h))) & ((~0U) << (l)))
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define BITS_PER_BYTE		8
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+
+#define SZ_512			0x00000200
+#define SZ_2K			0x00000800
+#define SZ_4K			0x00001000
+#define SZ_8K			0x00002000
+#define SZ_16K			0x00004000
+
+static inline int fls(int x)
+{
+	return x ? 32 - __builtin_clz(x) : 0;
+}
+
+static inline unsigned int hweight8(unsigned int w)
+{
+	return __builtin_popcount(w & 0xff);
+}
+
+static inline unsigned int hweight32(unsigned int w)
+{
+	return __builtin_popcount(w);
+}
+
+struct mtk_snand_plat_dev {
+	struct snfi_sim *sim;
+
+	/* Drop log messages, for probing geometries that are meant to fail */
+	bool quiet;
+};
+
+/* Register accessors */
+static inline uint32_t readl(const volatile void *addr)
+{
+	return snfi_sim_readl(addr);
+}
+
+static inline uint16_t readw(const volatile void *addr)
+{
+	return snfi_sim_readl(addr) & 0xffff;
+}
+
+static inline void writel(uint32_t val, volatile void *addr)
+{
+	snfi_sim_writel(val, addr);
+}
+
+static inline void writew(uint16_t val, volatile void *addr)
+{
+	snfi_sim_writel(val, addr);
+}
+
+/* Polling helpers, every register read advances the simulated clock */
+#define __sim_poll_timeout(rd, addr, val, cond, timeout_us) \
+({ \
+	uint64_t __tmo = snfi_sim_now() + (uint64_t)(timeout_us) * 1000; \
+	for (;;) { \
+		(val) = rd(addr); \
+		if (cond) \
+			break; \
+		if (snfi_sim_now() > __tmo) { \
+			(val) = rd(addr); \
+			break; \
+		} \
+	} \
+	(cond) ? 0 : -ETIMEDOUT; \
+})
+
+#define read16_poll_timeout(addr, val, cond, sleep_us, timeout_us) \
+	__sim_poll_timeout(readw, addr, val, cond, timeout_us)
+
+#define read32_poll_timeout(addr, val, cond, sleep_us, timeout_us) \
+	__sim_poll_timeout(readl, addr, val, cond, timeout_us)
+
+/* Timer helpers */
+#define mtk_snand_time_t uint64_t
+
+static inline mtk_snand_time_t timer_get_ticks(void)
+{
+	return snfi_sim_now();
+}
+
+static inline mtk_snand_time_t timer_time_to_tick(uint32_t timeout_us)
+{
+	return (uint64_t)timeout_us * 1000;
+}
+
+static inline bool timer_is_timeout(mtk_snand_time_t start_tick,
+				    mtk_snand_time_t timeout_tick)
+{
+	return snfi_sim_now() > start_tick + timeout_tick;
+}
+
+/* Memory helpers */
+static inline void *generic_mem_alloc(struct mtk_snand_plat_dev *pdev,
+				      size_t size)
+{
+	return calloc(1, size);
+}
+static inline void generic_mem_free(struct mtk_snand_plat_dev *pdev, void *ptr)
+{
+	free(ptr);
+}
+
+static inline void *dma_mem_alloc(struct mtk_snand_plat_dev *pdev, size_t size)
+{
+	return calloc(1, size);
+}
+static inline void dma_mem_free(struct mtk_snand_plat_dev *pdev, void *ptr)
+{
+	free(ptr);
+}
+
+static inline int dma_mem_map(struct mtk_snand_plat_dev *pdev, void *vaddr,
+			      uintptr_t *dma_addr, size_t size, bool to_device)
+{
+	uint32_t bus;
+	int ret;
+
+	ret = snfi_sim_dma_map(pdev->sim, vaddr, size, &bus);
+	if (ret)
+		return ret;
+
+	*dma_addr = bus;
+
+	return 0;
+}
+
+static inline void dma_mem_unmap(struct mtk_snand_plat_dev *pdev,
+				 uintptr_t dma_addr, size_t size,
+				 bool to_device)
+{
+	snfi_sim_dma_unmap(pdev->sim, dma_addr);
+}
+
+/* Interrupt helpers, completion is polled from the status register */
+static inline void irq_completion_done(struct mtk_snand_plat_dev *pdev)
+{
+}
+
+static inline void irq_completion_init(struct mtk_snand_plat_dev *pdev)
+{
+}
+
+static inline int irq_completion_wait(struct mtk_snand_plat_dev *pdev,
+				       void __iomem *reg, uint32_t bit,
+				       uint32_t timeout_us)
+{
+	uint32_t val;
+
+	return read32_poll_timeout(reg, val, val & bit, 0, timeout_us);
+}
+
+#endif /* _MTK_SNAND_OS_H_ */
@@ -0,0 +1,597 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Host simulator for the MediaTek SPI-NAND driver
+ *
+ * Runs the unmodified mtk-snand.c against a simulated NFI/SNFI controller
+ * and SPI-NAND chip to check the read/program paths, including sequential
+ * cache reads, and to count the SPI clocks and simulated time they take.
+ * 'layout' checks the page format and raw layout code of every SoC against
+ * a model, 'rawbench' times the raw layout conversions.
+ *
+ * Examples:
+ *   mtk-snand-sim -q verify
+ *   mtk-snand-sim -c 2c,24 -s mt7986 -q -n 32 bench
+ *   mtk-snand-sim -B 200000 -b 3 verify
+ *   mtk-snand-sim layout
+ *   mtk-snand-sim -I 1000000 rawbench
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "mtk-snand-def.h"
+#include "layout.h"
+
+struct sim {
+	struct snfi_sim snfi;
+	struct mtk_snand_plat_dev pdev;
+	struct mtk_snand *snf;
+	struct mtk_snand_chip_info info;
+
+	uint8_t *buf;
+	uint8_t *oob;
+	uint8_t *ref;
+	uint8_t *refoob;
+
+	uint64_t mismatches;
+	uint64_t uncorrectable;
+};
+
+static struct snfi_sim_config cfg = {
+	.id = { 0x2c, 0x14 },
+	.soc = SNAND_SOC_MT7622,
+	.bitflip_bits = 1,
+	.seed = 1,
+	.timing = {
+		.spi_mhz = 52,
+		.read_us = 25,
+		.cache_us = 3,
+		.prog_us = 200,
+		.erase_us = 2000,
+		.reg_ns = 20,
+	},
+};
+
+static bool quad_spi;
+static uint32_t count = 16;
+static uint32_t iterations = 100000;
+static int verbose;
+
+static const char *const soc_names[__SNAND_SOC_MAX] = {
+	[SNAND_SOC_MT7622] = "mt7622",
+	[SNAND_SOC_MT7629] = "mt7629",
+	[SNAND_SOC_MT7981] = "mt7981",
+	[SNAND_SOC_MT7986] = "mt7986",
+};
+
+int mtk_snand_log(struct mtk_snand_plat_dev *pdev,
+		  enum mtk_snand_log_category cat, const char *fmt, ...)
+{
+	static const char *const catnames[__SNAND_LOG_CAT_MAX] = {
+		[SNAND_LOG_NFI] = "NFI: ",
+		[SNAND_LOG_SNFI] = "SNFI: ",
+		[SNAND_LOG_ECC] = "ECC: ",
+		[SNAND_LOG_CHIP] = "",
+	};
+	va_list ap;
+
+	/* Corrected bitflips are expected while injecting them */
+	if (!verbose && (cat == SNAND_LOG_ECC || pdev->quiet))
+		return 0;
+
+	fprintf(stderr, "mtk-snand: %s", catnames[cat]);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+
+	return 0;
+}
+
+static void sim_fill_page(uint8_t *buf, uint32_t size, uint64_t page,
+			  uint32_t gen)
+{
+	uint64_t x = (page + 1) * 0x9e3779b97f4a7c15ULL ^ gen;
+	uint32_t i;
+
+	for (i = 0; i < size; i++) {
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		buf[i] = x >> 56;
+	}
+}
+
+/* Every seventh page stays erased to cover the empty page handling */
+static bool sim_page_erased(uint64_t page)
+{
+	return page % 7 == 3;
+}
+
+static void sim_expected(struct sim *s, uint64_t page)
+{
+	uint32_t fdmlen = s->info.num_sectors * s->info.fdm_size;
+
+	memset(s->refoob, 0xff, s->info.sparesize);
+
+	if (sim_page_erased(page)) {
+		memset(s->ref, 0xff, s->info.pagesize);
+		return;
+	}
+
+	sim_fill_page(s->ref, s->info.pagesize, page, 1);
+	sim_fill_page(s->refoob, fdmlen, page, 2);
+
+	/* Keep the bad block markers clear */
+	s->refoob[0] = 0xff;
+}
+
+static int sim_open(struct sim *s)
+{
+	const struct snand_flash_info *info;
+	struct mtk_snand_platdata pdata = {};
+	int ret;
+
+	memset(s, 0, sizeof(*s));
+
+	info = snand_flash_id_lookup(SNAND_ID_DYMMY, cfg.id);
+	if (!info) {
+		fprintf(stderr, "Unknown chip ID %02x %02x\n", cfg.id[0],
+			cfg.id[1]);
+		return -EINVAL;
+	}
+
+	cfg.pagesize = info->memorg.pagesize;
+	cfg.sparesize = info->memorg.sparesize;
+	cfg.pages_per_block = info->memorg.pages_per_block;
+	cfg.blocks_per_die = info->memorg.blocks_per_die;
+	cfg.ndies = info->memorg.ndies;
+
+	ret = snfi_sim_init(&s->snfi, &cfg);
+	if (ret)
+		return ret;
+
+	s->pdev.sim = &s->snfi;
+
+	pdata.nfi_base = s->snfi.nfi_regs;
+	pdata.ecc_base = s->snfi.ecc_regs;
+	pdata.soc = cfg.soc;
+	pdata.quad_spi = quad_spi;
+
+	ret = mtk_snand_init(&s->pdev, &pdata, &s->snf);
+	if (ret) {
+		fprintf(stderr, "mtk_snand_init failed with %d\n", ret);
+		snfi_sim_cleanup(&s->snfi);
+		return ret;
+	}
+
+	mtk_snand_get_chip_info(s->snf, &s->info);
+
+	if (count > s->info.chipsize / s->info.blocksize)
+		count = s->info.chipsize / s->info.blocksize;
+
+	s->buf = malloc(s->info.pagesize);
+	s->oob = malloc(s->info.sparesize);
+	s->ref = malloc(s->info.pagesize);
+	s->refoob = malloc(s->info.sparesize);
+	if (!s->buf || !s->oob || !s->ref || !s->refoob)
+		return -ENOMEM;
+
+	printf("chip %s, %uK+%u pages, %uK blocks, %u ECC sectors, ECC %u bits, %s, %u MHz\n",
+	       s->info.model, s->info.pagesize >> 10, s->info.sparesize,
+	       s->info.blocksize >> 10, s->info.num_sectors,
+	       s->info.ecc_strength, soc_names[cfg.soc], cfg.timing.spi_mhz);
+
+	return 0;
+}
+
+static void sim_close(struct sim *s)
+{
+	if (s->snf)
+		mtk_snand_cleanup(s->snf);
+
+	snfi_sim_cleanup(&s->snfi);
+
+	free(s->buf);
+	free(s->oob);
+	free(s->ref);
+	free(s->refoob);
+}
+
+static int sim_write_blocks(struct sim *s, uint32_t nblocks)
+{
+	uint32_t ppb = s->info.blocksize / s->info.pagesize;
+	uint64_t page, addr;
+	uint32_t ba;
+	int ret;
+
+	for (ba = 0; ba < nblocks; ba++) {
+		addr = (uint64_t)ba * s->info.blocksize;
+
+		ret = mtk_snand_erase_block(s->snf, addr);
+		if (ret) {
+			fprintf(stderr, "Erase of block %u failed with %d\n",
+				ba, ret);
+			return ret;
+		}
+
+		for (page = (uint64_t)ba * ppb; page < (ba + 1ULL) * ppb;
+		     page++) {
+			if (sim_page_erased(page))
+				continue;
+
+			sim_expected(s, page);
+
+			ret = mtk_snand_write_page(s->snf,
+						   page * s->info.pagesize,
+						   s->ref, s->refoob, false);
+			if (ret) {
+				fprintf(stderr,
+					"Write of page %llu failed with %d\n",
+					(unsigned long long)page, ret);
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int sim_check_page(struct sim *s, uint64_t page, bool oob)
+{
+	uint32_t fdmlen = s->info.num_sectors * s->info.fdm_size;
+	int ret;
+
+	ret = mtk_snand_read_page(s->snf, page * s->info.pagesize, s->buf,
+				  oob ? s->oob : NULL, false);
+	if (ret == -EBADMSG) {
+		s->uncorrectable++;
+		return 0;
+	}
+
+	if (ret < 0) {
+		fprintf(stderr, "Read of page %llu failed with %d\n",
+			(unsigned long long)page, ret);
+		return ret;
+	}
+
+	sim_expected(s, page);
+
+	/* Spare bytes outside of the ECC protected FDM may carry bitflips */
+	if (memcmp(s->buf, s->ref, s->info.pagesize) ||
+	    (oob && !cfg.bitflip_ppm && memcmp(s->oob, s->refoob, fdmlen))) {
+		fprintf(stderr, "Page %llu read back wrong data\n",
+			(unsigned long long)page);
+		s->mismatches++;
+	}
+
+	return 0;
+}
+
+static int sim_check_range(struct sim *s, uint64_t page, uint32_t npages,
+			   bool seq, bool oob)
+{
+	int ret;
+
+	if (seq) {
+		ret = mtk_snand_read_seq_start(s->snf,
+					       page * s->info.pagesize, npages);
+		if (ret)
+			return ret;
+	}
+
+	while (npages--) {
+		ret = sim_check_page(s, page++, oob);
+		if (ret)
+			return ret;
+	}
+
+	return seq ? mtk_snand_read_seq_stop(s->snf) : 0;
+}
+
+static void print_stats(struct sim *s)
+{
+	struct snfi_sim_stats *st = &s->snfi.stats;
+
+	printf("page reads:        %llu 13h, %llu 31h, %llu 3Fh\n",
+	       (unsigned long long)st->page_reads,
+	       (unsigned long long)st->cache_seq,
+	       (unsigned long long)st->cache_last);
+	printf("cache transfers:   %llu reads, %llu program loads\n",
+	       (unsigned long long)st->cache_xfers,
+	       (unsigned long long)st->program_loads);
+	printf("array operations:  %llu programs, %llu erases\n",
+	       (unsigned long long)st->programs,
+	       (unsigned long long)st->erases);
+	printf("MAC transfers:     %llu (%llu status polls)\n",
+	       (unsigned long long)st->mac_xfers,
+	       (unsigned long long)st->status_polls);
+	printf("register accesses: %llu reads, %llu writes\n",
+	       (unsigned long long)st->reg_reads,
+	       (unsigned long long)st->reg_writes);
+	printf("injected bitflips: %llu (%llu corrected by ECC, %llu sectors failed)\n",
+	       (unsigned long long)st->bitflips,
+	       (unsigned long long)st->ecc_corrected,
+	       (unsigned long long)st->ecc_failed);
+	printf("protocol errors:   %llu\n",
+	       (unsigned long long)st->violations);
+}
+
+static int cmd_verify(void)
+{
+	uint32_t ppb, npages;
+	struct sim s;
+	int ret;
+
+	ret = sim_open(&s);
+	if (ret)
+		goto out;
+
+	ppb = s.info.blocksize / s.info.pagesize;
+	npages = count * ppb;
+
+	ret = sim_write_blocks(&s, count);
+	if (ret)
+		goto out;
+
+	/* Page by page */
+	ret = sim_check_range(&s, 0, npages, false, true);
+	if (ret)
+		goto out;
+
+	/* Sequential, starting and ending in the middle of blocks */
+	ret = sim_check_range(&s, ppb / 2 + 1, npages - ppb, true, true);
+	if (ret)
+		goto out;
+
+	/* Sequential reads broken up by other reads, writes and erases */
+	if (count >= 3) {
+		mtk_snand_read_seq_start(s.snf, (uint64_t)ppb * s.info.pagesize,
+					 ppb);
+		ret = sim_check_page(&s, ppb, false);
+		if (!ret)
+			ret = sim_check_page(&s, ppb + 1, false);
+		if (!ret)
+			ret = sim_check_page(&s, 5, true);
+		if (!ret)
+			ret = sim_check_page(&s, ppb + 2, false);
+		if (ret)
+			goto out;
+
+		mtk_snand_read_seq_start(s.snf, (uint64_t)ppb * s.info.pagesize,
+					 ppb);
+		ret = sim_check_page(&s, ppb, false);
+		if (ret)
+			goto out;
+
+		mtk_snand_block_isbad(s.snf, 2ULL * s.info.blocksize);
+		ret = sim_write_blocks(&s, 1);
+		if (ret)
+			goto out;
+
+		ret = sim_check_range(&s, 0, ppb, false, true);
+		if (ret)
+			goto out;
+
+		mtk_snand_read_seq_stop(s.snf);
+	}
+
+	print_stats(&s);
+	printf("mismatches:        %llu (%llu uncorrectable reads)\n",
+	       (unsigned long long)s.mismatches,
+	       (unsigned long long)s.uncorrectable);
+
+	if (s.mismatches || s.snfi.stats.violations)
+		ret = -EIO;
+
+out:
+	sim_close(&s);
+	return ret;
+}
+
+static int bench_one(struct sim *s, bool seq)
+{
+	struct snfi_sim_stats *st = &s->snfi.stats;
+	uint32_t ppb = s->info.blocksize / s->info.pagesize;
+	uint64_t start, ns, bytes;
+	uint32_t npages = count * ppb;
+	int ret;
+
+	memset(st, 0, sizeof(*st));
+	s->snfi.now += 1000000;
+	start = s->snfi.now;
+
+	ret = sim_check_range(s, 0, npages, seq, false);
+	if (ret)
+		return ret;
+
+	ns = s->snfi.now - start;
+	bytes = (uint64_t)npages * s->info.pagesize;
+
+	printf("%-10s %8u %10.1f %9.2f %9.1f %12llu %9.1f %6llu %6llu %6llu %8llu\n",
+	       seq ? "sequential" : "single", npages, ns / 1000.0,
+	       bytes * 1000.0 / ns, (double)ns / npages / 1000.0,
+	       (unsigned long long)st->spi_clocks,
+	       100.0 * st->spi_clocks * 1000 / cfg.timing.spi_mhz / ns,
+	       (unsigned long long)st->page_reads,
+	       (unsigned long long)st->cache_seq,
+	       (unsigned long long)st->cache_last,
+	       (unsigned long long)st->status_polls);
+
+	return 0;
+}
+
+static int cmd_bench(void)
+{
+	struct sim s;
+	int ret;
+
+	ret = sim_open(&s);
+	if (ret)
+		goto out;
+
+	ret = sim_write_blocks(&s, count);
+	if (ret)
+		goto out;
+
+	printf("%-10s %8s %10s %9s %9s %12s %9s %6s %6s %6s %8s\n",
+	       "mode", "pages", "time", "MB/s", "us/page", "SPI clocks",
+	       "bus%", "13h", "31h", "3Fh", "polls");
+
+	ret = bench_one(&s, false);
+	if (!ret)
+		ret = bench_one(&s, true);
+
+	if (!ret && (s.mismatches || s.snfi.stats.violations)) {
+		fprintf(stderr, "%llu mismatches, %llu protocol errors\n",
+			(unsigned long long)s.mismatches,
+			(unsigned long long)s.snfi.stats.violations);
+		ret = -EIO;
+	}
+
+out:
+	sim_close(&s);
+	return ret;
+}
+
+static int parse_id(const char *str)
+{
+	char *end;
+	int i;
+
+	memset(cfg.id, 0, sizeof(cfg.id));
+
+	for (i = 0; i < (int)sizeof(cfg.id) && *str; i++) {
+		cfg.id[i] = strtoul(str, &end, 16);
+		if (end == str)
+			return -EINVAL;
+
+		str = *end == ',' ? end + 1 : end;
+	}
+
+	return *str ? -EINVAL : 0;
+}
+
+static int parse_soc(const char *str)
+{
+	int i;
+
+	for (i = 0; i < __SNAND_SOC_MAX; i++) {
+		if (!strcmp(str, soc_names[i])) {
+			cfg.soc = i;
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <verify|bench|layout|rawbench>\n"
+		"\n"
+		"Commands:\n"
+		"  verify     write blocks, read them back page by page and sequentially\n"
+		"  bench      compare page by page and sequential reads\n"
+		"  layout     check page formats and raw layouts of all SoCs\n"
+		"  rawbench   time the raw layout conversions\n"
+		"\n"
+		"Options:\n"
+		"  -c <id>      chip JEDEC ID, e.g. 2c,14 (default)\n"
+		"  -s <soc>     mt7622 (default), mt7629, mt7981 or mt7986\n"
+		"  -q           quad SPI\n"
+		"  -f <MHz>     SPI clock (default %u)\n"
+		"  -t <r,c,p,e> tRD, tRCBSY, tPROG, tBERS in us\n"
+		"  -n <blocks>  blocks to write and read (default %u)\n"
+		"  -B <ppm>     chance of bitflips per page read\n"
+		"  -b <bits>    bits flipped per affected page (default 1)\n"
+		"  -S <seed>    random seed\n"
+		"  -I <n>       rawbench iterations (default %u)\n"
+		"  -v           print ECC log messages\n",
+		prog, cfg.timing.spi_mhz, count, iterations);
+}
+
+int main(int argc, char *argv[])
+{
+	struct snfi_sim_timing *t = &cfg.timing;
+	const char *cmd;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "c:s:qf:t:n:B:b:S:I:v")) != -1) {
+		switch (opt) {
+		case 'c':
+			if (parse_id(optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 's':
+			if (parse_soc(optarg)) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'q':
+			quad_spi = true;
+			break;
+		case 'f':
+			t->spi_mhz = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			if (sscanf(optarg, "%u,%u,%u,%u", &t->read_us,
+				   &t->cache_us, &t->prog_us,
+				   &t->erase_us) != 4) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			cfg.bitflip_ppm = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			cfg.bitflip_bits = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			cfg.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'I':
+			iterations = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose++;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1 || !t->spi_mhz || !count || !iterations) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	cmd = argv[optind];
+
+	if (!strcmp(cmd, "verify"))
+		ret = cmd_verify();
+	else if (!strcmp(cmd, "bench"))
+		ret = cmd_bench();
+	else if (!strcmp(cmd, "layout"))
+		ret = layout_verify(&cfg);
+	else if (!strcmp(cmd, "rawbench"))
+		ret = layout_bench(&cfg, iterations);
+	else {
+		usage(argv[0]);
+		return 1;
+	}
+
+	return ret ? 1 : 0;
+}
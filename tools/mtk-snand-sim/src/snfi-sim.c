@@ -0,0 +1,1071 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Simulated MediaTek NFI/SNFI controller with an attached SPI-NAND chip
+ *
+ * Models the registers mtk-snand.c uses: the SNFI MAC for short SPI
+ * transactions through GPRAM, custom read/program mode with DMA and the
+ * ECC engine. The chip behind it implements the common SPI-NAND command
+ * set including PAGE READ CACHE SEQUENTIAL (31h) and LAST (3Fh). Time is
+ * simulated in ns from the SPI clock and the chip busy times.
+ *
+ * The ECC engine encodes and decodes real BCH codes (bch.c) with the
+ * strength and symbol size programmed by mtk-snand-ecc.c. The parity is
+ * not bit compatible with the hardware, but it occupies the same bytes of
+ * the raw sector and corrects the same number of bits.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "mtk-snand.h"
+#include "snfi-sim.h"
+#include "bch.h"
+
+#define BIT(nr)				(1U << (nr))
+
+/* NFI registers */
+#define NFI_CNFG			0x000
+#define CNFG_OP_MODE_S			12
+#define CNFG_OP_MODE_M			0x7
+#define   CNFG_OP_MODE_CUST		6
+#define   CNFG_OP_MODE_PROGRAM		3
+#define CNFG_AUTO_FMT_EN		BIT(9)
+#define CNFG_HW_ECC_EN			BIT(8)
+
+#define NFI_PAGEFMT			0x004
+#define NFI_FDM_ECC_NUM_S		12
+#define NFI_FDM_NUM_S			8
+#define NFI_SEC_SEL_512			BIT(2)
+
+#define NFI_CON				0x008
+#define CON_SEC_NUM_S			12
+#define CON_SEC_NUM_M			0x1f
+#define CON_BWR				BIT(9)
+#define CON_BRD				BIT(8)
+#define CON_NFI_RST			BIT(1)
+#define CON_FIFO_FLUSH			BIT(0)
+
+#define NFI_INTR_EN			0x010
+#define NFI_INTR_STA			0x014
+#define NFI_IRQ_CUS_READ		BIT(8)
+#define NFI_IRQ_CUS_PG			BIT(7)
+
+#define NFI_STRDATA			0x040
+#define STR_DATA			BIT(0)
+
+#define NFI_STA				0x060
+#define NFI_FIFOSTA			0x064
+#define NFI_ADDRCNTR			0x070
+#define NFI_STRADDR			0x080
+#define NFI_BYTELEN			0x084
+#define SEC_CNTR_S			12
+
+#define NFI_FDM0L			0x0a0
+#define NFI_FDML(n)			(NFI_FDM0L + (n) * 8)
+#define NFI_FDMM(n)			(NFI_FDM0L + 4 + (n) * 8)
+
+#define NFI_MASTERSTA			0x224
+
+/* SNFI registers */
+#define SNF_MAC_CTL			0x500
+#define SF_TRIG				BIT(2)
+#define WIP_READY			BIT(1)
+#define WIP				BIT(0)
+
+#define SNF_MAC_OUTL			0x504
+#define SNF_MAC_INL			0x508
+#define SNF_RD_CTL2			0x510
+#define SNF_RD_CTL3			0x514
+#define SNF_PG_CTL1			0x524
+#define SNF_PG_CTL2			0x528
+
+#define SNF_MISC_CTL			0x538
+#define SW_RST				BIT(28)
+#define PG_LOAD_X4_EN			BIT(20)
+#define DATA_READ_MODE_S		16
+#define DATA_READ_MODE_M		0x7
+
+#define SNF_MISC_CTL2			0x53c
+#define PROGRAM_LOAD_BYTE_NUM_S		16
+
+#define SNF_STA_CTL1			0x550
+#define CUS_PG_DONE			BIT(28)
+#define CUS_READ_DONE			BIT(27)
+
+#define SNF_GPRAM			0x800
+#define SNF_GPRAM_SIZE			0xa0
+
+/* ECC registers */
+#define ECC_ENCCON			0x000
+#define ECC_ENCCNFG			0x004
+#define ENC_MS_S			16
+#define ECC_ENCIDLE			0x00c
+#define ECC_DECCON			0x100
+#define ECC_DECCNFG			0x104
+#define ECC_DECIDLE			0x10c
+#define ECC_DECENUM0			0x114
+#define ECC_EN				BIT(0)
+#define ECC_IDLE			BIT(0)
+#define ECC_MODE_S			4
+#define ECC_MODE_S_V2			5
+#define ECC_ERRNUM_M			0x1f
+
+/* SPI-NAND */
+#define STATUS_OIP			BIT(0)
+#define STATUS_WEL			BIT(1)
+#define FEATURE_PROTECT			0xa0
+#define FEATURE_CONFIG			0xb0
+#define FEATURE_STATUS			0xc0
+#define FEATURE_MICRON_DIE		0xd0
+#define MICRON_DIE_SEL_1		BIT(6)
+
+#define CHIP_RESET_NS			5000
+
+static struct snfi_sim *cur_sim;
+
+static uint64_t sim_rand(struct snfi_sim *sim)
+{
+	/* xorshift64* */
+	sim->rng ^= sim->rng >> 12;
+	sim->rng ^= sim->rng << 25;
+	sim->rng ^= sim->rng >> 27;
+
+	return sim->rng * 0x2545f4914f6cdd1dULL;
+}
+
+static void sim_violation(struct snfi_sim *sim, const char *fmt, ...)
+{
+	va_list ap;
+
+	sim->stats.violations++;
+
+	fprintf(stderr, "snfi-sim: ");
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+static void sim_spi_clocks(struct snfi_sim *sim, uint64_t clocks)
+{
+	sim->stats.spi_clocks += clocks;
+	sim->now += clocks * 1000 / sim->cfg.timing.spi_mhz;
+}
+
+static uint32_t *sim_nfi_reg(struct snfi_sim *sim, uint32_t reg)
+{
+	return &sim->nfi_regs[reg / 4];
+}
+
+static uint32_t *sim_ecc_reg(struct snfi_sim *sim, uint32_t reg)
+{
+	return &sim->ecc_regs[reg / 4];
+}
+
+static uint8_t sim_gpram_get(struct snfi_sim *sim, uint32_t i)
+{
+	return *sim_nfi_reg(sim, SNF_GPRAM + (i & ~3)) >> ((i % 4) * 8);
+}
+
+static void sim_gpram_set(struct snfi_sim *sim, uint32_t i, uint8_t val)
+{
+	uint32_t *reg = sim_nfi_reg(sim, SNF_GPRAM + (i & ~3));
+
+	*reg &= ~(0xffU << ((i % 4) * 8));
+	*reg |= (uint32_t)val << ((i % 4) * 8);
+}
+
+static bool sim_soc_is_v2(struct snfi_sim *sim)
+{
+	return sim->cfg.soc == SNAND_SOC_MT7981 ||
+	       sim->cfg.soc == SNAND_SOC_MT7986;
+}
+
+/*
+ * Chip
+ */
+
+static bool chip_busy(struct snfi_sim *sim)
+{
+	return sim->now < sim->busy_until;
+}
+
+static void chip_reset(struct snfi_sim *sim)
+{
+	memset(sim->features, 0, sizeof(sim->features));
+	sim->features[FEATURE_PROTECT] = 0x38;
+	sim->features[FEATURE_CONFIG] = 0x10;
+
+	sim->die = 0;
+	sim->data_page = -1;
+	sim->seq_active = false;
+	sim->busy_until = sim->now + CHIP_RESET_NS;
+}
+
+static int64_t chip_page(struct snfi_sim *sim, const uint8_t *row)
+{
+	uint32_t page = (row[0] << 16) | (row[1] << 8) | row[2];
+
+	if (page >= sim->pages_per_die) {
+		sim_violation(sim, "row address %06x out of range\n", page);
+		return -1;
+	}
+
+	return (int64_t)sim->die * sim->pages_per_die + page;
+}
+
+static uint32_t chip_column(struct snfi_sim *sim, uint32_t col)
+{
+	/* Drop the plane select bit */
+	return col & ((sim->cfg.pagesize << 1) - 1);
+}
+
+static uint8_t *chip_page_data(struct snfi_sim *sim, int64_t page)
+{
+	uint32_t ba = page / sim->cfg.pages_per_block;
+	uint32_t pg = page % sim->cfg.pages_per_block;
+
+	if (!sim->blocks[ba])
+		return NULL;
+
+	return sim->blocks[ba] + (size_t)pg * sim->rawpage_size;
+}
+
+static void chip_load_cache(struct snfi_sim *sim, int64_t page)
+{
+	uint32_t i, bit;
+	uint8_t *data;
+
+	data = page >= 0 ? chip_page_data(sim, page) : NULL;
+	if (data)
+		memcpy(sim->cache, data, sim->rawpage_size);
+	else
+		memset(sim->cache, 0xff, sim->rawpage_size);
+
+	if (!sim->cfg.bitflip_ppm ||
+	    sim_rand(sim) % 1000000 >= sim->cfg.bitflip_ppm)
+		return;
+
+	for (i = 0; i < sim->cfg.bitflip_bits; i++) {
+		bit = sim_rand(sim) % (sim->rawpage_size * 8);
+		sim->cache[bit / 8] ^= 1 << (bit % 8);
+		sim->stats.bitflips++;
+	}
+}
+
+static bool chip_write_enabled(struct snfi_sim *sim, const char *what)
+{
+	if (sim->features[FEATURE_STATUS] & STATUS_WEL)
+		return true;
+
+	sim_violation(sim, "%s without write enable\n", what);
+	return false;
+}
+
+static bool chip_array_idle(struct snfi_sim *sim, const char *what)
+{
+	if (!sim->seq_active)
+		return true;
+
+	sim_violation(sim, "%s during sequential cache read\n", what);
+	return false;
+}
+
+static void chip_cache_seq(struct snfi_sim *sim, bool last)
+{
+	uint64_t start;
+
+	if (sim->data_page < 0 || (last && !sim->seq_active)) {
+		sim_violation(sim, "%s without a page read\n",
+			      last ? "3Fh" : "31h");
+		return;
+	}
+
+	/* Waits for the array read of the previous command to finish */
+	start = sim->now > sim->data_ready ? sim->now : sim->data_ready;
+	sim->busy_until = start + sim->cfg.timing.cache_us * 1000ULL;
+
+	chip_load_cache(sim, sim->data_page);
+
+	if (last) {
+		sim->stats.cache_last++;
+		sim->data_page = -1;
+		sim->seq_active = false;
+		return;
+	}
+
+	sim->stats.cache_seq++;
+	sim->data_page++;
+	sim->seq_active = true;
+
+	if (!(sim->data_page % sim->cfg.pages_per_block))
+		sim_violation(sim, "31h crosses a block boundary\n");
+
+	sim->data_ready = sim->busy_until + sim->cfg.timing.read_us * 1000ULL;
+}
+
+static uint8_t chip_get_feature(struct snfi_sim *sim, uint8_t addr)
+{
+	uint8_t val = sim->features[addr];
+
+	if (addr == FEATURE_STATUS) {
+		sim->stats.status_polls++;
+		if (chip_busy(sim))
+			val |= STATUS_OIP;
+	}
+
+	return val;
+}
+
+static void chip_set_feature(struct snfi_sim *sim, uint8_t addr, uint8_t val)
+{
+	if (addr == FEATURE_STATUS)
+		return;
+
+	sim->features[addr] = val;
+
+	if (addr == FEATURE_MICRON_DIE)
+		sim->die = !!(val & MICRON_DIE_SEL_1);
+}
+
+static void chip_program(struct snfi_sim *sim, int64_t page)
+{
+	uint32_t ba = page / sim->cfg.pages_per_block;
+	size_t blksz = (size_t)sim->rawpage_size * sim->cfg.pages_per_block;
+	uint8_t *data;
+	uint32_t i;
+
+	if (!sim->blocks[ba]) {
+		sim->blocks[ba] = malloc(blksz);
+		if (!sim->blocks[ba]) {
+			sim_violation(sim, "out of memory\n");
+			return;
+		}
+		memset(sim->blocks[ba], 0xff, blksz);
+	}
+
+	/* Programming can only clear bits */
+	data = chip_page_data(sim, page);
+	for (i = 0; i < sim->rawpage_size; i++)
+		data[i] &= sim->cache[i];
+}
+
+static bool chip_is_rfc(uint8_t op)
+{
+	switch (op) {
+	case 0x03:
+	case 0x0b:
+	case 0x3b:
+	case 0x6b:
+	case 0xbb:
+	case 0xeb:
+		return true;
+	}
+
+	return false;
+}
+
+static void chip_cmd(struct snfi_sim *sim, const uint8_t *out, uint32_t outlen,
+		     uint8_t *in, uint32_t inlen)
+{
+	uint8_t op = out[0];
+	int64_t page;
+	uint32_t i, col;
+
+	memset(in, 0xff, inlen);
+
+	if (chip_busy(sim) && op != 0x0f && op != 0xff) {
+		sim_violation(sim, "command %02xh while busy\n", op);
+		return;
+	}
+
+	switch (op) {
+	case 0xff:
+		chip_reset(sim);
+		break;
+
+	case 0x9f:
+		/* ID follows one dummy byte */
+		for (i = 0; i < inlen; i++) {
+			if (outlen + i >= 2 && outlen + i - 2 < 4)
+				in[i] = sim->cfg.id[outlen + i - 2];
+		}
+		break;
+
+	case 0x0f:
+		if (inlen)
+			in[0] = chip_get_feature(sim, out[1]);
+		break;
+
+	case 0x1f:
+		chip_set_feature(sim, out[1], out[2]);
+		break;
+
+	case 0xc2:
+		sim->die = out[1];
+		break;
+
+	case 0x06:
+		sim->features[FEATURE_STATUS] |= STATUS_WEL;
+		break;
+
+	case 0x04:
+		sim->features[FEATURE_STATUS] &= ~STATUS_WEL;
+		break;
+
+	case 0x13:
+		if (!chip_array_idle(sim, "13h"))
+			break;
+
+		page = chip_page(sim, out + 1);
+		chip_load_cache(sim, page);
+		sim->stats.page_reads++;
+
+		sim->busy_until = sim->now + sim->cfg.timing.read_us * 1000ULL;
+		sim->data_page = page;
+		sim->data_ready = sim->busy_until;
+		break;
+
+	case 0x31:
+	case 0x3f:
+		chip_cache_seq(sim, op == 0x3f);
+		break;
+
+	case 0x10:
+		if (!chip_write_enabled(sim, "10h") ||
+		    !chip_array_idle(sim, "10h"))
+			break;
+
+		page = chip_page(sim, out + 1);
+		if (page >= 0)
+			chip_program(sim, page);
+
+		sim->stats.programs++;
+		sim->features[FEATURE_STATUS] &= ~STATUS_WEL;
+		sim->busy_until = sim->now + sim->cfg.timing.prog_us * 1000ULL;
+		break;
+
+	case 0xd8:
+		if (!chip_write_enabled(sim, "D8h") ||
+		    !chip_array_idle(sim, "D8h"))
+			break;
+
+		page = chip_page(sim, out + 1);
+		if (page >= 0) {
+			i = page / sim->cfg.pages_per_block;
+			free(sim->blocks[i]);
+			sim->blocks[i] = NULL;
+		}
+
+		sim->stats.erases++;
+		sim->features[FEATURE_STATUS] &= ~STATUS_WEL;
+		sim->busy_until = sim->now + sim->cfg.timing.erase_us * 1000ULL;
+		break;
+
+	default:
+		if (!chip_is_rfc(op) || outlen < 4) {
+			sim_violation(sim, "unsupported MAC command %02xh\n",
+				      op);
+			break;
+		}
+
+		col = chip_column(sim, (out[1] << 8) | out[2]);
+		for (i = 0; i < inlen && col + i < sim->rawpage_size; i++)
+			in[i] = sim->cache[col + i];
+	}
+}
+
+/*
+ * ECC engine
+ */
+
+struct sim_fmt {
+	uint32_t sectors;
+	uint32_t raw_sector_size;
+	uint32_t sector_size;
+	uint32_t fdm_size;
+	uint32_t fdm_ecc_size;
+	uint32_t strength;
+	uint32_t parity_bits;
+	uint32_t ecc_bytes;
+};
+
+static void sim_get_fmt(struct snfi_sim *sim, uint32_t nbytes,
+			struct sim_fmt *fmt)
+{
+	uint32_t pagefmt = *sim_nfi_reg(sim, NFI_PAGEFMT);
+	uint32_t enccnfg = *sim_ecc_reg(sim, ECC_ENCCNFG);
+	uint32_t msg_size, cap_idx;
+
+	fmt->sectors = (*sim_nfi_reg(sim, NFI_CON) >> CON_SEC_NUM_S) &
+		       CON_SEC_NUM_M;
+	if (!fmt->sectors)
+		fmt->sectors = 1;
+
+	fmt->raw_sector_size = nbytes / fmt->sectors;
+	fmt->sector_size = pagefmt & NFI_SEC_SEL_512 ? 512 : 1024;
+	fmt->fdm_size = (pagefmt >> NFI_FDM_NUM_S) & 0xf;
+	fmt->fdm_ecc_size = (pagefmt >> NFI_FDM_ECC_NUM_S) & 0xf;
+
+	/* Both ECC capability tables are 4, 6, 8, ... */
+	cap_idx = enccnfg & (BIT(sim_soc_is_v2(sim) ? ECC_MODE_S_V2 :
+						      ECC_MODE_S) - 1);
+	fmt->strength = 4 + 2 * cap_idx;
+
+	msg_size = (enccnfg >> ENC_MS_S) / 8;
+	fmt->parity_bits = 32 - __builtin_clz(1 + 8 * msg_size);
+	fmt->ecc_bytes = (fmt->strength * fmt->parity_bits + 7) / 8;
+}
+
+static struct bch *ecc_get_bch(struct snfi_sim *sim,
+				const struct sim_fmt *fmt)
+{
+	if (fmt->sector_size + fmt->fdm_size + fmt->ecc_bytes >
+	    fmt->raw_sector_size) {
+		sim_violation(sim, "ECC parity does not fit the sector\n");
+		return NULL;
+	}
+
+	if (sim->bch && sim->bch->m == fmt->parity_bits &&
+	    sim->bch->t == fmt->strength)
+		return sim->bch;
+
+	bch_free(sim->bch);
+
+	sim->bch = bch_init(fmt->parity_bits, fmt->strength);
+	if (!sim->bch)
+		sim_violation(sim, "no BCH code for %u bits over GF(2^%u)\n",
+			      fmt->strength, fmt->parity_bits);
+
+	return sim->bch;
+}
+
+static void ecc_encode(struct snfi_sim *sim, const struct sim_fmt *fmt,
+		       uint8_t *sect)
+{
+	uint8_t *parity = sect + fmt->sector_size + fmt->fdm_size;
+	struct bch *bch = ecc_get_bch(sim, fmt);
+
+	if (!bch)
+		return;
+
+	memset(parity, 0xff, fmt->ecc_bytes);
+	bch_encode(bch, sect, fmt->sector_size + fmt->fdm_ecc_size, parity);
+}
+
+static bool ecc_is_empty(const uint8_t *buf, uint32_t len)
+{
+	while (len--) {
+		if (*buf++ != 0xff)
+			return false;
+	}
+
+	return true;
+}
+
+/* Returns the number of corrected bits, or ECC_ERRNUM_M if uncorrectable */
+static uint32_t ecc_decode(struct snfi_sim *sim, const struct sim_fmt *fmt,
+			   uint8_t *sect)
+{
+	uint32_t msg = fmt->sector_size + fmt->fdm_ecc_size;
+	uint8_t *parity = sect + fmt->sector_size + fmt->fdm_size;
+	struct bch *bch = ecc_get_bch(sim, fmt);
+	int ret;
+
+	if (!bch)
+		return ECC_ERRNUM_M;
+
+	/* Erased sectors pass without bitflips only, as with DEC_EMPTY_EN */
+	if (ecc_is_empty(sect, msg) && ecc_is_empty(parity, fmt->ecc_bytes))
+		return 0;
+
+	ret = bch_decode(bch, sect, msg, parity);
+
+	return ret < 0 ? ECC_ERRNUM_M : ret;
+}
+
+static void ecc_set_errnum(struct snfi_sim *sim, uint32_t sect, uint32_t num)
+{
+	uint32_t shift = sim_soc_is_v2(sim) ? 8 : 5;
+	uint32_t *reg = sim_ecc_reg(sim, ECC_DECENUM0 + (sect / 4) * 4);
+
+	*reg &= ~(ECC_ERRNUM_M << ((sect % 4) * shift));
+	*reg |= num << ((sect % 4) * shift);
+}
+
+static uint32_t ecc_decdone_reg(struct snfi_sim *sim)
+{
+	return sim_soc_is_v2(sim) ? 0x124 : 0x11c;
+}
+
+/*
+ * Controller
+ */
+
+static void *sim_dma_addr(struct snfi_sim *sim, uint32_t bus, size_t len)
+{
+	struct snfi_sim_dma_map *m;
+	uint32_t i;
+
+	for (i = 0; i < SNFI_SIM_MAX_DMA_MAPS; i++) {
+		m = &sim->dma[i];
+		if (!m->vaddr || bus < m->bus || bus - m->bus + len > m->size)
+			continue;
+
+		return (uint8_t *)m->vaddr + (bus - m->bus);
+	}
+
+	sim_violation(sim, "DMA to unmapped address %08x\n", bus);
+	return NULL;
+}
+
+static void sim_read_fdm(struct snfi_sim *sim, uint32_t sect, uint8_t *fdm,
+			 uint32_t len)
+{
+	uint32_t i, val;
+
+	for (i = 0; i < len; i++) {
+		val = *sim_nfi_reg(sim, i < 4 ? NFI_FDML(sect) : NFI_FDMM(sect));
+		fdm[i] = val >> ((i % 4) * 8);
+	}
+}
+
+static void sim_write_fdm(struct snfi_sim *sim, uint32_t sect,
+			  const uint8_t *fdm, uint32_t len)
+{
+	uint32_t i, vall = ~0U, valm = ~0U, *val;
+
+	for (i = 0; i < len && i < 8; i++) {
+		val = i < 4 ? &vall : &valm;
+		*val &= ~(0xffU << ((i % 4) * 8));
+		*val |= (uint32_t)fdm[i] << ((i % 4) * 8);
+	}
+
+	*sim_nfi_reg(sim, NFI_FDML(sect)) = vall;
+	*sim_nfi_reg(sim, NFI_FDMM(sect)) = valm;
+}
+
+static void sim_io_widths(uint32_t mode, uint32_t *aw, uint32_t *dw)
+{
+	switch (mode) {
+	case 1:		/* 1-1-2 */
+		*aw = 1;
+		*dw = 2;
+		break;
+	case 2:		/* 1-1-4 */
+		*aw = 1;
+		*dw = 4;
+		break;
+	case 5:		/* 1-2-2 */
+		*aw = 2;
+		*dw = 2;
+		break;
+	case 6:		/* 1-4-4 */
+		*aw = 4;
+		*dw = 4;
+		break;
+	default:
+		*aw = 1;
+		*dw = 1;
+	}
+}
+
+static void sim_mac_xfer(struct snfi_sim *sim)
+{
+	uint32_t outlen = *sim_nfi_reg(sim, SNF_MAC_OUTL);
+	uint32_t inlen = *sim_nfi_reg(sim, SNF_MAC_INL);
+	uint8_t out[SNF_GPRAM_SIZE], in[SNF_GPRAM_SIZE];
+	uint32_t i;
+
+	if (!outlen || outlen + inlen > SNF_GPRAM_SIZE) {
+		sim_violation(sim, "bad MAC length %u+%u\n", outlen, inlen);
+		return;
+	}
+
+	for (i = 0; i < outlen; i++)
+		out[i] = sim_gpram_get(sim, i);
+
+	sim->stats.mac_xfers++;
+	sim_spi_clocks(sim, (outlen + inlen) * 8);
+
+	chip_cmd(sim, out, outlen, in, inlen);
+
+	for (i = 0; i < inlen; i++)
+		sim_gpram_set(sim, outlen + i, in[i]);
+}
+
+static void sim_custom_done(struct snfi_sim *sim, uint32_t sta, uint32_t irq,
+			    uint32_t cntr_reg, uint32_t sectors)
+{
+	*sim_nfi_reg(sim, SNF_STA_CTL1) |= sta;
+	*sim_nfi_reg(sim, cntr_reg) = sectors << SEC_CNTR_S;
+
+	if (*sim_nfi_reg(sim, NFI_INTR_EN) & irq)
+		*sim_nfi_reg(sim, NFI_INTR_STA) |= irq;
+}
+
+static void sim_custom_read(struct snfi_sim *sim, uint32_t cnfg)
+{
+	uint32_t ctl2 = *sim_nfi_reg(sim, SNF_RD_CTL2);
+	uint32_t op = ctl2 & 0xff, dummy = (ctl2 >> 8) & 0xff;
+	uint32_t col = chip_column(sim, *sim_nfi_reg(sim, SNF_RD_CTL3));
+	uint32_t nbytes = *sim_nfi_reg(sim, SNF_MISC_CTL2) & 0xffff;
+	uint32_t mode = (*sim_nfi_reg(sim, SNF_MISC_CTL) >> DATA_READ_MODE_S) &
+			DATA_READ_MODE_M;
+	bool ecc = (cnfg & CNFG_HW_ECC_EN) &&
+		   (*sim_ecc_reg(sim, ECC_DECCON) & ECC_EN);
+	uint8_t *buf, *dst;
+	uint32_t i, aw, dw, num;
+	struct sim_fmt fmt;
+
+	if (!(*sim_nfi_reg(sim, NFI_CON) & CON_BRD))
+		sim_violation(sim, "custom read without CON_BRD\n");
+
+	if (!chip_is_rfc(op))
+		sim_violation(sim, "custom read with opcode %02xh\n", op);
+
+	if (chip_busy(sim))
+		sim_violation(sim, "read from cache while busy\n");
+
+	sim_io_widths(mode, &aw, &dw);
+	sim_spi_clocks(sim, 8 + 16 / aw + dummy + nbytes * 8 / dw);
+	sim->stats.cache_xfers++;
+
+	sim_get_fmt(sim, nbytes, &fmt);
+
+	buf = malloc(nbytes);
+	if (!buf)
+		goto out;
+
+	for (i = 0; i < nbytes; i++)
+		buf[i] = col + i < sim->rawpage_size ? sim->cache[col + i] : 0xff;
+
+	if (!(cnfg & CNFG_AUTO_FMT_EN)) {
+		dst = sim_dma_addr(sim, *sim_nfi_reg(sim, NFI_STRADDR), nbytes);
+		if (dst)
+			memcpy(dst, buf, nbytes);
+		goto done;
+	}
+
+	dst = sim_dma_addr(sim, *sim_nfi_reg(sim, NFI_STRADDR),
+			   fmt.sectors * fmt.sector_size);
+	if (!dst)
+		goto done;
+
+	for (i = 0; i < fmt.sectors; i++) {
+		uint8_t *sect = buf + i * fmt.raw_sector_size;
+
+		if (ecc) {
+			num = ecc_decode(sim, &fmt, sect);
+			if (num == ECC_ERRNUM_M)
+				sim->stats.ecc_failed++;
+			else
+				sim->stats.ecc_corrected += num;
+
+			ecc_set_errnum(sim, i, num);
+		}
+
+		memcpy(dst + i * fmt.sector_size, sect, fmt.sector_size);
+		sim_write_fdm(sim, i, sect + fmt.sector_size, fmt.fdm_size);
+	}
+
+	if (ecc)
+		*sim_ecc_reg(sim, ecc_decdone_reg(sim)) = (1 << fmt.sectors) - 1;
+
+done:
+	sim_custom_done(sim, CUS_READ_DONE, NFI_IRQ_CUS_READ, NFI_BYTELEN,
+			fmt.sectors);
+out:
+	free(buf);
+}
+
+static void sim_custom_program(struct snfi_sim *sim, uint32_t cnfg)
+{
+	uint32_t op = (*sim_nfi_reg(sim, SNF_PG_CTL1) >> 8) & 0xff;
+	uint32_t col = chip_column(sim, *sim_nfi_reg(sim, SNF_PG_CTL2));
+	uint32_t nbytes = *sim_nfi_reg(sim, SNF_MISC_CTL2) >>
+			  PROGRAM_LOAD_BYTE_NUM_S;
+	bool x4 = *sim_nfi_reg(sim, SNF_MISC_CTL) & PG_LOAD_X4_EN;
+	bool ecc = (cnfg & CNFG_HW_ECC_EN) &&
+		   (*sim_ecc_reg(sim, ECC_ENCCON) & ECC_EN);
+	const uint8_t *src;
+	struct sim_fmt fmt;
+	uint8_t *buf;
+	uint32_t i;
+
+	if (!(*sim_nfi_reg(sim, NFI_CON) & CON_BWR))
+		sim_violation(sim, "custom program without CON_BWR\n");
+
+	if (op != (x4 ? 0x32 : 0x02))
+		sim_violation(sim, "program load with opcode %02xh\n", op);
+
+	if (chip_busy(sim))
+		sim_violation(sim, "program load while busy\n");
+
+	sim_spi_clocks(sim, 8 + 16 + nbytes * 8 / (x4 ? 4 : 1));
+	sim->stats.program_loads++;
+
+	sim_get_fmt(sim, nbytes, &fmt);
+
+	buf = malloc(nbytes);
+	if (!buf)
+		return;
+
+	memset(buf, 0xff, nbytes);
+
+	if (!(cnfg & CNFG_AUTO_FMT_EN)) {
+		src = sim_dma_addr(sim, *sim_nfi_reg(sim, NFI_STRADDR), nbytes);
+		if (src)
+			memcpy(buf, src, nbytes);
+	} else {
+		src = sim_dma_addr(sim, *sim_nfi_reg(sim, NFI_STRADDR),
+				   fmt.sectors * fmt.sector_size);
+
+		for (i = 0; src && i < fmt.sectors; i++) {
+			uint8_t *sect = buf + i * fmt.raw_sector_size;
+
+			memcpy(sect, src + i * fmt.sector_size,
+			       fmt.sector_size);
+			sim_read_fdm(sim, i, sect + fmt.sector_size,
+				     fmt.fdm_size);
+
+			if (ecc)
+				ecc_encode(sim, &fmt, sect);
+		}
+	}
+
+	/* Program load clears the whole cache register first */
+	memset(sim->cache, 0xff, sim->rawpage_size);
+	for (i = 0; i < nbytes && col + i < sim->rawpage_size; i++)
+		sim->cache[col + i] = buf[i];
+
+	free(buf);
+
+	sim_custom_done(sim, CUS_PG_DONE, NFI_IRQ_CUS_PG, NFI_ADDRCNTR,
+			fmt.sectors);
+}
+
+static void sim_start_data(struct snfi_sim *sim)
+{
+	uint32_t cnfg = *sim_nfi_reg(sim, NFI_CNFG);
+
+	switch ((cnfg >> CNFG_OP_MODE_S) & CNFG_OP_MODE_M) {
+	case CNFG_OP_MODE_CUST:
+		sim_custom_read(sim, cnfg);
+		break;
+	case CNFG_OP_MODE_PROGRAM:
+		sim_custom_program(sim, cnfg);
+		break;
+	default:
+		sim_violation(sim, "STR_DATA in NFI mode %x\n", cnfg);
+	}
+}
+
+static struct snfi_sim *sim_lookup(const volatile void *addr, bool *ecc,
+				   uint32_t *reg)
+{
+	struct snfi_sim *sim = cur_sim;
+	uintptr_t a = (uintptr_t)addr;
+	uintptr_t nfi = (uintptr_t)sim->nfi_regs;
+	uintptr_t eccb = (uintptr_t)sim->ecc_regs;
+
+	if (a >= nfi && a < nfi + SNFI_SIM_NFI_SIZE) {
+		*ecc = false;
+		*reg = a - nfi;
+	} else if (a >= eccb && a < eccb + SNFI_SIM_ECC_SIZE) {
+		*ecc = true;
+		*reg = a - eccb;
+	} else {
+		fprintf(stderr, "snfi-sim: access to unknown address %p\n",
+			addr);
+		abort();
+	}
+
+	sim->now += sim->cfg.timing.reg_ns;
+
+	return sim;
+}
+
+uint64_t snfi_sim_now(void)
+{
+	return cur_sim->now;
+}
+
+uint32_t snfi_sim_readl(const volatile void *addr)
+{
+	struct snfi_sim *sim;
+	uint32_t reg, val;
+	bool ecc;
+
+	sim = sim_lookup(addr, &ecc, &reg);
+	sim->stats.reg_reads++;
+
+	if (ecc) {
+		switch (reg) {
+		case ECC_ENCIDLE:
+		case ECC_DECIDLE:
+			return ECC_IDLE;
+		}
+
+		return *sim_ecc_reg(sim, reg);
+	}
+
+	switch (reg) {
+	case NFI_STA:
+	case NFI_FIFOSTA:
+	case NFI_MASTERSTA:
+		return 0;
+
+	case NFI_INTR_STA:
+		val = *sim_nfi_reg(sim, reg);
+		*sim_nfi_reg(sim, reg) = 0;
+		return val;
+	}
+
+	return *sim_nfi_reg(sim, reg);
+}
+
+void snfi_sim_writel(uint32_t val, volatile void *addr)
+{
+	struct snfi_sim *sim;
+	uint32_t reg, *p;
+	bool ecc;
+
+	sim = sim_lookup(addr, &ecc, &reg);
+	sim->stats.reg_writes++;
+
+	if (ecc) {
+		*sim_ecc_reg(sim, reg) = val;
+
+		if (reg == ECC_DECCON)
+			*sim_ecc_reg(sim, ecc_decdone_reg(sim)) = 0;
+		return;
+	}
+
+	p = sim_nfi_reg(sim, reg);
+
+	switch (reg) {
+	case NFI_CON:
+		*p = val & ~(CON_NFI_RST | CON_FIFO_FLUSH);
+		if (val & CON_NFI_RST) {
+			*sim_nfi_reg(sim, NFI_BYTELEN) = 0;
+			*sim_nfi_reg(sim, NFI_ADDRCNTR) = 0;
+		}
+		break;
+
+	case SNF_MISC_CTL:
+		*p = val & ~SW_RST;
+		break;
+
+	case SNF_MAC_CTL:
+		if (val & SF_TRIG) {
+			sim_mac_xfer(sim);
+			val = (val & ~(SF_TRIG | WIP)) | WIP_READY;
+		}
+		*p = val;
+		break;
+
+	case SNF_STA_CTL1:
+		/* Done flags are write-one-to-clear */
+		*p = (*p & ~(val & (CUS_READ_DONE | CUS_PG_DONE))) |
+		     (val & ~(CUS_READ_DONE | CUS_PG_DONE));
+		break;
+
+	case NFI_STRDATA:
+		*p = val;
+		if (val & STR_DATA)
+			sim_start_data(sim);
+		break;
+
+	default:
+		*p = val;
+	}
+}
+
+int snfi_sim_dma_map(struct snfi_sim *sim, void *vaddr, size_t size,
+		     uint32_t *bus)
+{
+	uint32_t i;
+
+	for (i = 0; i < SNFI_SIM_MAX_DMA_MAPS; i++) {
+		if (sim->dma[i].vaddr)
+			continue;
+
+		sim->dma[i].bus = 0x40000000 + i * 0x01000000;
+		sim->dma[i].vaddr = vaddr;
+		sim->dma[i].size = size;
+		*bus = sim->dma[i].bus;
+		return 0;
+	}
+
+	return -ENOMEM;
+}
+
+void snfi_sim_dma_unmap(struct snfi_sim *sim, uint32_t bus)
+{
+	uint32_t i;
+
+	for (i = 0; i < SNFI_SIM_MAX_DMA_MAPS; i++) {
+		if (sim->dma[i].vaddr && sim->dma[i].bus == bus) {
+			sim->dma[i].vaddr = NULL;
+			return;
+		}
+	}
+
+	sim_violation(sim, "unmap of unknown DMA address %08x\n", bus);
+}
+
+int snfi_sim_init(struct snfi_sim *sim, const struct snfi_sim_config *cfg)
+{
+	uint32_t nblocks;
+
+	memset(sim, 0, sizeof(*sim));
+	sim->cfg = *cfg;
+
+	if (!sim->cfg.timing.spi_mhz)
+		return -EINVAL;
+
+	sim->rawpage_size = cfg->pagesize + cfg->sparesize;
+	sim->pages_per_die = cfg->pages_per_block * cfg->blocks_per_die;
+	sim->rng = cfg->seed ? cfg->seed : 1;
+
+	nblocks = cfg->blocks_per_die * cfg->ndies;
+	sim->blocks = calloc(nblocks, sizeof(*sim->blocks));
+	sim->cache = malloc(sim->rawpage_size);
+	if (!sim->blocks || !sim->cache) {
+		snfi_sim_cleanup(sim);
+		return -ENOMEM;
+	}
+
+	chip_reset(sim);
+	sim->busy_until = 0;
+
+	cur_sim = sim;
+
+	return 0;
+}
+
+void snfi_sim_cleanup(struct snfi_sim *sim)
+{
+	uint32_t i;
+
+	if (sim->blocks) {
+		for (i = 0; i < sim->cfg.blocks_per_die * sim->cfg.ndies; i++)
+			free(sim->blocks[i]);
+	}
+
+	free(sim->blocks);
+	free(sim->cache);
+	bch_free(sim->bch);
+
+	sim->blocks = NULL;
+	sim->cache = NULL;
+	sim->bch = NULL;
+
+	if (cur_sim == sim)
+		cur_sim = NULL;
+}
@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Simulated MediaTek NFI/SNFI controller with an attached SPI-NAND chip
+ */
+
+#ifndef _SNFI_SIM_H_
+#define _SNFI_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SNFI_SIM_NFI_SIZE		0x1000
+#define SNFI_SIM_ECC_SIZE		0x200
+#define SNFI_SIM_MAX_DMA_MAPS		4
+
+struct snfi_sim_timing {
+	uint32_t spi_mhz;	/* SPI clock */
+	uint32_t read_us;	/* tRD, array to cache */
+	uint32_t cache_us;	/* tRCBSY, data to cache register of 31h/3Fh */
+	uint32_t prog_us;	/* tPROG */
+	uint32_t erase_us;	/* tBERS */
+	uint32_t reg_ns;	/* one CPU access to a controller register */
+};
+
+struct snfi_sim_config {
+	/* returned by READ ID after the dummy byte */
+	uint8_t id[4];
+
+	uint32_t pagesize;
+	uint32_t sparesize;
+	uint32_t pages_per_block;
+	uint32_t blocks_per_die;
+	uint32_t ndies;
+
+	/* SoC of the controller, selects ECC register layout */
+	uint32_t soc;
+
+	/* bits flipped in a page with bitflip_ppm chance on every array read */
+	uint32_t bitflip_ppm;
+	uint32_t bitflip_bits;
+
+	uint32_t seed;
+	struct snfi_sim_timing timing;
+};
+
+struct snfi_sim_stats {
+	uint64_t reg_reads;
+	uint64_t reg_writes;
+	uint64_t mac_xfers;
+	uint64_t status_polls;
+
+	uint64_t page_reads;		/* 13h */
+	uint64_t cache_seq;		/* 31h */
+	uint64_t cache_last;		/* 3Fh */
+	uint64_t cache_xfers;		/* custom reads from cache */
+	uint64_t program_loads;
+	uint64_t programs;
+	uint64_t erases;
+
+	uint64_t spi_clocks;		/* SPI bus busy time in clocks */
+
+	uint64_t bitflips;		/* injected */
+	uint64_t ecc_corrected;
+	uint64_t ecc_failed;
+
+	/* commands the chip or controller would have ignored or rejected */
+	uint64_t violations;
+};
+
+struct bch;
+
+struct snfi_sim_dma_map {
+	uint32_t bus;
+	void *vaddr;
+	size_t size;
+};
+
+struct snfi_sim {
+	struct snfi_sim_config cfg;
+
+	/* register space handed to the driver as nfi_base/ecc_base */
+	uint32_t nfi_regs[SNFI_SIM_NFI_SIZE / 4];
+	uint32_t ecc_regs[SNFI_SIM_ECC_SIZE / 4];
+
+	struct snfi_sim_dma_map dma[SNFI_SIM_MAX_DMA_MAPS];
+
+	/* simulated time in ns */
+	uint64_t now;
+
+	/* chip */
+	uint32_t rawpage_size;
+	uint32_t pages_per_die;
+	uint8_t **blocks;	/* NULL when erased */
+	uint8_t *cache;		/* cache register, with injected bitflips */
+	uint8_t features[256];
+	uint32_t die;
+	uint64_t busy_until;
+
+	/* page held by the data register, for 31h/3Fh */
+	int64_t data_page;
+	uint64_t data_ready;
+	bool seq_active;
+
+	/* ECC engine */
+	struct bch *bch;
+
+	uint64_t rng;
+
+	struct snfi_sim_stats stats;
+};
+
+int snfi_sim_init(struct snfi_sim *sim, const struct snfi_sim_config *cfg);
+void snfi_sim_cleanup(struct snfi_sim *sim);
+
+uint64_t snfi_sim_now(void);
+uint32_t snfi_sim_readl(const volatile void *addr);
+void snfi_sim_writel(uint32_t val, volatile void *addr);
+
+int snfi_sim_dma_map(struct snfi_sim *sim, void *vaddr, size_t size,
+		     uint32_t *bus);
+void snfi_sim_dma_unmap(struct snfi_sim *sim, uint32_t bus);
+
+#endif /* _SNFI_SIM_H_ */
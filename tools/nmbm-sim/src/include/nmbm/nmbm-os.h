@@ -0,0 +1,68 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Host OS-dependent definitions for NAND Mapped-block Management (NMBM)
+ *
+ * Lets nmbm-core.c be built as a userspace program against a simulated
+ * lower device.
+ */
+
+#ifndef _NMBM_OS_H_
+#define _NMBM_OS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
+
+#ifndef EUCLEAN
+#define EUCLEAN		117
+#endif
+
+#ifndef EBADMSG
+#define EBADMSG		74
+#endif
+
+#ifndef ENOTSUPP
+#define ENOTSUPP	524
+#endif
+
+#define is_power_of_2(n)	((n) != 0 && (((n) & ((n) - 1)) == 0))
+
+/* Same as the kernel's crc32_le(): reflected, no pre/post inversion */
+static inline uint32_t nmbm_crc32(uint32_t crcval, const void *buf, size_t size)
+{
+	static uint32_t table[256];
+	const unsigned char *p = buf;
+	uint32_t i, j, c;
+
+	if (!table[1]) {
+		for (i = 0; i < 256; i++) {
+			c = i;
+			for (j = 0; j < 8; j++)
+				c = (c >> 1) ^ ((c & 1) ? 0xedb88320 : 0);
+			table[i] = c;
+		}
+	}
+
+	while (size--)
+		crcval = table[(crcval ^ *p++) & 0xff] ^ (crcval >> 8);
+
+	return crcval;
+}
+
+static inline uint32_t nmbm_lldiv(uint64_t dividend, uint32_t divisor)
+{
+	return dividend / divisor;
+}
+
+#define WATCHDOG_RESET()
+
+#ifndef NMBM_DEFAULT_LOG_LEVEL
+#define NMBM_DEFAULT_LOG_LEVEL		1
+#endif
+
+#endif /* _NMBM_OS_H_ */
@@ -0,0 +1,557 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * File-backed NAND simulator for the host build of NMBM
+ *
+ * Each page is stored as writesize + oobsize bytes in a sparse file. The
+ * contents are stored inverted so that holes read back as erased (0xff)
+ * pages and an erase can simply punch a hole.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "nand-sim.h"
+
+uint64_t nand_sim_rand(struct nand_sim *ns)
+{
+	/* xorshift64* */
+	ns->rng ^= ns->rng >> 12;
+	ns->rng ^= ns->rng << 25;
+	ns->rng ^= ns->rng >> 27;
+
+	return ns->rng * 0x2545f4914f6cdd1dULL;
+}
+
+static bool nand_sim_chance(struct nand_sim *ns, uint32_t ppm)
+{
+	if (!ppm)
+		return false;
+
+	return nand_sim_rand(ns) % 1000000 < ppm;
+}
+
+static uint32_t nand_sim_ba(struct nand_sim *ns, uint64_t addr)
+{
+	return addr / ns->cfg.erasesize;
+}
+
+static off_t nand_sim_offset(struct nand_sim *ns, uint64_t addr)
+{
+	uint64_t page = addr / ns->cfg.writesize;
+
+	return (off_t)(page * ns->rawpage_size);
+}
+
+static enum nand_sim_region nand_sim_region(struct nand_sim *ns, uint32_t ba)
+{
+	if (ns->is_mgmt && ns->is_mgmt(ns->priv, ba))
+		return NS_REGION_MGMT;
+
+	return NS_REGION_DATA;
+}
+
+static uint64_t nand_sim_xfer_us(struct nand_sim *ns)
+{
+	return ((uint64_t)ns->rawpage_size * ns->cfg.timing.ns_per_byte) / 1000;
+}
+
+static int nand_sim_load(struct nand_sim *ns, uint64_t addr, uint8_t *raw)
+{
+	ssize_t ret;
+	uint32_t i;
+
+	ret = pread(ns->fd, raw, ns->rawpage_size, nand_sim_offset(ns, addr));
+	if (ret < 0)
+		return -errno;
+
+	if (ret < ns->rawpage_size)
+		memset(raw + ret, 0, ns->rawpage_size - ret);
+
+	for (i = 0; i < ns->rawpage_size; i++)
+		raw[i] = ~raw[i];
+
+	return 0;
+}
+
+static int nand_sim_store(struct nand_sim *ns, uint64_t addr,
+			  const uint8_t *raw)
+{
+	uint8_t *inv = ns->buf + ns->rawpage_size;
+	ssize_t ret;
+	uint32_t i;
+
+	for (i = 0; i < ns->rawpage_size; i++)
+		inv[i] = ~raw[i];
+
+	ret = pwrite(ns->fd, inv, ns->rawpage_size, nand_sim_offset(ns, addr));
+	if (ret != ns->rawpage_size)
+		return ret < 0 ? -errno : -EIO;
+
+	return 0;
+}
+
+static void nand_sim_flip_bits(struct nand_sim *ns, uint8_t *buf, size_t len,
+			       uint32_t count)
+{
+	uint64_t bit;
+
+	while (count--) {
+		bit = nand_sim_rand(ns) % (len * 8);
+		buf[bit / 8] ^= 1 << (bit % 8);
+	}
+}
+
+static void nand_sim_oob_layout(struct nand_sim *ns, enum nmbm_oob_mode mode,
+				uint32_t *off, uint32_t *len)
+{
+	/* The first two spare bytes hold the bad block marker */
+	if (mode == NMBM_MODE_AUTO_OOB) {
+		*off = 2;
+		*len = ns->cfg.oobsize - 2;
+	} else {
+		*off = 0;
+		*len = ns->cfg.oobsize;
+	}
+}
+
+static int nand_sim_read_one(struct nand_sim *ns, uint64_t addr, void *buf,
+			     void *oob, enum nmbm_oob_mode mode)
+{
+	uint8_t *raw = ns->buf;
+	uint32_t flips = 0, ooboff, ooblen;
+	int ret;
+
+	ret = nand_sim_load(ns, addr, raw);
+	if (ret)
+		return ret;
+
+	ns->stats.page_reads++;
+	ns->stats.busy_us += ns->cfg.timing.read_us + nand_sim_xfer_us(ns);
+
+	if (nand_sim_chance(ns, ns->cfg.bitflip_ppm))
+		flips = 1 + nand_sim_rand(ns) % (ns->cfg.ecc_strength + 2);
+
+	ret = 0;
+
+	if (flips) {
+		ns->stats.bitflips += flips;
+
+		if (mode == NMBM_MODE_RAW || flips > ns->cfg.ecc_strength) {
+			/* Uncorrected data goes out with the flips in it */
+			nand_sim_flip_bits(ns, raw, ns->rawpage_size, flips);
+
+			if (mode != NMBM_MODE_RAW) {
+				ns->stats.ecc_failures++;
+				ret = -EBADMSG;
+			}
+		} else {
+			ret = flips;
+		}
+	}
+
+	if (buf)
+		memcpy(buf, raw, ns->cfg.writesize);
+
+	if (oob) {
+		nand_sim_oob_layout(ns, mode, &ooboff, &ooblen);
+		memcpy(oob, raw + ns->cfg.writesize + ooboff, ooblen);
+	}
+
+	return ret;
+}
+
+static int nand_sim_read_page(void *arg, uint64_t addr, void *buf, void *oob,
+			      enum nmbm_oob_mode mode)
+{
+	struct nand_sim *ns = arg;
+
+	ns->stats.read_requests++;
+
+	return nand_sim_read_one(ns, addr, buf, oob, mode);
+}
+
+static int nand_sim_read_pages(void *arg, uint64_t addr, uint32_t count,
+			       void *buf, enum nmbm_oob_mode mode)
+{
+	struct nand_sim *ns = arg;
+	uint8_t *ptr = buf;
+	bool has_ecc_err = false;
+	int ret, max_bitflips = 0;
+
+	ns->stats.read_requests++;
+
+	while (count--) {
+		ret = nand_sim_read_one(ns, addr, ptr, NULL, mode);
+		if (ret == -EBADMSG)
+			has_ecc_err = true;
+		else if (ret < 0)
+			return ret;
+		else if (ret > max_bitflips)
+			max_bitflips = ret;
+
+		addr += ns->cfg.writesize;
+		ptr += ns->cfg.writesize;
+	}
+
+	return has_ecc_err ? -EBADMSG : max_bitflips;
+}
+
+enum nand_sim_power {
+	NS_POWER_ON,
+	NS_POWER_CUT,
+	NS_POWER_OFF,
+};
+
+/*
+ * nand_sim_power - Account a program/erase operation against power-cut
+ *
+ * Returns NS_POWER_CUT for the operation during which power is lost. Once
+ * power is lost, all later operations are dropped silently, as nothing
+ * issued after that point can reach the chip.
+ */
+static enum nand_sim_power nand_sim_power(struct nand_sim *ns)
+{
+	if (ns->powered_off)
+		return NS_POWER_OFF;
+
+	ns->ops++;
+
+	if (ns->cut_at && ns->ops >= ns->cut_at) {
+		ns->powered_off = true;
+		return NS_POWER_CUT;
+	}
+
+	return NS_POWER_ON;
+}
+
+static int nand_sim_program(struct nand_sim *ns, uint64_t addr,
+			    const uint8_t *data, uint32_t len)
+{
+	uint8_t *raw = ns->buf;
+	bool blank = true;
+	uint32_t i;
+	int ret;
+
+	ret = nand_sim_load(ns, addr, raw);
+	if (ret)
+		return ret;
+
+	/* Programming can only clear bits */
+	for (i = 0; i < len; i++) {
+		if (raw[i] != 0xff)
+			blank = false;
+
+		raw[i] &= data[i];
+	}
+
+	if (!blank)
+		ns->stats.overwrites++;
+
+	return nand_sim_store(ns, addr, raw);
+}
+
+static int nand_sim_write_page(void *arg, uint64_t addr, const void *buf,
+			       const void *oob, enum nmbm_oob_mode mode)
+{
+	struct nand_sim *ns = arg;
+	uint8_t *page = ns->buf + 2 * ns->rawpage_size;
+	uint32_t ba = nand_sim_ba(ns, addr), ooboff, ooblen;
+	enum nand_sim_power power;
+
+	memset(page, 0xff, ns->rawpage_size);
+
+	if (buf)
+		memcpy(page, buf, ns->cfg.writesize);
+
+	if (oob) {
+		nand_sim_oob_layout(ns, mode, &ooboff, &ooblen);
+		memcpy(page + ns->cfg.writesize + ooboff, oob, ooblen);
+	}
+
+	power = nand_sim_power(ns);
+	if (power == NS_POWER_OFF)
+		return 0;
+
+	if (power == NS_POWER_CUT) {
+		/* Interrupted program: only part of the page made it */
+		return nand_sim_program(ns, addr, page,
+					nand_sim_rand(ns) % ns->rawpage_size);
+	}
+
+	ns->stats.page_writes[nand_sim_region(ns, ba)]++;
+	ns->stats.busy_us += ns->cfg.timing.prog_us + nand_sim_xfer_us(ns);
+
+	if (ns->worn[ba] || nand_sim_chance(ns, ns->cfg.write_fail_ppm)) {
+		ns->worn[ba] = 1;
+		ns->stats.write_failures++;
+		return -EIO;
+	}
+
+	return nand_sim_program(ns, addr, page, ns->rawpage_size);
+}
+
+static int nand_sim_erase_pages(struct nand_sim *ns, uint64_t addr,
+				uint32_t count)
+{
+	off_t off = nand_sim_offset(ns, addr);
+	off_t len = (off_t)count * ns->rawpage_size;
+	uint8_t *zero = ns->buf + ns->rawpage_size;
+	uint32_t i;
+
+	if (!count)
+		return 0;
+
+#ifdef FALLOC_FL_PUNCH_HOLE
+	if (!fallocate(ns->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off,
+		       len))
+		return 0;
+#endif
+
+	memset(zero, 0, ns->rawpage_size);
+
+	for (i = 0; i < count; i++) {
+		if (pwrite(ns->fd, zero, ns->rawpage_size,
+			   off + (off_t)i * ns->rawpage_size) != ns->rawpage_size)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+static int nand_sim_erase_block(void *arg, uint64_t addr)
+{
+	struct nand_sim *ns = arg;
+	uint32_t ba = nand_sim_ba(ns, addr), done;
+	uint8_t *junk = ns->buf + 2 * ns->rawpage_size;
+	uint64_t start = (uint64_t)ba * ns->cfg.erasesize;
+	enum nand_sim_power power;
+	uint32_t i;
+
+	power = nand_sim_power(ns);
+	if (power == NS_POWER_OFF)
+		return 0;
+
+	if (power == NS_POWER_CUT) {
+		/*
+		 * Interrupted erase: leading pages are erased, the page
+		 * at the cut point is half-erased garbage.
+		 */
+		done = nand_sim_rand(ns) % ns->pages_per_block;
+		if (nand_sim_erase_pages(ns, start, done))
+			return -EIO;
+
+		for (i = 0; i < ns->rawpage_size; i++)
+			junk[i] = nand_sim_rand(ns);
+
+		nand_sim_load(ns, start + (uint64_t)done * ns->cfg.writesize,
+			      ns->buf);
+		for (i = 0; i < ns->rawpage_size; i++)
+			junk[i] |= ns->buf[i];
+
+		return nand_sim_store(ns, start +
+				      (uint64_t)done * ns->cfg.writesize, junk);
+	}
+
+	ns->stats.block_erases[nand_sim_region(ns, ba)]++;
+	ns->stats.busy_us += ns->cfg.timing.erase_us;
+
+	if (ns->worn[ba] || nand_sim_chance(ns, ns->cfg.erase_fail_ppm)) {
+		ns->worn[ba] = 1;
+		ns->stats.erase_failures++;
+		return -EIO;
+	}
+
+	return nand_sim_erase_pages(ns, start, ns->pages_per_block);
+}
+
+static int nand_sim_is_bad_block(void *arg, uint64_t addr)
+{
+	struct nand_sim *ns = arg;
+	uint64_t start = (uint64_t)nand_sim_ba(ns, addr) * ns->cfg.erasesize;
+
+	if (nand_sim_load(ns, start, ns->buf))
+		return 1;
+
+	return ns->buf[ns->cfg.writesize] != 0xff;
+}
+
+static int nand_sim_mark_bad_block(void *arg, uint64_t addr)
+{
+	struct nand_sim *ns = arg;
+	uint64_t start = (uint64_t)nand_sim_ba(ns, addr) * ns->cfg.erasesize;
+	int ret;
+
+	if (nand_sim_power(ns) != NS_POWER_ON)
+		return 0;
+
+	ns->stats.marked_bad++;
+	ns->worn[nand_sim_ba(ns, addr)] = 1;
+
+	ret = nand_sim_load(ns, start, ns->buf);
+	if (ret)
+		return ret;
+
+	ns->buf[ns->cfg.writesize] = 0;
+
+	return nand_sim_store(ns, start, ns->buf);
+}
+
+/* NMBM must never nest or unbalance its mapping sections */
+static void nand_sim_lock_mapping(void *arg)
+{
+	struct nand_sim *ns = arg;
+
+	if (ns->mapping_locked) {
+		fprintf(stderr, "mapping locked twice\n");
+		abort();
+	}
+
+	ns->mapping_locked = true;
+}
+
+static void nand_sim_unlock_mapping(void *arg)
+{
+	struct nand_sim *ns = arg;
+
+	if (!ns->mapping_locked) {
+		fprintf(stderr, "mapping unlocked without lock\n");
+		abort();
+	}
+
+	ns->mapping_locked = false;
+}
+
+static void nand_sim_logprint(void *arg, enum nmbm_log_category level,
+			      const char *fmt, va_list ap)
+{
+	struct nand_sim *ns = arg;
+
+	if (level < ns->log_level)
+		return;
+
+	fprintf(stderr, "nmbm: ");
+	vfprintf(stderr, fmt, ap);
+}
+
+void nand_sim_setup_lower(struct nand_sim *ns, struct nmbm_lower_device *nld)
+{
+	memset(nld, 0, sizeof(*nld));
+
+	nld->size = ns->cfg.size;
+	nld->erasesize = ns->cfg.erasesize;
+	nld->writesize = ns->cfg.writesize;
+	nld->oobsize = ns->cfg.oobsize;
+	nld->oobavail = ns->cfg.oobsize - 2;
+
+	nld->arg = ns;
+	nld->read_page = nand_sim_read_page;
+	nld->read_pages = nand_sim_read_pages;
+	nld->write_page = nand_sim_write_page;
+	nld->erase_block = nand_sim_erase_block;
+	nld->is_bad_block = nand_sim_is_bad_block;
+	nld->mark_bad_block = nand_sim_mark_bad_block;
+	nld->lock_mapping = nand_sim_lock_mapping;
+	nld->unlock_mapping = nand_sim_unlock_mapping;
+	nld->logprint = nand_sim_logprint;
+}
+
+/*
+ * nand_sim_power_cut - Lose power during the program/erase operation
+ *                      @after_ops operations from now. 0 disarms.
+ */
+void nand_sim_power_cut(struct nand_sim *ns, uint64_t after_ops)
+{
+	ns->cut_at = after_ops ? ns->ops + after_ops : 0;
+}
+
+void nand_sim_power_on(struct nand_sim *ns)
+{
+	ns->cut_at = 0;
+	ns->powered_off = false;
+}
+
+int nand_sim_open(struct nand_sim *ns, const char *path,
+		  const struct nand_sim_config *cfg, bool create)
+{
+	uint64_t rawsize, addr;
+	uint32_t i, ba;
+	int flags = O_RDWR;
+
+	memset(ns, 0, sizeof(*ns));
+	ns->fd = -1;
+	ns->cfg = *cfg;
+	ns->log_level = NMBM_LOG_WARN;
+	ns->rng = cfg->seed ? cfg->seed : 0x4e4d424d;
+
+	if (!cfg->erasesize || !cfg->writesize || cfg->oobsize < 4 ||
+	    cfg->erasesize % cfg->writesize || cfg->size % cfg->erasesize) {
+		fprintf(stderr, "Invalid NAND geometry\n");
+		return -EINVAL;
+	}
+
+	ns->block_count = cfg->size / cfg->erasesize;
+	ns->pages_per_block = cfg->erasesize / cfg->writesize;
+	ns->rawpage_size = cfg->writesize + cfg->oobsize;
+	rawsize = (uint64_t)ns->block_count * ns->pages_per_block *
+		  ns->rawpage_size;
+
+	ns->buf = malloc(3 * ns->rawpage_size);
+	ns->worn = calloc(ns->block_count, 1);
+	if (!ns->buf || !ns->worn) {
+		nand_sim_close(ns);
+		return -ENOMEM;
+	}
+
+	if (create)
+		flags |= O_CREAT | O_TRUNC;
+
+	ns->fd = open(path, flags, 0644);
+	if (ns->fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", path,
+			strerror(errno));
+		nand_sim_close(ns);
+		return -errno;
+	}
+
+	if (!create)
+		return 0;
+
+	if (ftruncate(ns->fd, (off_t)rawsize)) {
+		fprintf(stderr, "Failed to size %s: %s\n", path,
+			strerror(errno));
+		nand_sim_close(ns);
+		return -EIO;
+	}
+
+	/* Factory bad blocks, block 0 is guaranteed good */
+	for (i = 0; i < cfg->factory_bad && ns->block_count > 1; i++) {
+		ba = 1 + nand_sim_rand(ns) % (ns->block_count - 1);
+		addr = (uint64_t)ba * cfg->erasesize;
+
+		memset(ns->buf, 0xff, ns->rawpage_size);
+		ns->buf[cfg->writesize] = 0;
+		nand_sim_store(ns, addr, ns->buf);
+		ns->worn[ba] = 1;
+	}
+
+	return 0;
+}
+
+void nand_sim_close(struct nand_sim *ns)
+{
+	if (ns->fd >= 0)
+		close(ns->fd);
+
+	free(ns->buf);
+	free(ns->worn);
+
+	ns->fd = -1;
+	ns->buf = NULL;
+	ns->worn = NULL;
+}
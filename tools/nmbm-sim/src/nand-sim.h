@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * File-backed NAND simulator for the host build of NMBM
+ */
+
+#ifndef _NAND_SIM_H_
+#define _NAND_SIM_H_
+
+#include <nmbm/nmbm.h>
+
+struct nand_sim_timing {
+	uint32_t read_us;
+	uint32_t prog_us;
+	uint32_t erase_us;
+	uint32_t ns_per_byte;
+};
+
+struct nand_sim_config {
+	uint64_t size;
+	uint32_t erasesize;
+	uint32_t writesize;
+	uint32_t oobsize;
+
+	uint32_t ecc_strength;
+
+	/* fault injection, in parts per million of operations */
+	uint32_t bitflip_ppm;
+	uint32_t erase_fail_ppm;
+	uint32_t write_fail_ppm;
+
+	/* number of blocks marked bad when the image is created */
+	uint32_t factory_bad;
+
+	uint32_t seed;
+	struct nand_sim_timing timing;
+};
+
+enum nand_sim_region {
+	NS_REGION_DATA,
+	NS_REGION_MGMT,
+
+	__NS_REGION_MAX
+};
+
+struct nand_sim_stats {
+	uint64_t page_reads;
+	uint64_t read_requests;
+	uint64_t page_writes[__NS_REGION_MAX];
+	uint64_t block_erases[__NS_REGION_MAX];
+	uint64_t bitflips;
+	uint64_t ecc_failures;
+	uint64_t erase_failures;
+	uint64_t write_failures;
+	uint64_t overwrites;
+	uint64_t marked_bad;
+
+	/* chip busy time according to the timing model */
+	uint64_t busy_us;
+};
+
+struct nand_sim {
+	struct nand_sim_config cfg;
+
+	int fd;
+	uint32_t block_count;
+	uint32_t pages_per_block;
+	uint32_t rawpage_size;
+	uint8_t *buf;
+	uint8_t *worn;
+	uint64_t rng;
+
+	struct nand_sim_stats stats;
+
+	/* program/erase operations since open, drives power-cut injection */
+	uint64_t ops;
+	uint64_t cut_at;
+	bool powered_off;
+
+	/* inside a mapping change section of NMBM */
+	bool mapping_locked;
+
+	/* log messages below this level are dropped */
+	enum nmbm_log_category log_level;
+
+	/* tells table writes from data writes for accounting */
+	bool (*is_mgmt)(void *priv, uint32_t ba);
+	void *priv;
+};
+
+int nand_sim_open(struct nand_sim *ns, const char *path,
+		  const struct nand_sim_config *cfg, bool create);
+void nand_sim_close(struct nand_sim *ns);
+
+void nand_sim_setup_lower(struct nand_sim *ns, struct nmbm_lower_device *nld);
+
+void nand_sim_power_cut(struct nand_sim *ns, uint64_t after_ops);
+void nand_sim_power_on(struct nand_sim *ns);
+
+uint64_t nand_sim_rand(struct nand_sim *ns);
+
+#endif /* _NAND_SIM_H_ */
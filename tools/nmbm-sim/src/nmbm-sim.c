@@ -0,0 +1,974 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Host simulator for NAND Mapped-block Management (NMBM)
+ *
+ * Runs the unmodified nmbm-core.c on top of a sparse-file backed NAND
+ * simulator to measure attach time, remap rate and info table write
+ * amplification, and to check recovery from power cuts during table
+ * updates, without wearing out real flash.
+ *
+ * Examples:
+ *   nmbm-sim -s 128M,256M,512M -E 300 -W 50 -n 20 bench
+ *   nmbm-sim -s 64M -B 200 -E 200 -W 50 -n 20000 stress
+ *   nmbm-sim -s 32M powercut
+ *   nmbm-sim -s 64M -F 4 -n 2000 read
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "nmbm-private.h"
+#include "nand-sim.h"
+
+#define GEN_UNKNOWN		UINT32_MAX
+
+/* blocks holding known data while sweeping power cuts */
+#define POWERCUT_BLOCKS		8
+
+/* logic blocks written for the read test, and the longest range read */
+#define READ_BLOCKS		64
+#define READ_MAX_BLOCKS		4
+
+struct sim {
+	struct nand_sim ns;
+	struct nmbm_lower_device nld;
+	struct nmbm_instance *ni;
+
+	uint32_t *gen;
+	int32_t *mapping;
+	uint8_t *buf;
+	uint8_t *ref;
+
+	uint64_t uncorrectable;
+	uint64_t mismatches;
+};
+
+struct attach_result {
+	uint64_t wall_us;
+	uint64_t busy_us;
+	uint64_t reads;
+};
+
+static struct nand_sim_config cfg = {
+	.erasesize = 128 * 1024,
+	.writesize = 2048,
+	.oobsize = 64,
+	.ecc_strength = 4,
+	.seed = 1,
+	.timing = {
+		/* Typical quad SPI-NAND */
+		.read_us = 60,
+		.prog_us = 400,
+		.erase_us = 3000,
+		.ns_per_byte = 20,
+	},
+};
+
+static const char *image = "nmbm-sim.img";
+static const char *sizes = "128M,256M,512M";
+static uint32_t max_ratio = 1;
+static uint32_t max_reserved_blocks = 256;
+static uint32_t count;
+static int extra_flags;
+static bool single_page_reads;
+static enum nmbm_log_category log_level = NMBM_LOG_WARN;
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t parse_size(const char *str, char **end)
+{
+	uint64_t val = strtoull(str, end, 0);
+
+	switch (**end) {
+	case 'g':
+	case 'G':
+		val <<= 10;
+		/* fall through */
+	case 'm':
+	case 'M':
+		val <<= 10;
+		/* fall through */
+	case 'k':
+	case 'K':
+		val <<= 10;
+		(*end)++;
+		break;
+	}
+
+	return val;
+}
+
+static bool sim_is_mgmt(void *priv, uint32_t ba)
+{
+	struct nmbm_instance *ni = priv;
+
+	if (ba == ni->signature_ba)
+		return true;
+
+	/* Remapped data blocks are taken from the top of the area */
+	return ba >= ni->mgmt_start_ba && ba < ni->mapping_blocks_top_ba;
+}
+
+static void sim_fill_page(uint8_t *buf, uint32_t size, uint64_t page,
+			  uint32_t gen)
+{
+	uint64_t x = (page + 1) * 0x9e3779b97f4a7c15ULL ^ gen;
+	uint32_t i;
+
+	if (!gen) {
+		memset(buf, 0xff, size);
+		return;
+	}
+
+	for (i = 0; i < size; i += sizeof(x)) {
+		x ^= x >> 12;
+		x ^= x << 25;
+		x ^= x >> 27;
+		memcpy(buf + i, &x, sizeof(x));
+	}
+}
+
+static int sim_open(struct sim *s, bool create)
+{
+	int ret;
+
+	ret = nand_sim_open(&s->ns, image, &cfg, create);
+	if (ret)
+		return ret;
+
+	s->ns.log_level = log_level;
+
+	nand_sim_setup_lower(&s->ns, &s->nld);
+	if (single_page_reads)
+		s->nld.read_pages = NULL;
+	s->nld.max_ratio = max_ratio;
+	s->nld.max_reserved_blocks = max_reserved_blocks;
+
+	s->buf = malloc(cfg.erasesize);
+	s->ref = malloc(cfg.erasesize);
+	s->gen = calloc(s->ns.block_count, sizeof(*s->gen));
+	s->mapping = calloc(s->ns.block_count, sizeof(*s->mapping));
+	if (!s->buf || !s->ref || !s->gen || !s->mapping)
+		return -ENOMEM;
+
+	s->uncorrectable = 0;
+	s->mismatches = 0;
+
+	return 0;
+}
+
+static void sim_drop(struct sim *s)
+{
+	free(s->ni);
+	s->ni = NULL;
+	s->ns.is_mgmt = NULL;
+	s->ns.priv = NULL;
+}
+
+static void sim_close(struct sim *s)
+{
+	sim_drop(s);
+	nand_sim_close(&s->ns);
+
+	free(s->buf);
+	free(s->ref);
+	free(s->gen);
+	free(s->mapping);
+}
+
+static int sim_attach(struct sim *s, bool create, struct attach_result *res)
+{
+	struct nand_sim_stats before = s->ns.stats;
+	uint64_t start;
+	int ret;
+
+	s->nld.flags = extra_flags | (create ? NMBM_F_CREATE : 0);
+
+	s->ni = calloc(1, nmbm_calc_structure_size(&s->nld));
+	if (!s->ni)
+		return -ENOMEM;
+
+	start = now_us();
+	ret = nmbm_attach(&s->nld, s->ni);
+
+	if (res) {
+		res->wall_us = now_us() - start;
+		res->busy_us = s->ns.stats.busy_us - before.busy_us;
+		res->reads = s->ns.stats.page_reads - before.page_reads;
+	}
+
+	if (ret) {
+		sim_drop(s);
+		return ret;
+	}
+
+	s->ns.is_mgmt = sim_is_mgmt;
+	s->ns.priv = s->ni;
+
+	return 0;
+}
+
+static void sim_detach(struct sim *s)
+{
+	nmbm_detach(s->ni);
+	sim_drop(s);
+}
+
+static int sim_write_block(struct sim *s, uint32_t lb)
+{
+	uint64_t addr = (uint64_t)lb * cfg.erasesize;
+	uint32_t off, gen;
+	size_t retlen;
+	int ret;
+
+	gen = s->gen[lb] == GEN_UNKNOWN ? 1 : s->gen[lb] + 1;
+	s->gen[lb] = GEN_UNKNOWN;
+
+	ret = nmbm_erase_block_range(s->ni, addr, cfg.erasesize, NULL);
+	if (ret)
+		return ret;
+
+	for (off = 0; off < cfg.erasesize; off += cfg.writesize)
+		sim_fill_page(s->buf + off, cfg.writesize,
+			      (addr + off) / cfg.writesize, gen);
+
+	ret = nmbm_write_range(s->ni, addr, cfg.erasesize, s->buf,
+			       NMBM_MODE_PLACE_OOB, &retlen);
+	if (ret)
+		return ret;
+
+	s->gen[lb] = gen;
+
+	return 0;
+}
+
+/*
+ * sim_update_block - Rewrite a logic block like UBI does
+ *
+ * A failed program leaves the block waiting for remap, which happens on
+ * the next erase, so retry once. Returns -ENOSPC once the logic block has
+ * become unusable because no spare block was left.
+ */
+static int sim_update_block(struct sim *s, uint32_t lb)
+{
+	int ret;
+
+	ret = sim_write_block(s, lb);
+	if (ret == -EIO)
+		ret = sim_write_block(s, lb);
+
+	if (ret && nmbm_check_bad_block(s->ni, (uint64_t)lb * cfg.erasesize))
+		return -ENOSPC;
+
+	return ret;
+}
+
+static int sim_verify_block(struct sim *s, uint32_t lb)
+{
+	uint64_t addr = (uint64_t)lb * cfg.erasesize;
+	uint32_t off;
+	size_t retlen;
+	int ret;
+
+	if (s->gen[lb] == GEN_UNKNOWN || nmbm_check_bad_block(s->ni, addr))
+		return 0;
+
+	ret = nmbm_read_range(s->ni, addr, cfg.erasesize, s->buf,
+			      NMBM_MODE_PLACE_OOB, &retlen);
+	if (ret == -EBADMSG) {
+		s->uncorrectable++;
+		return 0;
+	}
+
+	if (ret < 0) {
+		fprintf(stderr, "Failed to read logic block %u: %d\n", lb, ret);
+		s->mismatches++;
+		return ret;
+	}
+
+	for (off = 0; off < cfg.erasesize; off += cfg.writesize)
+		sim_fill_page(s->ref + off, cfg.writesize,
+			      (addr + off) / cfg.writesize, s->gen[lb]);
+
+	if (memcmp(s->buf, s->ref, cfg.erasesize)) {
+		fprintf(stderr, "Data mismatch in logic block %u\n", lb);
+		s->mismatches++;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static uint32_t sim_verify_all(struct sim *s)
+{
+	uint32_t lb, failed = 0;
+
+	for (lb = 0; lb < s->ni->data_block_count; lb++) {
+		if (sim_verify_block(s, lb))
+			failed++;
+	}
+
+	return failed;
+}
+
+static void sim_snapshot_mapping(struct sim *s)
+{
+	memcpy(s->mapping, s->ni->block_mapping,
+	       s->ni->data_block_count * sizeof(*s->mapping));
+}
+
+static uint32_t sim_count_remapped(struct sim *s)
+{
+	uint32_t lb, n = 0;
+
+	for (lb = 0; lb < s->ni->data_block_count; lb++) {
+		if (s->ni->block_mapping[lb] != s->mapping[lb])
+			n++;
+	}
+
+	return n;
+}
+
+static void print_stats(struct sim *s)
+{
+	struct nand_sim_stats *st = &s->ns.stats;
+
+	printf("page reads:         %llu in %llu requests\n",
+	       (unsigned long long)st->page_reads,
+	       (unsigned long long)st->read_requests);
+	printf("page writes:        %llu data, %llu management\n",
+	       (unsigned long long)st->page_writes[NS_REGION_DATA],
+	       (unsigned long long)st->page_writes[NS_REGION_MGMT]);
+	printf("block erases:       %llu data, %llu management\n",
+	       (unsigned long long)st->block_erases[NS_REGION_DATA],
+	       (unsigned long long)st->block_erases[NS_REGION_MGMT]);
+	printf("injected bitflips:  %llu (%llu uncorrectable reads)\n",
+	       (unsigned long long)st->bitflips,
+	       (unsigned long long)st->ecc_failures);
+	printf("injected failures:  %llu erase, %llu write\n",
+	       (unsigned long long)st->erase_failures,
+	       (unsigned long long)st->write_failures);
+	printf("blocks marked bad:  %llu\n",
+	       (unsigned long long)st->marked_bad);
+	printf("overwritten pages:  %llu\n",
+	       (unsigned long long)st->overwrites);
+}
+
+static int bench_one(uint64_t size)
+{
+	struct attach_result create, boot;
+	struct nand_sim_stats *st;
+	uint64_t written = 0;
+	uint32_t pass, lb, remapped;
+	const char *end = NULL;
+	double gib, amp;
+	struct sim s;
+	int ret;
+
+	memset(&s, 0, sizeof(s));
+	cfg.size = size;
+
+	ret = sim_open(&s, true);
+	if (ret)
+		goto out;
+
+	ret = sim_attach(&s, true, &create);
+	if (ret) {
+		fprintf(stderr, "Failed to create NMBM: %d\n", ret);
+		goto out;
+	}
+
+	sim_detach(&s);
+
+	ret = sim_attach(&s, false, &boot);
+	if (ret) {
+		fprintf(stderr, "Failed to attach NMBM: %d\n", ret);
+		goto out;
+	}
+
+	sim_snapshot_mapping(&s);
+	memset(&s.ns.stats, 0, sizeof(s.ns.stats));
+
+	for (pass = 0; pass < count && !end; pass++) {
+		for (lb = 0; lb < s.ni->data_block_count; lb++) {
+			ret = sim_update_block(&s, lb);
+			if (ret == -ENOSPC || ret == -EROFS) {
+				/* Out of spare blocks, or tables can't be saved */
+				end = ret == -ENOSPC ? "spares" : "tables";
+				break;
+			}
+
+			if (!ret)
+				written += cfg.erasesize;
+		}
+	}
+
+	ret = 0;
+	st = &s.ns.stats;
+	remapped = sim_count_remapped(&s);
+	gib = (double)written / (1ULL << 30);
+	amp = st->page_writes[NS_REGION_DATA] ?
+	      100.0 * st->page_writes[NS_REGION_MGMT] /
+	      st->page_writes[NS_REGION_DATA] : 0;
+
+	printf("%6lluM %7u %7u %9.1f %9.1f %8llu %10.1f %6llu %8u %9.2f %8llu %7llu %7.3f ",
+	       (unsigned long long)(size >> 20), s.ns.block_count,
+	       s.ni->data_block_count,
+	       create.busy_us / 1000.0, boot.busy_us / 1000.0,
+	       (unsigned long long)boot.reads,
+	       (double)written / (1 << 20),
+	       (unsigned long long)st->marked_bad, remapped,
+	       gib ? remapped / gib : 0,
+	       (unsigned long long)st->page_writes[NS_REGION_MGMT],
+	       (unsigned long long)st->block_erases[NS_REGION_MGMT], amp);
+
+	if (end)
+		printf("%s\n", end);
+	else
+		printf("-\n");
+
+out:
+	sim_close(&s);
+	return ret;
+}
+
+static int cmd_bench(void)
+{
+	const char *p = sizes;
+	uint64_t size;
+	char *end;
+	int ret;
+
+	if (!count)
+		count = 1;
+
+	printf("%7s %7s %7s %9s %9s %8s %10s %6s %8s %9s %8s %7s %7s %s\n",
+	       "size", "blocks", "data", "create", "attach", "reads",
+	       "written", "bad", "remapped", "remap/GiB", "tblpages",
+	       "tblers", "amp%", "worn-out");
+	printf("%7s %7s %7s %9s %9s %8s %10s %6s %8s %9s %8s %7s %7s\n",
+	       "", "", "", "ms", "ms", "", "MiB", "", "", "", "", "", "");
+
+	while (*p) {
+		size = parse_size(p, &end);
+		if (end == p || !size) {
+			fprintf(stderr, "Invalid size list '%s'\n", sizes);
+			return -EINVAL;
+		}
+
+		ret = bench_one(size);
+		if (ret)
+			return ret;
+
+		p = *end == ',' ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+/* Same share of the spare pool the nmbm-mtd scrubber leaves alone */
+static uint32_t sim_spare_reserve(struct sim *s)
+{
+	return (s->ni->mapping_blocks_top_ba - s->ni->mapping_blocks_ba) / 2;
+}
+
+static int cmd_stress(void)
+{
+	struct attach_result res;
+	uint32_t i, lb, op, failed = 0, wfailed = 0, relocated = 0, reserve;
+	uint64_t boot_us = 0, boots = 0;
+	char *end;
+	struct sim s;
+	int ret;
+
+	if (!count)
+		count = 10000;
+
+	memset(&s, 0, sizeof(s));
+	cfg.size = parse_size(sizes, &end);
+
+	ret = sim_open(&s, true);
+	if (ret)
+		goto out;
+
+	ret = sim_attach(&s, true, NULL);
+	if (ret) {
+		fprintf(stderr, "Failed to create NMBM: %d\n", ret);
+		goto out;
+	}
+
+	sim_snapshot_mapping(&s);
+	reserve = sim_spare_reserve(&s);
+
+	for (i = 0; i < count; i++) {
+		lb = nand_sim_rand(&s.ns) % s.ni->data_block_count;
+		op = nand_sim_rand(&s.ns) % 100;
+
+		if (op < 60) {
+			if (sim_update_block(&s, lb))
+				wfailed++;
+		} else if (op < 96) {
+			if (sim_verify_block(&s, lb))
+				failed++;
+		} else if (op < 97) {
+			/* What the scrubber does with a block of rising bitflips */
+			if (!nmbm_relocate_block(s.ni, (uint64_t)lb * cfg.erasesize,
+						  reserve))
+				relocated++;
+
+			if (sim_verify_block(&s, lb))
+				failed++;
+		} else if (op < 98) {
+			nmbm_mark_bad_block(s.ni, (uint64_t)lb * cfg.erasesize);
+			s.gen[lb] = GEN_UNKNOWN;
+		} else {
+			/* Reboot, uncleanly for half of them */
+			if (op < 99)
+				sim_drop(&s);
+			else
+				sim_detach(&s);
+
+			ret = sim_attach(&s, false, &res);
+			if (ret) {
+				fprintf(stderr, "Re-attach failed at iteration %u: %d\n",
+					i, ret);
+				goto out;
+			}
+
+			boot_us += res.busy_us;
+			boots++;
+
+			if (!s.ni->protected)
+				failed += sim_verify_all(&s);
+		}
+
+		if (s.ni->protected) {
+			printf("tables could not be saved, NMBM is read-only\n");
+			break;
+		}
+	}
+
+	if (!s.ni->protected)
+		failed += sim_verify_all(&s);
+
+	printf("iterations:         %u\n", i);
+	printf("reboots:            %llu, %.1f ms average attach\n",
+	       (unsigned long long)boots,
+	       boots ? boot_us / 1000.0 / boots : 0);
+	printf("remapped blocks:    %u\n", sim_count_remapped(&s));
+	printf("relocated blocks:   %u\n", relocated);
+	printf("failed writes:      %u\n", wfailed);
+	print_stats(&s);
+	printf("uncorrectable:      %llu\n",
+	       (unsigned long long)s.uncorrectable);
+	printf("verify failures:    %u\n", failed);
+
+	ret = failed ? -EIO : 0;
+
+out:
+	sim_close(&s);
+	return ret;
+}
+
+/* Build the known state every power-cut run starts from */
+static int powercut_setup(struct sim *s)
+{
+	uint32_t lb;
+	int ret;
+
+	if (s->buf)
+		sim_close(s);
+
+	memset(s, 0, sizeof(*s));
+
+	ret = sim_open(s, true);
+	if (ret)
+		return ret;
+
+	ret = sim_attach(s, true, NULL);
+	if (ret)
+		return ret;
+
+	for (lb = 0; lb < POWERCUT_BLOCKS; lb++) {
+		ret = sim_write_block(s, lb);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Logic block 0 fails to erase and gets remapped, then logic block 1 is
+ * marked bad by the user. Both end in an info table update.
+ */
+static void powercut_event(struct sim *s)
+{
+	s->ns.worn[s->ni->block_mapping[0]] = 1;
+	sim_write_block(s, 0);
+	s->gen[0] = GEN_UNKNOWN;
+
+	nmbm_mark_bad_block(s->ni, cfg.erasesize);
+	s->gen[1] = GEN_UNKNOWN;
+}
+
+static int cmd_powercut(void)
+{
+	uint64_t ops, cut;
+	uint32_t failed = 0;
+	char *end;
+	struct sim s;
+	int ret;
+
+	memset(&s, 0, sizeof(s));
+	cfg.size = parse_size(sizes, &end);
+
+	ret = powercut_setup(&s);
+	if (ret)
+		goto out;
+
+	ops = s.ns.ops;
+	powercut_event(&s);
+	ops = s.ns.ops - ops;
+
+	printf("remap and bad block marking take %llu program/erase operations\n",
+	       (unsigned long long)ops);
+
+	for (cut = 1; cut <= ops; cut++) {
+		ret = powercut_setup(&s);
+		if (ret)
+			goto out;
+
+		nand_sim_power_cut(&s.ns, cut);
+		powercut_event(&s);
+
+		/* Nothing gets written back after power loss */
+		sim_drop(&s);
+		nand_sim_power_on(&s.ns);
+
+		ret = sim_attach(&s, false, NULL);
+		if (ret) {
+			printf("cut at operation %llu: attach failed (%d)\n",
+			       (unsigned long long)cut, ret);
+			failed++;
+			continue;
+		}
+
+		if (sim_verify_all(&s)) {
+			printf("cut at operation %llu: data lost\n",
+			       (unsigned long long)cut);
+			failed++;
+			continue;
+		}
+
+		/* The tables must still be updatable after recovery */
+		ret = sim_write_block(&s, 2);
+		sim_detach(&s);
+
+		if (!ret)
+			ret = sim_attach(&s, false, NULL);
+
+		if (ret || sim_verify_all(&s)) {
+			printf("cut at operation %llu: unusable after recovery\n",
+			       (unsigned long long)cut);
+			failed++;
+		}
+	}
+
+	printf("%llu cut points, %u failed\n", (unsigned long long)ops,
+	       failed);
+
+	ret = failed ? -EIO : 0;
+
+out:
+	sim_close(&s);
+	return ret;
+}
+
+/* Whether [addr, addr + len) only covers good blocks of known content */
+static bool read_range_known(struct sim *s, uint64_t addr, uint64_t len)
+{
+	uint32_t lb;
+
+	for (lb = addr / cfg.erasesize; lb <= (addr + len - 1) / cfg.erasesize;
+	     lb++) {
+		if (s->gen[lb] == GEN_UNKNOWN || !s->gen[lb] ||
+		    nmbm_check_bad_block(s->ni, (uint64_t)lb * cfg.erasesize))
+			return false;
+	}
+
+	return true;
+}
+
+static int read_range_check(struct sim *s, uint64_t addr, uint64_t len)
+{
+	uint64_t page, first = addr / cfg.writesize;
+	uint64_t last = (addr + len - 1) / cfg.writesize;
+	uint32_t skip = addr % cfg.writesize, n;
+	const uint8_t *p = s->buf;
+
+	for (page = first; page <= last; page++) {
+		sim_fill_page(s->ref, cfg.writesize, page,
+			      s->gen[page * cfg.writesize / cfg.erasesize]);
+
+		n = cfg.writesize - skip;
+		if (n > len)
+			n = len;
+
+		if (memcmp(p, s->ref + skip, n))
+			return -EIO;
+
+		p += n;
+		len -= n;
+		skip = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Random ranges of any alignment, up to READ_MAX_BLOCKS blocks long, over
+ * blocks written through NMBM. Some of them were remapped on the way, so
+ * ranges cross mapped and remapped blocks as well as page boundaries.
+ */
+static int cmd_read(void)
+{
+	uint64_t addr, len, bytes = 0, start_us;
+	uint32_t i, lb, blocks, skipped = 0, failed = 0;
+	uint8_t *buf;
+	size_t retlen;
+	char *end;
+	struct sim s;
+	int ret;
+
+	if (!count)
+		count = 1000;
+
+	memset(&s, 0, sizeof(s));
+	cfg.size = parse_size(sizes, &end);
+
+	ret = sim_open(&s, true);
+	if (ret)
+		goto out;
+
+	buf = realloc(s.buf, (size_t)READ_MAX_BLOCKS * cfg.erasesize);
+	if (!buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	s.buf = buf;
+
+	ret = sim_attach(&s, true, NULL);
+	if (ret) {
+		fprintf(stderr, "Failed to create NMBM: %d\n", ret);
+		goto out;
+	}
+
+	sim_snapshot_mapping(&s);
+
+	blocks = s.ni->data_block_count;
+	if (blocks > READ_BLOCKS)
+		blocks = READ_BLOCKS;
+
+	for (lb = 0; lb < blocks; lb++) {
+		/* Every eighth block fails to erase and gets remapped */
+		if (!(lb % 8))
+			s.ns.worn[s.ni->block_mapping[lb]] = 1;
+
+		sim_update_block(&s, lb);
+	}
+
+	memset(&s.ns.stats, 0, sizeof(s.ns.stats));
+	start_us = now_us();
+
+	for (i = 0; i < count; i++) {
+		len = 1 + nand_sim_rand(&s.ns) %
+		      ((uint64_t)READ_MAX_BLOCKS * cfg.erasesize);
+		if (len > (uint64_t)blocks * cfg.erasesize)
+			len = (uint64_t)blocks * cfg.erasesize;
+		addr = nand_sim_rand(&s.ns) %
+		       ((uint64_t)blocks * cfg.erasesize - len + 1);
+
+		if (!read_range_known(&s, addr, len)) {
+			skipped++;
+			continue;
+		}
+
+		ret = nmbm_read_range(s.ni, addr, len, s.buf,
+				      NMBM_MODE_PLACE_OOB, &retlen);
+		if (ret == -EBADMSG) {
+			s.uncorrectable++;
+			continue;
+		}
+
+		if (ret < 0 || retlen != len || read_range_check(&s, addr, len)) {
+			fprintf(stderr, "Bad read of 0x%llx+0x%llx: %d, %zu bytes\n",
+				(unsigned long long)addr,
+				(unsigned long long)len, ret, retlen);
+			failed++;
+			continue;
+		}
+
+		bytes += len;
+	}
+
+	printf("ranges:             %u read, %u skipped\n", count - skipped,
+	       skipped);
+	printf("remapped blocks:    %u\n", sim_count_remapped(&s));
+	printf("data read:          %.1f MiB in %.1f ms\n",
+	       (double)bytes / (1 << 20), (now_us() - start_us) / 1000.0);
+	printf("chip busy:          %.1f ms\n", s.ns.stats.busy_us / 1000.0);
+	print_stats(&s);
+	printf("uncorrectable:      %llu\n",
+	       (unsigned long long)s.uncorrectable);
+	printf("verify failures:    %u\n", failed);
+
+	ret = failed ? -EIO : 0;
+
+out:
+	sim_close(&s);
+	return ret;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options] <bench|stress|powercut|read>\n"
+		"\n"
+		"Commands:\n"
+		"  bench      create, attach and wear out a fresh image for each size\n"
+		"  stress     random writes, reads, bad blocks and reboots, verified\n"
+		"  powercut   cut power at every operation of a table update\n"
+		"  read       random unaligned range reads, verified\n"
+		"\n"
+		"Options:\n"
+		"  -f <file>    sparse image file (default %s)\n"
+		"  -s <list>    chip sizes, e.g. 128M,256M (default %s)\n"
+		"  -b <size>    block size (default 128K)\n"
+		"  -p <size>    page size (default 2K)\n"
+		"  -o <size>    spare size (default 64)\n"
+		"  -e <bits>    ECC strength (default 4)\n"
+		"  -r <ratio>   NMBM max-ratio (default 1)\n"
+		"  -m <blocks>  NMBM max-reserved-blocks (default 256)\n"
+		"  -n <count>   bench passes, stress iterations or read ranges\n"
+		"  -B <ppm>     bitflip rate per page read\n"
+		"  -E <ppm>     erase failure rate\n"
+		"  -W <ppm>     program failure rate\n"
+		"  -F <blocks>  factory bad blocks\n"
+		"  -S <seed>    random seed\n"
+		"  -t <r,p,e,n> tR, tPROG, tBERS in us and bus ns/byte\n"
+		"  -j           record table changes in the delta log\n"
+		"  -1           read one page per lower request\n"
+		"  -v           more NMBM log output, may be repeated\n",
+		prog, image, sizes);
+}
+
+int main(int argc, char *argv[])
+{
+	struct nand_sim_timing *t = &cfg.timing;
+	const char *cmd;
+	char *end;
+	int opt, ret;
+
+	while ((opt = getopt(argc, argv, "f:s:b:p:o:e:r:m:n:B:E:W:F:S:t:j1v")) != -1) {
+		switch (opt) {
+		case 'f':
+			image = optarg;
+			break;
+		case 's':
+			sizes = optarg;
+			break;
+		case 'b':
+			cfg.erasesize = parse_size(optarg, &end);
+			break;
+		case 'p':
+			cfg.writesize = parse_size(optarg, &end);
+			break;
+		case 'o':
+			cfg.oobsize = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			cfg.ecc_strength = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			max_ratio = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			max_reserved_blocks = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'B':
+			cfg.bitflip_ppm = strtoul(optarg, NULL, 0);
+			break;
+		case 'E':
+			cfg.erase_fail_ppm = strtoul(optarg, NULL, 0);
+			break;
+		case 'W':
+			cfg.write_fail_ppm = strtoul(optarg, NULL, 0);
+			break;
+		case 'F':
+			cfg.factory_bad = strtoul(optarg, NULL, 0);
+			break;
+		case 'S':
+			cfg.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			if (sscanf(optarg, "%u,%u,%u,%u", &t->read_us,
+				   &t->prog_us, &t->erase_us,
+				   &t->ns_per_byte) != 4) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'j':
+			extra_flags |= NMBM_F_DELTA_LOG;
+			break;
+		case '1':
+			single_page_reads = true;
+			break;
+		case 'v':
+			if (log_level > NMBM_LOG_DEBUG)
+				log_level--;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	cmd = argv[optind];
+
+	if (!strcmp(cmd, "bench"))
+		ret = cmd_bench();
+	else if (!strcmp(cmd, "stress"))
+		ret = cmd_stress();
+	else if (!strcmp(cmd, "powercut"))
+		ret = cmd_powercut();
+	else if (!strcmp(cmd, "read"))
+		ret = cmd_read();
+	else {
+		usage(argv[0]);
+		return 1;
+	}
+
+	return ret ? 1 : 0;
+}